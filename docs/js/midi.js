@@ -182,7 +182,8 @@ async function requestMidiAccess() {
         for (let input of midiAccess.inputs.values()) {
             if (input.name == 'PicoKeyer') {
                 midiInput = input;
-                break;
+            } else if (input.name.startsWith('PicoKeyer')) {
+                input.onmidimessage = handleMidiMessage; // Second cable, replies may be sent on it (TX_SEPARATE_CABLE)
             }
         }
         // Populate output
@@ -211,46 +212,152 @@ async function requestMidiAccess() {
     }
 }
 
+// Config field names by id, the firmware reports the wire layout (CMD_GET_LAYOUT)
+const configFields = [
+    { name: 'keyMode' },
+    { name: 'pinMode' },
+    { name: 'ledMode' },
+    { name: 'gpioOutputMode' },
+    { name: 'output' },
+    { name: 'normalLED' },
+    { name: 'rgbLED' },
+    { name: 'ditPaddle' },
+    { name: 'dahPaddle' },
+    { name: 'straightKey' },
+    { name: 'wpm', scale: 100 },
+    { name: 'channel' },
+    { name: 'note' },
+    { name: 'volume' },
+    { name: 'farnsworth', scale: 100 },
+    { name: 'weight' },
+    { name: 'iambicMode' },
+    { name: 'ditMemory' },
+    { name: 'dahMemory' },
+    { name: 'eventStream' },
+    { name: 'debounceMode' },
+    { name: 'straightDebounce', scale: 4 },
+    { name: 'ditDebounce', scale: 4 },
+    { name: 'dahDebounce', scale: 4 }
+];
+
+// Keyers after the first, each with its own key, output and MIDI note: [name, bits] in wire order
+const keyerCount = 4;
+const keyerFields = [
+    ['KeyMode', 2], ['DitPaddle', 7], ['DahPaddle', 7], ['StraightKey', 7],
+    ['OutputMode', 2], ['Output', 7], ['Note', 7], ['Channel', 7]
+];
+for (let k = 1; k < keyerCount; k++) {
+    for (const [name] of keyerFields) {
+        configFields.push({ name: `keyer${k}${name}` });
+    }
+}
+configFields.push(
+    { name: 'pttMode' },
+    { name: 'ptt' },
+    { name: 'pttLead' },
+    { name: 'pttTail', scale: 0.1 },
+    { name: 'speedPot' },
+    { name: 'speedMin' },
+    { name: 'speedMax' }
+);
+
+// Layout used until the firmware reports its own: [id, bits, revision]
+let configLayout = [
+    [0, 2, 1], [1, 2, 1], [2, 2, 1], [3, 2, 1], [4, 7, 1], [5, 7, 1], [6, 7, 1], [7, 7, 1],
+    [8, 7, 1], [9, 7, 1], [10, 16, 1], [11, 7, 1], [12, 7, 1], [13, 7, 1], [14, 16, 2], [15, 7, 2],
+    [16, 2, 3], [17, 7, 3], [18, 7, 3], [19, 1, 4], [20, 1, 5], [21, 6, 5], [22, 6, 5], [23, 6, 5]
+];
+for (let k = 1; k < keyerCount; k++) {
+    for (const [, bits] of keyerFields) {
+        configLayout.push([configLayout.length, bits, 6]);
+    }
+}
+configLayout.push([48, 2, 7], [49, 7, 7], [50, 7, 7], [51, 8, 7], [52, 7, 8], [53, 7, 8], [54, 7, 8]);
+
+// Layout pages received so far, the firmware sends it a page at a time
+let layoutPages = [];
+
+// Raw values of fields this page does not know about, sent back unchanged
+let unknownFields = {};
+
+// Decodes a layout page: revision, field count, first field, then bits and revision per field from there
+function decodeLayout(data) {
+    const count = data[1];
+    const first = data[2];
+    const fields = [];
+    for (let i = 0; 3 + i * 2 + 1 < data.length; i++) {
+        fields.push([first + i, data[3 + i * 2], data[4 + i * 2]]); // Listed in wire order, the position is the id
+    }
+    return { count, first, fields };
+}
+
+// Raw field values by id as the device has them, from the last config read or sent
+let deviceFields = null;
+const maxFieldsData = 60; // 64 byte SysEx less header, command and footer
+
+// Raw wire values of a config by id, in layout order
+function configValues(config) {
+    const values = {};
+    for (const [id, width] of configLayout) {
+        const field = configFields[id];
+        let value = unknownFields[id] || 0;
+        if (field) {
+            value = Math.round(config[field.name] * (field.scale || 1));
+        }
+        values[id] = value & ((1 << width) - 1);
+    }
+    return values;
+}
+
 function encodeConfig(config) {
-    const packer = new BitPacker(128);
-    packer.addField(config.keyMode & 0x3, 2);
-    packer.addField(config.pinMode & 0x3, 2);
-    packer.addField(config.ledMode & 0x3, 2);
-    packer.addField(config.gpioOutputMode & 0x3, 2);
-    packer.addField(config.output & 0x7F, 7);
-    packer.addField(config.normalLED & 0x7F, 7);
-    packer.addField(config.rgbLED & 0x7F, 7);
-    packer.addField(config.ditPaddle & 0x7F, 7);
-    packer.addField(config.dahPaddle & 0x7F, 7);
-    packer.addField(config.straightKey & 0x7F, 7);
-    packer.addField(Math.round(config.wpm * 100), 16);
-    packer.addField(config.channel & 0x7F, 7);
-    packer.addField(config.note & 0x7F, 7);
-    packer.addField(config.volume & 0x7F, 7);
+    const bits = configLayout.reduce((total, field) => total + field[1], 0);
+    const packer = new BitPacker(Math.ceil(bits / 7) * 7);
+    const values = configValues(config);
+    for (const [id, width] of configLayout) {
+        packer.addField(values[id], width);
+    }
+    return packer.pack7Bit();
+}
+
+// Packs only the fields that differ from the device (CMD_SET_FIELDS): a count, then id and value per field.
+// Null when the device config is not known or the list would not fit in one message.
+function encodeConfigFields(config) {
+    if (!deviceFields) {
+        return null;
+    }
+    const values = configValues(config);
+    const changed = configLayout.filter(([id]) => values[id] !== deviceFields[id]);
+    const bits = changed.reduce((total, [, width]) => total + 7 + width, 7);
+    if (Math.ceil(bits / 7) > maxFieldsData) {
+        return null;
+    }
+    const packer = new BitPacker(Math.ceil(bits / 7) * 7);
+    packer.addField(changed.length, 7);
+    for (const [id, width] of changed) {
+        packer.addField(id, 7);
+        packer.addField(values[id], width);
+    }
     return packer.pack7Bit();
 }
 
 function decodeConfig(data) {
-    const packer = new BitPacker(128);
+    const packer = new BitPacker(data.length * 7);
     if (!packer.unpack7Bit(data)) {
         throw new Error('Failed to unpack SysEx data');
     }
-    return {
-        keyMode: packer.extractField(2),
-        pinMode: packer.extractField(2),
-        ledMode: packer.extractField(2),
-        gpioOutputMode: packer.extractField(2),
-        output: packer.extractField(7),
-        normalLED: packer.extractField(7),
-        rgbLED: packer.extractField(7),
-        ditPaddle: packer.extractField(7),
-        dahPaddle: packer.extractField(7),
-        straightKey: packer.extractField(7),
-        wpm: packer.extractField(16) / 100,
-        channel: packer.extractField(7),
-        note: packer.extractField(7),
-        volume: packer.extractField(7)
-    };
+    const config = {};
+    deviceFields = {};
+    for (const [id, width] of configLayout) {
+        const value = packer.extractField(width) >>> 0;
+        deviceFields[id] = value;
+        const field = configFields[id];
+        if (field) {
+            config[field.name] = value / (field.scale || 1);
+        } else {
+            unknownFields[id] = value;
+        }
+    }
+    return config;
 }
 
 function decodeVersion(data) {
@@ -263,6 +370,177 @@ function decodeVersion(data) {
     };
 }
 
+function decodeStats(data) {
+    const packer = new BitPacker(322); // 10 x 32-bit fields rounded up to whole 7-bit bytes
+    if (!packer.unpack7Bit(data)) {
+        throw new Error('Failed to unpack SysEx data');
+    }
+    return {
+        elements: packer.extractField(32) >>> 0,
+        maxElementError: packer.extractField(32) >>> 0,
+        maxKeyerPass: packer.extractField(32) >>> 0,
+        maxHostPass: packer.extractField(32) >>> 0,
+        maxKeyEventDelay: packer.extractField(32) >>> 0,
+        keyEventDrops: packer.extractField(32) >>> 0,
+        edges: packer.extractField(32) >>> 0,
+        edgeErrorTotal: packer.extractField(32) >>> 0,
+        maxEdgeError: packer.extractField(32) >>> 0,
+        sysExDrops: packer.extractField(32) >>> 0
+    };
+}
+
+function decodeJournal(data) {
+    const packer = new BitPacker(196); // 193 bits rounded up to whole 7-bit bytes
+    if (!packer.unpack7Bit(data)) {
+        throw new Error('Failed to unpack SysEx data');
+    }
+    return {
+        writes: packer.extractField(32) >>> 0,
+        failures: packer.extractField(16),
+        compactions: packer.extractField(16),
+        records: packer.extractField(16),
+        bytes: packer.extractField(16),
+        capacity: packer.extractField(16),
+        damaged: packer.extractField(16),
+        lastWriteTime: packer.extractField(32) >>> 0,
+        maxWriteTime: packer.extractField(32) >>> 0,
+        pending: packer.extractField(1) === 1
+    };
+}
+
+function decodeBoot(data) {
+    const packer = new BitPacker(133); // 129 bits rounded up to whole 7-bit bytes
+    if (!packer.unpack7Bit(data)) {
+        throw new Error('Failed to unpack SysEx data');
+    }
+    return {
+        keyerReadyTime: packer.extractField(32) >>> 0,
+        settingsTime: packer.extractField(32) >>> 0,
+        usbMountTime: packer.extractField(32) >>> 0,
+        firstKeyTime: packer.extractField(32) >>> 0,
+        fastBoot: packer.extractField(1) === 1
+    };
+}
+
+// Histogram ids, in firmware order (histogram_t)
+const histogramNames = ['keyerPeriod', 'keyerPass', 'elementError', 'edgeError', 'keyerSleep', 'hostPeriod', 'midiUpdate', 'sysex', 'keyLatency', 'journalWrite', 'hostSleep'];
+
+function decodeHistogram(data) {
+    const packer = new BitPacker(329); // 327 bits rounded up to whole 7-bit bytes
+    if (!packer.unpack7Bit(data)) {
+        throw new Error('Failed to unpack SysEx data');
+    }
+    const histogram = {
+        name: histogramNames[packer.extractField(7)],
+        count: packer.extractField(32) >>> 0,
+        max: packer.extractField(32) >>> 0,
+        buckets: []
+    };
+    // Bucket n holds values of n significant bits, 0, 1, 2-3, 4-7 ...
+    for (let i = 0; i < 16; i++) {
+        histogram.buckets.push(packer.extractField(16));
+    }
+    return histogram;
+}
+
+// Key input and output trace, read back a page at a time and saved for the host replay (program trace <file>)
+const traceHeaderSize = 10; // 66 bits rounded up to whole 7-bit bytes
+let trace = null;
+
+function decodeTraceHeader(data) {
+    const packer = new BitPacker(traceHeaderSize * 7);
+    if (!packer.unpack7Bit(data.slice(0, traceHeaderSize))) {
+        throw new Error('Failed to unpack SysEx data');
+    }
+    return {
+        recording: packer.extractField(1) === 1,
+        full: packer.extractField(1) === 1,
+        count: packer.extractField(16),
+        capacity: packer.extractField(16),
+        start: packer.extractField(32) >>> 0,
+        config: Array.from(data.slice(traceHeaderSize)), // Packed like CMD_SET_CONFIG
+        records: []
+    };
+}
+
+function decodeTracePage(data) {
+    const packer = new BitPacker(data.length * 7);
+    if (!packer.unpack7Bit(data)) {
+        throw new Error('Failed to unpack SysEx data');
+    }
+    const first = packer.extractField(14);
+    const count = packer.extractField(3);
+    const records = [];
+    for (let i = 0; i < count; i++) {
+        records.push({
+            time: packer.extractField(32) >>> 0,
+            kind: packer.extractField(2), // 0 key pin levels, 1 output edge
+            value: packer.extractField(30) >>> 0
+        });
+    }
+    return { first, records };
+}
+
+function saveTrace() {
+    const hex = (value, width) => value.toString(16).padStart(width, '0');
+    const lines = ['# PicoKeyer trace, times in microseconds', `config ${trace.config.map((byte) => hex(byte, 2)).join('')}`, `start ${trace.start}`];
+    for (const record of trace.records) {
+        lines.push(record.kind === 0 ? `in ${record.time} ${hex(record.value, 8)}` : `out ${record.time} ${record.value >> 1} ${record.value & 1}`);
+    }
+    const link = document.createElement('a');
+    link.href = URL.createObjectURL(new Blob([lines.join('\n') + '\n'], { type: 'text/plain' }));
+    link.download = 'picokeyer-trace.txt';
+    link.click();
+    URL.revokeObjectURL(link.href);
+}
+
+// Loopback self-test, press to output on and press to note on latency in microseconds
+function decodeSelfTest(data) {
+    const packer = new BitPacker(data.length * 7);
+    if (!packer.unpack7Bit(data)) {
+        throw new Error('Failed to unpack SysEx data');
+    }
+    const stats = () => ({
+        count: packer.extractField(14),
+        min: packer.extractField(16),
+        mean: packer.extractField(16),
+        p99: packer.extractField(16),
+        max: packer.extractField(16)
+    });
+    return {
+        running: packer.extractField(1) === 1,
+        pin: packer.extractField(7),
+        presses: packer.extractField(14),
+        driven: packer.extractField(14),
+        output: stats(),
+        note: stats()
+    };
+}
+
+function decodePlaybackStatus(data) {
+    const packer = new BitPacker(63); // 57 bits rounded up to whole 7-bit bytes
+    if (!packer.unpack7Bit(data)) {
+        throw new Error('Failed to unpack SysEx data');
+    }
+    return {
+        accepted: packer.extractField(8),
+        free: packer.extractField(16),
+        queued: packer.extractField(16),
+        aborts: packer.extractField(16),
+        busy: packer.extractField(1)
+    };
+}
+
+function decodeDecodedCharacter(data) {
+    const packer = new BitPacker(28); // 23 bits rounded up to whole 7-bit bytes
+    if (!packer.unpack7Bit(data)) {
+        throw new Error('Failed to unpack SysEx data');
+    }
+    return {
+        character: String.fromCharCode(packer.extractField(7)),
+        wpm: packer.extractField(16) / 100
+    };
+}
 
 function buildConfig() {
     try {
@@ -280,10 +558,31 @@ function buildConfig() {
             wpm: parseFloat(document.getElementById('wpm').value),
             channel: parseInt(document.getElementById('channel').value),
             note: parseInt(document.getElementById('note').value),
-            volume: parseInt(document.getElementById('volume').value)
+            volume: parseInt(document.getElementById('volume').value),
+            farnsworth: parseFloat(document.getElementById('farnsworth').value),
+            weight: parseInt(document.getElementById('weight').value),
+            iambicMode: parseInt(document.getElementById('iambicMode').value),
+            ditMemory: parseInt(document.getElementById('ditMemory').value),
+            dahMemory: parseInt(document.getElementById('dahMemory').value),
+            eventStream: parseInt(document.getElementById('eventStream').value),
+            debounceMode: parseInt(document.getElementById('debounceMode').value),
+            straightDebounce: parseFloat(document.getElementById('straightDebounce').value),
+            ditDebounce: parseFloat(document.getElementById('ditDebounce').value),
+            dahDebounce: parseFloat(document.getElementById('dahDebounce').value)
         };
-        const data = encodeConfig(config);
-        return data;
+        config.pttMode = parseInt(document.getElementById('pttMode').value);
+        config.ptt = parseInt(document.getElementById('ptt').value);
+        config.pttLead = parseInt(document.getElementById('pttLead').value);
+        config.pttTail = parseInt(document.getElementById('pttTail').value);
+        config.speedPot = parseInt(document.getElementById('speedPot').value);
+        config.speedMin = parseInt(document.getElementById('speedMin').value);
+        config.speedMax = parseInt(document.getElementById('speedMax').value);
+        for (let k = 1; k < keyerCount; k++) {
+            for (const [name] of keyerFields) {
+                config[`keyer${k}${name}`] = parseInt(document.getElementById(`keyer${k}${name}`).value);
+            }
+        }
+        return config;
     } catch (error) {
         errortext.textContent = error;
         openModal(errormodal);
@@ -329,9 +628,15 @@ async function sendSetConfig() {
         return;
     }
     try {
-        const data = buildConfig();
-        const sysex = [0xF0, 0x7D, 0x02, ...data, 0xF7]; // Use [0xF0, 0x00, 0x00, 0x7F, 0x01, ...data, 0xF7] for three-byte ID
+        const config = buildConfig();
+        if (!config) {
+            return;
+        }
+        // Just the changed fields when the device config is known, so the keyer carries on keying
+        const fields = encodeConfigFields(config);
+        const sysex = fields ? [0xF0, 0x7D, 0x14, ...fields, 0xF7] : [0xF0, 0x7D, 0x02, ...encodeConfig(config), 0xF7]; // Use [0xF0, 0x00, 0x00, 0x7F, 0x01, ...data, 0xF7] for three-byte ID
         midiOutput.send(sysex);
+        deviceFields = configValues(config);
     } catch (error) {
         errortext.textContent = error;
         openModal(errormodal);
@@ -345,9 +650,105 @@ async function sendSaveConfig() {
         return;
     }
     try {
-        const data = buildConfig();
+        const config = buildConfig();
+        if (!config) {
+            return;
+        }
+        const data = encodeConfig(config);
         const sysex = [0xF0, 0x7D, 0x03, ...data, 0xF7]; // Use [0xF0, 0x00, 0x00, 0x7F, 0x01, ...data, 0xF7] for three-byte ID
         midiOutput.send(sysex);
+        deviceFields = configValues(config);
+    } catch (error) {
+        errortext.textContent = error;
+        openModal(errormodal);
+    }
+}
+
+async function sendGetLayout(first = 0) {
+    if (!midiOutput) {
+        errortext.textContent = errornodevice;
+        openModal(errormodal);
+        return;
+    }
+    try {
+        const sysex = [0xF0, 0x7D, 0x07, first, 0xF7];
+        midiOutput.send(sysex);
+    } catch (error) {
+        errortext.textContent = error;
+        openModal(errormodal);
+    }
+}
+
+async function sendGetStats() {
+    if (!midiOutput) {
+        errortext.textContent = errornodevice;
+        openModal(errormodal);
+        return;
+    }
+    try {
+        const sysex = [0xF0, 0x7D, 0x06, 0xF7];
+        midiOutput.send(sysex);
+    } catch (error) {
+        errortext.textContent = error;
+        openModal(errormodal);
+    }
+}
+
+async function sendGetJournal() {
+    if (!midiOutput) {
+        errortext.textContent = errornodevice;
+        openModal(errormodal);
+        return;
+    }
+    try {
+        const sysex = [0xF0, 0x7D, 0x10, 0xF7];
+        midiOutput.send(sysex);
+    } catch (error) {
+        errortext.textContent = error;
+        openModal(errormodal);
+    }
+}
+
+async function sendGetBoot() {
+    if (!midiOutput) {
+        errortext.textContent = errornodevice;
+        openModal(errormodal);
+        return;
+    }
+    try {
+        const sysex = [0xF0, 0x7D, 0x11, 0xF7];
+        midiOutput.send(sysex);
+    } catch (error) {
+        errortext.textContent = error;
+        openModal(errormodal);
+    }
+}
+
+async function sendGetHistograms() {
+    if (!midiOutput) {
+        errortext.textContent = errornodevice;
+        openModal(errormodal);
+        return;
+    }
+    try {
+        for (let id = 0; id < histogramNames.length; id++) {
+            midiOutput.send([0xF0, 0x7D, 0x0C, id, 0xF7]);
+        }
+    } catch (error) {
+        errortext.textContent = error;
+        openModal(errormodal);
+    }
+}
+
+async function sendResetStats() {
+    if (!midiOutput) {
+        errortext.textContent = errornodevice;
+        openModal(errormodal);
+        return;
+    }
+    try {
+        const sysex = [0xF0, 0x7D, 0x0D, 0xF7];
+        midiOutput.send(sysex);
     } catch (error) {
         errortext.textContent = error;
         openModal(errormodal);
@@ -384,6 +785,293 @@ async function sendUpdateFirmware() {
     }
 }
 
+// Characters of decoded text kept on the page
+const maxDecodedText = 400;
+
+// Text waiting to be streamed to the keyer, sent as the playback buffer frees up
+const maxTextChunk = 60; // 64 byte SysEx less header, command and footer
+let playbackQueue = [];
+let playbackPoll = null;
+
+function sendTextChunk(free) {
+    const chunk = playbackQueue.slice(0, Math.min(free, maxTextChunk));
+    if (chunk.length === 0) {
+        return false;
+    }
+    midiOutput.send([0xF0, 0x7D, 0x08, ...chunk, 0xF7]);
+    return true;
+}
+
+function handlePlaybackStatus(command, status) {
+    if (command === 0x8) {
+        playbackQueue = playbackQueue.slice(status.accepted);
+    }
+    if (playbackQueue.length === 0) {
+        return;
+    }
+    // Send more if it fits, otherwise ask again once some has been keyed
+    if (!sendTextChunk(status.free)) {
+        clearTimeout(playbackPoll);
+        playbackPoll = setTimeout(sendGetPlayback, 250);
+    }
+}
+
+async function sendText() {
+    if (!midiOutput) {
+        errortext.textContent = errornodevice;
+        openModal(errormodal);
+        return;
+    }
+    try {
+        const text = document.getElementById('playbackText').value.toUpperCase();
+        for (const c of text) {
+            const code = c.charCodeAt(0);
+            if (code >= 0x20 && code < 0x7F) {
+                playbackQueue.push(code);
+            }
+        }
+        sendTextChunk(maxTextChunk);
+    } catch (error) {
+        errortext.textContent = error;
+        openModal(errormodal);
+    }
+}
+
+async function sendGetPlayback() {
+    if (!midiOutput) {
+        return;
+    }
+    try {
+        const sysex = [0xF0, 0x7D, 0x09, 0xF7];
+        midiOutput.send(sysex);
+    } catch (error) {
+        errortext.textContent = error;
+        openModal(errormodal);
+    }
+}
+
+async function sendStopPlayback() {
+    if (!midiOutput) {
+        errortext.textContent = errornodevice;
+        openModal(errormodal);
+        return;
+    }
+    try {
+        playbackQueue = [];
+        clearTimeout(playbackPoll);
+        const sysex = [0xF0, 0x7D, 0x0A, 0xF7];
+        midiOutput.send(sysex);
+    } catch (error) {
+        errortext.textContent = error;
+        openModal(errormodal);
+    }
+}
+
+// Key transitions timed by the keyer, sent next to the notes when the event stream is on
+const maxKeyTimeline = 1000;
+let keyTimeline = []; // { state, device: us, host: performance.now() ms once the clock is synced }
+let keyStream = { synced: false, expected: 0, lastTime: 0 };
+
+function decodeKeyEvents(data) {
+    const packer = new BitPacker(data.length * 7);
+    if (!packer.unpack7Bit(data)) {
+        throw new Error('Failed to unpack SysEx data');
+    }
+    const sequence = packer.extractField(7);
+    const count = packer.extractField(4);
+    // A lost message leaves the deltas with nothing to add to until the next absolute time
+    if (sequence !== keyStream.expected) {
+        keyStream.synced = false;
+    }
+    keyStream.expected = (sequence + 1) & 0x7F;
+
+    const events = [];
+    for (let i = 0; i < count; i++) {
+        const state = packer.extractField(1);
+        const width = packer.extractField(2); // Delta of 8, 16 or 24 bits, or 3 for an absolute time
+        const value = packer.extractField(width === 3 ? 32 : (width + 1) * 8) >>> 0;
+        if (width === 3) {
+            keyStream.synced = true;
+            keyStream.lastTime = value;
+        } else if (keyStream.synced) {
+            keyStream.lastTime = (keyStream.lastTime + value) >>> 0;
+        } else {
+            continue;
+        }
+        events.push({ state: state === 1, device: keyStream.lastTime });
+    }
+    return events;
+}
+
+// Device clock sync, pinged every second and fitted from the quickest round trips
+const pingPeriod = 1000;
+const pingWindow = 8;   // Pings the quickest round trip is picked from
+const maxClockSamples = 32;
+let pingTimer = null;
+let pingToken = 0;
+let pingsSent = {};     // performance.now() by token
+let pingWindowBest = null;
+let pingWindowCount = 0;
+let clockSamples = [];  // [host ms, device us] at the middle of the quickest round trips
+let clockFit = null;    // host ms = host + (device us - device) * rate
+
+function decodePong(data) {
+    const packer = new BitPacker(98); // 92 bits rounded up to whole 7-bit bytes
+    if (!packer.unpack7Bit(data)) {
+        throw new Error('Failed to unpack SysEx data');
+    }
+    let token = 0;
+    for (let i = 0; i < 4; i++) {
+        token |= packer.extractField(7) << (i * 7);
+    }
+    return {
+        token: token,
+        received: packer.extractField(32) >>> 0,
+        sent: packer.extractField(32) >>> 0
+    };
+}
+
+function fitClock() {
+    // Least squares of host time against device time, relative to the newest sample so micros() wrapping drops out
+    const [hostRef, deviceRef] = clockSamples[clockSamples.length - 1];
+    let sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (const [host, device] of clockSamples) {
+        const x = ((device - deviceRef) | 0) / 1000;
+        const y = host - hostRef;
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+    const n = clockSamples.length;
+    // Too few samples spread too little time to tell drift from jitter
+    const rate = n >= 4 ? (n * sxy - sx * sy) / (n * sxx - sx * sx) : 1;
+    clockFit = { host: hostRef + (sy - rate * sx) / n, device: deviceRef, rate: rate };
+    console.log(`PicoKeyer clock: ${((rate - 1) * 1e6).toFixed(1)} ppm from ${n} pings`);
+}
+
+function handlePong(pong) {
+    const sent = pingsSent[pong.token];
+    if (sent === undefined) return;
+    delete pingsSent[pong.token];
+
+    const now = performance.now();
+    const sample = { rtt: now - sent, host: (sent + now) / 2, device: (pong.received + ((pong.sent - pong.received) >>> 0) / 2) >>> 0 };
+    // A slow round trip was held up somewhere unknown, keep the quickest of each few
+    if (!pingWindowBest || sample.rtt < pingWindowBest.rtt) {
+        pingWindowBest = sample;
+    }
+    if (++pingWindowCount < pingWindow && clockSamples.length >= 2) return; // The first couple go straight in to get started
+
+    clockSamples.push([pingWindowBest.host, pingWindowBest.device]);
+    clockSamples = clockSamples.slice(-maxClockSamples);
+    pingWindowBest = null;
+    pingWindowCount = 0;
+    fitClock();
+}
+
+function deviceToHost(device) {
+    return clockFit ? clockFit.host + ((device - clockFit.device) | 0) / 1000 * clockFit.rate : null;
+}
+
+function sendPing() {
+    if (!midiOutput) {
+        return;
+    }
+    try {
+        pingToken = (pingToken + 1) & 0xFFFFFFF;
+        pingsSent[pingToken] = performance.now();
+        const sysex = [0xF0, 0x7D, 0x0F];
+        for (let i = 0; i < 4; i++) {
+            sysex.push((pingToken >> (i * 7)) & 0x7F);
+        }
+        sysex.push(0xF7);
+        midiOutput.send(sysex);
+    } catch (error) {
+        errortext.textContent = error;
+        openModal(errormodal);
+    }
+}
+
+function startClockSync() {
+    if (!pingTimer) {
+        pingTimer = setInterval(sendPing, pingPeriod);
+        sendPing();
+    }
+}
+
+async function sendTrace(start) {
+    if (!midiOutput) {
+        errortext.textContent = errornodevice;
+        openModal(errormodal);
+        return;
+    }
+    try {
+        const sysex = [0xF0, 0x7D, 0x12, start ? 1 : 0, 0xF7];
+        midiOutput.send(sysex);
+    } catch (error) {
+        errortext.textContent = error;
+        openModal(errormodal);
+    }
+}
+
+async function sendStartTrace() {
+    sendTrace(true);
+}
+
+async function sendStopTrace() {
+    sendTrace(false);
+}
+
+async function sendGetTrace(first = null) {
+    if (!midiOutput) {
+        errortext.textContent = errornodevice;
+        openModal(errormodal);
+        return;
+    }
+    try {
+        const sysex = first === null ? [0xF0, 0x7D, 0x12, 0xF7] : [0xF0, 0x7D, 0x13, first >> 7, first & 0x7F, 0xF7];
+        midiOutput.send(sysex);
+    } catch (error) {
+        errortext.textContent = error;
+        openModal(errormodal);
+    }
+}
+
+async function sendSelfTest(pin, presses = 1000) {
+    if (!midiOutput) {
+        errortext.textContent = errornodevice;
+        openModal(errormodal);
+        return;
+    }
+    try {
+        const sysex = [0xF0, 0x7D, 0x15, pin, (presses >> 7) & 0x7F, presses & 0x7F, 0xF7];
+        midiOutput.send(sysex);
+    } catch (error) {
+        errortext.textContent = error;
+        openModal(errormodal);
+    }
+}
+
+async function sendStopSelfTest() {
+    sendSelfTest(0, 0);
+}
+
+async function sendGetSelfTest() {
+    if (!midiOutput) {
+        errortext.textContent = errornodevice;
+        openModal(errormodal);
+        return;
+    }
+    try {
+        const sysex = [0xF0, 0x7D, 0x15, 0xF7];
+        midiOutput.send(sysex);
+    } catch (error) {
+        errortext.textContent = error;
+        openModal(errormodal);
+    }
+}
+
 function handleMidiMessage(event) {
     const data = event.data;
     if (data.length <= 3) handleNote(event);
@@ -394,7 +1082,7 @@ function handleMidiMessage(event) {
         const versionData = data.slice(3, -1); // Adjust to slice(5, 14) for three-byte ID
         const version = decodeVersion(versionData);
 
-        if (version.version != 0x2) {
+        if (version.version != 0xA) {
             firmwaretext.innerHTML = 'Download the latest PicoKeyer firmware <a target="_blank" href="https://github.com/bontebok/PicoKeyer/releases">\
                 here.</a> Once you have the downloaded the firmware, click the <b>Update Firmware</b> button below.<br><br> \
                 A new drive letter will appear named <b>RPI-RP2</b> containing files INDEX.HTM and INFO_UF2.TXT. Copy the <b>PicoKeyer.uf2</b>\
@@ -403,6 +1091,17 @@ function handleMidiMessage(event) {
             return;
         }
         else {
+            sendGetLayout();
+        }
+    }
+    if (command === 0x7) {
+        const page = decodeLayout(data.slice(3, -1));
+        if (page.first === 0) layoutPages = [];
+        layoutPages.push(...page.fields);
+        if (page.fields.length && layoutPages.length < page.count) {
+            sendGetLayout(layoutPages.length); // Ask for the next page
+        } else {
+            configLayout = layoutPages;
             sendGetConfig();
         }
     }
@@ -425,15 +1124,99 @@ function handleMidiMessage(event) {
             document.getElementById('channel').value = config.channel;
             document.getElementById('note').value = config.note;
             document.getElementById('volume').value = config.volume;
+            document.getElementById('farnsworth').value = config.farnsworth.toFixed(2);
+            document.getElementById('weight').value = config.weight;
+            document.getElementById('iambicMode').value = config.iambicMode;
+            document.getElementById('ditMemory').value = config.ditMemory;
+            document.getElementById('dahMemory').value = config.dahMemory;
+            document.getElementById('eventStream').value = config.eventStream;
+            document.getElementById('debounceMode').value = config.debounceMode;
+            document.getElementById('straightDebounce').value = config.straightDebounce.toFixed(2);
+            document.getElementById('ditDebounce').value = config.ditDebounce.toFixed(2);
+            document.getElementById('dahDebounce').value = config.dahDebounce.toFixed(2);
+            document.getElementById('pttMode').value = config.pttMode;
+            document.getElementById('ptt').value = config.ptt;
+            document.getElementById('pttLead').value = config.pttLead;
+            document.getElementById('pttTail').value = Math.round(config.pttTail);
+            document.getElementById('speedPot').value = config.speedPot;
+            document.getElementById('speedMin').value = config.speedMin;
+            document.getElementById('speedMax').value = config.speedMax;
+            for (let k = 1; k < keyerCount; k++) {
+                for (const [name] of keyerFields) {
+                    const id = `keyer${k}${name}`;
+                    if (id in config) document.getElementById(id).value = config[id];
+                }
+            }
             // Ensure the right fields are hidden/displayed
             document.getElementById('main').classList.remove('hidden');
             keyModeChange();
             resizeCanvas();
+            startClockSync();
         } catch (error) {
             errortext.textContent = error;
             openModal(errormodal);
         }
     }
+    if (command === 0x6) {
+        const stats = decodeStats(data.slice(3, -1));
+        console.log('PicoKeyer stats (times in us):', stats);
+    }
+    if (command === 0x10) {
+        const journal = decodeJournal(data.slice(3, -1));
+        console.log(`PicoKeyer settings journal ${journal.bytes}/${journal.capacity} bytes (times in us):`, journal);
+    }
+    if (command === 0x11) {
+        const boot = decodeBoot(data.slice(3, -1));
+        console.log('PicoKeyer power on timing (us from reset):', boot);
+    }
+    if (command === 0x12) {
+        trace = decodeTraceHeader(data.slice(3, -1));
+        console.log(`PicoKeyer trace ${trace.count}/${trace.capacity} records${trace.recording ? ', still recording' : ''}${trace.full ? ', full' : ''}`);
+        if (trace.count) sendGetTrace(0);
+    }
+    if (command === 0x13 && trace) {
+        const page = decodeTracePage(data.slice(3, -1));
+        if (page.first !== trace.records.length) return; // Not the page asked for
+        trace.records.push(...page.records);
+        if (page.records.length && trace.records.length < trace.count) {
+            sendGetTrace(trace.records.length); // Ask for the next page
+        } else {
+            saveTrace();
+        }
+    }
+    if (command === 0x15) {
+        const test = decodeSelfTest(data.slice(3, -1));
+        if (test.running) {
+            console.log(`PicoKeyer self-test on GPIO ${test.pin}: ${test.driven}/${test.presses} presses, still running`);
+        } else if (test.presses === 0) {
+            console.log(`PicoKeyer self-test on GPIO ${test.pin} not run, the pin is in use or the first keyer has no key`);
+        } else {
+            console.log(`PicoKeyer self-test on GPIO ${test.pin}, ${test.driven}/${test.presses} presses (latency in us):`, { output: test.output, note: test.note });
+        }
+    }
+    if (command === 0xC) {
+        const histogram = decodeHistogram(data.slice(3, -1));
+        console.log(`PicoKeyer ${histogram.name} histogram (times in us):`, histogram);
+    }
+    if (command === 0xB) {
+        const decoded = decodeDecodedCharacter(data.slice(3, -1));
+        const text = document.getElementById('decodedText');
+        text.textContent = (text.textContent + decoded.character).slice(-maxDecodedText);
+        document.getElementById('decodedWPM').textContent = `(${decoded.wpm.toFixed(1)} WPM)`;
+    }
+    if (command === 0x8 || command === 0x9) {
+        handlePlaybackStatus(command, decodePlaybackStatus(data.slice(3, -1)));
+    }
+    if (command === 0xE) {
+        for (const keyEvent of decodeKeyEvents(data.slice(3, -1))) {
+            keyEvent.host = deviceToHost(keyEvent.device);
+            keyTimeline.push(keyEvent);
+        }
+        keyTimeline = keyTimeline.slice(-maxKeyTimeline);
+    }
+    if (command === 0xF) {
+        handlePong(decodePong(data.slice(3, -1)));
+    }
 }
 
 window.onload = requestMidiAccess();
\ No newline at end of file
@@ -1,18 +1,28 @@
 #include "BitPacker.hpp"
 
-BitPacker::BitPacker(uint16_t maxBits) : maxBits_(maxBits), bitPosition_(maxBits), totalBits_(0)
+const uint8_t bitPackerReverse7[128] = {
+    0x00, 0x40, 0x20, 0x60, 0x10, 0x50, 0x30, 0x70, 0x08, 0x48, 0x28, 0x68, 0x18, 0x58, 0x38, 0x78,
+    0x04, 0x44, 0x24, 0x64, 0x14, 0x54, 0x34, 0x74, 0x0C, 0x4C, 0x2C, 0x6C, 0x1C, 0x5C, 0x3C, 0x7C,
+    0x02, 0x42, 0x22, 0x62, 0x12, 0x52, 0x32, 0x72, 0x0A, 0x4A, 0x2A, 0x6A, 0x1A, 0x5A, 0x3A, 0x7A,
+    0x06, 0x46, 0x26, 0x66, 0x16, 0x56, 0x36, 0x76, 0x0E, 0x4E, 0x2E, 0x6E, 0x1E, 0x5E, 0x3E, 0x7E,
+    0x01, 0x41, 0x21, 0x61, 0x11, 0x51, 0x31, 0x71, 0x09, 0x49, 0x29, 0x69, 0x19, 0x59, 0x39, 0x79,
+    0x05, 0x45, 0x25, 0x65, 0x15, 0x55, 0x35, 0x75, 0x0D, 0x4D, 0x2D, 0x6D, 0x1D, 0x5D, 0x3D, 0x7D,
+    0x03, 0x43, 0x23, 0x63, 0x13, 0x53, 0x33, 0x73, 0x0B, 0x4B, 0x2B, 0x6B, 0x1B, 0x5B, 0x3B, 0x7B,
+    0x07, 0x47, 0x27, 0x67, 0x17, 0x57, 0x37, 0x77, 0x0F, 0x4F, 0x2F, 0x6F, 0x1F, 0x5F, 0x3F, 0x7F};
+
+DynamicBitPacker::DynamicBitPacker(uint16_t maxBits) : maxBits_(maxBits), bitPosition_(maxBits), totalBits_(0)
 {
     bufferSize_ = (maxBits + 7) / 8; // Ceiling(maxBits/8)
     buffer_ = new uint8_t[bufferSize_];
     reset();
 }
 
-BitPacker::~BitPacker()
+DynamicBitPacker::~DynamicBitPacker()
 {
     delete[] buffer_;
 }
 
-bool BitPacker::addField(uint64_t value, uint8_t bits)
+bool DynamicBitPacker::addField(uint64_t value, uint8_t bits)
 {
     if (bitPosition_ < bits || totalBits_ + bits > maxBits_)
     {
@@ -39,7 +49,7 @@ bool BitPacker::addField(uint64_t value, uint8_t bits)
     return true;
 }
 
-uint64_t BitPacker::extractField(uint8_t bits)
+uint64_t DynamicBitPacker::extractField(uint8_t bits)
 {
     if (bitPosition_ < bits)
     {
@@ -62,7 +72,7 @@ uint64_t BitPacker::extractField(uint8_t bits)
     return value;
 }
 
-bool BitPacker::pack7Bit(uint8_t *output, uint8_t &outputSize)
+bool DynamicBitPacker::pack7Bit(uint8_t *output, uint8_t &outputSize)
 {
     outputSize = (totalBits_ + 6) / 7; // Ceiling(totalBits/7)
     if (!output)
@@ -88,7 +98,7 @@ bool BitPacker::pack7Bit(uint8_t *output, uint8_t &outputSize)
     return true;
 }
 
-bool BitPacker::unpack7Bit(const uint8_t *input, uint8_t inputSize)
+bool DynamicBitPacker::unpack7Bit(const uint8_t *input, uint8_t inputSize)
 {
     reset();                            // Clear existing bitstream
     uint16_t totalBits = inputSize * 7; // Max bits from input
@@ -120,12 +130,12 @@ bool BitPacker::unpack7Bit(const uint8_t *input, uint8_t inputSize)
     return true;
 }
 
-uint16_t BitPacker::getTotalBits() const
+uint16_t DynamicBitPacker::getTotalBits() const
 {
     return totalBits_;
 }
 
-void BitPacker::reset()
+void DynamicBitPacker::reset()
 {
     for (uint8_t i = 0; i < bufferSize_; i++)
     {
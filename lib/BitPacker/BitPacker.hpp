@@ -3,13 +3,15 @@
 
 #include <Arduino.h>
 
-class BitPacker {
+// Heap allocated bit-at-a-time packer, capacity chosen at runtime. Kept as the
+// reference implementation of the wire format for BitPacker<N> below.
+class DynamicBitPacker {
 public:
   // Constructor: Initialize with maximum bit capacity (default 128 bits)
-  BitPacker(uint16_t maxBits = 128);
+  DynamicBitPacker(uint16_t maxBits = 128);
 
   // Destructor: Free buffer
-  ~BitPacker();
+  ~DynamicBitPacker();
 
   // Add a field to the bitstream
   bool addField(uint64_t value, uint8_t bits);
@@ -37,4 +39,151 @@ private:
   uint16_t totalBits_;   // Total bits packed
 };
 
-#endif // BITPACKER_HPP
\ No newline at end of file
+// The 7 bits of a SysEx byte mirrored, the wire fills each byte from bit 6 down
+extern const uint8_t bitPackerReverse7[128];
+
+// Fixed capacity packer of up to N bits, storage lives inside the object so it
+// can sit on the stack or in a static without touching the heap. Fields are
+// held LSB first in 32-bit words and move a whole word at a time, the packed
+// 7-bit output is bit for bit the same as DynamicBitPacker.
+template <uint16_t N>
+class BitPacker {
+public:
+  BitPacker()
+  {
+    reset();
+  }
+
+  // Add a field to the bitstream, up to 64 bits
+  bool addField(uint64_t value, uint8_t bits)
+  {
+    if (bits > 64 || totalBits_ + bits > N)
+      return false; // Overflow
+
+    if (bits < 64)
+      value &= (1ULL << bits) - 1;
+
+    uint16_t pos = totalBits_;
+    totalBits_ += bits;
+
+    // A field spans at most three words
+    while (bits)
+    {
+      uint8_t shift = pos & 31;
+      uint8_t count = 32 - shift < bits ? 32 - shift : bits;
+      uint32_t mask = (count == 32 ? 0xFFFFFFFFu : (1u << count) - 1) << shift;
+
+      words_[pos >> 5] = (words_[pos >> 5] & ~mask) | (((uint32_t)value << shift) & mask);
+      value >>= count;
+      pos += count;
+      bits -= count;
+    }
+    return true;
+  }
+
+  // Extract the next field from the bitstream, in the order they were added
+  uint64_t extractField(uint8_t bits)
+  {
+    if (bits > 64 || readPosition_ + bits > N)
+      return 0; // Underflow
+
+    uint16_t pos = readPosition_;
+    readPosition_ += bits;
+
+    uint64_t value = 0;
+    uint8_t done = 0;
+    while (done < bits)
+    {
+      uint8_t shift = pos & 31;
+      uint8_t count = 32 - shift < bits - done ? 32 - shift : bits - done;
+      uint32_t chunk = words_[pos >> 5] >> shift;
+      if (count < 32)
+        chunk &= (1u << count) - 1;
+
+      value |= (uint64_t)chunk << done;
+      pos += count;
+      done += count;
+    }
+    return value;
+  }
+
+  // Pack bitstream into 7-bit bytes
+  bool pack7Bit(uint8_t* output, uint8_t& outputSize) const
+  {
+    outputSize = (totalBits_ + 6) / 7; // Ceiling(totalBits/7)
+    if (!output)
+      return false;
+
+    // Bits past totalBits_ are always zero, so whole words can be fed through
+    uint64_t window = 0;
+    uint8_t windowBits = 0;
+    uint8_t word = 0;
+    for (uint8_t i = 0; i < outputSize; i++)
+    {
+      if (windowBits < 7)
+      {
+        if (word < WORDS) // The last byte can run past the storage, those bits are zero
+          window |= (uint64_t)words_[word++] << windowBits;
+        windowBits += 32;
+      }
+      output[i] = bitPackerReverse7[window & 0x7F];
+      window >>= 7;
+      windowBits -= 7;
+    }
+    return true;
+  }
+
+  // Unpack 7-bit bytes into bitstream
+  bool unpack7Bit(const uint8_t* input, uint8_t inputSize)
+  {
+    reset(); // Clear existing bitstream
+    uint16_t totalBits = inputSize * 7;
+    if (totalBits > N)
+      return false; // Overflow
+
+    uint64_t window = 0;
+    uint8_t windowBits = 0;
+    uint8_t word = 0;
+    for (uint8_t i = 0; i < inputSize; i++)
+    {
+      window |= (uint64_t)bitPackerReverse7[input[i] & 0x7F] << windowBits;
+      windowBits += 7;
+      if (windowBits >= 32)
+      {
+        words_[word++] = (uint32_t)window;
+        window >>= 32;
+        windowBits -= 32;
+      }
+    }
+    if (windowBits)
+      words_[word] = (uint32_t)window;
+
+    totalBits_ = totalBits;
+    return true;
+  }
+
+  // Get total bits packed
+  uint16_t getTotalBits() const
+  {
+    return totalBits_;
+  }
+
+  // Reset the packer
+  void reset()
+  {
+    for (uint8_t i = 0; i < WORDS; i++)
+      words_[i] = 0;
+    totalBits_ = 0;
+    readPosition_ = 0;
+  }
+
+private:
+  static constexpr uint8_t WORDS = (N + 31) / 32;
+  static_assert(N > 0 && N <= 255 * 7, "BitPacker capacity out of range, the 7-bit byte count is a uint8_t");
+
+  uint32_t words_[WORDS];  // Bitstream, first field in the low bits of word 0
+  uint16_t totalBits_;     // Total bits packed, next write position
+  uint16_t readPosition_;  // Next bit to extract
+};
+
+#endif // BITPACKER_HPP
@@ -0,0 +1,81 @@
+#include <Arduino.h>
+#include "main.h"
+#include "capture.h"
+#include "keyer.h"
+#include "queue.h"
+
+// Produced by the GPIO IRQ, consumed by the keyer
+static SpscQueue<KeyEdge_t, CAPTURE_BUFFER_SIZE> edges;
+static volatile uint32_t overflowCount = 0;
+static volatile bool resyncNeeded = true;
+
+static uint32_t capturePins = 0; // One bit per GPIO with an edge interrupt attached
+
+/** GPIO IRQ, timestamps the edge with a snapshot of the pins and queues it for the keyer */
+static void onKeyEdge(void *)
+{
+  KeyEdge_t edge;
+  edge.time = micros();
+  edge.levels = readInputPins(); // The other key pins are read too, whichever one moved
+
+  if (!edges.push(edge))
+  {
+    overflowCount++;
+    resyncNeeded = true; // Keyer resyncs from the pin level
+  }
+  signalEvent(); // Wake the keyer if it is sleeping
+}
+
+/** Attaches edge interrupts to the key pins of every keyer */
+void setupCapture()
+{
+  cleanUpCapture();
+
+  capturePins = keyInputPins();
+
+  edges.clear(); // Drop anything left over from a previous configuration
+  resyncNeeded = true; // Pick up keys already held when capture starts
+
+  for (uint32_t pins = capturePins; pins; pins &= pins - 1)
+  {
+    uint8_t pin = __builtin_ctz(pins);
+    attachInterruptParam(digitalPinToInterrupt(pin), onKeyEdge, CHANGE, (void *)(uintptr_t)pin);
+  }
+}
+
+/** Detaches the key pin interrupts */
+void cleanUpCapture()
+{
+  for (uint32_t pins = capturePins; pins; pins &= pins - 1)
+    detachInterrupt(digitalPinToInterrupt(__builtin_ctz(pins)));
+
+  capturePins = 0;
+}
+
+/** Pops the oldest captured edge, returns false when the buffer is empty */
+bool readCapturedEdge(KeyEdge_t &edge)
+{
+  return edges.pop(edge);
+}
+
+/** Returns true once after setup or an overflow, the keyer should then sample the pins directly */
+bool captureNeedsResync()
+{
+  if (!resyncNeeded)
+    return false;
+
+  resyncNeeded = false;
+  return true;
+}
+
+/** True while captured edges or a resync are waiting for the keyer */
+bool captureWaiting()
+{
+  return edges.size() || resyncNeeded;
+}
+
+/** Number of edges dropped because the buffer was full */
+uint32_t captureOverflows()
+{
+  return overflowCount;
+}
@@ -0,0 +1,13 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "main.h"
+
+void setupCapture();
+void cleanUpCapture();
+bool readCapturedEdge(KeyEdge_t &edge);
+bool captureNeedsResync();
+bool captureWaiting();
+uint32_t captureOverflows();
+
+#endif
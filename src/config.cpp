@@ -0,0 +1,175 @@
+#include <Arduino.h>
+#include <BitPacker.hpp>
+#include "main.h"
+#include "config.h"
+
+/** Writes a field into the packed 7-bit stream, offset and bits are compile-time constants at every call site */
+static inline void putField(uint8_t *out, uint16_t offset, uint8_t bits, uint32_t value)
+{
+  uint8_t first = offset / 7;
+  uint8_t last = (offset + bits - 1) / 7;
+  uint8_t shift = offset % 7;
+  uint64_t mask = ((1ULL << bits) - 1) << shift;
+
+  // Gather the bytes the field touches as one little-endian word of 7-bit digits
+  uint64_t word = 0;
+  for (int i = last; i >= first; i--)
+    word = (word << 7) | bitPackerReverse7[out[i] & 0x7F];
+
+  word = (word & ~mask) | (((uint64_t)value << shift) & mask);
+
+  for (uint8_t i = first; i <= last; i++)
+  {
+    out[i] = bitPackerReverse7[word & 0x7F];
+    word >>= 7;
+  }
+}
+
+/** Reads a field from the packed 7-bit stream */
+static inline uint32_t getField(const uint8_t *input, uint16_t offset, uint8_t bits)
+{
+  uint8_t first = offset / 7;
+  uint8_t last = (offset + bits - 1) / 7;
+
+  uint64_t word = 0;
+  for (int i = last; i >= first; i--)
+    word = (word << 7) | bitPackerReverse7[input[i] & 0x7F];
+
+  return (word >> (offset % 7)) & ((1ULL << bits) - 1);
+}
+
+/** Encode Config struct into a contiguous 7-bit buffer */
+void encodeConfig(const Settings_t &settings, uint8_t *out, uint8_t &outSize)
+{
+  outSize = CONFIG_PACKED_SIZE;
+  memset(out, 0, outSize);
+
+#define CONFIG_ENCODE_FIELD(id, member, bits, revision) \
+  putField(out, configOffset(CONFIG_##id), bits, (uint32_t)settings.member);
+  CONFIG_FIELDS(CONFIG_ENCODE_FIELD)
+#undef CONFIG_ENCODE_FIELD
+}
+
+/** Decode a 7-bit buffer into the Config struct, fields newer than the sender's revision are left untouched. Returns the revision decoded, 0 if none. */
+uint8_t decodeConfig(Settings_t &settings, const uint8_t *input, uint8_t inputSize)
+{
+  // The packed length identifies the sender's revision
+  uint8_t revision = CONFIG_REVISION;
+  while (revision > 0 && configRevisionBytes(revision) > inputSize)
+    revision--;
+
+#define CONFIG_DECODE_FIELD(id, member, bits, revision_)                                           \
+  if (revision_ <= revision)                                                                      \
+    settings.member = (decltype(settings.member))getField(input, configOffset(CONFIG_##id), bits);
+  CONFIG_FIELDS(CONFIG_DECODE_FIELD)
+#undef CONFIG_DECODE_FIELD
+
+  return revision;
+}
+
+/** Sets one field by id, the value as it came off the wire */
+static void setField(Settings_t &settings, uint8_t id, uint32_t value)
+{
+  switch (id)
+  {
+#define CONFIG_SET_FIELD(id, member, bits, revision)     \
+  case CONFIG_##id:                                      \
+    settings.member = (decltype(settings.member))value; \
+    break;
+    CONFIG_FIELDS(CONFIG_SET_FIELD)
+#undef CONFIG_SET_FIELD
+  }
+}
+
+/** Decode a list of changed fields into the Config struct: a 7-bit count, then a 7-bit id and the field's bits per field. Returns the fields set, 0 with nothing set if the list is cut short or names a field this firmware does not have. */
+uint8_t decodeConfigFields(Settings_t &settings, const uint8_t *input, uint8_t inputSize)
+{
+  uint16_t totalBits = inputSize * 7;
+  if (totalBits < 7)
+    return 0;
+
+  // Checked whole before any field is set, a bad list changes nothing
+  uint8_t count = getField(input, 0, 7);
+  uint16_t offset = 7;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    if (offset + 7 > totalBits)
+      return 0;
+    uint8_t id = getField(input, offset, 7);
+    if (id >= CONFIG_FIELD_COUNT || offset + 7 + configFieldBits[id] > totalBits)
+      return 0;
+    offset += 7 + configFieldBits[id];
+  }
+
+  offset = 7;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    uint8_t id = getField(input, offset, 7);
+    setField(settings, id, getField(input, offset + 7, configFieldBits[id]));
+    offset += 7 + configFieldBits[id];
+  }
+  return count;
+}
+
+/** Which parts of the keyer a change of settings touches, a settingsChange_t mask */
+uint8_t settingsChanges(const Settings_t &from, const Settings_t &to)
+{
+  uint8_t changes = CHANGE_NONE;
+
+  bool keys = from.keyMode != to.keyMode || from.pinMode != to.pinMode || from.gpio.ditPaddle != to.gpio.ditPaddle ||
+              from.gpio.dahPaddle != to.gpio.dahPaddle || from.gpio.straightKey != to.gpio.straightKey ||
+              from.debounceMode != to.debounceMode || from.straightDebounce != to.straightDebounce ||
+              from.ditDebounce != to.ditDebounce || from.dahDebounce != to.dahDebounce ||
+              from.gpio.speedPot != to.gpio.speedPot;
+  bool outputs = from.gpioOutputMode != to.gpioOutputMode || from.gpio.output != to.gpio.output ||
+                 from.pttMode != to.pttMode || from.gpio.ptt != to.gpio.ptt;
+  bool led = from.ledMode != to.ledMode || from.gpio.normalLED != to.gpio.normalLED || from.gpio.rgbLED != to.gpio.rgbLED;
+
+  for (uint8_t k = 0; k < KEYER_COUNT - 1; k++)
+  {
+    const KeyerSettings_t &a = from.keyers[k];
+    const KeyerSettings_t &b = to.keyers[k];
+    keys |= a.keyMode != b.keyMode || a.ditPaddle != b.ditPaddle || a.dahPaddle != b.dahPaddle || a.straightKey != b.straightKey;
+    outputs |= a.outputMode != b.outputMode || a.output != b.output;
+  }
+
+  if (keys)
+    changes |= CHANGE_KEYS;
+  if (outputs)
+    changes |= CHANGE_OUTPUTS;
+  if (led)
+    changes |= CHANGE_LED;
+
+  // Everything else, compared on the wire so padding and the derived timings do not count
+  uint8_t a[CONFIG_PACKED_SIZE], b[CONFIG_PACKED_SIZE];
+  uint8_t size;
+  encodeConfig(from, a, size);
+  encodeConfig(to, b, size);
+  if (changes == CHANGE_NONE && memcmp(a, b, size) != 0)
+    changes = CHANGE_SOFT;
+
+  return changes;
+}
+
+/** Encode a page of the config layout for the host: revision, field count, first field, then bits and revision per field from there */
+void encodeLayout(uint8_t first, uint8_t *out, uint8_t &outSize)
+{
+  if (first > CONFIG_FIELD_COUNT)
+    first = CONFIG_FIELD_COUNT;
+
+  uint8_t end = first + CONFIG_LAYOUT_PAGE_FIELDS;
+  if (end > CONFIG_FIELD_COUNT)
+    end = CONFIG_FIELD_COUNT;
+
+  outSize = 0;
+  out[outSize++] = CONFIG_REVISION;
+  out[outSize++] = CONFIG_FIELD_COUNT;
+  out[outSize++] = first;
+
+  // Fields are listed in wire order, the position is the id
+  for (uint8_t field = first; field < end; field++)
+  {
+    out[outSize++] = configFieldBits[field];
+    out[outSize++] = configFieldRevision[field];
+  }
+}
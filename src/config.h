@@ -0,0 +1,136 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "main.h"
+
+// SysEx config wire layout, declared once. The layout is append only: new
+// fields go at the end, tagged with the next CONFIG_REVISION, and older hosts
+// or saved configs that stop short of them simply leave those fields as they
+// are. Each field is packed LSB first into the 7-bit SysEx stream.
+//
+//    FIELD(ID, Settings_t member, bits, revision added)
+#define CONFIG_FIELDS(FIELD)                   \
+    FIELD(KEYMODE, keyMode, 2, 1)              \
+    FIELD(PINMODE, pinMode, 2, 1)              \
+    FIELD(LEDMODE, ledMode, 2, 1)              \
+    FIELD(OUTPUTMODE, gpioOutputMode, 2, 1)    \
+    FIELD(GPIO_OUTPUT, gpio.output, 7, 1)      \
+    FIELD(GPIO_NORMALLED, gpio.normalLED, 7, 1) \
+    FIELD(GPIO_RGBLED, gpio.rgbLED, 7, 1)      \
+    FIELD(GPIO_DITPADDLE, gpio.ditPaddle, 7, 1) \
+    FIELD(GPIO_DAHPADDLE, gpio.dahPaddle, 7, 1) \
+    FIELD(GPIO_STRAIGHT, gpio.straightKey, 7, 1) \
+    FIELD(WPM, wpm, 16, 1)                     \
+    FIELD(CHANNEL, channel, 7, 1)              \
+    FIELD(NOTE, note, 7, 1)                    \
+    FIELD(VOLUME, volume, 7, 1)                \
+    FIELD(FARNSWORTH, farnsworth, 16, 2)       \
+    FIELD(WEIGHT, weight, 7, 2)                \
+    FIELD(IAMBICMODE, iambicMode, 2, 3)        \
+    FIELD(DITMEMORY, ditMemory, 7, 3)          \
+    FIELD(DAHMEMORY, dahMemory, 7, 3)          \
+    FIELD(EVENTSTREAM, eventStream, 1, 4)      \
+    FIELD(DEBOUNCEMODE, debounceMode, 1, 5)    \
+    FIELD(STRAIGHTDEBOUNCE, straightDebounce, 6, 5) \
+    FIELD(DITDEBOUNCE, ditDebounce, 6, 5)     \
+    FIELD(DAHDEBOUNCE, dahDebounce, 6, 5)     \
+    CONFIG_KEYER_FIELDS(FIELD, 1, 6)          \
+    CONFIG_KEYER_FIELDS(FIELD, 2, 6)          \
+    CONFIG_KEYER_FIELDS(FIELD, 3, 6)          \
+    FIELD(PTTMODE, pttMode, 2, 7)             \
+    FIELD(GPIO_PTT, gpio.ptt, 7, 7)           \
+    FIELD(PTTLEAD, pttLead, 7, 7)             \
+    FIELD(PTTTAIL, pttTail, 8, 7)             \
+    FIELD(GPIO_SPEEDPOT, gpio.speedPot, 7, 8) \
+    FIELD(SPEEDMIN, speedMin, 7, 8)           \
+    FIELD(SPEEDMAX, speedMax, 7, 8)
+
+// Fields of a keyer after the first, n is its index from 1
+#define CONFIG_KEYER_FIELDS(FIELD, n, revision)                       \
+    FIELD(KEYER##n##_KEYMODE, keyers[n - 1].keyMode, 2, revision)     \
+    FIELD(KEYER##n##_DITPADDLE, keyers[n - 1].ditPaddle, 7, revision) \
+    FIELD(KEYER##n##_DAHPADDLE, keyers[n - 1].dahPaddle, 7, revision) \
+    FIELD(KEYER##n##_STRAIGHT, keyers[n - 1].straightKey, 7, revision) \
+    FIELD(KEYER##n##_OUTPUTMODE, keyers[n - 1].outputMode, 2, revision) \
+    FIELD(KEYER##n##_OUTPUT, keyers[n - 1].output, 7, revision)       \
+    FIELD(KEYER##n##_NOTE, keyers[n - 1].note, 7, revision)           \
+    FIELD(KEYER##n##_CHANNEL, keyers[n - 1].channel, 7, revision)
+
+// Newest revision tag used in CONFIG_FIELDS
+#define CONFIG_REVISION 8
+
+// Field ids, in wire order
+enum configField_t : uint8_t
+{
+#define CONFIG_FIELD_ID(id, member, bits, revision) CONFIG_##id,
+    CONFIG_FIELDS(CONFIG_FIELD_ID)
+#undef CONFIG_FIELD_ID
+    CONFIG_FIELD_COUNT
+};
+
+#define CONFIG_FIELD_BITS(id, member, bits, revision) bits,
+constexpr uint8_t configFieldBits[] = {CONFIG_FIELDS(CONFIG_FIELD_BITS)};
+#undef CONFIG_FIELD_BITS
+
+#define CONFIG_FIELD_REVISION(id, member, bits, revision) revision,
+constexpr uint8_t configFieldRevision[] = {CONFIG_FIELDS(CONFIG_FIELD_REVISION)};
+#undef CONFIG_FIELD_REVISION
+
+/** Bit offset of a field in the config stream */
+constexpr uint16_t configOffset(uint8_t field)
+{
+    return field == 0 ? 0 : configOffset(field - 1) + configFieldBits[field - 1];
+}
+
+/** Bits used by every field up to and including a revision */
+constexpr uint16_t configRevisionBits(uint8_t revision, uint8_t field = 0)
+{
+    return field == CONFIG_FIELD_COUNT ? 0
+                                       : (configFieldRevision[field] <= revision ? configFieldBits[field] : 0) + configRevisionBits(revision, field + 1);
+}
+
+/** Packed SysEx bytes for a config of a given revision */
+constexpr uint8_t configRevisionBytes(uint8_t revision)
+{
+    return (configRevisionBits(revision) + 6) / 7;
+}
+
+/** Revisions must be appended in order and each must change the packed length, that is how the decoder tells them apart */
+constexpr bool configLayoutValid(uint8_t field = 1)
+{
+    return field >= CONFIG_FIELD_COUNT ? true
+                                       : configFieldRevision[field] >= configFieldRevision[field - 1] &&
+                                             (configFieldRevision[field] == configFieldRevision[field - 1] ||
+                                              configRevisionBytes(configFieldRevision[field]) > configRevisionBytes(configFieldRevision[field - 1])) &&
+                                             configLayoutValid(field + 1);
+}
+
+#define CONFIG_TOTAL_BITS configOffset(CONFIG_FIELD_COUNT)
+#define CONFIG_PACKED_SIZE configRevisionBytes(CONFIG_REVISION)
+#define CONFIG_LAYOUT_PAGE_FIELDS 28 // Fields per CMD_GET_LAYOUT reply, the host asks for the next page from where one stops
+#define CONFIG_LAYOUT_SIZE (3 + CONFIG_LAYOUT_PAGE_FIELDS * 2)
+
+static_assert(configLayoutValid(), "CONFIG_FIELDS revisions must be in order and change the packed length");
+static_assert(configFieldRevision[CONFIG_FIELD_COUNT - 1] == CONFIG_REVISION, "CONFIG_REVISION must match the newest field");
+static_assert(KEYER_COUNT == 4, "CONFIG_FIELDS lists the fields of KEYER_COUNT - 1 extra keyers");
+static_assert(CONFIG_PACKED_SIZE + 4 <= MAX_SYSEX_LENGTH, "Config does not fit in a SysEx message");
+static_assert(CONFIG_LAYOUT_SIZE + 4 <= MAX_SYSEX_LENGTH, "Config layout does not fit in a SysEx message");
+
+// What a settings change touches. Anything not listed here, the speed, notes,
+// volume, memory and PTT timing, is taken up without stopping the keyers
+enum settingsChange_t : uint8_t
+{
+    CHANGE_NONE = 0,
+    CHANGE_SOFT = 1,    // Only fields the keyers take up as they go
+    CHANGE_KEYS = 2,    // Key or speed knob pins, modes or debounce
+    CHANGE_OUTPUTS = 4, // Output or PTT pins or modes
+    CHANGE_LED = 8      // LED pin or mode
+};
+
+void encodeConfig(const Settings_t &settings, uint8_t *out, uint8_t &outSize);
+uint8_t decodeConfig(Settings_t &settings, const uint8_t *input, uint8_t inputSize);
+uint8_t decodeConfigFields(Settings_t &settings, const uint8_t *input, uint8_t inputSize);
+uint8_t settingsChanges(const Settings_t &from, const Settings_t &to);
+void encodeLayout(uint8_t first, uint8_t *out, uint8_t &outSize);
+
+#endif
@@ -0,0 +1,130 @@
+#include <Arduino.h>
+#include "main.h"
+#include "debounce.h"
+#include "keyer.h"
+
+// Ticks after which every lane has settled on a held reading, a full window
+// to a leading edge lockout's end and another for the edge it then acts on
+#define DEBOUNCE_SETTLE_TICKS (2 << DEBOUNCE_COUNTER_BITS)
+
+static uint32_t inputPins = 0;    // Lanes being debounced
+static uint32_t leadingPins = 0;  // Lanes that act on the first edge then lock out the window
+static uint32_t rawLevels = 0;    // Last snapshot of the pins
+static uint32_t stableLevels = 0; // Debounced levels
+static uint32_t counter[DEBOUNCE_COUNTER_BITS]; // Ticks left in each lane's window
+static uint32_t window[DEBOUNCE_COUNTER_BITS];  // Window each lane's counter is reloaded with
+static uint32_t nextTick = 0;
+
+/** Lanes whose counter has not run out */
+static inline uint32_t counterRunning()
+{
+  uint32_t running = 0;
+  for (uint8_t i = 0; i < DEBOUNCE_COUNTER_BITS; i++)
+    running |= counter[i];
+  return running;
+}
+
+/** Counts the given lanes down by one, a borrow ripples up through the bit planes */
+static inline void counterDecrement(uint32_t lanes)
+{
+  uint32_t borrow = lanes;
+  for (uint8_t i = 0; i < DEBOUNCE_COUNTER_BITS; i++)
+  {
+    counter[i] ^= borrow;
+    borrow &= counter[i]; // The bit was clear, keep borrowing
+  }
+}
+
+/** Restarts the window of the given lanes */
+static inline void counterReload(uint32_t lanes)
+{
+  for (uint8_t i = 0; i < DEBOUNCE_COUNTER_BITS; i++)
+    counter[i] = (counter[i] & ~lanes) | (window[i] & lanes);
+}
+
+/** Steps every lane by one tick on the last snapshot, returns the lanes whose debounced level changed */
+static uint32_t debounceTick()
+{
+  uint32_t differs = (rawLevels ^ stableLevels) & inputPins;
+  uint32_t running = counterRunning();
+
+  // Settling lanes count while the reading differs, leading lanes count out their lockout
+  counterDecrement((differs | leadingPins) & running);
+
+  // Settled for a whole window, or the lockout ended on a reading that moved during it
+  uint32_t toggled = differs & ~counterRunning();
+  stableLevels ^= toggled;
+
+  // A settling lane starts over whenever the reading agrees again
+  counterReload(toggled | (inputPins & ~leadingPins & ~differs));
+  return toggled;
+}
+
+/** Sets the window of a pin's lane in ticks, applied by the next setupDebounce() */
+void setDebounceWindow(uint8_t pin, uint8_t ticks)
+{
+  if (ticks > (1 << DEBOUNCE_COUNTER_BITS) - 1)
+    ticks = (1 << DEBOUNCE_COUNTER_BITS) - 1;
+
+  for (uint8_t i = 0; i < DEBOUNCE_COUNTER_BITS; i++)
+    window[i] = (window[i] & ~(1u << pin)) | ((uint32_t)((ticks >> i) & 1) << pin);
+}
+
+/** Starts debouncing the given pins from known levels */
+void setupDebounce(uint32_t pins, uint32_t leading, uint32_t levels, uint32_t now)
+{
+  inputPins = pins;
+  leadingPins = leading & pins;
+  rawLevels = levels;
+  stableLevels = levels;
+  nextTick = now + DEBOUNCE_TICK_US;
+
+  for (uint8_t i = 0; i < DEBOUNCE_COUNTER_BITS; i++)
+    counter[i] = 0;
+  counterReload(pins & ~leadingPins);
+  counter[0] |= leadingPins; // Locked for a tick, a pin still charging through a new pull-up is not a press
+}
+
+/** Runs the ticks due by now on the last snapshot, returns the lanes whose debounced level changed */
+uint32_t debounceAdvance(uint32_t now)
+{
+  // After a stall or a sleep only the last few ticks can change anything, the rest are skipped on the same tick phase
+  if (timeReached(now, nextTick + DEBOUNCE_SETTLE_TICKS * DEBOUNCE_TICK_US))
+    nextTick += ((now - nextTick) / DEBOUNCE_TICK_US - DEBOUNCE_SETTLE_TICKS) * DEBOUNCE_TICK_US;
+
+  // A held reading changes a lane at most once
+  uint32_t changed = 0;
+  while (timeReached(now, nextTick))
+  {
+    changed |= debounceTick();
+    nextTick += DEBOUNCE_TICK_US;
+  }
+  return changed;
+}
+
+/** Takes a snapshot of the pins, leading lanes not locked out act on it at once. Returns the lanes whose debounced level changed */
+uint32_t debounceSample(uint32_t levels)
+{
+  rawLevels = levels;
+
+  uint32_t toggled = (levels ^ stableLevels) & leadingPins & ~counterRunning();
+  stableLevels ^= toggled;
+  counterReload(toggled); // Lock out the bounce that follows
+  return toggled;
+}
+
+/** Debounced level of every pin, lanes not being debounced read as their last setup level */
+uint32_t debouncedLevels()
+{
+  return stableLevels;
+}
+
+/** Next tick that can change a debounced level, false if every lane agrees with its last reading and only a new edge can */
+bool debounceNextTick(uint32_t &tick)
+{
+  if (!((rawLevels ^ stableLevels) & inputPins))
+    return false; // Lockouts still counting catch up on the ticks missed when the next edge comes in
+
+  tick = nextTick;
+  return true;
+}
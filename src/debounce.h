@@ -0,0 +1,16 @@
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+#include "main.h"
+
+// Key debounce for every GPIO at once, one lane per pin in a 32-bit word.
+// Lanes are stepped together every DEBOUNCE_TICK_US with vertical counters,
+// bit n of every lane's count is held in counter word n.
+void setDebounceWindow(uint8_t pin, uint8_t ticks);
+void setupDebounce(uint32_t pins, uint32_t leading, uint32_t levels, uint32_t now);
+uint32_t debounceAdvance(uint32_t now);
+uint32_t debounceSample(uint32_t levels);
+uint32_t debouncedLevels();
+bool debounceNextTick(uint32_t &tick);
+
+#endif
@@ -0,0 +1,196 @@
+#include <Arduino.h>
+#include "main.h"
+#include "decoder.h"
+#include "morse.h"
+
+// Speed estimates in microseconds, adapted to the sender as marks and gaps come in
+static uint32_t ditEstimate = 100000;
+static uint32_t gapEstimate = 100000;
+static uint32_t charGapEstimate = 300000; // Farnsworth stretches this apart from the dit
+static uint32_t lastMark = 0;             // Length of the previous mark, 0 until there is one
+static uint32_t lastSpace = 0;            // Length of the previous character or word space, 0 until there is one
+
+// Character being received, see morse.h
+static uint8_t dahs = 0;
+static uint8_t elements = 0;
+static bool overflow = false;   // More elements than any character has
+static bool wordPending = false; // A character was sent since the last word space
+
+static bool keyDown = false;
+static uint32_t lastEdge = 0;
+
+/** Moves an estimate a quarter of the way to a new measurement */
+static inline uint32_t track(uint32_t estimate, uint32_t measured)
+{
+  return (uint32_t)((int32_t)estimate + ((int32_t)measured - (int32_t)estimate) / 4);
+}
+
+/** Keeps the estimates in the range of speeds anyone sends at */
+static void clampEstimates()
+{
+  if (ditEstimate < DECODER_MIN_DIT)
+    ditEstimate = DECODER_MIN_DIT;
+  if (ditEstimate > DECODER_MAX_DIT)
+    ditEstimate = DECODER_MAX_DIT;
+
+  // Weighting and hand keying move the gap away from the dit, but not this far
+  if (gapEstimate < ditEstimate / 4)
+    gapEstimate = ditEstimate / 4;
+  if (gapEstimate > ditEstimate * 2)
+    gapEstimate = ditEstimate * 2;
+
+  // From plain spacing up to Farnsworth at a fifth of the character speed
+  uint32_t unit = (ditEstimate + gapEstimate) / 2;
+  if (charGapEstimate < unit * 3)
+    charGapEstimate = unit * 3;
+  if (charGapEstimate > unit * 20)
+    charGapEstimate = unit * 20;
+}
+
+/** One dot unit, a dit and the gap after it */
+static inline uint32_t unitEstimate()
+{
+  return (ditEstimate + gapEstimate) / 2;
+}
+
+/** Starts over at the configured speed */
+void resetDecoder(uint16_t wpm)
+{
+  if (wpm == 0)
+    wpm = DEFAULT_WPM;
+
+  // PARIS timing, 50 units per word
+  ditEstimate = 1200000u * WPM_SCALE / wpm;
+  gapEstimate = ditEstimate;
+  charGapEstimate = ditEstimate * 3;
+  lastMark = 0;
+  lastSpace = 0;
+  clampEstimates();
+
+  dahs = 0;
+  elements = 0;
+  overflow = false;
+  wordPending = false;
+  keyDown = false;
+}
+
+/** Looks the elements received so far up and sends the character */
+static void endCharacter()
+{
+  char c = overflow ? 0 : morseDecode(dahs | (1 << elements));
+  sendDecodedCharacter(c ? c : DECODER_UNKNOWN);
+
+  dahs = 0;
+  elements = 0;
+  overflow = false;
+  wordPending = true;
+}
+
+/** Classifies a mark as a dit or a dah and adapts the speed to it */
+static void decodeMark(uint32_t length)
+{
+  // A dit and a dah back to back give the speed directly, so a sudden change is picked up within a character
+  uint32_t shorter = length < lastMark ? length : lastMark;
+  uint32_t longer = length < lastMark ? lastMark : length;
+  if (lastMark && longer > shorter * 2 && longer < shorter * 5)
+    ditEstimate = (ditEstimate + (shorter + longer / 3) / 2) / 2;
+
+  bool dah = length >= ditEstimate * 2;
+
+  // Marks far longer than a dah are not Morse, a tuning carrier say, keep them out of the estimate
+  if (length < ditEstimate * 6)
+    ditEstimate = track(ditEstimate, dah ? length / 3 : length);
+  clampEstimates();
+  lastMark = length;
+
+  if (elements < 7)
+  {
+    if (dah)
+      dahs |= 1 << elements;
+    elements++;
+  }
+  else
+  {
+    overflow = true;
+  }
+}
+
+/** Sends the character and word space a space of this length closes */
+static void closeSpace(uint32_t length)
+{
+  if (length < unitEstimate() * 2)
+    return;
+
+  if (elements || overflow)
+    endCharacter();
+  if (wordPending && length >= charGapEstimate * 5 / 3) // Halfway to a word space, 7 units to the character space's 3
+  {
+    sendDecodedCharacter(' ');
+    wordPending = false;
+  }
+}
+
+/** Adapts the spacing to a space that has ended */
+static void trackSpace(uint32_t length)
+{
+  if (length < unitEstimate() * 2)
+  {
+    if (elements)
+      gapEstimate = track(gapEstimate, length); // Gap between elements
+    clampEstimates();
+    return;
+  }
+
+  // Far longer than a word space, the sender stopped for a while
+  if (length > charGapEstimate * 8)
+  {
+    lastSpace = 0;
+    return;
+  }
+
+  // A character space and a word space back to back give the spacing directly, like a dit and a dah
+  uint32_t shorter = length < lastSpace ? length : lastSpace;
+  uint32_t longer = length < lastSpace ? lastSpace : length;
+  if (lastSpace && longer * 5 > shorter * 9 && longer * 5 < shorter * 16)
+    charGapEstimate = (charGapEstimate + (shorter + longer * 3 / 7) / 2) / 2;
+
+  bool word = length >= charGapEstimate * 5 / 3;
+  charGapEstimate = track(charGapEstimate, word ? length * 3 / 7 : length);
+  clampEstimates();
+  lastSpace = length;
+}
+
+/** Feeds a key down or up edge, called in order with the time the keyer switched the output */
+void decodeKeyEdge(bool state, uint32_t time)
+{
+  if (state == keyDown)
+    return;
+
+  uint32_t length = time - lastEdge;
+  if (state)
+  {
+    closeSpace(length);
+    trackSpace(length);
+  }
+  else
+  {
+    decodeMark(length);
+  }
+
+  keyDown = state;
+  lastEdge = time;
+}
+
+/** Sends the last character and word space once the key has been up long enough, called regularly */
+void decodeIdle(uint32_t now)
+{
+  if (!keyDown)
+    closeSpace(now - lastEdge);
+}
+
+/** Sending speed the decoder has settled on, fixed point like settings.wpm */
+uint16_t decoderWPM()
+{
+  uint32_t wpm = 1200000u * WPM_SCALE / unitEstimate();
+  return wpm > UINT16_MAX ? UINT16_MAX : wpm;
+}
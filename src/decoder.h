@@ -0,0 +1,15 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+#include "main.h"
+
+// CW decoder, fed with the keyed output edges as timestamped by the keyer
+void resetDecoder(uint16_t wpm);
+void decodeKeyEdge(bool state, uint32_t time);
+void decodeIdle(uint32_t now);
+uint16_t decoderWPM();
+
+// Output hook, implemented by main.cpp on the device and by the simulated HAL on the host
+void sendDecodedCharacter(char c);
+
+#endif
@@ -0,0 +1,72 @@
+#include <Arduino.h>
+#include <BitPacker.hpp>
+#include "main.h"
+#include "eventstream.h"
+
+// Each transition is a key state, a width code and a timestamp. Codes 0-2
+// are a delta from the transition before it in 8, 16 or 24 bits, code 3 an
+// absolute 32-bit micros() time.
+#define EVENT_WIDTH_ABSOLUTE 3
+#define EVENT_BITS (1 + 2 + 32)
+#define EVENT_MESSAGE_BITS (7 + 4 + EVENT_STREAM_BATCH * EVENT_BITS)
+
+static_assert((EVENT_MESSAGE_BITS + 6) / 7 + 4 <= MAX_SYSEX_LENGTH, "Key event batch does not fit in a SysEx message");
+static_assert(EVENT_STREAM_BATCH < 16, "Key event count is sent in 4 bits");
+
+static uint8_t sequence = 0;   // Message counter, 7 bits, lets the host spot a lost message
+static uint32_t lastTime = 0;  // Timestamp of the last transition sent
+static bool synced = false;    // The host has an absolute time to add deltas to
+
+/** Starts the stream over, the next transition is sent with an absolute time */
+void resetEventStream()
+{
+  sequence = 0;
+  synced = false;
+}
+
+/** Packs up to EVENT_STREAM_BATCH key transitions, each timed from the one before it */
+void encodeKeyEvents(const KeyEvent_t *events, uint8_t count, uint8_t *out, uint8_t &outSize)
+{
+  BitPacker<EVENT_MESSAGE_BITS> packer;
+
+  if (count > EVENT_STREAM_BATCH)
+    count = EVENT_STREAM_BATCH;
+
+  // Now and then start from an absolute time, a host that lost a message picks the stream up again here
+  if (sequence % EVENT_STREAM_SYNC_EVERY == 0)
+    synced = false;
+
+  packer.addField(sequence, 7);
+  packer.addField(count, 4);
+  sequence = (sequence + 1) & 0x7F;
+
+  for (uint8_t i = 0; i < count; i++)
+  {
+    uint32_t delta = events[i].time - lastTime;
+    uint8_t width = !synced ? EVENT_WIDTH_ABSOLUTE : delta < (1u << 8) ? 0 : delta < (1u << 16) ? 1 : delta < (1u << 24) ? 2 : EVENT_WIDTH_ABSOLUTE;
+
+    packer.addField(events[i].state, 1);
+    packer.addField(width, 2);
+    if (width == EVENT_WIDTH_ABSOLUTE)
+      packer.addField(events[i].time, 32);
+    else
+      packer.addField(delta, (width + 1) * 8);
+
+    lastTime = events[i].time;
+    synced = true;
+  }
+
+  packer.pack7Bit(out, outSize);
+}
+
+/** Packs the reply to a ping: the host's token as it came, when the ping was received and when the reply left */
+void encodePong(const uint8_t *token, uint32_t received, uint32_t sent, uint8_t *out, uint8_t &outSize)
+{
+  BitPacker<PING_TOKEN_SIZE * 7 + 2 * 32> packer;
+
+  for (uint8_t i = 0; i < PING_TOKEN_SIZE; i++)
+    packer.addField(token[i], 7);
+  packer.addField(received, 32);
+  packer.addField(sent, 32);
+  packer.pack7Bit(out, outSize);
+}
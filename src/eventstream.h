@@ -0,0 +1,11 @@
+#ifndef EVENTSTREAM_H
+#define EVENTSTREAM_H
+
+#include "main.h"
+
+// Timestamped key transitions and clock sync over SysEx, runs on core0
+void resetEventStream();
+void encodeKeyEvents(const KeyEvent_t *events, uint8_t count, uint8_t *out, uint8_t &outSize);
+void encodePong(const uint8_t *token, uint32_t received, uint32_t sent, uint8_t *out, uint8_t &outSize);
+
+#endif
@@ -0,0 +1,131 @@
+#include <Arduino.h>
+#include "journal.h"
+
+// CRC-32 (IEEE, reflected), a nibble at a time from a 16 entry table
+static const uint32_t crcTable[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+
+/** CRC-32 of a block of bytes */
+uint32_t journalCrc(const uint8_t *data, size_t length)
+{
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ crcTable[crc & 0x0F];
+    crc = (crc >> 4) ^ crcTable[crc & 0x0F];
+  }
+  return ~crc;
+}
+
+/** Writes a record for a payload, returns its size */
+uint8_t encodeJournalRecord(uint16_t sequence, const uint8_t *payload, uint8_t length, uint8_t *out)
+{
+  out[0] = JOURNAL_MAGIC;
+  out[1] = sequence & 0xFF;
+  out[2] = sequence >> 8;
+  out[3] = length;
+  memcpy(&out[JOURNAL_HEADER_SIZE], payload, length);
+
+  uint32_t crc = journalCrc(out, JOURNAL_HEADER_SIZE + length);
+  for (uint8_t i = 0; i < 4; i++)
+    out[JOURNAL_HEADER_SIZE + length + i] = crc >> (i * 8);
+
+  return JOURNAL_RECORD_SIZE(length);
+}
+
+/** Checks for an intact record at the start of a block, returns its size or 0 */
+uint16_t checkJournalRecord(const uint8_t *data, uint16_t size)
+{
+  if (size < JOURNAL_RECORD_SIZE(0) || data[0] != JOURNAL_MAGIC)
+    return 0;
+
+  uint8_t length = data[3];
+  if (size < JOURNAL_RECORD_SIZE(length))
+    return 0;
+
+  uint32_t crc = 0;
+  for (uint8_t i = 0; i < 4; i++)
+    crc |= (uint32_t)data[JOURNAL_HEADER_SIZE + length + i] << (i * 8);
+
+  return journalCrc(data, JOURNAL_HEADER_SIZE + length) == crc ? JOURNAL_RECORD_SIZE(length) : 0;
+}
+
+/** Finds the newest intact record, stepping a byte at a time past anything damaged to the next one */
+JournalScan_t scanJournal(const uint8_t *data, uint16_t size)
+{
+  JournalScan_t scan = {};
+  bool skipping = false;
+
+  for (uint16_t offset = 0; offset < size;)
+  {
+    uint16_t recordSize = checkJournalRecord(&data[offset], size - offset);
+    if (!recordSize)
+    {
+      if (!skipping)
+        scan.damaged++;
+      skipping = true;
+      offset++;
+      continue;
+    }
+
+    // Newest by sequence number, so it holds even if records were not appended in order
+    uint16_t sequence = data[offset + 1] | (data[offset + 2] << 8);
+    if (!scan.found || (int16_t)(sequence - scan.sequence) > 0)
+    {
+      scan.found = true;
+      scan.sequence = sequence;
+      scan.offset = offset + JOURNAL_HEADER_SIZE;
+      scan.length = data[offset + 3];
+    }
+
+    scan.records++;
+    skipping = false;
+    offset += recordSize;
+    scan.end = offset;
+  }
+
+  return scan;
+}
+
+/** Finds the newest intact record in the boot sector and the slot the next one goes in, recordSize bytes must be erased there */
+BootScan_t scanBootSector(const uint8_t *sector, uint8_t recordSize)
+{
+  BootScan_t scan = {};
+  uint8_t newest = 0;
+
+  for (uint8_t slot = 0; slot < BOOT_SLOTS; slot++)
+  {
+    const uint8_t *data = &sector[slot * BOOT_SLOT_SIZE];
+    if (!checkJournalRecord(data, BOOT_SLOT_SIZE))
+      continue;
+
+    uint16_t sequence = data[1] | (data[2] << 8);
+    if (!scan.found || (int16_t)(sequence - scan.sequence) > 0)
+    {
+      scan.found = true;
+      scan.sequence = sequence;
+      scan.offset = slot * BOOT_SLOT_SIZE + JOURNAL_HEADER_SIZE;
+      scan.length = data[3];
+      newest = slot;
+    }
+  }
+
+  // Slots are used in order, a torn program leaves one that is neither intact nor erased
+  scan.next = BOOT_SLOTS;
+  for (uint8_t slot = scan.found ? newest + 1 : 0; slot < BOOT_SLOTS; slot++)
+  {
+    const uint8_t *data = &sector[slot * BOOT_SLOT_SIZE];
+    uint8_t i = 0;
+    while (i < recordSize && data[i] == 0xFF)
+      i++;
+    if (i == recordSize)
+    {
+      scan.next = slot;
+      break;
+    }
+  }
+
+  return scan;
+}
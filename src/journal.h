@@ -0,0 +1,53 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <Arduino.h>
+
+// Settings journal records, appended one after another to JOURNAL_FILE:
+//
+//    magic (1) | sequence (2, LE) | length (1) | payload (length) | CRC-32 (4, LE)
+//
+// The CRC covers everything before it. A record cut short by a power loss
+// or damaged later fails the CRC and is skipped, the newest intact record
+// wins, so a torn write falls back to the save before it.
+#define JOURNAL_MAGIC 0xA5
+#define JOURNAL_HEADER_SIZE 4
+#define JOURNAL_RECORD_SIZE(length) (JOURNAL_HEADER_SIZE + (length) + 4)
+
+// Boot image, the newest record again in a raw flash sector read straight
+// through XIP before the filesystem is mounted. Each save takes the next
+// page of the sector and the sector is erased once every page is used, the
+// journal stays the copy that counts.
+#define BOOT_SECTOR_SIZE 4096
+#define BOOT_SLOT_SIZE 256
+#define BOOT_SLOTS (BOOT_SECTOR_SIZE / BOOT_SLOT_SIZE)
+
+// What a scan of the journal found
+struct JournalScan_t
+{
+  bool found;        // There is an intact record
+  uint16_t sequence; // Of the newest record
+  uint16_t offset;   // Of the newest record's payload
+  uint8_t length;    // Of the newest record's payload
+  uint16_t records;  // Intact records
+  uint16_t damaged;  // Stretches of bytes that were not an intact record
+  uint16_t end;      // Just past the last intact record, anything after it is a torn write
+};
+
+// What a scan of the boot sector found
+struct BootScan_t
+{
+  bool found;        // There is an intact record
+  uint16_t sequence; // Journal sequence number of the newest record
+  uint16_t offset;   // Of the newest record's payload in the sector
+  uint8_t length;    // Of the newest record's payload
+  uint8_t next;      // Erased slot to program next, BOOT_SLOTS if the sector must be erased first
+};
+
+uint32_t journalCrc(const uint8_t *data, size_t length);
+uint8_t encodeJournalRecord(uint16_t sequence, const uint8_t *payload, uint8_t length, uint8_t *out);
+uint16_t checkJournalRecord(const uint8_t *data, uint16_t size);
+JournalScan_t scanJournal(const uint8_t *data, uint16_t size);
+BootScan_t scanBootSector(const uint8_t *sector, uint8_t recordSize);
+
+#endif
@@ -0,0 +1,823 @@
+#include <Arduino.h>
+#include "main.h"
+#include "keyer.h"
+#include "capture.h"
+#include "debounce.h"
+#include "playback.h"
+#include "ptt.h"
+#include "stats.h"
+#include "timers.h"
+#include "trace.h"
+
+// Every keyer instance, stepped together each pass
+Keyers_t keyers = {};
+
+static bool playbackKeying = false; // Text playback owns the first keyer's output
+
+// Key/paddle fed by each debounce lane, nullptr for pins no keyer uses
+static PaddleState_t *pinKeys[INPUT_GPIO_COUNT];
+static uint32_t keyPins = 0;   // Debounce lanes of every keyer's inputs
+static uint32_t keyLevels = 0; // Last snapshot of them
+
+// Earliest deadline the state alarm is armed for
+static bool notesPending = false; // A note or channel change waits for a keyer's note to end
+
+static bool alarmSet = false;
+static uint32_t alarmDeadline = 0;
+
+KeyerStats_t keyerStats = {};
+
+bool inputCapture = DEFAULT_INPUT_CAPTURE;
+bool edgeAlarm = DEFAULT_EDGE_ALARM;
+bool idleSleep = DEFAULT_IDLE_SLEEP;
+
+static_assert((((uint64_t)1200000 * WPM_SCALE) << TIMING_FRACTION_BITS) / MIN_WPM * (400 - MIN_WEIGHT) / 50 <= UINT32_MAX,
+              "The longest word space does not fit the fixed point timings");
+
+/** Sets or updates the word per minute timings for paddle mode */
+void setupWPM()
+{
+  uint32_t wpm = (settings.wpm < MIN_WPM) ? MIN_WPM : settings.wpm;
+  int32_t weight = settings.weight ? constrain(settings.weight, MIN_WEIGHT, MAX_WEIGHT) : DEFAULT_WEIGHT;
+
+  // PARIS timing, a dit is 1.2 s / WPM
+  uint32_t dit = (((uint64_t)1200000 * WPM_SCALE) << TIMING_FRACTION_BITS) / wpm;
+
+  // Weighting lengthens both elements and shortens the spaces by the same amount, keeping the speed
+  int32_t weighting = ((int64_t)dit * (weight - 50)) / 50;
+
+  settings.timings.dit = dit + weighting;
+  settings.timings.dah = dit * 3 + weighting;
+  settings.timings.gap = dit - weighting;
+  settings.timings.charGap = dit * 3 - weighting;
+  settings.timings.wordGap = dit * 7 - weighting;
+
+  // Farnsworth keeps the characters at wpm and stretches the spacing to average out at the slower speed
+  if (settings.farnsworth >= MIN_FARNSWORTH && settings.farnsworth < wpm)
+  {
+    uint64_t c = wpm;
+    uint64_t s = settings.farnsworth;
+
+    // ARRL total added delay per word, ta = (60c - 37.2s) / (sc) seconds
+    uint64_t delay = (((6000 * c - 3720 * s) * 1000000) / (s * c)) << TIMING_FRACTION_BITS;
+
+    settings.timings.charGap = (uint32_t)(delay * 3 / 19) - weighting;
+    settings.timings.wordGap = (uint32_t)(delay * 7 / 19) - weighting;
+  }
+}
+
+/** Copies each keyer's key, output and MIDI settings into the instance arrays, the first keyer from the original fields */
+void loadKeyers()
+{
+  keyers.keyMode[0] = settings.keyMode;
+  keyers.straightPin[0] = settings.gpio.straightKey;
+  keyers.ditPin[0] = settings.gpio.ditPaddle;
+  keyers.dahPin[0] = settings.gpio.dahPaddle;
+  keyers.outputMode[0] = settings.gpioOutputMode;
+  keyers.outputPin[0] = settings.gpio.output;
+  keyers.note[0] = settings.note;
+  keyers.channel[0] = settings.channel;
+  keyers.count = 1;
+
+  for (uint8_t k = 1; k < KEYER_COUNT; k++)
+  {
+    const KeyerSettings_t &keyer = settings.keyers[k - 1];
+    keyers.keyMode[k] = keyer.keyMode;
+    keyers.straightPin[k] = keyer.straightKey;
+    keyers.ditPin[k] = keyer.ditPaddle;
+    keyers.dahPin[k] = keyer.dahPaddle;
+    keyers.outputMode[k] = keyer.outputMode;
+    keyers.outputPin[k] = keyer.output;
+    keyers.note[k] = keyer.note;
+    keyers.channel[k] = keyer.channel;
+
+    // Passes step every instance up to the last one with a key
+    if (keyer.keyMode != keyMode_t::KEY_NONE)
+      keyers.count = k + 1;
+  }
+
+  notesPending = false;
+}
+
+/** Takes up note and channel changes for every keyer whose note is off, a sounding note keeps its own until it ends. Returns false while one is still sounding */
+bool takeKeyerNotes()
+{
+  bool taken = true;
+
+  for (uint8_t k = 0; k < KEYER_COUNT; k++)
+  {
+    if (keyers.state[k] == OutputState_t::OUTPUT_ON)
+    {
+      taken = false;
+      continue;
+    }
+
+    keyers.note[k] = k ? settings.keyers[k - 1].note : settings.note;
+    keyers.channel[k] = k ? settings.keyers[k - 1].channel : settings.channel;
+  }
+  return taken;
+}
+
+/** Takes up settings that leave the key inputs and outputs alone without stopping the keyers. An element or gap being sent keeps its length, the speed applies from the next one, and a sounding note keeps its note until it ends */
+void swapKeyerSettings(const Settings_t &newSettings)
+{
+  noInterrupts(); // The state alarm times elements from these
+
+  settings = newSettings;
+  setupWPM();
+
+  notesPending = !takeKeyerNotes();
+
+  interrupts();
+}
+
+/** True while a keyer's state ends at stateEndTime, paddles or text playback rather than a straight key held down */
+static inline bool keyerTimed(uint8_t k)
+{
+  if (keyers.state[k] == OutputState_t::IDLE)
+    return false;
+  return keyers.keyMode[k] == keyMode_t::KEY_PADDLES || (k == 0 && playbackKeying);
+}
+
+/** Arms the state alarm for the earliest deadline of any keyer or delayed output edge, left alone if that is already armed */
+static void scheduleStateAlarm()
+{
+  if (!edgeAlarm)
+    return;
+
+  bool found = false;
+  uint32_t earliest = 0;
+
+  for (uint8_t k = 0; k < keyers.count; k++)
+  {
+    if (!keyerTimed(k))
+      continue;
+    if (!found || (int32_t)(keyers.stateEndTime[k] - earliest) < 0)
+      earliest = keyers.stateEndTime[k];
+    found = true;
+  }
+
+  // Output edges delayed by the PTT lead are switched on time too
+  uint32_t edge;
+  if (pttNextEdge(edge) && (!found || (int32_t)(edge - earliest) < 0))
+  {
+    earliest = edge;
+    found = true;
+  }
+
+  if (!found)
+  {
+    if (alarmSet)
+      cancelStateAlarm();
+    alarmSet = false;
+  }
+  else if (!alarmSet || earliest != alarmDeadline)
+  {
+    armStateAlarm(earliest);
+    alarmSet = true;
+    alarmDeadline = earliest;
+  }
+}
+
+/** Moves a keyer's stateEndTime on by a fixed point duration, chained from the previous deadline so loop latency and rounding never accumulate */
+static void advanceStateEnd(uint8_t k, uint32_t now, uint32_t duration, bool chained)
+{
+  uint32_t base = keyers.stateEndTime[k];
+  uint32_t fraction = keyers.stateEndFraction[k];
+
+  // Start a fresh timeline from idle or after a stall that would eat more than half the state
+  if (!chained || now - base > (duration >> TIMING_FRACTION_BITS) / 2)
+  {
+    base = now;
+    fraction = 0;
+  }
+
+  uint32_t total = fraction + duration;
+  keyers.stateEndTime[k] = base + (total >> TIMING_FRACTION_BITS);
+  keyers.stateEndFraction[k] = total & TIMING_FRACTION_MASK;
+}
+
+/** Sets the debounced state of a key/paddle from a raw edge at the given time, counting presses */
+static void setKeyState(PaddleState_t &paddle, bool state, uint32_t edgeTime)
+{
+  if (state == paddle.currentState)
+    return;
+
+  if (state)
+    paddle.presses++;
+  paddle.currentState = state;
+  paddle.stateTime = edgeTime;
+}
+
+/** Copies the debounce lanes that changed to their keys, counting presses */
+static void updateKeys(uint32_t changed)
+{
+  uint32_t levels = debouncedLevels();
+
+  for (changed &= keyPins; changed; changed &= changed - 1)
+  {
+    uint8_t pin = __builtin_ctz(changed);
+    PaddleState_t &paddle = *pinKeys[pin];
+    setKeyState(paddle, !((levels >> pin) & 1), paddle.lastChangeTime); // Active low due to pull-up
+  }
+}
+
+/** Feeds a snapshot of every input pin taken at the given time to the debounce engine */
+static void applyKeyLevels(uint32_t levels, uint32_t time)
+{
+  updateKeys(debounceAdvance(time)); // Ticks up to the snapshot run on the previous one
+
+  // Stamp the keys whose raw reading moved, their next debounced state is timed from here
+  uint32_t moved = (levels ^ keyLevels) & keyPins;
+  keyLevels = levels;
+
+  if (moved && traceRecording)
+  {
+    noInterrupts(); // The state alarm records output edges
+    traceRecord(TRACE_INPUT, time, levels & keyPins);
+    interrupts();
+  }
+
+  for (; moved; moved &= moved - 1)
+  {
+    uint8_t pin = __builtin_ctz(moved);
+    PaddleState_t &paddle = *pinKeys[pin];
+    paddle.lastReading = !((levels >> pin) & 1);
+    paddle.lastChangeTime = time;
+  }
+
+  updateKeys(debounceSample(levels));
+}
+
+/** Feeds edges captured by the GPIO interrupt into the debounce engine with their exact times, returns true if the pins must be sampled */
+static bool applyCapturedEdges()
+{
+  KeyEdge_t edge;
+
+  while (readCapturedEdge(edge))
+    applyKeyLevels(edge.levels, edge.time);
+
+  // Capture just started or edges were lost, fall back to sampling the pins this pass
+  return captureNeedsResync();
+}
+
+/** Adds a key's pin to the debounce lanes with its window, starting from its debounced state */
+static void addKeyLane(PaddleState_t &paddle, uint8_t pin, uint8_t window, uint32_t &levels)
+{
+  if (pin >= INPUT_GPIO_COUNT)
+    return; // Not a GPIO, never reads pressed
+  if (keyPins & (1u << pin))
+    return; // Already an input of an earlier keyer, which keeps it
+
+  setDebounceWindow(pin, window);
+  pinKeys[pin] = &paddle;
+  keyPins |= 1u << pin;
+  if (!paddle.currentState)
+    levels |= 1u << pin; // Active low due to pull-up
+  paddle.lastReading = paddle.currentState;
+}
+
+/** Starts debouncing the pins of every keyer, called whenever the key settings change */
+void setupKeyDebounce()
+{
+  uint32_t levels = 0;
+
+  keyPins = 0;
+  for (uint8_t pin = 0; pin < INPUT_GPIO_COUNT; pin++)
+    pinKeys[pin] = nullptr;
+
+  for (uint8_t k = 0; k < keyers.count; k++)
+  {
+    if (keyers.keyMode[k] == keyMode_t::KEY_STRAIGHT)
+    {
+      addKeyLane(keyers.straightKey[k], keyers.straightPin[k], settings.straightDebounce, levels);
+    }
+    else if (keyers.keyMode[k] == keyMode_t::KEY_PADDLES)
+    {
+      addKeyLane(keyers.ditPaddle[k], keyers.ditPin[k], settings.ditDebounce, levels);
+      addKeyLane(keyers.dahPaddle[k], keyers.dahPin[k], settings.dahDebounce, levels);
+    }
+  }
+
+  keyLevels = levels;
+  setupDebounce(keyPins, settings.debounceMode == debounceMode_t::DEBOUNCE_LEADING ? keyPins : 0, levels, micros());
+}
+
+/** Input pins of every keyer, one bit per GPIO */
+uint32_t keyInputPins()
+{
+  return keyPins;
+}
+
+/** The LED follows the first keyer */
+static inline void showElement(uint8_t k, ledElement_t element)
+{
+  if (k == 0)
+    setLed(element);
+}
+
+/** Starts sending a dit or dah by turning on the output and setting the duration. */
+void startIambicOutput(uint8_t k, bool isDit, uint32_t now)
+{
+  bool chained = (keyers.state[k] == OutputState_t::OUTPUT_OFF);
+  keyers.state[k] = OutputState_t::OUTPUT_ON;
+
+  sendNoteOn(k);
+
+  uint32_t length = isDit ? settings.timings.dit : settings.timings.dah;
+  advanceStateEnd(k, now, length, chained);
+  keyers.lastWasDit[k] = isDit;
+  keyers.oppositeQueued[k] = false;
+  keyers.elementStart[k] = now;
+  keyers.elementLength[k] = length >> TIMING_FRACTION_BITS;
+
+  keyOutput(k, true);
+  showElement(k, (k == 0 && playbackKeying) ? ledElement_t::LED_TEXT : isDit ? ledElement_t::LED_DIT : ledElement_t::LED_DAH);
+}
+
+/** Marks a keyer's next note as caused by a key edge at the given time */
+static inline void noteInput(uint8_t k, uint32_t time)
+{
+  keyers.noteFromInput[k] = true;
+  keyers.noteInputTime[k] = time;
+}
+
+/** Returns true and the key edge time if the note a keyer is sending was caused by one */
+bool takeNoteInput(uint8_t k, uint32_t &time)
+{
+  if (!keyers.noteFromInput[k])
+    return false;
+
+  keyers.noteFromInput[k] = false;
+  time = keyers.noteInputTime[k];
+  return true;
+}
+
+/** Processes a straight key. */
+void processStraightKey(uint8_t k)
+{
+  PaddleState_t &key = keyers.straightKey[k];
+
+  if (key.currentState && keyers.state[k] == OutputState_t::IDLE)
+  {
+    noteInput(k, key.stateTime);
+    sendNoteOn(k);
+    keyOutput(k, true);
+    showElement(k, ledElement_t::LED_STRAIGHT);
+    keyers.state[k] = OutputState_t::OUTPUT_ON;
+  }
+  if (!key.currentState && keyers.state[k] == OutputState_t::OUTPUT_ON)
+  {
+    noteInput(k, key.stateTime);
+    sendNoteOff(k);
+    keyOutput(k, false);
+    showElement(k, ledElement_t::LED_OFF);
+    keyers.state[k] = OutputState_t::IDLE;
+  }
+}
+
+/** Adds an element to a keyer's paddle memory, dropped if the memory is full */
+static void queueElement(uint8_t k, NextElement_t element)
+{
+  if (keyers.queueCount[k] < ELEMENT_QUEUE_SIZE)
+  {
+    keyers.elementQueue[k][(keyers.queueHead[k] + keyers.queueCount[k]) % ELEMENT_QUEUE_SIZE] = element;
+    keyers.queueCount[k]++;
+  }
+
+  if ((element == NextElement_t::DIT) != keyers.lastWasDit[k])
+    keyers.oppositeQueued[k] = true;
+}
+
+/** Takes the oldest element from a keyer's paddle memory, NONE if empty */
+static NextElement_t dequeueElement(uint8_t k)
+{
+  if (keyers.queueCount[k] == 0)
+    return NextElement_t::NONE;
+
+  NextElement_t element = keyers.elementQueue[k][keyers.queueHead[k]];
+  keyers.queueHead[k] = (keyers.queueHead[k] + 1) % ELEMENT_QUEUE_SIZE;
+  keyers.queueCount[k]--;
+  return element;
+}
+
+/** Forgets a keyer's remembered elements and presses, its next element comes from the paddles as they are now */
+static void clearKeyerMemory(uint8_t k)
+{
+  keyers.queueHead[k] = 0;
+  keyers.queueCount[k] = 0;
+  keyers.ditPressesSeen[k] = keyers.ditPaddle[k].presses;
+  keyers.dahPressesSeen[k] = keyers.dahPaddle[k].presses;
+}
+
+/** Forgets every keyer's remembered elements and presses */
+void clearIambicMemory()
+{
+  for (uint8_t k = 0; k < KEYER_COUNT; k++)
+    clearKeyerMemory(k);
+}
+
+/** True once the memory window, the last percent of the current element and its gap, has opened */
+static bool inMemoryWindow(uint8_t k, uint8_t window, uint32_t now)
+{
+  if (window == 0)
+    return false;
+  if (window >= 100)
+    return true;
+
+  uint32_t period = ((keyers.lastWasDit[k] ? settings.timings.dit : settings.timings.dah) + settings.timings.gap) >> TIMING_FRACTION_BITS;
+  return now - keyers.elementStart[k] >= period * (100 - window) / 100;
+}
+
+/** Remembers paddle presses made while an element or its gap is being sent */
+static void sampleIambicMemory(uint8_t k, uint32_t now)
+{
+  PaddleState_t &dit = keyers.ditPaddle[k];
+  PaddleState_t &dah = keyers.dahPaddle[k];
+
+  uint8_t ditPresses = dit.presses - keyers.ditPressesSeen[k];
+  uint8_t dahPresses = dah.presses - keyers.dahPressesSeen[k];
+  keyers.ditPressesSeen[k] = dit.presses;
+  keyers.dahPressesSeen[k] = dah.presses;
+
+  if (ditPresses)
+    keyers.lastPressWasDit[k] = true;
+  if (dahPresses)
+    keyers.lastPressWasDit[k] = false;
+
+  // Every new press inside its window is an element of its own, taps during the gap included
+  if (inMemoryWindow(k, settings.ditMemory, now))
+  {
+    for (; ditPresses; ditPresses--)
+      queueElement(k, NextElement_t::DIT);
+  }
+  if (inMemoryWindow(k, settings.dahMemory, now))
+  {
+    for (; dahPresses; dahPresses--)
+      queueElement(k, NextElement_t::DAH);
+  }
+
+  // Iambic B also remembers the opposite paddle held during the element, that is the extra element after a squeeze
+  if (settings.iambicMode == iambicMode_t::IAMBIC_B && keyers.state[k] == OutputState_t::OUTPUT_ON && !keyers.oppositeQueued[k])
+  {
+    if (keyers.lastWasDit[k] && dah.currentState && inMemoryWindow(k, settings.dahMemory, now))
+    {
+      queueElement(k, NextElement_t::DAH);
+    }
+    else if (!keyers.lastWasDit[k] && dit.currentState && inMemoryWindow(k, settings.ditMemory, now))
+    {
+      queueElement(k, NextElement_t::DIT);
+    }
+  }
+}
+
+/** Element to send for the paddles held right now, NONE if neither is */
+static NextElement_t heldElement(uint8_t k)
+{
+  bool dit = keyers.ditPaddle[k].currentState;
+  bool dah = keyers.dahPaddle[k].currentState;
+
+  if (dit && dah)
+  {
+    if (settings.iambicMode == iambicMode_t::ULTIMATIC)
+      return keyers.lastPressWasDit[k] ? NextElement_t::DIT : NextElement_t::DAH;
+    return keyers.lastWasDit[k] ? NextElement_t::DAH : NextElement_t::DIT; // Squeeze alternates
+  }
+  if (dit)
+    return NextElement_t::DIT;
+  if (dah)
+    return NextElement_t::DAH;
+  return NextElement_t::NONE;
+}
+
+/** Keys the next step of text playback on the first keyer, chained from the end of the last one. Returns false once the text has run out. */
+static bool stepPlayback(uint32_t now)
+{
+  bool chained = (keyers.state[0] == OutputState_t::OUTPUT_OFF);
+
+  switch (nextPlaybackStep())
+  {
+  case PlaybackStep_t::PLAY_DIT:
+  {
+    startIambicOutput(0, true, now);
+    break;
+  }
+  case PlaybackStep_t::PLAY_DAH:
+  {
+    startIambicOutput(0, false, now);
+    break;
+  }
+  case PlaybackStep_t::PLAY_CHAR_SPACE: // The element gap has passed, add the rest of the character space
+  {
+    keyers.state[0] = OutputState_t::OUTPUT_OFF;
+    advanceStateEnd(0, now, settings.timings.charGap - settings.timings.gap, chained);
+    break;
+  }
+  case PlaybackStep_t::PLAY_WORD_SPACE: // The character space has passed, add the rest of the word space
+  {
+    keyers.state[0] = OutputState_t::OUTPUT_OFF;
+    advanceStateEnd(0, now, settings.timings.wordGap - settings.timings.charGap, chained);
+    break;
+  }
+  default:
+  {
+    playbackKeying = false;
+    setPlaybackBusy(false);
+    return false;
+  }
+  }
+  return true;
+}
+
+/** Drops the queued text and cuts the element being sent, keyed is true when the key did it rather than the host */
+static void abortPlayback(uint32_t now, bool keyed)
+{
+  clearPlayback(keyed);
+
+  if (!playbackKeying)
+    return;
+
+  playbackKeying = false;
+  setPlaybackBusy(false);
+
+  if (keyers.state[0] == OutputState_t::OUTPUT_ON)
+  {
+    sendNoteOff(0);
+    keyOutput(0, false);
+    setLed(ledElement_t::LED_OFF);
+  }
+
+  if (keyers.state[0] != OutputState_t::IDLE && keyers.keyMode[0] == keyMode_t::KEY_PADDLES)
+  {
+    // A full element gap before the paddles take over
+    keyers.state[0] = OutputState_t::OUTPUT_OFF;
+    advanceStateEnd(0, now, settings.timings.gap, false);
+  }
+  else
+  {
+    keyers.state[0] = OutputState_t::IDLE; // The straight key, or nothing, keys from here
+  }
+}
+
+/** Runs text playback on the first keyer while its key is left alone, returns true while playback owns the output */
+static bool processPlayback(uint32_t now, bool keyInput)
+{
+  bool stop = takePlaybackStop();
+
+  // Touching the key drops the text, whether it is being sent or still queued
+  if (stop || (keyInput && (playbackKeying || playbackPending())))
+    abortPlayback(now, !stop);
+
+  // Start, or pick the text up again if the keyer was reset under it
+  if (keyers.state[0] == OutputState_t::IDLE)
+  {
+    playbackKeying = playbackPending();
+    setPlaybackBusy(playbackKeying);
+    if (playbackKeying)
+      stepPlayback(now);
+  }
+
+  return playbackKeying;
+}
+
+/** Runs the deadline transitions of one keyer's state machine */
+static void processKeyerDeadline(uint8_t k, uint32_t now)
+{
+  if (!keyerTimed(k) || !timeReached(now, keyers.stateEndTime[k]))
+    return;
+
+  // Scheduled vs actual edge time
+  uint32_t edgeError = now - keyers.stateEndTime[k];
+  keyerStats.edges++;
+  keyerStats.edgeErrorTotal += edgeError;
+  if (edgeError > keyerStats.maxEdgeError)
+    keyerStats.maxEdgeError = edgeError;
+  histogramAdd(HIST_EDGE_ERROR, edgeError);
+
+  bool playing = (k == 0 && playbackKeying);
+
+  if (keyers.state[k] == OutputState_t::OUTPUT_ON)
+  {
+    if (!playing)
+      sampleIambicMemory(k, now); // Last look at the paddles before the element ends
+
+    // Measure how far the element strayed from its nominal length
+    uint32_t length = now - keyers.elementStart[k];
+    uint32_t nominal = keyers.elementLength[k]; // The speed may have changed since it started
+    uint32_t error = (length > nominal) ? length - nominal : nominal - length;
+    if (error > keyerStats.maxElementError)
+      keyerStats.maxElementError = error;
+    histogramAdd(HIST_ELEMENT_ERROR, error);
+    keyerStats.elements++;
+
+    sendNoteOff(k);
+
+    keyers.state[k] = OutputState_t::OUTPUT_OFF;
+    advanceStateEnd(k, now, settings.timings.gap, true);
+
+    keyOutput(k, false);
+    showElement(k, ledElement_t::LED_OFF);
+  }
+  else if (playing)
+  {
+    if (!stepPlayback(now))
+      keyers.state[k] = OutputState_t::IDLE; // Text finished
+  }
+  else
+  {
+    sampleIambicMemory(k, now); // Taps during the gap count too
+
+    // Remembered elements first, then whatever is held
+    NextElement_t next = dequeueElement(k);
+    if (next == NextElement_t::NONE)
+      next = heldElement(k);
+
+    if (next == NextElement_t::DIT)
+    {
+      startIambicOutput(k, true, now);
+    }
+    else if (next == NextElement_t::DAH)
+    {
+      startIambicOutput(k, false, now);
+    }
+    else
+    {
+      keyers.state[k] = OutputState_t::IDLE; // Nothing pressed, go idle
+    }
+  }
+}
+
+/** Runs the deadline transitions of every keyer that is due */
+static void processDeadlines(uint32_t now)
+{
+  for (uint8_t k = 0; k < keyers.count; k++)
+    processKeyerDeadline(k, now);
+}
+
+/** State alarm handler, right at the earliest stateEndTime or delayed output edge, then armed again for the next one */
+void processStateDeadline(uint32_t now)
+{
+  alarmSet = false; // It just fired
+  processDeadlines(now);
+  timerAdvance(now);
+  scheduleStateAlarm();
+}
+
+/** Steps a paddle keyer between deadlines, remembering presses or starting from idle */
+static void processIambic(uint8_t k, uint32_t now)
+{
+  if (keyers.state[k] != OutputState_t::IDLE)
+  {
+    sampleIambicMemory(k, now);
+    return;
+  }
+
+  PaddleState_t &dit = keyers.ditPaddle[k];
+  PaddleState_t &dah = keyers.dahPaddle[k];
+
+  // A tap shorter than a loop pass still starts an element
+  bool ditPressed = dit.currentState || dit.presses != keyers.ditPressesSeen[k];
+  bool dahPressed = dah.currentState || dah.presses != keyers.dahPressesSeen[k];
+  if (dit.presses != keyers.ditPressesSeen[k])
+    keyers.lastPressWasDit[k] = true;
+  if (dah.presses != keyers.dahPressesSeen[k])
+    keyers.lastPressWasDit[k] = false;
+  clearKeyerMemory(k);
+
+  if (ditPressed && (!dahPressed || settings.iambicMode != iambicMode_t::ULTIMATIC || keyers.lastPressWasDit[k]))
+  {
+    noteInput(k, dit.stateTime);
+    startIambicOutput(k, true, now); // Start with dit
+  }
+  else if (dahPressed)
+  {
+    noteInput(k, dah.stateTime);
+    startIambicOutput(k, false, now); // Start with dah
+  }
+}
+
+/** True while a keyer's key is down or a paddle press is waiting to be seen */
+static bool keyerInput(uint8_t k)
+{
+  if (keyers.keyMode[k] == keyMode_t::KEY_STRAIGHT)
+    return keyers.straightKey[k].currentState;
+
+  if (keyers.keyMode[k] == keyMode_t::KEY_PADDLES)
+    return keyers.ditPaddle[k].currentState || keyers.dahPaddle[k].currentState ||
+           keyers.ditPaddle[k].presses != keyers.ditPressesSeen[k] || keyers.dahPaddle[k].presses != keyers.dahPressesSeen[k];
+
+  return false;
+}
+
+/** Samples every keyer's inputs and steps them all, called once per loop() */
+void processKey()
+{
+  bool sample = !inputCapture || applyCapturedEdges();
+  uint32_t now = micros(); // Sampled after draining so no captured edge is newer
+
+  // Every pin in one read, debounced together
+  if (sample)
+    applyKeyLevels(readInputPins(), now);
+  else
+    updateKeys(debounceAdvance(now));
+
+  bool keyInput = keyerInput(0);
+
+  noInterrupts(); // The state alarm runs the same state machines
+
+  bool playing = processPlayback(now, keyInput);
+
+  now = micros();
+  processDeadlines(now); // Fallback for when the state alarm is off
+  timerAdvance(now);
+
+  if (notesPending)
+    notesPending = !takeKeyerNotes(); // Before any keyer starts a note
+
+  for (uint8_t k = 0; k < keyers.count; k++)
+  {
+    if (k == 0 && playing)
+      continue;
+
+    if (keyers.keyMode[k] == keyMode_t::KEY_STRAIGHT)
+    {
+      processStraightKey(k);
+    }
+    else if (keyers.keyMode[k] == keyMode_t::KEY_PADDLES)
+    {
+      processIambic(k, now);
+    }
+  }
+
+  scheduleStateAlarm();
+
+  interrupts();
+}
+
+/** Keeps the earlier of two deadlines in wake */
+static inline void earliestWake(uint32_t deadline, uint32_t &wake)
+{
+  if ((int32_t)(deadline - wake) < 0)
+    wake = deadline;
+}
+
+/** True if no keyer pass is needed before wake unless an event comes in first, a key edge, the state alarm or a
+ * message from core0. False when a pass has work to do now, or the pins are polled and only a pass sees a press */
+bool keyerNextWake(uint32_t now, uint32_t &wake)
+{
+  if (!idleSleep || !inputCapture || captureWaiting() || notesPending)
+    return false;
+  if (!playbackKeying && playbackPending() && keyers.state[0] == OutputState_t::IDLE)
+    return false; // Text to start sending
+
+  wake = now + KEYER_MAX_SLEEP_US;
+
+  for (uint8_t k = 0; k < keyers.count; k++)
+  {
+    // A press or release the state machine has not acted on yet
+    bool input = keyerInput(k);
+    if (keyers.keyMode[k] == keyMode_t::KEY_STRAIGHT && !(k == 0 && playbackKeying) &&
+        input != (keyers.state[k] == OutputState_t::OUTPUT_ON))
+      return false;
+    if (keyers.keyMode[k] == keyMode_t::KEY_PADDLES && input && keyers.state[k] == OutputState_t::IDLE)
+      return false;
+
+    if (keyerTimed(k))
+      earliestWake(keyers.stateEndTime[k], wake);
+  }
+
+  uint32_t deadline;
+  if (debounceNextTick(deadline))
+    earliestWake(deadline, wake);
+  if (timerNextDeadline(deadline))
+    earliestWake(deadline, wake);
+  if (pttNextEdge(deadline))
+    earliestWake(deadline, wake);
+
+  return !timeReached(now, wake);
+}
+
+/** Stops every keyer where it is, the note and output of an element being sent are ended */
+void stopKeyers()
+{
+  noInterrupts();
+
+  cancelStateAlarm();
+  alarmSet = false;
+
+  for (uint8_t k = 0; k < keyers.count; k++)
+  {
+    if (keyers.state[k] == OutputState_t::OUTPUT_ON)
+    {
+      // Currently sending, need to stop and turn off the output and LED
+      sendNoteOff(k);
+      keyOutput(k, false);
+      showElement(k, ledElement_t::LED_OFF);
+    }
+    keyers.state[k] = OutputState_t::IDLE;
+  }
+  clearIambicMemory(); // Nothing remembered carries over to the new settings
+  resetPtt();
+
+  interrupts();
+}
@@ -0,0 +1,60 @@
+#ifndef KEYER_H
+#define KEYER_H
+
+#include "main.h"
+
+extern Settings_t settings;
+
+// Every keyer instance, key inputs and state machines laid out by field
+extern Keyers_t keyers;
+
+// Timing counters
+extern KeyerStats_t keyerStats;
+
+// Consume interrupt-captured key edges rather than polling the pins
+extern bool inputCapture;
+
+// Switch the output from a hardware alarm at each deadline instead of waiting for loop()
+extern bool edgeAlarm;
+
+// Sleep between key edges, deadlines and messages from core0 instead of running a keyer pass every loop
+extern bool idleSleep;
+
+/** Wrap-safe check that a micros() deadline has passed, valid for deadlines up to ~35 minutes away */
+inline bool timeReached(uint32_t now, uint32_t deadline)
+{
+    return (int32_t)(now - deadline) >= 0;
+}
+
+// Keyer engine, shared by the firmware and the host simulation
+void setupWPM();
+void loadKeyers();
+bool takeKeyerNotes();
+void swapKeyerSettings(const Settings_t &newSettings);
+void setupKeyDebounce();
+uint32_t keyInputPins();
+void startIambicOutput(uint8_t k, bool isDit, uint32_t now);
+void processStraightKey(uint8_t k);
+void processStateDeadline(uint32_t now);
+void clearIambicMemory();
+bool takeNoteInput(uint8_t k, uint32_t &time);
+void processKey();
+bool keyerNextWake(uint32_t now, uint32_t &wake);
+void stopKeyers();
+
+// Output hooks for keyer k, implemented by main.cpp on the device and by the simulated HAL on the host
+void sendNoteOn(uint8_t k);
+void sendNoteOff(uint8_t k);
+void setOutput(uint8_t k, bool state);
+void setPtt(bool state);
+void setLed(ledElement_t element);
+void armStateAlarm(uint32_t deadline);
+void cancelStateAlarm();
+
+// Wake hook, called from interrupts and the other core whenever a sleeping core has work: SEV on the device, a flag on the host
+void signalEvent();
+
+// Input hook, every GPIO level in one read: the SIO input register on the device, the simulated pins on the host
+uint32_t readInputPins();
+
+#endif
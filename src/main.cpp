@@ -1,22 +1,43 @@
 #include <Arduino.h>
-#include <Adafruit_NeoPixel.h>
 #include <Control_Surface.h>
 #include <Adafruit_TinyUSB.h>
 #include <BitPacker.hpp>
+#include <pico/time.h>
+#include <hardware/sync.h>
+#include <hardware/structs/usb.h>
+#include <hardware/structs/sio.h>
+#include <hardware/structs/scb.h>
+#include <hardware/gpio.h>
 #include "main.h"
 #include "nvram.h"
-
-Settings_t settings;
-
-// Sraight Key/Paddle variables
-PaddleState_t straightKey = {false, false, 0};
-PaddleState_t ditPaddle = {false, false, 0};
-PaddleState_t dahPaddle = {false, false, 0};
-
-OutputState_t currentState = OutputState_t::IDLE;
-uint32_t stateEndTime = 0;
-bool lastWasDit = false; // Tracks whether last output was a dit
-NextElement_t nextElement = NextElement_t::NONE;
+#include "keyer.h"
+#include "timers.h"
+#include "speedpot.h"
+#include "capture.h"
+#include "queue.h"
+#include "config.h"
+#include "playback.h"
+#include "decoder.h"
+#include "stats.h"
+#include "eventstream.h"
+#include "transmit.h"
+#include "trace.h"
+#include "selftest.h"
+#include "neopixel.h"
+
+Settings_t settings;     // Applied by the keyer, owned by core1
+Settings_t hostSettings; // As last set over SysEx, owned by core0
+
+// Inter-core queues
+SpscQueue<KeyEvent_t, KEY_EVENT_QUEUE_SIZE> keyEvents;  // core1 -> core0
+Mailbox<Settings_t> configUpdates;                      // core0 -> core1, latest wins
+volatile bool keyerReady = false;                       // Set by core0 once settings are loaded
+
+BootStats_t bootStats;
+
+// Last key event sent, saves wait for the key to go quiet, core0 only
+uint32_t lastKeyEventTime = 0;
+uint8_t keysDown = 0; // Keyers whose last key event was a note on
 
 // SysEx tokens
 const uint8_t sysex_header[] = SYSEX_HEADER;
@@ -24,8 +45,16 @@ const uint8_t sysex_footer = SYSEX_FOOTER;
 uint8_t sysExBuffer[MAX_SYSEX_LENGTH];
 uint8_t sysExLength = 0;
 
-// Adafruit_NeoPixel strip(1, 16, NEO_GRB + NEO_KHZ800);
-Adafruit_NeoPixel *strip = nullptr;
+// Keyer state alarm, created on core1 so its IRQ runs next to the keyer
+alarm_pool_t *keyerAlarmPool = nullptr;
+alarm_id_t stateAlarm = 0;
+
+// LED state requested by the keyer, shown from loop1()
+volatile ledElement_t ledRequest = ledElement_t::LED_OFF;
+uint32_t ledShown = 0;       // Colour on the LED, 0 is off
+uint32_t ledErrors = 0;      // Lost key events, SysEx replies and saves seen so far
+uint32_t ledErrorStart = 0;  // When the error blink started
+bool ledBlinking = false;
 
 // Control Surface variables
 USBMIDI_Interface midi;
@@ -34,100 +63,433 @@ MIDIAddress address;
 /** Clear MIDI send and reset inputs for key GPIOs */
 void cleanUpKey()
 {
-  if (currentState == OutputState_t::OUTPUT_ON)
+  stopKeyers();
+  cleanUpCapture();
+  cleanUpSpeedPot();
+
+  // Cleanup every keyer's key, default to normal input for the pins
+  for (uint8_t k = 0; k < keyers.count; k++)
   {
-    // Currently sending, need to stop and turn off the LED
-    midi.sendNoteOff(address, settings.volume);
-    currentState = OutputState_t::IDLE;
+    if (keyers.keyMode[k] == keyMode_t::KEY_STRAIGHT)
+    {
+      pinMode(keyers.straightPin[k], INPUT); // Reset input pin
+    }
+    else if (keyers.keyMode[k] == keyMode_t::KEY_PADDLES)
+    {
+      pinMode(keyers.ditPin[k], INPUT); // Reset input pin
+      pinMode(keyers.dahPin[k], INPUT); // Reset input pin
+    }
   }
+}
 
-  // Cleanup current Key
-  if (settings.keyMode == keyMode_t::KEY_STRAIGHT)
+/** Reset GPIO outputs, if enabled */
+void cleanUpOutput()
+{
+  if (settings.pttMode != gpioOutputMode_t::OUTPUT_DISABLED)
+    pinMode(settings.gpio.ptt, INPUT);
+
+  for (uint8_t k = 0; k < keyers.count; k++)
   {
-    pinMode(settings.gpio.straightKey, INPUT); // Reset input pin
+    if (keyers.outputMode[k] != gpioOutputMode_t::OUTPUT_DISABLED)
+      pinMode(keyers.outputPin[k], INPUT); // Turn switch GPIO back to input
   }
-  else if (settings.keyMode == keyMode_t::KEY_PADDLES)
+}
+
+/** Configures the GPIO Outputs */
+void setupOutput()
+{
+  if (settings.pttMode != gpioOutputMode_t::OUTPUT_DISABLED)
+  {
+    pinMode(settings.gpio.ptt, OUTPUT);
+    digitalWrite(settings.gpio.ptt, settings.pttMode == gpioOutputMode_t::OUTPUT_NORMAL ? LOW : HIGH); // PTT starts down
+  }
+
+  for (uint8_t k = 0; k < keyers.count; k++)
   {
-    // Default to normal Input for pins
-    pinMode(settings.gpio.ditPaddle, INPUT); // Reset input pin
-    pinMode(settings.gpio.dahPaddle, INPUT); // Reset input pin
+    if (keyers.outputMode[k] != gpioOutputMode_t::OUTPUT_DISABLED)
+    {
+      PinStatus initialState = (keyers.outputMode[k] == gpioOutputMode_t::OUTPUT_NORMAL) ? LOW : HIGH;
+      pinMode(keyers.outputPin[k], OUTPUT);
+      digitalWrite(keyers.outputPin[k], initialState); // Set initial output
+    }
   }
 }
 
-/** Reset GPIO output, if enabled */
-void cleanUpOutput()
+/** Turns a keyer's GPIO output on or off */
+void setOutput(uint8_t k, bool state)
 {
-  if (settings.gpioOutputMode == gpioOutputMode_t::OUTPUT_DISABLED)
+  if (keyers.outputMode[k] == gpioOutputMode_t::OUTPUT_DISABLED)
     return;
 
-  // Turn switch GPIO back to input
-  pinMode(settings.gpio.output, INPUT);
+  bool setState = (keyers.outputMode[k] == gpioOutputMode_t::OUTPUT_NORMAL) ? state : !state;
+
+  PinStatus outputState = (setState) ? HIGH : LOW;
+
+  digitalWrite(keyers.outputPin[k], outputState);
 }
 
-/** Configures the GPIO Output */
-void setupOutput()
+/** Raises or drops the PTT output */
+void setPtt(bool state)
 {
-  if (settings.gpioOutputMode != gpioOutputMode_t::OUTPUT_DISABLED)
+  if (settings.pttMode == gpioOutputMode_t::OUTPUT_DISABLED)
+    return;
+
+  bool setState = (settings.pttMode == gpioOutputMode_t::OUTPUT_NORMAL) ? state : !state;
+
+  digitalWrite(settings.gpio.ptt, setState ? HIGH : LOW);
+}
+
+/** Presses or releases a self-test pin, open drain: driven low to press, left to the pull-up to release */
+void driveTestPin(uint8_t pin, bool pressed)
+{
+  gpio_put(pin, 0);
+  gpio_set_dir(pin, pressed);
+}
+
+/** Reads every GPIO input level in a single SIO register access */
+uint32_t readInputPins()
+{
+  return sio_hw->gpio_in;
+}
+
+/** Queues a keyer's key event for core0 to send over MIDI */
+void queueKeyEvent(uint8_t k, bool state)
+{
+  KeyEvent_t event = {micros(), k, keyers.note[k], keyers.channel[k], settings.volume, state};
+  event.fromInput = takeNoteInput(k, event.inputTime);
+
+  if (state && bootStats.firstKeyTime == 0)
+    bootStats.firstKeyTime = event.time;
+
+  // The state alarm IRQ queues events too, keep the producer side single threaded
+  uint32_t status = save_and_disable_interrupts();
+  if (!keyEvents.push(event))
+    keyerStats.keyEventDrops++;
+  restore_interrupts(status);
+
+  signalEvent(); // core0 may be asleep
+}
+
+/** Sends a keyer's note on over MIDI */
+void sendNoteOn(uint8_t k)
+{
+  queueKeyEvent(k, true);
+}
+
+/** Sends a keyer's note off over MIDI */
+void sendNoteOff(uint8_t k)
+{
+  queueKeyEvent(k, false);
+}
+
+/** Writes a key note to USB MIDI, for the transmit scheduler */
+void writeNote(const KeyEvent_t &event)
+{
+  if (!TinyUSBDevice.mounted())
+    return; // Keying before the host has enumerated the keyer
+
+  MIDIAddress noteAddress(event.note, Channel(event.channel - 1));
+
+  if (event.state)
+    midi.sendNoteOn(noteAddress, event.volume);
+  else
+    midi.sendNoteOff(noteAddress, event.volume);
+}
+
+/** Writes SysEx, or the next part of one, to USB MIDI for the transmit scheduler */
+void writeSysEx(const uint8_t *data, uint8_t length, bool bulkCable)
+{
+  if (!TinyUSBDevice.mounted())
+    return;
+
+  // Control Surface carries on a SysEx that is written in parts
+  midi.sendSysEx(data, length, bulkCable ? CABLE_2 : address.getCableNumber());
+}
+
+/** Sends what is buffered in the next USB frame rather than waiting for the packet to fill */
+void flushMidi()
+{
+  if (TinyUSBDevice.mounted())
+    midi.sendNow();
+}
+
+/** Send a batch of timestamped key transitions as SysEx */
+void sendKeyEventBatch(const KeyEvent_t *events, uint8_t count)
+{
+  uint8_t packedSize;
+
+  sysExLength = sizeof(sysex_header);
+
+  memcpy(sysExBuffer, sysex_header, sysExLength);
+  sysExBuffer[sysExLength++] = CMD_KEY_EVENTS;
+
+  encodeKeyEvents(events, count, &sysExBuffer[sysExLength], packedSize);
+
+  sysExLength += packedSize;
+  sysExBuffer[sysExLength++] = SYSEX_FOOTER;
+
+  // Send SysEx, ahead of anything queued
+  transmitSysEx(sysExBuffer, sysExLength, TX_KEY);
+}
+
+/** Sends key events queued by core1 over MIDI */
+void sendKeyEvents()
+{
+  KeyEvent_t event;
+  KeyEvent_t batch[EVENT_STREAM_BATCH];
+  uint8_t batchSize = 0;
+
+  while (keyEvents.pop(event))
   {
-    PinStatus initialState = (settings.gpioOutputMode == gpioOutputMode_t::OUTPUT_NORMAL) ? LOW : HIGH;
-    pinMode(settings.gpio.output, OUTPUT);
-    digitalWrite(settings.gpio.normalLED, initialState); // Set initial output
+    transmitNote(event);
+
+    uint32_t now = micros();
+    selfTestNote(event.keyer, event.state, now);
+    lastKeyEventTime = now;
+    if (event.state)
+      keysDown |= 1u << event.keyer;
+    else
+      keysDown &= ~(1u << event.keyer);
+
+    uint32_t latency = now - event.time;
+    if (latency > keyerStats.maxKeyEventDelay)
+      keyerStats.maxKeyEventDelay = latency;
+    if (event.fromInput)
+      histogramAdd(HIST_KEY_LATENCY, now - event.inputTime);
+
+    if (event.keyer == 0)
+      decodeKeyEdge(event.state, event.time); // Timed at the keyer, before USB adds any jitter
+
+    if (!hostSettings.eventStream || event.keyer != 0)
+      continue; // The stream carries the first keyer, the others are just their notes
+
+    // The notes go out straight away, their timestamps follow in as few messages as there are events
+    batch[batchSize++] = event;
+    if (batchSize == EVENT_STREAM_BATCH)
+    {
+      sendKeyEventBatch(batch, batchSize);
+      batchSize = 0;
+    }
   }
+
+  if (batchSize)
+    sendKeyEventBatch(batch, batchSize);
 }
 
-/** Turns the GPIO output on or off */
-void setOutput(bool state)
+/** True once the key has been up and no text has been waiting for JOURNAL_IDLE_US, a flash write then costs nothing */
+bool keyerIdle()
 {
-  if (settings.gpioOutputMode == gpioOutputMode_t::OUTPUT_DISABLED)
-    return;
+  return !keysDown && micros() - lastKeyEventTime >= JOURNAL_IDLE_US && !playbackBusy() && playbackQueued() == 0;
+}
+
+/** State alarm IRQ, switches the output at the exact deadline */
+int64_t onStateAlarm(alarm_id_t id, void *userData)
+{
+  stateAlarm = 0;
+  processStateDeadline(micros());
+  signalEvent(); // loop1() picks up after the edge
+  return 0;
+}
+
+/** Wakes both cores, an event set while a core is awake makes its next sleep return at once */
+void signalEvent()
+{
+  __sev();
+}
 
-  bool setState = (settings.gpioOutputMode == gpioOutputMode_t::OUTPUT_NORMAL) ? state : !state;
+/** Wake alarm IRQ, the sleeping core has reached the time it asked for */
+int64_t onWakeAlarm(alarm_id_t id, void *userData)
+{
+  signalEvent();
+  return 0;
+}
 
-  PinStatus outputState = (setState) ? HIGH : LOW;
+/** Arms the state alarm for a micros() deadline, replacing any pending one */
+void armStateAlarm(uint32_t deadline)
+{
+  cancelStateAlarm();
+
+  int32_t wait = (int32_t)(deadline - micros());
+  stateAlarm = alarm_pool_add_alarm_in_us(keyerAlarmPool, wait > 0 ? wait : 0, onStateAlarm, nullptr, true);
+}
+
+/** Cancels the pending state alarm, if any */
+void cancelStateAlarm()
+{
+  if (stateAlarm > 0)
+    alarm_pool_cancel_alarm(keyerAlarmPool, stateAlarm);
+
+  stateAlarm = 0;
+}
 
-  digitalWrite(settings.gpio.output, outputState);
+/** Requests the LED colour for what is being keyed, it follows the output from loop1() so the IRQ never waits on the LED */
+void setLed(ledElement_t element)
+{
+  ledRequest = element;
 }
 
-/** Turns the LED on or off */
-void setLed(bool state)
+/** Colour for what is being keyed, or a dim one for the key mode between elements */
+uint32_t ledColor(ledElement_t element)
+{
+  switch (element)
+  {
+  case ledElement_t::LED_DIT:
+    return LED_COLOR_DIT;
+  case ledElement_t::LED_DAH:
+    return LED_COLOR_DAH;
+  case ledElement_t::LED_STRAIGHT:
+    return LED_COLOR_STRAIGHT;
+  case ledElement_t::LED_TEXT:
+    return LED_COLOR_TEXT;
+  default:
+    break;
+  }
+
+  if (settings.ledMode != ledMode_t::LED_RGB)
+    return 0; // A plain LED only lights while keying
+  if (settings.keyMode == keyMode_t::KEY_STRAIGHT)
+    return LED_COLOR_STRAIGHT_IDLE;
+  if (settings.keyMode != keyMode_t::KEY_PADDLES)
+    return 0;
+  if (settings.iambicMode == iambicMode_t::IAMBIC_A)
+    return LED_COLOR_IAMBIC_A_IDLE;
+  if (settings.iambicMode == iambicMode_t::IAMBIC_B)
+    return LED_COLOR_IAMBIC_B_IDLE;
+  return LED_COLOR_ULTIMATIC_IDLE;
+}
+
+/** Shows a colour on the LED, a plain LED is on for any colour */
+void showLed(uint32_t color)
 {
   if (settings.ledMode == ledMode_t::LED_NORMAL)
   {
-    digitalWrite(settings.gpio.normalLED, state ? HIGH : LOW); // On or off
+    digitalWrite(settings.gpio.normalLED, color ? HIGH : LOW); // On or off
   }
   else if (settings.ledMode == ledMode_t::LED_RGB)
   {
-    strip->setPixelColor(0, state ? strip->Color(255, 0, 0) : strip->Color(0, 0, 0)); // Red or off
-    strip->show();
+    setNeoPixel(0, color); // Goes out by DMA from serviceNeoPixel()
+  }
+}
+
+/** Shows the requested LED state, blinking between elements when something was lost */
+void updateLed()
+{
+  uint32_t now = micros();
+
+  // Counters only go down when the stats are reset
+  uint32_t errors = keyerStats.keyEventDrops + keyerStats.sysExDrops + journalStats.failures;
+  if (errors > ledErrors)
+  {
+    ledBlinking = true;
+    ledErrorStart = now;
   }
+  ledErrors = errors;
+
+  ledElement_t element = ledRequest;
+  uint32_t color = ledColor(element);
+
+  if (ledBlinking)
+  {
+    uint32_t phase = (now - ledErrorStart) / LED_ERROR_BLINK_US;
+    if (phase >= LED_ERROR_BLINKS * 2)
+      ledBlinking = false;
+    else if (element == ledElement_t::LED_OFF)
+      color = (phase & 1) ? 0 : LED_COLOR_ERROR; // Keying always shows through
+  }
+
+  if (color != ledShown)
+  {
+    showLed(color);
+    ledShown = color;
+  }
+
+  if (settings.ledMode == ledMode_t::LED_RGB)
+    serviceNeoPixel(now);
 }
 
-/** Sets or updates the word per minute timings for paddle mode */
-void setupWPM()
+/** True if the LED needs nothing from loop1() before wake, moved up to the next blink */
+bool ledIdle(uint32_t now, uint32_t &wake)
 {
-  settings.timings.dit = (INTTOFLOATSCALAR * 1200) / settings.wpm;
-  settings.timings.dah = settings.timings.dit * 3;
-  settings.timings.gap = settings.timings.dit;
+  if (settings.ledMode == ledMode_t::LED_RGB && neoPixelPending())
+    return false; // Waiting for the last frame to latch
+
+  if (ledBlinking)
+  {
+    uint32_t blink = ledErrorStart + ((now - ledErrorStart) / LED_ERROR_BLINK_US + 1) * LED_ERROR_BLINK_US;
+    if ((int32_t)(blink - wake) < 0)
+      wake = blink;
+  }
+  return true;
+}
+
+/** Sleeps core1 until a key edge, the keyer's next deadline or a message from core0, when nothing needs a pass before then */
+void sleepKeyer()
+{
+  uint32_t now = micros();
+  uint32_t wake;
+
+  uint32_t status = save_and_disable_interrupts(); // The state alarm moves the deadlines
+  bool idle = keyerNextWake(now, wake);
+  restore_interrupts(status);
+
+  if (!idle || !ledIdle(now, wake) || configUpdates.pending())
+    return;
+
+  // An edge or alarm since the check has set the event, the WFE then returns at once
+  alarm_id_t alarm = alarm_pool_add_alarm_in_us(keyerAlarmPool, wake - now, onWakeAlarm, nullptr, true);
+  __wfe();
+  if (alarm > 0)
+    alarm_pool_cancel_alarm(keyerAlarmPool, alarm);
+
+  histogramAdd(HIST_KEYER_SLEEP, micros() - now);
+}
+
+/** Sleeps core0 until a USB interrupt or a key event from core1, when nothing is waiting to go out */
+void sleepHost()
+{
+  if (!idleSleep || keyEvents.size() || transmitPending())
+    return;
+
+  // TinyUSB and the decoder's word gaps are serviced from loop(), wake now and then even with the bus quiet
+  uint32_t now = micros();
+  alarm_id_t alarm = add_alarm_in_us(HOST_MAX_SLEEP_US, onWakeAlarm, nullptr, true);
+  __wfe();
+  if (alarm > 0)
+    cancel_alarm(alarm);
+
+  histogramAdd(HIST_HOST_SLEEP, micros() - now);
 }
 
 /** Sets or updates the channel, note, and volume details for the MIDI output */
 void setupMidi()
 {
-  address = MIDIAddress(settings.note, Channel(settings.channel - 1));
+  address = MIDIAddress(hostSettings.note, Channel(hostSettings.channel - 1));
 }
 
-/** Configures the key mode and GPIO pins */
+/** Configures the key mode and GPIO pins of every keyer */
 void setupKey()
 {
-  if (settings.keyMode == keyMode_t::KEY_STRAIGHT)
-  {
-    pinMode(settings.gpio.straightKey, settings.pinMode);
-  }
-  else if (settings.keyMode == keyMode_t::KEY_PADDLES)
+  loadKeyers();
+
+  for (uint8_t k = 0; k < keyers.count; k++)
   {
-    pinMode(settings.gpio.ditPaddle, settings.pinMode);
-    pinMode(settings.gpio.dahPaddle, settings.pinMode);
+    if (keyers.keyMode[k] == keyMode_t::KEY_STRAIGHT)
+    {
+      pinMode(keyers.straightPin[k], settings.pinMode);
+    }
+    else if (keyers.keyMode[k] == keyMode_t::KEY_PADDLES)
+    {
+      pinMode(keyers.ditPin[k], settings.pinMode);
+      pinMode(keyers.dahPin[k], settings.pinMode);
+    }
   }
+
+  setupKeyDebounce();
+
+  if (inputCapture)
+    setupCapture();
+
+  setupSpeedPot(micros());
 }
 
 /** Turn off LED and reset input or deactivate */
@@ -142,14 +504,17 @@ void cleanUpLED()
   }
   else if (settings.ledMode == ledMode_t::LED_RGB)
   {
-    strip->clear(); // Set all pixels to off
-    strip->show();  // Update to show off state
+    endNeoPixel(); // Sends the pixel off and releases the pin
   }
 }
 
 /** Configures the LED */
 void setupLed()
 {
+  ledRequest = ledElement_t::LED_OFF;
+  ledShown = 0;
+  ledBlinking = false;
+
   if (settings.ledMode == ledMode_t::LED_NORMAL)
   {
     pinMode(settings.gpio.normalLED, OUTPUT);
@@ -157,22 +522,14 @@ void setupLed()
   }
   else if (settings.ledMode == ledMode_t::LED_RGB)
   {
-    if (strip == nullptr)
-    {
-      strip = new Adafruit_NeoPixel(NUM_LEDS, settings.gpio.rgbLED, NEOPIXELTYPE);
-      strip->begin();
-    }
-
-    strip->clear(); // Set all pixels to off
-    strip->show();
-    strip->setBrightness(NEOPIXELBRIGHTNESS);
+    beginNeoPixel(settings.gpio.rgbLED); // Starts with the pixel off
   }
 }
 
 /** Encode firmware version for sending over SysEx */
 void encodeVersion(const uint16_t version, uint8_t *out, uint8_t &outSize)
 {
-  BitPacker packer(32);
+  BitPacker<32> packer;
 
   packer.addField(version & 0xFFFF, 16);
   packer.pack7Bit(out, outSize);
@@ -194,94 +551,429 @@ void sendVersion()
   sysExBuffer[sysExLength++] = SYSEX_FOOTER;
 
   // Send SysEx
-  midi.sendSysEx(sysExBuffer, sysExLength, address.getCableNumber());
-}
-
-/** Encode Config struct into a contiguous 7-bit buffer */
-void encodeConfig(const Settings_t &settings, uint8_t *out, uint8_t &outSize)
-{
-  BitPacker packer(MAX_SYSEX_LENGTH * 8);
-
-  // Add fields in MSB-to-LSB order
-  packer.addField(settings.keyMode & 0x3, 2);
-  packer.addField(settings.pinMode & 0x3, 2);
-  packer.addField(settings.ledMode & 0x3, 2);
-  packer.addField(settings.gpioOutputMode & 0x3, 2);
-  packer.addField(settings.gpio.output & 0x7F, 7);
-  packer.addField(settings.gpio.normalLED & 0x7F, 7);
-  packer.addField(settings.gpio.rgbLED & 0x7F, 7);
-  packer.addField(settings.gpio.ditPaddle & 0x7F, 7);
-  packer.addField(settings.gpio.dahPaddle & 0x7F, 7);
-  packer.addField(settings.gpio.straightKey & 0x7F, 7);
-  packer.addField(settings.wpm & 0xFFFF, 16);
-  packer.addField(settings.channel & 0x7F, 7);
-  packer.addField(settings.note & 0x7F, 7);
-  packer.addField(settings.volume & 0x7F, 7);
+  transmitSysEx(sysExBuffer, sysExLength, TX_BULK);
+}
+
+/** Send current configuration as SysEx */
+void sendConfig()
+{
+  uint8_t packedSize;
+
+  sysExLength = sizeof(sysex_header);
+
+  memcpy(sysExBuffer, sysex_header, sysExLength);
+  sysExBuffer[sysExLength++] = CMD_GET_CONFIG;
+
+  encodeConfig(hostSettings, &sysExBuffer[sysExLength], packedSize);
+
+  sysExLength += packedSize;
+  sysExBuffer[sysExLength++] = SYSEX_FOOTER;
+
+  // Send SysEx
+  transmitSysEx(sysExBuffer, sysExLength, TX_BULK);
+}
+
+/** Send a page of the config wire layout as SysEx, starting at the given field */
+void sendLayout(uint8_t first)
+{
+  uint8_t layoutSize;
+
+  sysExLength = sizeof(sysex_header);
+
+  memcpy(sysExBuffer, sysex_header, sysExLength);
+  sysExBuffer[sysExLength++] = CMD_GET_LAYOUT;
+
+  encodeLayout(first, &sysExBuffer[sysExLength], layoutSize);
+
+  sysExLength += layoutSize;
+  sysExBuffer[sysExLength++] = SYSEX_FOOTER;
+
+  // Send SysEx
+  transmitSysEx(sysExBuffer, sysExLength, TX_BULK);
+}
+
+/** Encode keyer counters for sending over SysEx */
+void encodeStats(const KeyerStats_t &stats, uint8_t *out, uint8_t &outSize)
+{
+  BitPacker<10 * 32> packer;
+
+  packer.addField(stats.elements, 32);
+  packer.addField(stats.maxElementError, 32);
+  packer.addField(stats.maxKeyerPass, 32);
+  packer.addField(stats.maxHostPass, 32);
+  packer.addField(stats.maxKeyEventDelay, 32);
+  packer.addField(stats.keyEventDrops, 32);
+  packer.addField(stats.edges, 32);
+  packer.addField(stats.edgeErrorTotal, 32);
+  packer.addField(stats.maxEdgeError, 32);
+  packer.addField(stats.sysExDrops, 32);
   packer.pack7Bit(out, outSize);
 }
 
-/** Encode Config struct into a contiguous 7-bit buffer */
-void decodeConfig(Settings_t &settings, const uint8_t *input, uint8_t inputSize)
+/** Send keyer counters as SysEx */
+void sendStats()
 {
-  BitPacker packer(MAX_SYSEX_LENGTH * 8);
+  uint8_t packedSize;
+
+  sysExLength = sizeof(sysex_header);
+
+  memcpy(sysExBuffer, sysex_header, sysExLength);
+  sysExBuffer[sysExLength++] = CMD_GET_STATS;
+
+  encodeStats(keyerStats, &sysExBuffer[sysExLength], packedSize);
 
-  packer.unpack7Bit(input, inputSize);
+  sysExLength += packedSize;
+  sysExBuffer[sysExLength++] = SYSEX_FOOTER;
 
-  settings.keyMode = (keyMode_t)packer.extractField(2);
-  settings.pinMode = (PinMode)packer.extractField(2);
-  settings.ledMode = (ledMode_t)packer.extractField(2);
-  settings.gpioOutputMode = (gpioOutputMode_t)packer.extractField(2);
-  settings.gpio.output = packer.extractField(7);
-  settings.gpio.normalLED = packer.extractField(7);
-  settings.gpio.rgbLED = packer.extractField(7);
-  settings.gpio.ditPaddle = packer.extractField(7);
-  settings.gpio.dahPaddle = packer.extractField(7);
-  settings.gpio.straightKey = packer.extractField(7);
-  settings.wpm = (uint16_t)packer.extractField(16);
-  settings.channel = packer.extractField(7);
-  settings.note = packer.extractField(7);
-  settings.volume = packer.extractField(7);
+  // Send SysEx
+  transmitSysEx(sysExBuffer, sysExLength, TX_BULK);
 }
 
-/** Send current configuration as SysEx */
-void sendConfig()
+/** Encode the settings journal state for sending over SysEx */
+void encodeJournalStats(const JournalStats_t &stats, uint8_t *out, uint8_t &outSize)
+{
+  BitPacker<3 * 32 + 6 * 16 + 1> packer;
+
+  packer.addField(stats.writes, 32);
+  packer.addField(stats.failures, 16);
+  packer.addField(stats.compactions, 16);
+  packer.addField(stats.records, 16);
+  packer.addField(stats.bytes, 16);
+  packer.addField(JOURNAL_SIZE, 16);
+  packer.addField(stats.damaged, 16);
+  packer.addField(stats.lastWriteTime, 32);
+  packer.addField(stats.maxWriteTime, 32);
+  packer.addField(stats.pending, 1);
+  packer.pack7Bit(out, outSize);
+}
+
+/** Encode the power on timing for sending over SysEx */
+void encodeBootStats(const BootStats_t &stats, uint8_t *out, uint8_t &outSize)
+{
+  BitPacker<4 * 32 + 1> packer;
+
+  packer.addField(stats.keyerReadyTime, 32);
+  packer.addField(stats.settingsTime, 32);
+  packer.addField(stats.usbMountTime, 32);
+  packer.addField(stats.firstKeyTime, 32);
+  packer.addField(stats.fastBoot, 1);
+  packer.pack7Bit(out, outSize);
+}
+
+/** Send the power on timing as SysEx */
+void sendBootStats()
 {
   uint8_t packedSize;
 
   sysExLength = sizeof(sysex_header);
 
   memcpy(sysExBuffer, sysex_header, sysExLength);
-  sysExBuffer[sysExLength++] = CMD_GET_CONFIG;
+  sysExBuffer[sysExLength++] = CMD_GET_BOOT;
 
-  encodeConfig(settings, &sysExBuffer[sysExLength], packedSize);
+  encodeBootStats(bootStats, &sysExBuffer[sysExLength], packedSize);
 
   sysExLength += packedSize;
   sysExBuffer[sysExLength++] = SYSEX_FOOTER;
 
   // Send SysEx
-  midi.sendSysEx(sysExBuffer, sysExLength, address.getCableNumber());
+  transmitSysEx(sysExBuffer, sysExLength, TX_BULK);
 }
 
-/** Applies received SysEx configuration */
-void setConfig(const uint8_t *data, unsigned int length)
+/** Send the settings journal state as SysEx */
+void sendJournalStats()
 {
-  // Clear/clean up before applying
-  cleanUpKey();
-  cleanUpOutput();
-  cleanUpLED();
+  uint8_t packedSize;
 
-  decodeConfig(settings, &data[sizeof(sysex_header) + 1], length - sizeof(sysex_header) - 1);
+  sysExLength = sizeof(sysex_header);
 
-  // Apply new config
-  setupKey();
-  setupOutput();
-  setupLed();
-  setupWPM();
+  memcpy(sysExBuffer, sysex_header, sysExLength);
+  sysExBuffer[sysExLength++] = CMD_GET_JOURNAL;
+
+  encodeJournalStats(journalStats, &sysExBuffer[sysExLength], packedSize);
+
+  sysExLength += packedSize;
+  sysExBuffer[sysExLength++] = SYSEX_FOOTER;
+
+  // Send SysEx
+  transmitSysEx(sysExBuffer, sysExLength, TX_BULK);
+}
+
+/** Send the trace state and the settings it was recorded with as SysEx */
+void sendTraceHeader()
+{
+  uint8_t packedSize;
+
+  sysExLength = sizeof(sysex_header);
+
+  memcpy(sysExBuffer, sysex_header, sysExLength);
+  sysExBuffer[sysExLength++] = CMD_TRACE;
+
+  encodeTraceHeader(&sysExBuffer[sysExLength], packedSize);
+
+  sysExLength += packedSize;
+  sysExBuffer[sysExLength++] = SYSEX_FOOTER;
+
+  // Send SysEx
+  transmitSysEx(sysExBuffer, sysExLength, TX_BULK);
+}
+
+/** Send a page of trace records as SysEx, the host asks for the next one when it arrives */
+void sendTracePage(uint16_t first)
+{
+  uint8_t packedSize;
+
+  sysExLength = sizeof(sysex_header);
+
+  memcpy(sysExBuffer, sysex_header, sysExLength);
+  sysExBuffer[sysExLength++] = CMD_GET_TRACE;
+
+  encodeTracePage(first, &sysExBuffer[sysExLength], packedSize);
+
+  sysExLength += packedSize;
+  sysExBuffer[sysExLength++] = SYSEX_FOOTER;
+
+  // Send SysEx
+  transmitSysEx(sysExBuffer, sysExLength, TX_BULK);
+}
+
+/** Send the self-test state and, once it has finished, its latencies as SysEx */
+void sendSelfTest()
+{
+  uint8_t packedSize;
+
+  sysExLength = sizeof(sysex_header);
+
+  memcpy(sysExBuffer, sysex_header, sysExLength);
+  sysExBuffer[sysExLength++] = CMD_SELF_TEST;
+
+  encodeSelfTest(&sysExBuffer[sysExLength], packedSize);
+
+  sysExLength += packedSize;
+  sysExBuffer[sysExLength++] = SYSEX_FOOTER;
+
+  // Send SysEx
+  transmitSysEx(sysExBuffer, sysExLength, TX_BULK);
+}
+
+/** Encode a telemetry histogram for sending over SysEx */
+void encodeHistogram(uint8_t id, const Histogram_t &histogram, uint8_t *out, uint8_t &outSize)
+{
+  BitPacker<7 + 2 * 32 + HISTOGRAM_BUCKETS * HISTOGRAM_COUNT_BITS> packer;
+
+  packer.addField(id, 7);
+  packer.addField(histogram.count, 32);
+  packer.addField(histogram.max, 32);
+  for (uint8_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    packer.addField(histogram.buckets[i], HISTOGRAM_COUNT_BITS);
+  packer.pack7Bit(out, outSize);
+}
+
+static_assert((7 + 2 * 32 + HISTOGRAM_BUCKETS * HISTOGRAM_COUNT_BITS + 6) / 7 + 4 <= MAX_SYSEX_LENGTH, "Histogram does not fit in a SysEx message");
+
+/** Send a telemetry histogram as SysEx */
+void sendHistogram(uint8_t id)
+{
+  uint8_t packedSize;
+
+  // Copied first, the keyer's histograms keep changing on core1
+  Histogram_t histogram = histograms[id];
+
+  sysExLength = sizeof(sysex_header);
+
+  memcpy(sysExBuffer, sysex_header, sysExLength);
+  sysExBuffer[sysExLength++] = CMD_GET_HISTOGRAM;
+
+  encodeHistogram(id, histogram, &sysExBuffer[sysExLength], packedSize);
+
+  sysExLength += packedSize;
+  sysExBuffer[sysExLength++] = SYSEX_FOOTER;
+
+  // Send SysEx
+  transmitSysEx(sysExBuffer, sysExLength, TX_BULK);
+}
+
+/** Encode the text playback status for sending over SysEx */
+void encodePlaybackStatus(uint8_t accepted, uint8_t *out, uint8_t &outSize)
+{
+  BitPacker<64> packer;
+
+  packer.addField(accepted, 8);
+  packer.addField(playbackFree(), 16);
+  packer.addField(playbackQueued(), 16);
+  packer.addField(playbackAborts(), 16);
+  packer.addField(playbackBusy(), 1);
+  packer.pack7Bit(out, outSize);
+}
+
+/** Send the text playback status as SysEx, accepted is how much of the last CMD_SEND_TEXT fit */
+void sendPlaybackStatus(uint8_t command, uint8_t accepted)
+{
+  uint8_t packedSize;
+
+  sysExLength = sizeof(sysex_header);
+
+  memcpy(sysExBuffer, sysex_header, sysExLength);
+  sysExBuffer[sysExLength++] = command;
+
+  encodePlaybackStatus(accepted, &sysExBuffer[sysExLength], packedSize);
+
+  sysExLength += packedSize;
+  sysExBuffer[sysExLength++] = SYSEX_FOOTER;
+
+  // Send SysEx
+  transmitSysEx(sysExBuffer, sysExLength, TX_BULK);
+}
+
+/** Encode a decoded character and the speed it was sent at for sending over SysEx */
+void encodeDecodedCharacter(char c, uint8_t *out, uint8_t &outSize)
+{
+  BitPacker<32> packer;
+
+  packer.addField(c, 7);
+  packer.addField(decoderWPM(), 16);
+  packer.pack7Bit(out, outSize);
+}
+
+/** Send a character from the CW decoder as SysEx */
+void sendDecodedCharacter(char c)
+{
+  uint8_t packedSize;
+
+  sysExLength = sizeof(sysex_header);
+
+  memcpy(sysExBuffer, sysex_header, sysExLength);
+  sysExBuffer[sysExLength++] = CMD_DECODED_TEXT;
+
+  encodeDecodedCharacter(c, &sysExBuffer[sysExLength], packedSize);
+
+  sysExLength += packedSize;
+  sysExBuffer[sysExLength++] = SYSEX_FOOTER;
+
+  // Send SysEx
+  transmitSysEx(sysExBuffer, sysExLength, TX_BULK);
+}
+
+/** Answer a clock sync ping with its token and the device time it was received and answered at */
+void sendPong(const uint8_t *data, unsigned int length, uint32_t received)
+{
+  uint8_t packedSize;
+
+  if (length < sizeof(sysex_header) + 2 + PING_TOKEN_SIZE)
+    return; // No token
+
+  sysExLength = sizeof(sysex_header);
+
+  memcpy(sysExBuffer, sysex_header, sysExLength);
+  sysExBuffer[sysExLength++] = CMD_PING;
+
+  // Taken last, so the host's round trip brackets it as tightly as it can
+  encodePong(&data[sizeof(sysex_header) + 1], received, micros(), &sysExBuffer[sysExLength], packedSize);
+
+  sysExLength += packedSize;
+  sysExBuffer[sysExLength++] = SYSEX_FOOTER;
+
+  // Send SysEx, ahead of anything queued
+  transmitSysEx(sysExBuffer, sysExLength, TX_KEY);
+}
+
+/** Queues received SysEx text for the keyer and reports how much fit */
+void sendText(const uint8_t *data, unsigned int length)
+{
+  // Payload sits between the command byte and the footer
+  unsigned int size = length - sizeof(sysex_header) - 2;
+  uint8_t accepted = appendPlaybackText(&data[sizeof(sysex_header) + 1], size > UINT8_MAX ? UINT8_MAX : size);
+  sendPlaybackStatus(CMD_SEND_TEXT, accepted);
+}
+
+/** Takes up new settings on core0 and hands them to the keyer, which sets up only what changed */
+void updateHostSettings(const Settings_t &newSettings)
+{
+  bool wpmChanged = newSettings.wpm != hostSettings.wpm;
+  bool streamChanged = newSettings.eventStream != hostSettings.eventStream;
+
+  hostSettings = newSettings;
+  configUpdates.post(hostSettings); // Replaces any the keyer has not taken, it applies the difference
   setupMidi();
+
+  if (wpmChanged)
+    resetDecoder(hostSettings.wpm);
+  if (streamChanged)
+    resetEventStream();
+}
+
+/** Applies received SysEx configuration, the keyer on core1 picks it up on its next pass. False if it was rejected */
+bool setConfig(const uint8_t *data, unsigned int length)
+{
+  Settings_t newSettings = hostSettings;
+
+  // Payload sits between the command byte and the footer
+  if (!decodeConfig(newSettings, &data[sizeof(sysex_header) + 1], length - sizeof(sysex_header) - 2))
+    return false; // Too short for any config revision
+
+  updateHostSettings(newSettings);
+  return true;
+}
+
+/** Applies the config fields received over SysEx, the rest stay as they are */
+void setConfigFields(const uint8_t *data, unsigned int length)
+{
+  Settings_t newSettings = hostSettings;
+
+  if (!decodeConfigFields(newSettings, &data[sizeof(sysex_header) + 1], length - sizeof(sysex_header) - 2))
+    return; // Empty, cut short or a field this firmware does not have
+
+  updateHostSettings(newSettings);
+}
+
+/** Reconfigures the keyer with settings received from core0, runs on core1. Only what changed is set up again */
+void applySettings(const Settings_t &update)
+{
+  // The speed knob has the speed for as long as it stays on its pin
+  Settings_t newSettings = update;
+  if (speedPotActive() && newSettings.gpio.speedPot == settings.gpio.speedPot)
+    newSettings.wpm = settings.wpm;
+
+  uint8_t changes = settingsChanges(settings, newSettings);
+  if (changes == CHANGE_NONE)
+    return;
+
+  stopTrace(); // A replay keys the whole trace with the settings it started with
+  noInterrupts(); // The self-test runs off the timer wheel, shared with the state alarm
+  stopSelfTest(); // Timed with the settings it started with, the pins may be about to change
+  interrupts();
+
+  // Speed, notes and the like are taken up by the keyers as they go
+  if (changes == CHANGE_SOFT)
+  {
+    swapKeyerSettings(newSettings);
+    return;
+  }
+
+  // Clear/clean up what changed before applying, stopping the keyers switches their outputs off while the old pins are still set up
+  if (changes & (CHANGE_KEYS | CHANGE_OUTPUTS))
+    stopKeyers();
+  if (changes & CHANGE_KEYS)
+    cleanUpKey();
+  if (changes & CHANGE_OUTPUTS)
+    cleanUpOutput();
+  if (changes & CHANGE_LED)
+    cleanUpLED();
+
+  swapKeyerSettings(newSettings);
+
+  // Apply new config
+  if (changes & CHANGE_KEYS)
+    setupKey();
+  else if (changes & CHANGE_OUTPUTS)
+    loadKeyers(); // The keyers' output pins
+  if (changes & CHANGE_OUTPUTS)
+    setupOutput();
+  if (changes & CHANGE_LED)
+    setupLed(); // Starts off, an element already being sent shows from the next one
 }
 
 /** Handle received SysEx */
-void handleSysEx(const uint8_t *data, unsigned int length)
+void handleSysEx(const uint8_t *data, unsigned int length, uint32_t received)
 {
   if (length < sizeof(sysex_header) + 2)
     return; // Too short
@@ -314,10 +1006,15 @@ void handleSysEx(const uint8_t *data, unsigned int length)
     setConfig(data, length);
     break;
   }
+  case CMD_SET_FIELDS: // Changed config fields
+  {
+    setConfigFields(data, length);
+    break;
+  }
   case CMD_SAVE_CONFIG: // Config save request
   {
-    setConfig(data, length);
-    save(settings);
+    if (setConfig(data, length))
+      save(hostSettings);
     break;
   }
   case CMD_REBOOT: // Reboot request
@@ -330,137 +1027,99 @@ void handleSysEx(const uint8_t *data, unsigned int length)
     reset_usb_boot(0, 0);
     break;
   }
+  case CMD_GET_STATS: // Keyer counters request
+  {
+    sendStats();
+    break;
   }
-}
-
-/** Callback for Control Surface to receive a MIDI message */
-struct MyMIDI_Callbacks : MIDI_Callbacks
-{
-
-  // This callback function is called when a SysEx message is received.
-  void onSysExMessage(MIDI_Interface &, SysExMessage sysex) override
+  case CMD_GET_JOURNAL: // Settings journal state request
   {
-    handleSysEx(sysex.data, sysex.length);
+    sendJournalStats();
+    break;
   }
-} callback{};
-
-/** Updates the debounced state of a key/paddle based on its current reading. */
-void updateKeyState(PaddleState_t &paddle, int pin)
-{
-  bool reading = !digitalRead(pin); // Active low due to pull-up
-  if (reading != paddle.lastReading)
+  case CMD_GET_BOOT: // Power on timing request
   {
-    paddle.lastChangeTime = millis();
+    sendBootStats();
+    break;
   }
-  if (millis() - paddle.lastChangeTime >= DEBOUNCE_TIME)
+  case CMD_TRACE: // Trace start, stop or header request
   {
-    paddle.currentState = reading;
+    if (length == sizeof(sysex_header) + 2)
+      sendTraceHeader();
+    else if (data[sizeof(sysex_header) + 1])
+      requestTraceStart(hostSettings); // The keyer starts it on its next pass
+    else
+      requestTraceStop();
+    break;
   }
-  paddle.lastReading = reading;
-}
-
-/** Starts sending a dit or dah by turning on the output and setting the duration. */
-void startIambicOutput(bool isDit)
-{
-  currentState = OutputState_t::OUTPUT_ON;
-
-  // MIDI.sendNoteOn(settings.note, settings.volume, settings.channel);
-  midi.sendNoteOn(address, settings.volume);
-
-  stateEndTime = millis() + (isDit ? settings.timings.dit : settings.timings.dah);
-  lastWasDit = isDit;
-  nextElement = NextElement_t::NONE; // Reset nextElement when starting a new output
-
-  setOutput(true);
-  setLed(true);
-}
-
-/** Processes the straight key. */
-void processStraightKey()
-{
-  if (straightKey.currentState && currentState == OutputState_t::IDLE)
+  case CMD_GET_TRACE: // Trace records request, from the given record on
   {
-    midi.sendNoteOn(address, settings.volume);
-    setOutput(true);
-    setLed(true);
-    currentState = OutputState_t::OUTPUT_ON;
+    if (length > sizeof(sysex_header) + 3)
+      sendTracePage(data[sizeof(sysex_header) + 1] << 7 | data[sizeof(sysex_header) + 2]);
+    break;
   }
-  if (!straightKey.currentState && currentState == OutputState_t::OUTPUT_ON)
+  case CMD_SELF_TEST: // Self-test start, stop or results request
   {
-    midi.sendNoteOff(address, settings.volume);
-    setOutput(false);
-    setLed(false);
-    currentState = OutputState_t::IDLE;
+    if (length == sizeof(sysex_header) + 2)
+      sendSelfTest();
+    else if (length > sizeof(sysex_header) + 4)
+      requestSelfTest(data[sizeof(sysex_header) + 1], data[sizeof(sysex_header) + 2] << 7 | data[sizeof(sysex_header) + 3]);
+    break;
   }
-}
-
-/** Processes the iambic keyer state machine. */
-void processIambic()
-{
-  if (currentState == OutputState_t::OUTPUT_ON)
+  case CMD_GET_HISTOGRAM: // Telemetry histogram request
   {
-    if (millis() >= stateEndTime)
-    {
-      midi.sendNoteOff(address, settings.volume);
-
-      currentState = OutputState_t::OUTPUT_OFF;
-      stateEndTime = millis() + settings.timings.gap;
-
-      setOutput(false);
-      setLed(false);
-    }
-    else
-    {
-      // During output, check if the opposite paddle is pressed
-      if (lastWasDit && dahPaddle.currentState)
-      {
-        nextElement = NextElement_t::DAH; // Queue a dah next
-      }
-      else if (!lastWasDit && ditPaddle.currentState)
-      {
-        nextElement = NextElement_t::DIT; // Queue a dit next
-      }
-    }
+    if (length > sizeof(sysex_header) + 2 && data[sizeof(sysex_header) + 1] < HISTOGRAM_COUNT)
+      sendHistogram(data[sizeof(sysex_header) + 1]);
+    break;
   }
-  else if (currentState == OutputState_t::OUTPUT_OFF)
+  case CMD_RESET_STATS: // Clear counters and histograms
   {
-    if (millis() >= stateEndTime)
-    {
-      if (nextElement == NextElement_t::DIT)
-      {
-        startIambicOutput(true); // Send queued dit
-      }
-      else if (nextElement == NextElement_t::DAH)
-      {
-        startIambicOutput(false); // Send queued dah
-      }
-      else if (ditPaddle.currentState)
-      {
-        startIambicOutput(true); // Send dit if Dit Paddle is pressed
-      }
-      else if (dahPaddle.currentState)
-      {
-        startIambicOutput(false); // Send dah if Dah Paddle is pressed
-      }
-      else
-      {
-        currentState = OutputState_t::IDLE; // Nothing pressed, go idle
-      }
-    }
+    resetHostStats();
+    requestStatsReset(); // The keyer clears its own on the next pass
+    break;
   }
-  else if (currentState == OutputState_t::IDLE)
+  case CMD_GET_LAYOUT: // Config layout request, optionally followed by the first field of the page
   {
-    if (ditPaddle.currentState)
-    {
-      startIambicOutput(true); // Start with dit
-    }
-    else if (dahPaddle.currentState)
-    {
-      startIambicOutput(false); // Start with dah
-    }
+    sendLayout(length > sizeof(sysex_header) + 2 ? data[sizeof(sysex_header) + 1] : 0);
+    break;
+  }
+  case CMD_SEND_TEXT: // Text to key
+  {
+    sendText(data, length);
+    break;
+  }
+  case CMD_GET_PLAYBACK: // Playback status request
+  {
+    sendPlaybackStatus(CMD_GET_PLAYBACK, 0);
+    break;
+  }
+  case CMD_STOP_PLAYBACK: // Drop queued text
+  {
+    requestPlaybackStop();
+    break;
+  }
+  case CMD_PING: // Clock sync request
+  {
+    sendPong(data, length, received);
+    break;
+  }
   }
 }
 
+/** Callback for Control Surface to receive a MIDI message */
+struct MyMIDI_Callbacks : MIDI_Callbacks
+{
+
+  // This callback function is called when a SysEx message is received.
+  void onSysExMessage(MIDI_Interface &, SysExMessage sysex) override
+  {
+    uint32_t start = micros();
+    handleSysEx(sysex.data, sysex.length, start);
+    histogramAdd(HIST_SYSEX, micros() - start);
+    signalEvent(); // Settings, text or a request for the keyer
+  }
+} callback{};
+
 /** Default values from main.h */
 void setDefaultSettings()
 {
@@ -475,10 +1134,40 @@ void setDefaultSettings()
   settings.gpio.ditPaddle = DEFAULT_GPIO_DITPADDLE;
   settings.gpio.dahPaddle = DEFAULT_GPIO_DAHPADDLE;
   settings.gpio.straightKey = DEFAULT_GPIO_STRAIGHT;
+  settings.gpio.ptt = DEFAULT_GPIO_PTT;
+  settings.pttMode = DEFAULT_PTTMODE;
+  settings.pttLead = DEFAULT_PTT_LEAD;
+  settings.pttTail = DEFAULT_PTT_TAIL;
+  settings.gpio.speedPot = DEFAULT_GPIO_SPEEDPOT;
+  settings.speedMin = DEFAULT_SPEED_MIN;
+  settings.speedMax = DEFAULT_SPEED_MAX;
   settings.wpm = DEFAULT_WPM;
   settings.channel = DEFAULT_MIDI_CHANNEL;
   settings.note = DEFAULT_MIDI_NOTE;
   settings.volume = DEFAULT_MIDI_VOLUME;
+  settings.farnsworth = DEFAULT_FARNSWORTH;
+  settings.weight = DEFAULT_WEIGHT;
+  settings.iambicMode = DEFAULT_IAMBIC_MODE;
+  settings.ditMemory = DEFAULT_DIT_MEMORY;
+  settings.dahMemory = DEFAULT_DAH_MEMORY;
+  settings.eventStream = DEFAULT_EVENT_STREAM;
+  settings.debounceMode = DEFAULT_DEBOUNCE_MODE;
+  settings.straightDebounce = DEFAULT_DEBOUNCE_WINDOW;
+  settings.ditDebounce = DEFAULT_DEBOUNCE_WINDOW;
+  settings.dahDebounce = DEFAULT_DEBOUNCE_WINDOW;
+
+  for (uint8_t k = 1; k < KEYER_COUNT; k++)
+  {
+    KeyerSettings_t &keyer = settings.keyers[k - 1];
+    keyer.keyMode = keyMode_t::KEY_NONE;
+    keyer.ditPaddle = DEFAULT_GPIO_DITPADDLE;
+    keyer.dahPaddle = DEFAULT_GPIO_DAHPADDLE;
+    keyer.straightKey = DEFAULT_GPIO_STRAIGHT;
+    keyer.outputMode = gpioOutputMode_t::OUTPUT_DISABLED;
+    keyer.output = DEFAULT_GPIO_OUTPUT;
+    keyer.note = DEFAULT_MIDI_NOTE + k * DEFAULT_KEYER_NOTE_STEP;
+    keyer.channel = DEFAULT_MIDI_CHANNEL;
+  }
 }
 
 void setup()
@@ -486,36 +1175,111 @@ void setup()
   //Serial.begin(115200);
 
   setDefaultSettings();
-  init(settings);
+
+  // The boot image is read straight from flash, the keyer starts before the filesystem is up or USB enumerates
+  bootStats.fastBoot = loadBootSettings(settings);
+  hostSettings = settings;
+  if (bootStats.fastBoot)
+    keyerReady = true; // Hand the settings over to core1
+
+  // The journal has the final say, a save the boot image missed reaches the keyer like a CMD_SET_CONFIG
+  if (init(hostSettings) && bootStats.fastBoot)
+    configUpdates.post(hostSettings);
+  bootStats.settingsTime = micros();
+
+  if (!bootStats.fastBoot)
+  {
+    settings = hostSettings;
+    keyerReady = true;
+  }
 
   TinyUSBDevice.setManufacturerDescriptor(MANUFACTURER);
   TinyUSBDevice.setProductDescriptor(PRODUCT);
-  while (!TinyUSBDevice.mounted())
-    delay(1); // Wait for USB to mount
 
+  // Nothing is written to USB until it mounts, see writeNote()
   midi.begin();
   midi.setCallbacks(callback);
+  resetTransmit(TX_SEPARATE_CABLE);
+  scb_hw->scr |= M0PLUS_SCR_SEVONPEND_BITS; // USB interrupts wake loop() from sleep
+
+  setupMidi();
+  resetDecoder(hostSettings.wpm);
+  resetEventStream();
+}
+
+/** USB MIDI and SysEx, runs on core0 */
+void loop()
+{
+  static uint32_t lastPassStart = micros();
+  uint32_t passStart = micros();
+  histogramAdd(HIST_HOST_PERIOD, passStart - lastPassStart);
+  lastPassStart = passStart;
+
+  if (bootStats.usbMountTime == 0 && TinyUSBDevice.mounted())
+    bootStats.usbMountTime = micros();
+
+  midi.update();
+  histogramAdd(HIST_MIDI_UPDATE, micros() - passStart);
+  sendKeyEvents();
+  decodeIdle(micros());
+  serviceTransmit(usb_hw->sof_rd & USB_FRAME_MASK);
+  serviceSave(keyerIdle());
+
+  uint32_t passTime = micros() - passStart;
+  if (passTime > keyerStats.maxHostPass)
+    keyerStats.maxHostPass = passTime;
+
+  sleepHost();
+}
+
+/** Keyer, debouncing and GPIO/LED output, runs on core1 */
+void setup1()
+{
+  while (!keyerReady)
+    delay(1); // Wait for core0 to load the settings
+
+  keyerAlarmPool = alarm_pool_create_with_unused_hardware_alarm(KEYER_ALARM_TIMERS);
+  scb_hw->scr |= M0PLUS_SCR_SEVONPEND_BITS; // Any interrupt wakes loop1() from sleep, even one taken just before it
+  setupTimers(micros());
 
   setupKey();
   setupLed();
   setupOutput();
-  setupMidi();
   setupWPM();
+
+  bootStats.keyerReadyTime = micros();
 }
 
-void loop()
+void loop1()
 {
-  midi.update();
+  static uint32_t lastPassStart = micros();
+  uint32_t passStart = micros();
+  histogramAdd(HIST_KEYER_PERIOD, passStart - lastPassStart);
+  lastPassStart = passStart;
 
-  if (settings.keyMode == keyMode_t::KEY_STRAIGHT)
+  if (takeStatsReset())
   {
-    updateKeyState(straightKey, settings.gpio.straightKey);
-    processStraightKey();
-  }
-  else if (settings.keyMode == keyMode_t::KEY_PADDLES)
-  {
-    updateKeyState(ditPaddle, settings.gpio.ditPaddle);
-    updateKeyState(dahPaddle, settings.gpio.dahPaddle);
-    processIambic();
+    uint32_t status = save_and_disable_interrupts(); // The state alarm adds to them too
+    resetKeyerStats();
+    restore_interrupts(status);
   }
+
+  Settings_t newSettings;
+  if (configUpdates.take(newSettings))
+    applySettings(newSettings);
+
+  uint32_t status = save_and_disable_interrupts(); // The state alarm records into the trace and runs the self-test too
+  processTraceRequest(micros(), readInputPins() & keyInputPins());
+  processSelfTestRequest(micros());
+  restore_interrupts(status);
+
+  processKey();
+  updateLed();
+
+  uint32_t passTime = micros() - passStart;
+  if (passTime > keyerStats.maxKeyerPass)
+    keyerStats.maxKeyerPass = passTime;
+  histogramAdd(HIST_KEYER_PASS, passTime);
+
+  sleepKeyer();
 }
\ No newline at end of file
@@ -4,7 +4,7 @@
 #include <Arduino.h>
 
 // Firmware compatability
-#define VERSION 0x2
+#define VERSION 0xA
 
 // USB MIDI Config
 #define MANUFACTURER "bontebok"
@@ -27,10 +27,43 @@
 #define DEFAULT_MIDI_NOTE 77
 #define DEFAULT_MIDI_CHANNEL 1
 #define DEFAULT_MIDI_VOLUME 40
+#define DEFAULT_WEIGHT 50     // Percent, 50 is a 1:1 dit to space ratio
+#define DEFAULT_FARNSWORTH 0  // Fixed point like wpm, 0 disables Farnsworth spacing
+#define DEFAULT_IAMBIC_MODE iambicMode_t::IAMBIC_B
+#define DEFAULT_DIT_MEMORY 100 // Percent of each element and gap during which a dit press is remembered
+#define DEFAULT_DAH_MEMORY 100 // Percent of each element and gap during which a dah press is remembered
+#define DEFAULT_EVENT_STREAM false // Send each key transition with its device timestamp as SysEx
+#define DEFAULT_INPUT_CAPTURE true // Timestamp key edges from GPIO interrupts instead of polling in loop()
+#define DEFAULT_EDGE_ALARM true    // Switch the output from a hardware alarm at the exact element deadline
+#define DEFAULT_IDLE_SLEEP true    // Sleep between key edges and deadlines instead of spinning loop1(), needs input capture
+#define DEFAULT_DEBOUNCE_MODE debounceMode_t::DEBOUNCE_LEADING
+#define DEFAULT_DEBOUNCE_WINDOW 40 // Ticks of DEBOUNCE_TICK_US, 10 ms
+#define DEFAULT_KEYER_NOTE_STEP 1 // Each extra keyer defaults to the next MIDI note up
+#define DEFAULT_PTTMODE gpioOutputMode_t::OUTPUT_DISABLED
+#define DEFAULT_GPIO_PTT 15
+#define DEFAULT_PTT_LEAD 10 // PTT_LEAD_UNIT_US, PTT up this long before the output goes on
+#define DEFAULT_PTT_TAIL 20 // PTT_TAIL_UNIT_US, PTT held this long after the output last went off
+#define DEFAULT_GPIO_SPEEDPOT 0 // ADC pin of a speed knob, 26 to 29, any other pin leaves the speed to SysEx
+#define DEFAULT_SPEED_MIN 10    // Whole WPM with the speed knob fully anticlockwise
+#define DEFAULT_SPEED_MAX 40    // Whole WPM with the speed knob fully clockwise
 
 // RGB LED Settings
-#define NEOPIXELTYPE NEO_GRB + NEO_KHZ800
 #define NEOPIXELBRIGHTNESS 127
+#define NEOPIXEL_FREQ 800000     // WS2812 bit rate
+#define NEOPIXEL_RESET_US 300    // Line held low after a frame before the pixels latch it, newer WS2812B need 280
+
+// RGB LED colours as 0xRRGGBB, scaled by NEOPIXELBRIGHTNESS
+#define LED_COLOR_DIT 0xFF0000
+#define LED_COLOR_DAH 0xFF00C0
+#define LED_COLOR_STRAIGHT 0xFF0000
+#define LED_COLOR_TEXT 0x00C0FF
+#define LED_COLOR_ERROR 0xFF8000
+#define LED_COLOR_STRAIGHT_IDLE 0x000010 // Dim colour shown between elements for the key mode
+#define LED_COLOR_IAMBIC_A_IDLE 0x001000
+#define LED_COLOR_IAMBIC_B_IDLE 0x000C0C
+#define LED_COLOR_ULTIMATIC_IDLE 0x0C000C
+#define LED_ERROR_BLINKS 3           // Blinks when a key event, SysEx reply or save is lost
+#define LED_ERROR_BLINK_US 150000    // On and off time of each blink
 
 // SysEx Commands
 #define CMD_GET_VERSION 0
@@ -39,21 +72,120 @@
 #define CMD_SAVE_CONFIG 3
 #define CMD_REBOOT 4
 #define CMD_BOOTSEL 5
+#define CMD_GET_STATS 6
+#define CMD_GET_LAYOUT 7
+#define CMD_SEND_TEXT 8     // Append text to the playback buffer, answered with the playback status
+#define CMD_GET_PLAYBACK 9  // Playback status: accepted, free, queued, aborts, busy
+#define CMD_STOP_PLAYBACK 10
+#define CMD_DECODED_TEXT 11 // Sent by the keyer: decoded character and the speed it was sent at
+#define CMD_GET_HISTOGRAM 12 // Followed by a histogram_t id
+#define CMD_RESET_STATS 13   // Clears the counters and histograms
+#define CMD_KEY_EVENTS 14    // Sent by the keyer when the event stream is on: timestamped key transitions
+#define CMD_PING 15          // Answered with the token echoed and the device time, for clock sync
+#define CMD_GET_JOURNAL 16   // Settings journal fill and write times
+#define CMD_GET_BOOT 17      // Power on timing: keyer ready, settings loaded, USB mounted, first key press
+#define CMD_TRACE 18         // Followed by 1 to start a trace, 0 to stop it, or nothing for the trace header and its settings
+#define CMD_GET_TRACE 19     // Followed by the first record as two 7-bit bytes, answered with a page of records
+#define CMD_SET_FIELDS 20    // Changed config fields only: a count, then id and value per field, see decodeConfigFields()
+#define CMD_SELF_TEST 21     // Followed by the drive pin and the press count as two 7-bit bytes to start a test, a count of 0 stops it, or nothing for the results
 
 // Byte array SysEx buffer
-#define MAX_SYSEX_LENGTH 32
+#define MAX_SYSEX_LENGTH 64
+
+// Independent keyers, each with its own key, output and MIDI note. The first
+// one is the original single keyer's settings, the rest are KeyerSettings_t
+#define KEYER_COUNT 4
+
+// Timer wheel shared by the keyer's timed actions, see timers.h
+#define TIMER_TICK_SHIFT 4    // 16 us ticks
+#define TIMER_WHEEL_SLOTS 256 // One turn is 4.1 ms, later deadlines wait out further turns in their slot
+#define TIMER_POOL_SIZE 32    // Timers running at once
+
+// PTT sequencing
+#define PTT_LEAD_UNIT_US 1000  // pttLead steps, up to 127 ms
+#define PTT_TAIL_UNIT_US 10000 // pttTail steps, up to 2.55 s
+
+// Speed knob, see speedpot.h
+#define SPEED_POT_FIRST_PIN 26     // GPIO of ADC input 0, the ADC inputs are 26 to 29
+#define SPEED_POT_LAST_PIN 29
+#define SPEED_POT_SAMPLE_US 1000   // ADC free running one conversion every millisecond
+#define SPEED_POT_RING_SIZE 64     // Samples in the DMA ring, power of two, drained every SPEED_POT_PERIOD_US
+#define SPEED_POT_PERIOD_US 16000  // Keyer timer draining the ring and moving the speed
+#define SPEED_POT_SMOOTH_SHIFT 4   // IIR smoothing, each sample moves the level 1/16 of the way
+#define SPEED_POT_HYSTERESIS 64    // 1/256 WPM past the half way point before the speed moves a step
+
+// Timers in the keyer alarm pool
+#define KEYER_ALARM_TIMERS 4
+
+// Idle sleep, each core waits for an interrupt or the other core's SEV but no longer than this
+#define KEYER_MAX_SLEEP_US 100000 // core1, the error counters behind the LED blink are looked at this often
+#define HOST_MAX_SLEEP_US 10000   // core0, the decoder's word gaps and a waiting save
 
 // WS2812 LED setup
 #define NUM_LEDS 1
 
-// Timing constants (in milliseconds)
-#define DEBOUNCE_TIME 10 // Debounce period in ms
+// Key debounce, every input is stepped together once per tick
+#define DEBOUNCE_TICK_US 250
+#define INPUT_GPIO_COUNT 30     // GPIOs in the SIO input register, one debounce lane each
+#define DEBOUNCE_COUNTER_BITS 6 // Longest window is 2^bits - 1 ticks, 15.75 ms
+#define DEFAULT_DEBOUNCE_US (DEFAULT_DEBOUNCE_WINDOW * DEBOUNCE_TICK_US)
+
+// Queue sizes, must be powers of two
+#define CAPTURE_BUFFER_SIZE 64 // Captured key edges, GPIO IRQ to keyer
+#define KEY_EVENT_QUEUE_SIZE 32 // Key on/off events, core1 to core0
+#define ELEMENT_QUEUE_SIZE 4    // Remembered paddle presses waiting to be sent
+#define PLAYBACK_BUFFER_SIZE 256 // Text waiting to be keyed, core0 to core1
+
+// Key input and output trace, see trace.h
+#define TRACE_BUFFER_SIZE 2048 // Records kept in RAM, 8 bytes each
+#define TRACE_PAGE_RECORDS 6   // Records per CMD_GET_TRACE reply
+
+// Loopback latency self-test, see selftest.h
+#define SELF_TEST_MAX_PRESSES 4000 // Presses per test, an output and a note latency of 2 bytes each kept for the percentile
+
+// USB MIDI transmit scheduling, key notes first and other SysEx paced behind them
+#define USB_FRAME_US 1000          // Full speed USB frame
+#define USB_FRAME_MASK 0x7FF       // Frame numbers count up in 11 bits
+#define TX_FRAME_EVENTS 16         // USB-MIDI event packets in the 64 byte bulk packet sent each frame
+#define TX_KEY_RESERVE 4           // Event packets left free each frame for key notes
+#define TX_BULK_BUFFER_SIZE 1024   // SysEx waiting behind the key notes, power of two
+#define TX_SEPARATE_CABLE false    // Chunk other SysEx over virtual cable 2, needs a two cable USB descriptor
+
+// Timestamped key event stream
+#define EVENT_STREAM_BATCH 8       // Most key transitions per SysEx message
+#define EVENT_STREAM_SYNC_EVERY 16 // Messages between absolute timestamps, so a lost message is recovered from
+#define PING_TOKEN_SIZE 4          // 7-bit bytes the host tags a ping with
+
+// Telemetry histograms, bucket n counts values of n significant bits: 0, 1, 2-3, 4-7 ... 16384 and up
+#define HISTOGRAM_BUCKETS 16
+#define HISTOGRAM_COUNT_BITS 16 // Bucket counts are halved together before one overflows, keeping the shape
+
+// CW decoder
+#define DECODER_MIN_DIT 12000   // Shortest dit the speed estimate may track, 100 WPM in microseconds
+#define DECODER_MAX_DIT 240000  // Longest dit the speed estimate may track, 5 WPM in microseconds
+#define DECODER_UNKNOWN '*'     // Sent for a pattern that is not a character
 
 // Int scalar value
 #define INTTOFLOATSCALAR 100.0
+#define WPM_SCALE 100
+#define MIN_WPM 100        // 1 WPM, a word space at the lightest weighting (7.8 dits) fits the fixed point timings
+#define MIN_FARNSWORTH 500 // 5 WPM, longest word space that fits the fixed point timings
 
-// Settings file path
-#define SETTINGS_FILE "/settings.bin"
+// Keyer timings are microseconds in fixed point with this many fractional bits
+#define TIMING_FRACTION_BITS 8
+#define TIMING_FRACTION_MASK ((1 << TIMING_FRACTION_BITS) - 1)
+
+// Weighting limits in percent
+#define MIN_WEIGHT 10
+#define MAX_WEIGHT 90
+
+// Settings files
+#define SETTINGS_FILE "/config.bin"       // Older firmware, packed like CMD_SET_CONFIG, read once and moved to the journal
+#define LEGACY_SETTINGS_FILE "/settings.bin" // The first firmware's raw Settings_t, never read and removed
+#define JOURNAL_FILE "/config.jnl"        // Saved configs appended as CRC checked records, see journal.h
+#define JOURNAL_COMPACT_FILE "/config.tmp" // Written whole then renamed over the journal
+#define JOURNAL_SIZE 2048                 // Journal bytes before it is compacted to the newest record
+#define JOURNAL_IDLE_US 1000000           // Key up and no text to send for this long before a save touches flash
 
 // Key Modes
 enum keyMode_t : uint8_t
@@ -71,6 +203,31 @@ enum ledMode_t : uint8_t
     LED_RGB
 };
 
+// What the keyer is sending, picks the LED colour
+enum ledElement_t : uint8_t
+{
+    LED_OFF,
+    LED_DIT,
+    LED_DAH,
+    LED_STRAIGHT,
+    LED_TEXT // Text playback
+};
+
+// Key debounce behaviour
+enum debounceMode_t : uint8_t
+{
+    DEBOUNCE_SETTLE, // Act once the contact has read the same for the whole window
+    DEBOUNCE_LEADING // Act on the first edge, then ignore the contact for the window
+};
+
+// Paddle squeeze behaviour
+enum iambicMode_t : uint8_t
+{
+    IAMBIC_A,  // Squeeze alternates, releasing it stops after the current element
+    IAMBIC_B,  // Squeeze alternates, releasing it sends one more opposite element
+    ULTIMATIC  // Squeeze repeats the paddle pressed last
+};
+
 // GPIO Output Mode
 enum gpioOutputMode_t : uint8_t
 {
@@ -88,14 +245,31 @@ struct GPIO_t
     uint8_t ditPaddle;
     uint8_t dahPaddle;
     uint8_t straightKey;
+    uint8_t ptt;
+    uint8_t speedPot;
 };
 
-// Timing values for iambic key
+// Timing values for iambic key, microseconds << TIMING_FRACTION_BITS
 struct Timings_t
 {
-    uint dit;
-    uint dah;
-    uint gap;
+    uint32_t dit;     // Weighted dit on time
+    uint32_t dah;     // Weighted dah on time
+    uint32_t gap;     // Inter-element gap
+    uint32_t charGap; // Inter-character gap, Farnsworth stretched
+    uint32_t wordGap; // Inter-word gap, Farnsworth stretched
+};
+
+// Key, output and MIDI note of each keyer after the first
+struct KeyerSettings_t
+{
+    keyMode_t keyMode;
+    uint8_t ditPaddle;
+    uint8_t dahPaddle;
+    uint8_t straightKey;
+    gpioOutputMode_t outputMode;
+    uint8_t output;
+    uint8_t note;
+    uint8_t channel;
 };
 
 // Menu structure
@@ -112,6 +286,22 @@ struct Settings_t
     uint8_t note;
     uint8_t channel;
     uint8_t volume;
+    uint16_t farnsworth; // Character spacing speed, fixed point like wpm, 0 to disable
+    uint8_t weight;      // Dit/dah weighting in percent
+    iambicMode_t iambicMode;
+    uint8_t ditMemory;   // Dit memory window, percent at the end of each element and gap, 0 to disable
+    uint8_t dahMemory;   // Dah memory window, percent at the end of each element and gap, 0 to disable
+    bool eventStream;    // Send timestamped key transitions as SysEx next to the MIDI notes
+    debounceMode_t debounceMode;
+    uint8_t straightDebounce; // Debounce window in DEBOUNCE_TICK_US ticks
+    uint8_t ditDebounce;      // Debounce window in DEBOUNCE_TICK_US ticks
+    uint8_t dahDebounce;      // Debounce window in DEBOUNCE_TICK_US ticks
+    KeyerSettings_t keyers[KEYER_COUNT - 1]; // Keyers after the first, which uses the fields above
+    gpioOutputMode_t pttMode; // PTT output of the first keyer, disabled to switch the output without sequencing
+    uint8_t pttLead;          // PTT up before the output goes on, PTT_LEAD_UNIT_US steps
+    uint8_t pttTail;          // PTT held after the output last went off, PTT_TAIL_UNIT_US steps
+    uint8_t speedMin;         // Whole WPM at either end of the speed knob on gpio.speedPot
+    uint8_t speedMax;
 };
 
 // Paddle state tracking
@@ -119,7 +309,93 @@ struct PaddleState_t
 {
     bool currentState;       // Current debounced state
     bool lastReading;        // Last raw reading
-    uint32_t lastChangeTime; // Time of last state change
+    uint32_t lastChangeTime; // Time of the last raw reading change in microseconds
+    uint8_t presses;         // Debounced presses, wraps, lets the keyer see taps between passes
+    uint32_t stateTime;      // Time of the raw edge behind the current debounced state
+};
+
+// Key edge timestamped by the GPIO interrupt
+struct KeyEdge_t
+{
+    uint32_t time;   // micros() at the edge
+    uint32_t levels; // Every GPIO input level, read in one go at the edge
+};
+
+// Key on/off sent from the keyer (core1) to MIDI (core0)
+struct KeyEvent_t
+{
+    uint32_t time; // micros() when the keyer switched the output
+    uint8_t keyer; // Instance that switched it
+    uint8_t note;
+    uint8_t channel;
+    uint8_t volume;
+    bool state;
+    bool fromInput;     // Caused directly by a key edge
+    uint32_t inputTime; // micros() at that key edge
+};
+
+// Keyer counters, read back with CMD_GET_STATS
+struct KeyerStats_t
+{
+    uint32_t elements;         // Iambic elements keyed
+    uint32_t maxElementError;  // Worst element length error in microseconds
+    uint32_t maxKeyerPass;     // Longest keyer (core1) loop pass in microseconds
+    uint32_t maxHostPass;      // Longest USB/MIDI (core0) loop pass in microseconds
+    uint32_t maxKeyEventDelay; // Longest wait for a key event to reach MIDI in microseconds
+    uint32_t keyEventDrops;    // Key events lost to a full queue
+    uint32_t edges;            // Output edges switched at a deadline
+    uint32_t edgeErrorTotal;   // Sum of scheduled vs actual edge time in microseconds
+    uint32_t maxEdgeError;     // Worst scheduled vs actual edge time in microseconds
+    uint32_t sysExDrops;       // Outgoing SysEx lost to a full transmit queue
+};
+
+// Settings journal health, read back with CMD_GET_JOURNAL
+struct JournalStats_t
+{
+    uint32_t writes;        // Records appended, compactions included
+    uint16_t failures;      // Appends or compactions that did not complete
+    uint16_t compactions;   // Times the journal was rewritten with just the newest record
+    uint16_t records;       // Records in the journal
+    uint16_t bytes;         // Journal file size, out of JOURNAL_SIZE
+    uint16_t damaged;       // Bad records skipped when the journal was loaded
+    uint32_t lastWriteTime; // Last save in microseconds
+    uint32_t maxWriteTime;  // Slowest save in microseconds
+    bool pending;           // A save is waiting for the keyer to go idle
+};
+
+// Power on timing in microseconds from reset, read back with CMD_GET_BOOT. 0 until it has happened
+struct BootStats_t
+{
+    uint32_t keyerReadyTime; // core1 has set up the key inputs and output
+    uint32_t settingsTime;   // The settings journal was loaded
+    uint32_t usbMountTime;   // The host enumerated the keyer
+    uint32_t firstKeyTime;   // The key first went down, set by core1
+    bool fastBoot;           // The keyer started from the boot image rather than waiting for the journal
+};
+
+// Telemetry histograms, read back with CMD_GET_HISTOGRAM. The keyer (core1)
+// owns the ones before HIST_HOST_PERIOD, USB/MIDI (core0) the rest.
+enum histogram_t : uint8_t
+{
+    HIST_KEYER_PERIOD,  // Time between keyer loop passes in microseconds
+    HIST_KEYER_PASS,    // Keyer loop pass time in microseconds
+    HIST_ELEMENT_ERROR, // Iambic element length error in microseconds
+    HIST_EDGE_ERROR,    // Scheduled vs actual output edge time in microseconds
+    HIST_KEYER_SLEEP,   // Keyer sleep between events in microseconds
+    HIST_HOST_PERIOD,   // Time between USB/MIDI loop passes in microseconds
+    HIST_MIDI_UPDATE,   // midi.update() time, SysEx handling included, in microseconds
+    HIST_SYSEX,         // SysEx handling time, the reply included, in microseconds
+    HIST_KEY_LATENCY,   // Key edge to MIDI note sent in microseconds
+    HIST_JOURNAL_WRITE, // Settings journal append or compaction in microseconds
+    HIST_HOST_SLEEP,    // USB/MIDI sleep between events in microseconds
+    HISTOGRAM_COUNT
+};
+
+struct Histogram_t
+{
+    uint16_t buckets[HISTOGRAM_BUCKETS];
+    uint32_t count; // Values added, never halved
+    uint32_t max;
 };
 
 // Output state
@@ -138,4 +414,56 @@ enum NextElement_t : uint8_t
     DAH
 };
 
+// Every keyer instance, one array per field so a pass over all of them walks
+// each field in order. Settings are copied in by loadKeyers()
+struct Keyers_t
+{
+    // Settings
+    keyMode_t keyMode[KEYER_COUNT];
+    uint8_t straightPin[KEYER_COUNT];
+    uint8_t ditPin[KEYER_COUNT];
+    uint8_t dahPin[KEYER_COUNT];
+    gpioOutputMode_t outputMode[KEYER_COUNT];
+    uint8_t outputPin[KEYER_COUNT];
+    uint8_t note[KEYER_COUNT];
+    uint8_t channel[KEYER_COUNT];
+    uint8_t count; // Instances stepped each pass, up to the last one with a key
+
+    // Debounced inputs
+    PaddleState_t straightKey[KEYER_COUNT];
+    PaddleState_t ditPaddle[KEYER_COUNT];
+    PaddleState_t dahPaddle[KEYER_COUNT];
+
+    // State machines
+    OutputState_t state[KEYER_COUNT];
+    uint32_t stateEndTime[KEYER_COUNT];     // micros() deadline of the current state
+    uint32_t stateEndFraction[KEYER_COUNT]; // Sub-microsecond remainder carried to the next deadline
+    uint32_t elementStart[KEYER_COUNT];     // micros() when the current element started
+    uint32_t elementLength[KEYER_COUNT];    // Nominal length of the current element in microseconds, as timed when it started
+    bool lastWasDit[KEYER_COUNT];
+
+    // Paddle memory, elements remembered in the order they were pressed
+    NextElement_t elementQueue[KEYER_COUNT][ELEMENT_QUEUE_SIZE];
+    uint8_t queueHead[KEYER_COUNT];
+    uint8_t queueCount[KEYER_COUNT];
+    uint8_t ditPressesSeen[KEYER_COUNT];
+    uint8_t dahPressesSeen[KEYER_COUNT];
+    bool lastPressWasDit[KEYER_COUNT]; // Ultimatic squeeze follows the paddle pressed last
+    bool oppositeQueued[KEYER_COUNT];  // The current element already remembered the opposite paddle
+
+    // Raw key edge behind the next note, for the key latency histogram
+    bool noteFromInput[KEYER_COUNT];
+    uint32_t noteInputTime[KEYER_COUNT];
+};
+
+// Text playback, what to key next
+enum PlaybackStep_t : uint8_t
+{
+    PLAY_NONE,
+    PLAY_DIT,
+    PLAY_DAH,
+    PLAY_CHAR_SPACE, // Stretch the element gap to a character space
+    PLAY_WORD_SPACE  // Stretch the character space to a word space
+};
+
 #endif
\ No newline at end of file
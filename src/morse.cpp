@@ -0,0 +1,51 @@
+#include <Arduino.h>
+#include "morse.h"
+
+// ASCII 32 to 95, lower case is folded onto upper case
+static constexpr uint8_t morseTable[64] = {
+    0x00, 0x75, 0x52, 0x00, 0xC8, 0x00, 0x22, 0x5E, //   ! " # $ % & '
+    0x2D, 0x6D, 0x00, 0x2A, 0x73, 0x61, 0x6A, 0x29, // ( ) * + , - . /
+    0x3F, 0x3E, 0x3C, 0x38, 0x30, 0x20, 0x21, 0x23, // 0 1 2 3 4 5 6 7
+    0x27, 0x2F, 0x47, 0x55, 0x00, 0x31, 0x00, 0x4C, // 8 9 : ; < = > ?
+    0x56, 0x06, 0x11, 0x15, 0x09, 0x02, 0x14, 0x0B, // @ A B C D E F G
+    0x10, 0x04, 0x1E, 0x0D, 0x12, 0x07, 0x05, 0x0F, // H I J K L M N O
+    0x16, 0x1B, 0x0A, 0x08, 0x03, 0x0C, 0x18, 0x0E, // P Q R S T U V W
+    0x19, 0x1D, 0x13, 0x00, 0x00, 0x00, 0x00, 0x6C  // X Y Z [ \ ] ^ _
+};
+
+/** Returns the packed Morse code of a character, 0 if it has none */
+uint8_t morseEncode(char c)
+{
+  if (c >= 'a' && c <= 'z')
+    c -= 'a' - 'A';
+  if (c < ' ' || c > '_')
+    return 0;
+
+  return morseTable[c - ' '];
+}
+
+// morseTable inverted, indexed by code
+struct MorseDecodeTable_t
+{
+  char characters[256];
+};
+
+/** Builds the decode table at compile time, so a lookup is a single load */
+static constexpr MorseDecodeTable_t buildDecodeTable()
+{
+  MorseDecodeTable_t table = {};
+  for (uint8_t i = 0; i < sizeof(morseTable); i++)
+  {
+    if (morseTable[i])
+      table.characters[morseTable[i]] = ' ' + i;
+  }
+  return table;
+}
+
+static constexpr MorseDecodeTable_t morseDecodeTable = buildDecodeTable();
+
+/** Returns the character for a packed Morse code, 0 if there is none */
+char morseDecode(uint8_t code)
+{
+  return morseDecodeTable.characters[code];
+}
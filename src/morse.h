@@ -0,0 +1,12 @@
+#ifndef MORSE_H
+#define MORSE_H
+
+#include <Arduino.h>
+
+// Morse codes are packed one per byte: elements LSB first (0 dit, 1 dah)
+// with a 1 bit above the last element, so 'A' (.-) is 0b110. 0 means the
+// character has no code.
+uint8_t morseEncode(char c);
+char morseDecode(uint8_t code);
+
+#endif
@@ -0,0 +1,146 @@
+#include <Arduino.h>
+#include <hardware/pio.h>
+#include <hardware/dma.h>
+#include <hardware/clocks.h>
+#include "main.h"
+#include "neopixel.h"
+#include "ws2812.pio.h"
+
+// Frame time for every pixel plus the latch, before the next frame may start
+#define NEOPIXEL_FRAME_US (NUM_LEDS * 24 * 1000000 / NEOPIXEL_FREQ + 1 + NEOPIXEL_RESET_US)
+
+static PIO pio = nullptr;
+static int stateMachine = -1;
+static uint programOffset = 0;
+static int dmaChannel = -1;
+static int pixelPin = -1;
+
+// GRB words left aligned for the 24 bit autopull, set by the keyer core and copied out for the DMA
+static uint32_t pixels[NUM_LEDS];
+static uint32_t frame[NUM_LEDS];
+static bool framePending = false;
+static uint32_t frameStart = 0;
+
+/** Claims a PIO state machine with room for the program and a DMA channel, once */
+static bool claimNeoPixel()
+{
+  if (stateMachine >= 0)
+    return true;
+
+  PIO candidates[] = {pio0, pio1};
+  for (PIO candidate : candidates)
+  {
+    if (!pio_can_add_program(candidate, &ws2812_program))
+      continue;
+
+    stateMachine = pio_claim_unused_sm(candidate, false);
+    if (stateMachine < 0)
+      continue;
+
+    pio = candidate;
+    programOffset = pio_add_program(pio, &ws2812_program);
+    break;
+  }
+  if (stateMachine < 0)
+    return false;
+
+  dmaChannel = dma_claim_unused_channel(false);
+  if (dmaChannel < 0)
+  {
+    pio_remove_program(pio, &ws2812_program, programOffset);
+    pio_sm_unclaim(pio, stateMachine);
+    stateMachine = -1;
+    return false;
+  }
+
+  // One 32 bit word per pixel into the TX FIFO, paced by the state machine
+  dma_channel_config config = dma_channel_get_default_config(dmaChannel);
+  channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+  channel_config_set_read_increment(&config, true);
+  channel_config_set_write_increment(&config, false);
+  channel_config_set_dreq(&config, pio_get_dreq(pio, stateMachine, true));
+  dma_channel_configure(dmaChannel, &config, &pio->txf[stateMachine], frame, NUM_LEDS, false);
+  return true;
+}
+
+/** Waits out the frame being sent, only for settings changes */
+static void waitNeoPixel()
+{
+  dma_channel_wait_for_finish_blocking(dmaChannel);
+  while (micros() - frameStart < NEOPIXEL_FRAME_US)
+    tight_loop_contents();
+}
+
+/** Starts the WS2812 program on a pin, with every pixel off */
+bool beginNeoPixel(uint8_t pin)
+{
+  endNeoPixel();
+  if (!claimNeoPixel())
+    return false;
+
+  pio_gpio_init(pio, pin);
+  pio_sm_set_consecutive_pindirs(pio, stateMachine, pin, 1, true);
+
+  pio_sm_config config = ws2812_program_get_default_config(programOffset);
+  sm_config_set_sideset_pins(&config, pin);
+  sm_config_set_out_shift(&config, false, true, 24);
+  sm_config_set_fifo_join(&config, PIO_FIFO_JOIN_TX);
+  sm_config_set_clkdiv(&config, (float)clock_get_hz(clk_sys) / (NEOPIXEL_FREQ * (ws2812_T1 + ws2812_T2 + ws2812_T3)));
+  pio_sm_init(pio, stateMachine, programOffset, &config);
+  pio_sm_set_enabled(pio, stateMachine, true);
+
+  pixelPin = pin;
+  memset(pixels, 0, sizeof(pixels));
+  framePending = true;
+  frameStart = micros() - NEOPIXEL_FRAME_US;
+  return true;
+}
+
+/** Turns every pixel off and lets go of the pin */
+void endNeoPixel()
+{
+  if (pixelPin < 0)
+    return;
+
+  waitNeoPixel();
+  memset(frame, 0, sizeof(frame));
+  frameStart = micros();
+  dma_channel_transfer_from_buffer_now(dmaChannel, frame, NUM_LEDS);
+  waitNeoPixel();
+
+  pio_sm_set_enabled(pio, stateMachine, false);
+  pinMode(pixelPin, INPUT);
+  pixelPin = -1;
+  framePending = false;
+}
+
+/** Sets a pixel to 0xRRGGBB at NEOPIXELBRIGHTNESS, shown by the next serviceNeoPixel() */
+void setNeoPixel(uint8_t index, uint32_t color)
+{
+  if (index >= NUM_LEDS)
+    return;
+
+  uint32_t r = (((color >> 16) & 0xFF) * (NEOPIXELBRIGHTNESS + 1)) >> 8;
+  uint32_t g = (((color >> 8) & 0xFF) * (NEOPIXELBRIGHTNESS + 1)) >> 8;
+  uint32_t b = ((color & 0xFF) * (NEOPIXELBRIGHTNESS + 1)) >> 8;
+  pixels[index] = (g << 24) | (r << 16) | (b << 8);
+  framePending = true;
+}
+
+/** Starts the DMA on a changed frame once the last one has latched, called every pass of loop1() */
+void serviceNeoPixel(uint32_t now)
+{
+  if (!framePending || pixelPin < 0 || now - frameStart < NEOPIXEL_FRAME_US || dma_channel_is_busy(dmaChannel))
+    return;
+
+  memcpy(frame, pixels, sizeof(frame));
+  framePending = false;
+  frameStart = now;
+  dma_channel_transfer_from_buffer_now(dmaChannel, frame, NUM_LEDS);
+}
+
+/** True while a changed frame waits for serviceNeoPixel() to send it */
+bool neoPixelPending()
+{
+  return framePending && pixelPin >= 0;
+}
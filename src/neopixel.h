@@ -0,0 +1,15 @@
+#ifndef NEOPIXEL_H
+#define NEOPIXEL_H
+
+#include "main.h"
+
+// WS2812 pixels clocked out by a PIO state machine fed from DMA. Setting a
+// pixel only writes a buffer, serviceNeoPixel() hands it to the DMA once the
+// previous frame has latched, so nothing waits on the LED.
+bool beginNeoPixel(uint8_t pin);
+void endNeoPixel();
+void setNeoPixel(uint8_t index, uint32_t color);
+void serviceNeoPixel(uint32_t now);
+bool neoPixelPending();
+
+#endif
@@ -1,6 +1,26 @@
 #include <Arduino.h>
 #include <LittleFS.h>
+#include <hardware/flash.h>
 #include "main.h"
+#include "config.h"
+#include "journal.h"
+#include "stats.h"
+#include "nvram.h"
+
+JournalStats_t journalStats;
+
+// Flash sector the core sets aside ahead of the filesystem, it holds the boot image here
+extern "C" uint8_t _EEPROM_start;
+
+static_assert(BOOT_SECTOR_SIZE == FLASH_SECTOR_SIZE && BOOT_SLOT_SIZE % FLASH_PAGE_SIZE == 0, "Boot image slots must be whole flash pages");
+static_assert(JOURNAL_RECORD_SIZE(CONFIG_PACKED_SIZE) <= BOOT_SLOT_SIZE, "Config does not fit a boot image slot");
+
+static uint16_t journalSequence = 0; // Sequence number of the newest record
+static bool journalDirty = false;    // The file has a torn or damaged record in it, the next save compacts it
+static uint16_t bootSequence = 0;    // Journal sequence number the boot image was saved with
+static bool bootFound = false;       // The boot image has an intact record
+static bool bootStale = false;       // The boot image is behind the journal, caught up once the keyer is idle
+static Settings_t pendingSettings;   // Waiting for the keyer to go idle
 
 // Function to initialize LittleFS
 bool initLittleFS()
@@ -11,35 +31,153 @@ bool initLittleFS()
     return true;
 }
 
-// Function to read settings from LittleFS
+// Function to read the boot image through XIP, no filesystem needed so the keyer can start at once
+bool loadBootSettings(Settings_t &settings)
+{
+    BootScan_t scan = scanBootSector(&_EEPROM_start, JOURNAL_RECORD_SIZE(CONFIG_PACKED_SIZE));
+
+    bootFound = scan.found && decodeConfig(settings, &(&_EEPROM_start)[scan.offset], scan.length) != 0;
+    bootSequence = scan.sequence;
+    return bootFound;
+}
+
+// Function to program settings into the next boot image slot, erasing the sector once every slot is used
+bool writeBootSettings(const Settings_t &settings, uint16_t sequence)
+{
+    uint8_t packed[CONFIG_PACKED_SIZE];
+    uint8_t packedSize;
+    encodeConfig(settings, packed, packedSize);
+
+    uint8_t page[BOOT_SLOT_SIZE];
+    memset(page, 0xFF, sizeof(page)); // Programming erased bits leaves them erased
+    uint8_t size = encodeJournalRecord(sequence, packed, packedSize, page);
+
+    // A journal started over on a formatted filesystem numbers from 1 again, older images have to go
+    BootScan_t scan = scanBootSector(&_EEPROM_start, size);
+    uint8_t slot = scan.found && (int16_t)(sequence - scan.sequence) <= 0 ? BOOT_SLOTS : scan.next;
+    uint32_t offset = (uint32_t)&_EEPROM_start - XIP_BASE;
+
+    // Nothing may run from flash while it is written, the keyer core waits in RAM
+    noInterrupts();
+    rp2040.idleOtherCore();
+    if (slot == BOOT_SLOTS)
+    {
+        flash_range_erase(offset, BOOT_SECTOR_SIZE);
+        slot = 0;
+    }
+    flash_range_program(offset + slot * BOOT_SLOT_SIZE, page, BOOT_SLOT_SIZE);
+    rp2040.resumeOtherCore();
+    interrupts();
+
+    // Read back through XIP, the SDK flushed the cache
+    bootFound = checkJournalRecord(&(&_EEPROM_start)[slot * BOOT_SLOT_SIZE], BOOT_SLOT_SIZE) != 0;
+    bootSequence = sequence;
+    return bootFound;
+}
+
+// Function to read settings saved by older firmware, fields newer than the saved config keep their defaults
 bool readSettings(Settings_t &settings)
 {
     File file = LittleFS.open(SETTINGS_FILE, "r");
     if (!file)
         return false;
 
-    size_t bytesRead = file.readBytes((char *)&settings, sizeof(Settings_t));
+    uint8_t packed[CONFIG_PACKED_SIZE];
+    size_t bytesRead = file.readBytes((char *)packed, sizeof(packed));
+    file.close();
+
+    return decodeConfig(settings, packed, bytesRead) != 0;
+}
+
+// Function to write the journal over with a single record, the old one stays whole until the rename
+bool compactJournal(const uint8_t *record, uint8_t size)
+{
+    File file = LittleFS.open(JOURNAL_COMPACT_FILE, "w");
+    if (!file)
+        return false;
+
+    size_t bytesWritten = file.write(record, size);
     file.close();
 
-    if (bytesRead != sizeof(Settings_t))
+    if (bytesWritten != size || !LittleFS.rename(JOURNAL_COMPACT_FILE, JOURNAL_FILE))
         return false;
 
+    journalStats.compactions++;
+    journalStats.records = 1;
+    journalStats.bytes = size;
+    journalDirty = false;
     return true;
 }
 
-// Function to write settings to LittleFS
+// Function to append settings to the journal, compacting it when full
 bool writeSettings(const Settings_t &settings)
 {
-    File file = LittleFS.open(SETTINGS_FILE, "w");
+    uint8_t packed[CONFIG_PACKED_SIZE];
+    uint8_t packedSize;
+    encodeConfig(settings, packed, packedSize);
+
+    uint8_t record[JOURNAL_RECORD_SIZE(CONFIG_PACKED_SIZE)];
+    uint8_t size = encodeJournalRecord(journalSequence + 1, packed, packedSize, record);
+
+    bool written;
+    if (journalDirty || journalStats.bytes + size > JOURNAL_SIZE)
+    {
+        written = compactJournal(record, size);
+    }
+    else
+    {
+        File file = LittleFS.open(JOURNAL_FILE, "a");
+        if (!file)
+            return false;
+
+        written = file.write(record, size) == size;
+        file.close();
+
+        if (written)
+        {
+            journalStats.records++;
+            journalStats.bytes += size;
+        }
+        else
+        {
+            journalDirty = true; // Part of a record may have made it, start clean next time
+        }
+    }
+
+    if (!written)
+        return false;
+
+    journalSequence++;
+    journalStats.writes++;
+
+    // The journal has it, a boot image that did not take is only slower to boot from
+    writeBootSettings(settings, journalSequence);
+    return true;
+}
+
+// Function to read the newest intact record from the journal
+bool readJournal(Settings_t &settings)
+{
+    File file = LittleFS.open(JOURNAL_FILE, "r");
     if (!file)
         return false;
 
-    size_t bytesWritten = file.write((char *)&settings, sizeof(Settings_t));
+    static uint8_t image[JOURNAL_SIZE + JOURNAL_RECORD_SIZE(CONFIG_PACKED_SIZE)]; // Room for an append that went past the size
+    size_t bytesRead = file.read(image, sizeof(image));
+    bool truncated = file.available() > 0;
     file.close();
 
-    if (bytesWritten != sizeof(Settings_t))
+    JournalScan_t scan = scanJournal(image, bytesRead);
+    journalSequence = scan.sequence;
+    journalStats.records = scan.records;
+    journalStats.bytes = bytesRead;
+    journalStats.damaged = scan.damaged;
+    journalDirty = scan.damaged || truncated;
+
+    if (!scan.found)
         return false;
-    return true;
+
+    return decodeConfig(settings, &image[scan.offset], scan.length) != 0;
 }
 
 // Function to load settings (with default fallback)
@@ -48,28 +186,68 @@ bool loadSettings(Settings_t &settings)
     if (!initLittleFS())
         return false;
 
-    if (!LittleFS.exists(SETTINGS_FILE))
-        return writeSettings(settings);
+    // Decode over a copy of the boot image or defaults, a config saved by older firmware only carries its own fields
+    Settings_t storedSettings = settings;
 
-    Settings_t storedSettings;
+    if (readJournal(storedSettings))
+    {
+        settings = storedSettings;
+        return true;
+    }
 
+    // Nothing in the journal yet, carry over a config saved before there was one. The raw struct of the first firmware
+    // does not survive a layout change, so it is dropped rather than left in the filesystem
+    LittleFS.remove(LEGACY_SETTINGS_FILE);
     if (!readSettings(storedSettings))
-        return writeSettings(settings);
-    else {
-        if (storedSettings.version != VERSION) // Version mismatch
-            return writeSettings(settings);
-        else
-            settings = storedSettings;
-    }
+        return false; // Defaults, nothing is written until the first save
+
+    settings = storedSettings;
+    if (writeSettings(settings))
+        LittleFS.remove(SETTINGS_FILE);
+
     return true;
 }
 
-void init(Settings_t &settings)
+// Loads the journal over the boot image or defaults, returns true if it held something newer than the boot image
+bool init(Settings_t &settings)
 {
-    loadSettings(settings);
+    if (!loadSettings(settings) || (bootFound && bootSequence == journalSequence))
+        return false;
+
+    pendingSettings = settings;
+    bootStale = true;
+    return true;
 }
 
+// Saves wait for serviceSave(), flash writes pause the keyer core
 void save(Settings_t &settings)
 {
-    writeSettings(settings);
-}
\ No newline at end of file
+    pendingSettings = settings;
+    journalStats.pending = true;
+}
+
+// Function to write a pending save once keying has stopped, called every pass of loop()
+void serviceSave(bool keyerIdle)
+{
+    if (!keyerIdle || (!journalStats.pending && !bootStale))
+        return;
+
+    uint32_t start = micros();
+    if (journalStats.pending)
+    {
+        if (!writeSettings(pendingSettings))
+            journalStats.failures++;
+    }
+    else
+    {
+        writeBootSettings(pendingSettings, journalSequence); // Tried once a boot, a bad sector must not be hammered
+    }
+    journalStats.pending = false;
+    bootStale = false;
+    uint32_t writeTime = micros() - start;
+
+    journalStats.lastWriteTime = writeTime;
+    if (writeTime > journalStats.maxWriteTime)
+        journalStats.maxWriteTime = writeTime;
+    histogramAdd(HIST_JOURNAL_WRITE, writeTime);
+}
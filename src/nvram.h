@@ -3,7 +3,11 @@
 
 #include "main.h"
 
-void init(Settings_t &);
+extern JournalStats_t journalStats;
+
+bool loadBootSettings(Settings_t &);
+bool init(Settings_t &);
 void save(Settings_t &);
+void serviceSave(bool keyerIdle);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,118 @@
+#include <Arduino.h>
+#include "main.h"
+#include "playback.h"
+#include "morse.h"
+#include "queue.h"
+
+// Text from SysEx (core0) waiting to be keyed (core1)
+static SpscQueue<char, PLAYBACK_BUFFER_SIZE> text;
+
+// Character being keyed, elements left above a sentinel bit, see morse.h
+static uint8_t pattern = 0;
+static bool charSpacePending = false;
+
+// Status shared with core0
+static volatile bool busy = false;
+static volatile bool stopRequested = false;
+static volatile uint16_t aborts = 0;
+
+/** Queues as much text as fits, returns the number of characters taken */
+uint8_t appendPlaybackText(const uint8_t *data, uint8_t length)
+{
+  uint8_t accepted = 0;
+  while (accepted < length && text.push((char)data[accepted]))
+    accepted++;
+  return accepted;
+}
+
+/** Characters that can still be queued, the host streams long messages against this */
+uint16_t playbackFree()
+{
+  return PLAYBACK_BUFFER_SIZE - text.size();
+}
+
+/** Characters queued and not yet started */
+uint16_t playbackQueued()
+{
+  return text.size();
+}
+
+/** True while the keyer is sending text */
+bool playbackBusy()
+{
+  return busy;
+}
+
+/** Number of times key input cut playback short, wraps */
+uint16_t playbackAborts()
+{
+  return aborts;
+}
+
+/** Asks the keyer to drop all queued text and stop */
+void requestPlaybackStop()
+{
+  stopRequested = true;
+}
+
+/** True if there is text left to key */
+bool playbackPending()
+{
+  return pattern > 1 || charSpacePending || text.size() > 0;
+}
+
+/** Returns the next element or space to key, PLAY_NONE once the text runs out. Characters without a code are skipped. */
+PlaybackStep_t nextPlaybackStep()
+{
+  while (true)
+  {
+    if (pattern > 1)
+    {
+      PlaybackStep_t step = (pattern & 1) ? PlaybackStep_t::PLAY_DAH : PlaybackStep_t::PLAY_DIT;
+      pattern >>= 1;
+      charSpacePending = (pattern == 1);
+      return step;
+    }
+
+    if (charSpacePending)
+    {
+      charSpacePending = false;
+      return PlaybackStep_t::PLAY_CHAR_SPACE;
+    }
+
+    char c;
+    if (!text.pop(c))
+      return PlaybackStep_t::PLAY_NONE;
+
+    if (c == ' ')
+      return PlaybackStep_t::PLAY_WORD_SPACE;
+
+    pattern = morseEncode(c);
+  }
+}
+
+/** Returns true once after core0 asked for playback to stop */
+bool takePlaybackStop()
+{
+  if (!stopRequested)
+    return false;
+
+  stopRequested = false;
+  return true;
+}
+
+/** Drops the queued text and the character in progress */
+void clearPlayback(bool aborted)
+{
+  text.clear();
+  pattern = 0;
+  charSpacePending = false;
+  if (aborted)
+    aborts = aborts + 1;
+}
+
+/** Published by the keyer for the status report */
+void setPlaybackBusy(bool state)
+{
+  busy = state;
+}
@@ -0,0 +1,21 @@
+#ifndef PLAYBACK_H
+#define PLAYBACK_H
+
+#include "main.h"
+
+// Host side (core0), text in and status out
+uint8_t appendPlaybackText(const uint8_t *text, uint8_t length);
+uint16_t playbackFree();
+uint16_t playbackQueued();
+bool playbackBusy();
+uint16_t playbackAborts();
+void requestPlaybackStop();
+
+// Keyer side (core1), text out as element timing steps
+bool playbackPending();
+PlaybackStep_t nextPlaybackStep();
+bool takePlaybackStop();
+void clearPlayback(bool aborted);
+void setPlaybackBusy(bool busy);
+
+#endif
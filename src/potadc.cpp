@@ -0,0 +1,91 @@
+#include <Arduino.h>
+#include <hardware/adc.h>
+#include <hardware/dma.h>
+#include <hardware/clocks.h>
+#include "main.h"
+#include "potadc.h"
+
+#define POT_RING_BYTES (SPEED_POT_RING_SIZE * sizeof(uint16_t))
+#define POT_RING_BITS (__builtin_ctz(POT_RING_BYTES))
+
+static_assert((SPEED_POT_RING_SIZE & (SPEED_POT_RING_SIZE - 1)) == 0, "SPEED_POT_RING_SIZE must be a power of two");
+
+// The DMA wraps its write address on the ring size, so the ring is aligned to it
+static volatile uint16_t ring[SPEED_POT_RING_SIZE] __attribute__((aligned(POT_RING_BYTES)));
+static int dmaChannel = -1;
+static int potPin = -1;
+
+/** Starts the DMA writing ADC results into the ring from a sample index on, for as long as a transfer count lasts */
+static void startRing(uint16_t from)
+{
+  dma_channel_set_trans_count(dmaChannel, 0xFFFFFFFF, false); // 49 days at a sample a millisecond
+  dma_channel_set_write_addr(dmaChannel, &ring[from & (SPEED_POT_RING_SIZE - 1)], true);
+}
+
+/** Converts an ADC pin free running into the ring, false if it is not an ADC pin or there is no DMA channel */
+bool beginPotAdc(uint8_t pin)
+{
+  endPotAdc();
+  if (pin < SPEED_POT_FIRST_PIN || pin > SPEED_POT_LAST_PIN)
+    return false;
+
+  if (dmaChannel < 0)
+    dmaChannel = dma_claim_unused_channel(false);
+  if (dmaChannel < 0)
+    return false;
+
+  adc_init();
+  adc_gpio_init(pin);
+  adc_select_input(pin - SPEED_POT_FIRST_PIN);
+  adc_fifo_setup(true, true, 1, false, false); // Every result to the FIFO and a DMA request, 12 bits
+  adc_set_clkdiv((float)clock_get_hz(clk_adc) * SPEED_POT_SAMPLE_US / 1000000 - 1);
+  adc_fifo_drain();
+
+  // Half words from the FIFO into the ring, paced by the ADC
+  dma_channel_config config = dma_channel_get_default_config(dmaChannel);
+  channel_config_set_transfer_data_size(&config, DMA_SIZE_16);
+  channel_config_set_read_increment(&config, false);
+  channel_config_set_write_increment(&config, true);
+  channel_config_set_ring(&config, true, POT_RING_BITS);
+  channel_config_set_dreq(&config, DREQ_ADC);
+  dma_channel_configure(dmaChannel, &config, ring, &adc_hw->fifo, 0, false);
+
+  for (uint16_t i = 0; i < SPEED_POT_RING_SIZE; i++)
+    ring[i] = 0;
+  startRing(0);
+  adc_run(true);
+
+  potPin = pin;
+  return true;
+}
+
+/** Stops the conversions and lets go of the pin */
+void endPotAdc()
+{
+  if (potPin < 0)
+    return;
+
+  adc_run(false);
+  dma_channel_abort(dmaChannel);
+  adc_fifo_drain();
+  pinMode(potPin, INPUT);
+  potPin = -1;
+}
+
+/** The samples, read up to potAdcHead() */
+const volatile uint16_t *potAdcRing()
+{
+  return ring;
+}
+
+/** Index the DMA writes the next sample to, restarting it once the transfer count has run out */
+uint16_t potAdcHead()
+{
+  if (potPin < 0)
+    return 0;
+
+  uint16_t head = ((uintptr_t)dma_channel_hw_addr(dmaChannel)->write_addr - (uintptr_t)ring) / sizeof(uint16_t);
+  if (!dma_channel_is_busy(dmaChannel))
+    startRing(head);
+  return head & (SPEED_POT_RING_SIZE - 1);
+}
@@ -0,0 +1,16 @@
+#ifndef POTADC_H
+#define POTADC_H
+
+#include "main.h"
+
+// One ADC input converting free running into a DMA ring, so reading the
+// speed knob never waits on a conversion. The ring holds SPEED_POT_RING_SIZE
+// 12 bit samples, potAdcHead() is where the DMA writes next and the reader
+// keeps its own tail. Implemented by potadc.cpp on the device and by the
+// simulated HAL on the host.
+bool beginPotAdc(uint8_t pin);
+void endPotAdc();
+const volatile uint16_t *potAdcRing();
+uint16_t potAdcHead();
+
+#endif
@@ -0,0 +1,150 @@
+#include <Arduino.h>
+#include "main.h"
+#include "ptt.h"
+#include "keyer.h"
+#include "timers.h"
+#include "trace.h"
+#include "selftest.h"
+
+static bool pttOn = false;
+static bool rfOn = false;                  // Output of the first keyer as switched, after the lead time
+static uint8_t tailTimer = TIMER_NONE;     // Drops PTT once the tail has passed
+static uint8_t rfEdges[TIMER_POOL_SIZE];   // Output edges waiting out the lead time, oldest first
+static uint32_t rfDeadlines[TIMER_POOL_SIZE];
+static uint8_t rfHead = 0;
+static uint8_t rfCount = 0;
+static uint32_t rfLead = 0; // Lead time of the edges waiting
+
+/** Switches the first keyer's output, PTT is always up before it goes on */
+static void switchRf(bool state)
+{
+  if (state && !pttOn)
+  {
+    pttOn = true;
+    setPtt(true);
+  }
+
+  rfOn = state;
+  setOutput(0, state);
+  selfTestOutput(0, state, micros());
+}
+
+/** Tail timer, the output has been off long enough */
+static void onPttTail(uint32_t)
+{
+  tailTimer = TIMER_NONE;
+  pttOn = false;
+  setPtt(false);
+}
+
+/** Holds PTT for the tail after the output went off, dropped at once with no tail or no free timer */
+static void startTail(uint32_t now)
+{
+  timerCancel(tailTimer);
+
+  uint32_t tail = settings.pttTail * PTT_TAIL_UNIT_US;
+  if (tail)
+    tailTimer = timerStart(now + tail, onPttTail, 0);
+
+  if (tailTimer == TIMER_NONE)
+    onPttTail(0);
+}
+
+/** Output edge timer, the lead time has passed */
+static void onRfEdge(uint32_t state)
+{
+  rfHead = (rfHead + 1) % TIMER_POOL_SIZE;
+  rfCount--;
+
+  switchRf(state);
+  if (!state && rfCount == 0)
+    startTail(micros());
+}
+
+/** Drops the output edges still waiting out the lead time */
+static void cancelRfEdges()
+{
+  for (; rfCount; rfCount--)
+  {
+    timerCancel(rfEdges[rfHead]);
+    rfHead = (rfHead + 1) % TIMER_POOL_SIZE;
+  }
+  rfHead = 0;
+}
+
+/** Keyer output hook, the first keyer's output goes through PTT sequencing when a PTT output is set */
+void keyOutput(uint8_t k, bool state)
+{
+  uint32_t now = micros();
+  traceOutput(k, state, now);
+
+  if (k != 0 || settings.pttMode == gpioOutputMode_t::OUTPUT_DISABLED)
+  {
+    setOutput(k, state);
+    selfTestOutput(k, state, now);
+    return;
+  }
+
+  // A key down inside the tail keeps PTT up, otherwise it starts the lead time
+  if (state)
+  {
+    timerCancel(tailTimer);
+    if (!pttOn)
+    {
+      pttOn = true;
+      setPtt(true);
+    }
+  }
+
+  // Every edge of a transmission is delayed by the same lead, element lengths stay as keyed. A
+  // changed lead waits for the output to be off with no edge delayed, or it would stretch an
+  // element or switch edges out of order
+  if (rfCount == 0 && !rfOn)
+    rfLead = settings.pttLead * PTT_LEAD_UNIT_US;
+
+  if (rfLead)
+  {
+    uint8_t timer = rfCount < TIMER_POOL_SIZE ? timerStart(now + rfLead, onRfEdge, state) : TIMER_NONE;
+    if (timer != TIMER_NONE)
+    {
+      rfEdges[(rfHead + rfCount) % TIMER_POOL_SIZE] = timer;
+      rfDeadlines[(rfHead + rfCount) % TIMER_POOL_SIZE] = now + rfLead;
+      rfCount++;
+      return;
+    }
+
+    cancelRfEdges(); // No timer free, skip what was waiting rather than switch out of order
+  }
+
+  switchRf(state);
+  if (!state)
+    startTail(now);
+}
+
+/** Output off and PTT down straight away, for a keyer being stopped */
+void resetPtt()
+{
+  cancelRfEdges();
+  timerCancel(tailTimer);
+
+  if (rfOn)
+    switchRf(false);
+  if (pttOn)
+    onPttTail(0);
+}
+
+/** Deadline of the next output edge waiting out the lead time, for the state alarm to switch it on time. False if none is */
+bool pttNextEdge(uint32_t &deadline)
+{
+  if (rfCount == 0)
+    return false;
+
+  deadline = rfDeadlines[rfHead];
+  return true;
+}
+
+/** True while PTT is up */
+bool pttActive()
+{
+  return pttOn;
+}
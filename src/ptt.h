@@ -0,0 +1,15 @@
+#ifndef PTT_H
+#define PTT_H
+
+#include "main.h"
+
+// PTT sequencing of the first keyer's transmitter. PTT goes up with the key,
+// the output follows settings.pttLead later and PTT drops settings.pttTail
+// after the output last went off, so RF is never keyed without PTT. Timed on
+// the shared timer wheel, see timers.h
+void keyOutput(uint8_t k, bool state);
+void resetPtt();
+bool pttNextEdge(uint32_t &deadline);
+bool pttActive();
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <Arduino.h>
+
+// Lock-free single producer/single consumer queue. Safe between an IRQ and
+// loop(), or between core0 and core1, as long as each side only calls its
+// own half (push or pop). N must be a power of two.
+template <typename T, uint32_t N>
+class SpscQueue {
+public:
+  // Producer: returns false if the queue is full
+  bool push(const T &item)
+  {
+    uint32_t head = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+    if (head - __atomic_load_n(&tail_, __ATOMIC_ACQUIRE) >= N)
+      return false;
+
+    items_[head & (N - 1)] = item;
+    __atomic_store_n(&head_, head + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  // Consumer: returns false if the queue is empty
+  bool pop(T &item)
+  {
+    uint32_t tail = __atomic_load_n(&tail_, __ATOMIC_RELAXED);
+    if (tail == __atomic_load_n(&head_, __ATOMIC_ACQUIRE))
+      return false;
+
+    item = items_[tail & (N - 1)];
+    __atomic_store_n(&tail_, tail + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  // Consumer: drops everything queued
+  void clear()
+  {
+    __atomic_store_n(&tail_, __atomic_load_n(&head_, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+  }
+
+  // Number of queued items, either side
+  uint32_t size() const
+  {
+    return __atomic_load_n(&head_, __ATOMIC_ACQUIRE) - __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+  }
+
+private:
+  static_assert((N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+
+  T items_[N];             // Queue storage
+  uint32_t head_ = 0;      // Next slot to write, producer only
+  uint32_t tail_ = 0;      // Next slot to read, consumer only
+};
+
+// Latest-wins single slot between one producer and one consumer, for state
+// where only the newest value matters. A post replaces whatever has not been
+// taken yet, so the producer never has to drop one. The slot is guarded by a
+// sequence count, odd while a post is being written.
+template <typename T>
+class Mailbox {
+public:
+  // Producer: replaces any item not taken yet
+  void post(const T &item)
+  {
+    uint32_t seq = __atomic_load_n(&seq_, __ATOMIC_RELAXED);
+    __atomic_store_n(&seq_, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    item_ = item;
+    __atomic_store_n(&seq_, seq + 2, __ATOMIC_RELEASE);
+  }
+
+  // Consumer: returns false if nothing new was posted, or a post is still
+  // being written and has to be taken on a later call
+  bool take(T &item)
+  {
+    uint32_t seq = __atomic_load_n(&seq_, __ATOMIC_ACQUIRE);
+    if (seq == taken_ || (seq & 1))
+      return false;
+
+    item = item_;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&seq_, __ATOMIC_RELAXED) != seq)
+      return false;
+
+    taken_ = seq;
+    return true;
+  }
+
+  // Consumer: true if a post has not been taken yet
+  bool pending() const
+  {
+    return __atomic_load_n(&seq_, __ATOMIC_ACQUIRE) != taken_;
+  }
+
+private:
+  T item_ = {};            // Last item posted
+  uint32_t seq_ = 0;       // Posts started and finished, odd mid-post
+  uint32_t taken_ = 0;     // Sequence of the last item taken, consumer only
+};
+
+#endif // QUEUE_H
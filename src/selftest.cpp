@@ -0,0 +1,250 @@
+#include <Arduino.h>
+#include <algorithm>
+#include <BitPacker.hpp>
+#include "main.h"
+#include "selftest.h"
+#include "keyer.h"
+#include "timers.h"
+#include "speedpot.h"
+
+static_assert(SELF_TEST_MAX_PRESSES < (1 << 14), "Self-test presses are counted in 14 bits");
+static_assert((SELF_TEST_BITS + 6) / 7 + 4 <= MAX_SYSEX_LENGTH, "Self-test results do not fit in a SysEx message");
+
+volatile bool selfTestRunning = false;
+
+// Set by core0 for the keyer to act on next pass
+static volatile bool requested = false;
+static uint8_t requestPin = 0;
+static uint16_t requestPresses = 0;
+
+// The test, core1
+static uint8_t testPin = 0;
+static uint16_t testPresses = 0;
+static uint16_t pressesDriven = 0; // Published to core0 with release, driveTime is the last one's
+static uint32_t driveTime = 0;
+static bool pressed = false;
+static bool outputWaiting = false; // The last press has not switched the output on yet
+static uint8_t edgeTimer = TIMER_NONE;
+static uint32_t testRandom = 1;
+static uint16_t outputLatencies[SELF_TEST_MAX_PRESSES];
+static uint16_t outputCount = 0; // Published to core0 with release, latencies below it are complete
+
+// Notes, core0
+static uint16_t noteLatencies[SELF_TEST_MAX_PRESSES];
+static uint16_t noteCount = 0;
+static uint16_t notePress = 0; // Press the last timed note followed
+
+/** xorshift32, seeded from the clock when a test starts */
+static uint32_t nextTestRandom()
+{
+  testRandom ^= testRandom << 13;
+  testRandom ^= testRandom >> 17;
+  testRandom ^= testRandom << 5;
+  return testRandom;
+}
+
+/** Latency in microseconds, capped at what a SysEx reply carries */
+static inline uint16_t latency(uint32_t from, uint32_t to)
+{
+  uint32_t elapsed = to - from;
+  return elapsed > UINT16_MAX ? UINT16_MAX : elapsed;
+}
+
+/** Asks the keyer to start a test of presses on a pin, none stops one that is running */
+void requestSelfTest(uint8_t pin, uint16_t presses)
+{
+  if (presses)
+  {
+    noteCount = 0;
+    notePress = 0;
+  }
+  requestPin = pin;
+  requestPresses = presses < SELF_TEST_MAX_PRESSES ? presses : SELF_TEST_MAX_PRESSES;
+  requested = true;
+}
+
+/** True if the test may drive a pin: an input the first keyer does not switch an output, PTT, LED or knob on */
+static bool testPinFree(uint8_t pin)
+{
+  if (pin >= INPUT_GPIO_COUNT || keyers.keyMode[0] == keyMode_t::KEY_NONE)
+    return false;
+
+  for (uint8_t k = 0; k < keyers.count; k++)
+  {
+    if (keyers.outputMode[k] != gpioOutputMode_t::OUTPUT_DISABLED && keyers.outputPin[k] == pin)
+      return false;
+  }
+  if (settings.pttMode != gpioOutputMode_t::OUTPUT_DISABLED && settings.gpio.ptt == pin)
+    return false;
+  if (settings.ledMode == ledMode_t::LED_NORMAL && settings.gpio.normalLED == pin)
+    return false;
+  if (settings.ledMode == ledMode_t::LED_RGB && settings.gpio.rgbLED == pin)
+    return false;
+  return !(speedPotActive() && settings.gpio.speedPot == pin);
+}
+
+/** Ends the test with the key released, after the last press or when stopped */
+static void finishSelfTest()
+{
+  timerCancel(edgeTimer);
+  if (pressed)
+    driveTestPin(testPin, false);
+  pressed = false;
+  outputWaiting = false;
+  selfTestRunning = false;
+}
+
+/** Press and release timer: holds long enough for any debounce to take the press, rests until the keyer is idle again */
+static void onTestEdge(uint32_t)
+{
+  edgeTimer = TIMER_NONE;
+  uint32_t now = micros();
+  uint32_t window = std::max(settings.straightDebounce, std::max(settings.ditDebounce, settings.dahDebounce)) * DEBOUNCE_TICK_US;
+  uint32_t dit = settings.timings.dit >> TIMING_FRACTION_BITS;
+
+  if (pressed)
+  {
+    pressed = false;
+    driveTestPin(testPin, false);
+    edgeTimer = timerStart(now + window + dit * 4 + nextTestRandom() % (dit * 2 + 1), onTestEdge, 0);
+  }
+  else if (pressesDriven < testPresses)
+  {
+    driveTime = micros();
+    __atomic_store_n(&pressesDriven, pressesDriven + 1, __ATOMIC_RELEASE);
+    pressed = true;
+    outputWaiting = true;
+    driveTestPin(testPin, true);
+    edgeTimer = timerStart(now + window + dit / 4 + nextTestRandom() % (dit + 1), onTestEdge, 0);
+  }
+
+  if (edgeTimer == TIMER_NONE)
+    finishSelfTest(); // All pressed, or no timer free
+}
+
+/** Starts or stops the test core0 asked for. Call with interrupts off */
+void processSelfTestRequest(uint32_t now)
+{
+  if (!requested)
+    return;
+  requested = false;
+
+  stopSelfTest();
+  if (requestPresses == 0)
+    return; // Stopped, the results so far stay for core0 to read
+
+  // A refused test reports no presses
+  testPin = requestPin;
+  testPresses = 0;
+  __atomic_store_n(&pressesDriven, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&outputCount, 0, __ATOMIC_RELEASE);
+  if (!testPinFree(testPin))
+    return;
+
+  // A spare pin only switches between input and driven low, a key pin keeps its pull-up
+  if (!(keyInputPins() & (1u << testPin)))
+    pinMode(testPin, INPUT);
+
+  testPresses = requestPresses;
+  testRandom = now | 1;
+
+  // Starts from a rest, whatever the key was doing has finished
+  edgeTimer = timerStart(now + (settings.timings.dit >> TIMING_FRACTION_BITS) * 4, onTestEdge, 0);
+  selfTestRunning = edgeTimer != TIMER_NONE;
+}
+
+/** Stops a running test, the key is released and the presses timed so far are kept. Call with interrupts off */
+void stopSelfTest()
+{
+  if (selfTestRunning)
+    finishSelfTest();
+}
+
+/** Times the first output on after a press, later ones before the next press are the keyer's own. Call with interrupts off */
+void selfTestOutputEdge(uint32_t time)
+{
+  if (!outputWaiting)
+    return;
+  outputWaiting = false;
+
+  uint16_t count = outputCount;
+  outputLatencies[count] = latency(driveTime, time);
+  __atomic_store_n(&outputCount, count + 1, __ATOMIC_RELEASE);
+}
+
+/** Times the first note on written to USB after a press, on core0. The next press is a rest away, well after it */
+void selfTestNote(uint8_t k, bool state, uint32_t time)
+{
+  if (!selfTestRunning || k != 0 || !state)
+    return;
+
+  uint16_t press = __atomic_load_n(&pressesDriven, __ATOMIC_ACQUIRE);
+  if (press == notePress || noteCount >= SELF_TEST_MAX_PRESSES)
+    return;
+
+  notePress = press;
+  noteLatencies[noteCount++] = latency(driveTime, time);
+}
+
+/** Minimum, mean, 99th percentile and maximum of the latencies, put in order as far as the percentile needs */
+static void latencyStats(uint16_t *latencies, uint16_t count, SelfTestStats_t &stats)
+{
+  stats = {};
+  stats.count = count;
+  if (count == 0)
+    return;
+
+  uint32_t sum = 0;
+  stats.min = UINT16_MAX;
+  for (uint16_t i = 0; i < count; i++)
+  {
+    sum += latencies[i];
+    stats.min = std::min(stats.min, latencies[i]);
+    stats.max = std::max(stats.max, latencies[i]);
+  }
+  stats.mean = (sum + count / 2) / count;
+
+  uint16_t *p99 = latencies + (count * 99 + 99) / 100 - 1;
+  std::nth_element(latencies, p99, latencies + count);
+  stats.p99 = *p99;
+}
+
+/** Output and note latency of the last test, false while it is still running. core0 */
+bool selfTestResults(SelfTestStats_t &output, SelfTestStats_t &note)
+{
+  if (selfTestRunning || requested)
+    return false;
+
+  latencyStats(outputLatencies, __atomic_load_n(&outputCount, __ATOMIC_ACQUIRE), output);
+  latencyStats(noteLatencies, noteCount, note);
+  return true;
+}
+
+/** Packs one set of latency stats */
+template <uint16_t N>
+static void packStats(BitPacker<N> &packer, const SelfTestStats_t &stats)
+{
+  packer.addField(stats.count, 14);
+  packer.addField(stats.min, 16);
+  packer.addField(stats.mean, 16);
+  packer.addField(stats.p99, 16);
+  packer.addField(stats.max, 16);
+}
+
+/** Packs the test state and, once it has finished, the output and note latencies */
+void encodeSelfTest(uint8_t *out, uint8_t &outSize)
+{
+  BitPacker<SELF_TEST_BITS> packer;
+  SelfTestStats_t output = {};
+  SelfTestStats_t note = {};
+  bool finished = selfTestResults(output, note);
+
+  bool starting = requested && requestPresses; // A stop keeps the test it stops
+  packer.addField(!finished, 1);
+  packer.addField(starting ? requestPin : testPin, 7);
+  packer.addField(starting ? requestPresses : testPresses, 14);
+  packer.addField(__atomic_load_n(&pressesDriven, __ATOMIC_ACQUIRE), 14);
+  packStats(packer, output);
+  packStats(packer, note);
+  packer.pack7Bit(out, outSize);
+}
@@ -0,0 +1,50 @@
+#ifndef SELFTEST_H
+#define SELFTEST_H
+
+#include "main.h"
+
+// Key to output latency self-test over a GPIO loopback. core0 asks for a
+// test with CMD_SELF_TEST, the keyer (core1) then presses and releases the
+// first keyer's key by driving a spare GPIO wired back to its key input,
+// or the key pin itself with nothing wired. The pin is driven open drain,
+// pulled low to press and let go to the pull-up to release, so it never
+// fights a real key on the same pin. Presses come at random times off the
+// timer wheel, each one timed from the moment it was driven to the first
+// keyer's output switching on, on core1, and to its note on being written
+// to USB, on core0. Changing the settings ends a test.
+struct SelfTestStats_t
+{
+    uint16_t count; // Presses timed
+    uint16_t min;   // Microseconds, each latency capped at 16 bits
+    uint16_t mean;
+    uint16_t p99;
+    uint16_t max;
+};
+
+#define SELF_TEST_STATS_BITS (14 + 4 * 16)
+#define SELF_TEST_BITS (1 + 7 + 14 + 14 + 2 * SELF_TEST_STATS_BITS) // Running, pin, presses asked for and driven, output and note
+
+extern volatile bool selfTestRunning;
+
+// core0
+void requestSelfTest(uint8_t pin, uint16_t presses);
+void selfTestNote(uint8_t k, bool state, uint32_t time);
+bool selfTestResults(SelfTestStats_t &output, SelfTestStats_t &note);
+void encodeSelfTest(uint8_t *out, uint8_t &outSize);
+
+// core1
+void processSelfTestRequest(uint32_t now);
+void stopSelfTest();
+void selfTestOutputEdge(uint32_t time);
+
+/** Times the first keyer's output switching on, a single test when no self-test is running. Call with interrupts off */
+inline void selfTestOutput(uint8_t k, bool state, uint32_t time)
+{
+    if (selfTestRunning && k == 0 && state)
+        selfTestOutputEdge(time);
+}
+
+// Drive hook, a self-test press or release on a GPIO: open drain on the device, a wired loopback on the host
+void driveTestPin(uint8_t pin, bool pressed);
+
+#endif
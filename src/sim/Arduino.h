@@ -0,0 +1,48 @@
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+// Minimal Arduino core shim for the [env:native] host build. Time and pins
+// are backed by the simulated HAL in hal.cpp rather than real hardware.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef unsigned int uint;
+
+enum PinMode
+{
+    INPUT = 0x0,
+    OUTPUT = 0x1,
+    INPUT_PULLUP = 0x2,
+    INPUT_PULLDOWN = 0x3
+};
+
+enum PinStatus
+{
+    LOW = 0,
+    HIGH = 1,
+    CHANGE = 2,
+    FALLING = 3,
+    RISING = 4
+};
+
+typedef void (*voidFuncPtrParam)(void *);
+
+#define digitalPinToInterrupt(p) (p)
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// Single threaded simulation, alarms only fire between loop() passes
+#define noInterrupts()
+#define interrupts()
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void pinMode(uint8_t pin, PinMode mode);
+PinStatus digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, PinStatus value);
+void attachInterruptParam(uint8_t pin, voidFuncPtrParam callback, PinStatus mode, void *param);
+void detachInterrupt(uint8_t pin);
+
+#endif
@@ -0,0 +1,154 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <BitPacker.hpp>
+#include "../main.h"
+#include "sim.h"
+
+#define BENCH_ROUNDS 20000     // Random round trips per capacity
+#define BENCH_ITERATIONS 200000 // Timed encodes/decodes per packer
+#define BENCH_MAX_FIELDS 40
+
+static uint32_t benchRandom = 0x9E3779B9;
+
+/** xorshift32, fixed seed so failures reproduce */
+static uint32_t nextRandom()
+{
+  benchRandom ^= benchRandom << 13;
+  benchRandom ^= benchRandom >> 17;
+  benchRandom ^= benchRandom << 5;
+  return benchRandom;
+}
+
+static uint64_t nextRandom64()
+{
+  return ((uint64_t)nextRandom() << 32) | nextRandom();
+}
+
+/** Packs the same random fields with both packers and checks the wire bytes and the fields read back, returns mismatches */
+template <uint16_t N>
+static uint32_t roundTrip(uint32_t rounds)
+{
+  uint32_t failures = 0;
+
+  for (uint32_t round = 0; round < rounds; round++)
+  {
+    DynamicBitPacker reference(N);
+    BitPacker<N> packer;
+    uint64_t values[BENCH_MAX_FIELDS];
+    uint8_t bits[BENCH_MAX_FIELDS];
+    uint8_t fields = 0;
+
+    // Keep adding until a field is refused, the overflow has to match too
+    while (fields < BENCH_MAX_FIELDS)
+    {
+      bits[fields] = 1 + nextRandom() % 64;
+      values[fields] = nextRandom64(); // Bits above the field width must be ignored
+      bool added = reference.addField(values[fields], bits[fields]);
+      if (added != packer.addField(values[fields], bits[fields]))
+        failures++;
+      if (!added)
+        break;
+      fields++;
+    }
+
+    uint8_t expected[MAX_SYSEX_LENGTH * 8], actual[MAX_SYSEX_LENGTH * 8];
+    uint8_t expectedSize, actualSize;
+    reference.pack7Bit(expected, expectedSize);
+    packer.pack7Bit(actual, actualSize);
+
+    if (expectedSize != actualSize || memcmp(expected, actual, actualSize) != 0)
+    {
+      failures++;
+      continue;
+    }
+
+    // Junk in the top bit of each byte must be ignored
+    for (uint8_t i = 0; i < actualSize; i++)
+      actual[i] |= nextRandom() & 0x80;
+
+    // Both refuse a message whose 7-bit padding runs past their capacity
+    bool unpacked = packer.unpack7Bit(actual, actualSize);
+    if (unpacked != reference.unpack7Bit(expected, expectedSize))
+      failures++;
+    if (!unpacked)
+      continue;
+
+    for (uint8_t i = 0; i < fields; i++)
+    {
+      uint64_t mask = bits[i] == 64 ? ~0ULL : (1ULL << bits[i]) - 1;
+      uint64_t value = packer.extractField(bits[i]);
+      if (value != (values[i] & mask) || value != reference.extractField(bits[i]))
+        failures++;
+    }
+  }
+
+  // Oversized input is refused by both
+  uint8_t input[N / 7 + 1] = {};
+  DynamicBitPacker reference(N);
+  BitPacker<N> packer;
+  if (packer.unpack7Bit(input, sizeof(input)) != reference.unpack7Bit(input, sizeof(input)))
+    failures++;
+
+  return failures;
+}
+
+/** Times a stats sized message, nine 32-bit fields, through encode and decode */
+template <typename Packer>
+static double timeMessage(Packer &packer, uint32_t iterations, uint32_t &checksum)
+{
+  uint8_t out[MAX_SYSEX_LENGTH];
+  uint8_t outSize;
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    packer.reset();
+    for (uint32_t field = 0; field < 9; field++)
+      packer.addField(i * 2654435761u + field, 32);
+    packer.pack7Bit(out, outSize);
+
+    packer.unpack7Bit(out, outSize);
+    for (uint32_t field = 0; field < 9; field++)
+      checksum += (uint32_t)packer.extractField(32);
+  }
+
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+/** Round trip equivalence against DynamicBitPacker, then encode/decode time for each */
+int benchBitPacker(int argc, char **argv)
+{
+  uint32_t iterations = BENCH_ITERATIONS;
+
+  // Optional overrides: bitpacker [iterations]
+  if (argc > 0)
+    iterations = atoi(argv[0]);
+
+  uint32_t failures = roundTrip<7>(BENCH_ROUNDS) + roundTrip<32>(BENCH_ROUNDS) + roundTrip<128>(BENCH_ROUNDS) +
+                      roundTrip<9 * 32>(BENCH_ROUNDS) + roundTrip<400>(BENCH_ROUNDS);
+  printf("BitPacker round trip vs DynamicBitPacker: %u mismatches over %u messages\n", failures, BENCH_ROUNDS * 5);
+
+  uint32_t referenceSum = 0, packerSum = 0;
+  DynamicBitPacker reference(9 * 32);
+  BitPacker<9 * 32> packer;
+  double referenceNs = timeMessage(reference, iterations, referenceSum);
+  double packerNs = timeMessage(packer, iterations, packerSum);
+
+  printf("%-18s %12s\n", "packer", "ns/message");
+  printf("%-18s %12.1f\n", "DynamicBitPacker", referenceNs);
+  printf("%-18s %12.1f\n", "BitPacker<288>", packerNs);
+  printf("Speedup %.1fx, 9 x 32-bit fields packed, unpacked and extracted per message\n",
+         packerNs > 0 ? referenceNs / packerNs : 0.0);
+
+  if (referenceSum != packerSum)
+  {
+    printf("Checksum mismatch %u vs %u\n", referenceSum, packerSum);
+    failures++;
+  }
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,145 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "../main.h"
+#include "../keyer.h"
+#include "../capture.h"
+#include "sim.h"
+
+#define BENCH_DIT_PIN 3
+#define BENCH_DAH_PIN 29
+#define BENCH_PRESSES 2000
+#define BENCH_BOUNCES 4 // Contact bounces on every press, 200 us apart
+
+static uint32_t benchRandom = 0x9E3779B9;
+
+static uint32_t nextBenchRandom()
+{
+  benchRandom ^= benchRandom << 13;
+  benchRandom ^= benchRandom >> 17;
+  benchRandom ^= benchRandom << 5;
+  return benchRandom;
+}
+
+/** Bounces a paddle contact, the keyer keeps running between bounces */
+static void bounceKey(uint8_t pin, bool pressed, const SimLoop_t &loop)
+{
+  for (int i = 0; i < BENCH_BOUNCES; i++)
+  {
+    simSetKey(pin, pressed);
+    simRunUntil(simTime() + 100, loop);
+    simSetKey(pin, !pressed);
+    simRunUntil(simTime() + 100, loop);
+  }
+  simSetKey(pin, pressed);
+}
+
+/** Presses and releases the dit paddle with contact bounce at a random loop phase. Returns the time to the first output edge and the elements keyed. */
+static double pressLatency(const SimLoop_t &loop, uint32_t &notes)
+{
+  simReset();
+  if (inputCapture)
+    setupCapture();
+
+  simRunUntil(simTime() + 20000 + nextBenchRandom() % 5000, loop);
+  simAdvance(nextBenchRandom() % (loop.period + 1)); // Edge lands part way through a pass
+
+  uint64_t pressTime = simTime();
+  bounceKey(BENCH_DIT_PIN, true, loop);
+
+  while (simEdges().empty() && simTime() < pressTime + 100000)
+    simRunUntil(simTime() + 1, loop);
+
+  // Let go once the bounce has died down, a bounce taken for a press keys another dit
+  simRunUntil(pressTime + 2000, loop);
+  bounceKey(BENCH_DIT_PIN, false, loop);
+  simRunUntil(simTime() + 100000, loop);
+  notes = simNoteCount();
+
+  if (simEdges().empty())
+    return -1;
+
+  return (double)(simEdges()[0].time - pressTime);
+}
+
+/** Paddle press to output latency with polled vs interrupt-captured key edges, settling vs leading edge debounce */
+int benchCapture(int argc, char **argv)
+{
+  SimLoop_t loop = {20, 50, 3000};
+
+  // Optional overrides: capture [period us] [stall every N passes] [max stall us]
+  if (argc > 0)
+    loop.period = atoi(argv[0]);
+  if (argc > 1)
+    loop.stallEvery = atoi(argv[1]);
+  if (argc > 2)
+    loop.stallMax = atoi(argv[2]);
+
+  settings.keyMode = keyMode_t::KEY_PADDLES;
+  settings.gpio.ditPaddle = BENCH_DIT_PIN;
+  settings.gpio.dahPaddle = BENCH_DAH_PIN;
+  settings.wpm = 40 * INTTOFLOATSCALAR;
+  setupWPM();
+
+  printf("Press to output latency, %u bounces, %u us debounce, loop period %u us, stall up to %u us every ~%u passes\n",
+         BENCH_BOUNCES, DEFAULT_DEBOUNCE_US, loop.period, loop.stallMax, loop.stallEvery);
+  printf("%-22s %9s %9s %9s %9s %9s %6s %6s\n", "mode", "min", "mean", "p99", "max", "jitter", "lost", "extra");
+
+  bool savedCapture = inputCapture;
+  debounceMode_t savedDebounce = settings.debounceMode;
+  const debounceMode_t debounceModes[] = {debounceMode_t::DEBOUNCE_SETTLE, debounceMode_t::DEBOUNCE_LEADING};
+  const bool modes[] = {false, true};
+  int result = 0;
+
+  for (debounceMode_t debounce : debounceModes)
+  {
+    for (bool capture : modes)
+    {
+      settings.debounceMode = debounce;
+      inputCapture = capture;
+      benchRandom = 0x9E3779B9;
+
+      std::vector<double> latencies;
+      SimStat_t stat;
+      statReset(stat);
+      uint32_t lost = 0;
+      uint32_t extra = 0;
+
+      for (int i = 0; i < BENCH_PRESSES; i++)
+      {
+        uint32_t notes;
+        double latency = pressLatency(loop, notes);
+        if (notes > 1)
+          extra += notes - 1;
+        if (latency < 0)
+        {
+          lost++;
+          continue;
+        }
+        latencies.push_back(latency);
+        statAdd(stat, latency);
+      }
+
+      std::sort(latencies.begin(), latencies.end());
+      double p99 = latencies.empty() ? 0 : latencies[latencies.size() * 99 / 100];
+
+      // Settling waits out the bounce and a whole window, the leading edge keys on the first contact
+      char name[32];
+      snprintf(name, sizeof(name), "%s, %s", capture ? "edge capture" : "polling",
+               debounce == debounceMode_t::DEBOUNCE_LEADING ? "leading" : "settle");
+      printf("%-22s %9.1f %9.1f %9.1f %9.1f %9.1f %6u %6u\n", name,
+             stat.min, statMean(stat), p99, stat.max, statStdDev(stat), lost, extra);
+
+      if (lost || extra)
+        result = 1;
+    }
+  }
+
+  if (result)
+    printf("FAILED, a press was lost or a bounce keyed an extra element\n");
+
+  settings.debounceMode = savedDebounce;
+  inputCapture = savedCapture;
+  return result;
+}
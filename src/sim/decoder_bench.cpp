@@ -0,0 +1,244 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "../main.h"
+#include "../keyer.h"
+#include "../capture.h"
+#include "../playback.h"
+#include "../decoder.h"
+#include "../morse.h"
+#include "sim.h"
+
+#define BENCH_STRAIGHT_PIN 3
+#define BENCH_WORDS 60          // Random words per run
+#define BENCH_HAND_JITTER 20    // Hand keying error, percent either way on every mark and space
+#define BENCH_USB_FRAME 1000    // USB MIDI is polled once per millisecond
+#define BENCH_HOST_JITTER 4000  // Scheduling delay before a browser sees a note, up to
+#define BENCH_HOST_SPIKE 20000  // Occasional longer stall of the host
+#define BENCH_MAX_ERROR 0.02    // Character error rate the decoder must stay under, it is still learning the speed at first
+
+static const char *benchWordList[] = {"CQ", "TEST", "DE", "PARIS", "5NN", "73", "QTH", "RST", "TU", "K1ABC", "ES", "GL", "NAME", "WX", "UR"};
+
+// Paddle speeds, Farnsworth character spacing and weighting
+struct PaddleRun_t
+{
+  float wpm;
+  float farnsworth;
+  uint8_t weight;
+};
+
+static const PaddleRun_t paddleRuns[] = {{10, 0, 50}, {20, 0, 50}, {30, 0, 50}, {45, 0, 50}, {60, 0, 50}, {25, 12, 50}, {25, 0, 35}, {25, 0, 65}};
+
+// Hand sent speed drifting from start to end over the message
+struct HandRun_t
+{
+  float startWpm;
+  float endWpm;
+  float dahRatio;
+};
+
+static const HandRun_t handRuns[] = {{15, 15, 3.0}, {20, 28, 3.3}, {30, 18, 2.7}, {12, 35, 3.0}, {35, 35, 3.5}};
+
+static uint32_t benchRandom = 0x85EBCA6B;
+
+/** xorshift32, fixed seed so every run sends the same text */
+static uint32_t nextRandom()
+{
+  benchRandom ^= benchRandom << 13;
+  benchRandom ^= benchRandom >> 17;
+  benchRandom ^= benchRandom << 5;
+  return benchRandom;
+}
+
+/** Random factor of 1 +/- percent */
+static double jitter(uint32_t percent)
+{
+  return 1.0 + ((int32_t)(nextRandom() % (2 * percent + 1)) - (int32_t)percent) / 100.0;
+}
+
+static std::string randomText()
+{
+  std::string text;
+  for (int i = 0; i < BENCH_WORDS; i++)
+    text += std::string(i ? " " : "") + benchWordList[nextRandom() % (sizeof(benchWordList) / sizeof(benchWordList[0]))];
+  return text;
+}
+
+/** Decoded text without the word space sent after the last word */
+static std::string trimmed(const std::string &text)
+{
+  size_t end = text.find_last_not_of(' ');
+  return end == std::string::npos ? "" : text.substr(0, end + 1);
+}
+
+/** Edit distance, characters dropped, inserted or changed */
+static uint32_t editDistance(const std::string &a, const std::string &b)
+{
+  std::vector<uint32_t> row(b.size() + 1);
+  for (size_t j = 0; j <= b.size(); j++)
+    row[j] = j;
+
+  for (size_t i = 1; i <= a.size(); i++)
+  {
+    uint32_t diagonal = row[0];
+    row[0] = i;
+    for (size_t j = 1; j <= b.size(); j++)
+    {
+      uint32_t above = row[j];
+      uint32_t cost = diagonal + (a[i - 1] != b[j - 1]);
+      row[j] = cost < above + 1 ? cost : above + 1;
+      row[j] = row[j] < row[j - 1] + 1 ? row[j] : row[j - 1] + 1;
+      diagonal = above;
+    }
+  }
+  return row[b.size()];
+}
+
+/** Feeds the output timeline through the decoder again as a browser would see it, each note delayed by USB and the host */
+static std::string decodeAtHost()
+{
+  std::string decoded = simDecoded();
+  size_t start = decoded.size();
+
+  resetDecoder(settings.wpm);
+  uint64_t last = 0;
+  for (const SimEdge_t &edge : simEdges())
+  {
+    uint64_t frame = (edge.time / BENCH_USB_FRAME + 1) * BENCH_USB_FRAME;
+    uint64_t seen = frame + nextRandom() % BENCH_HOST_JITTER;
+    if (nextRandom() % 100 == 0)
+      seen += nextRandom() % BENCH_HOST_SPIKE;
+    if (seen < last)
+      seen = last; // MIDI arrives in order
+    last = seen;
+    decodeKeyEdge(edge.state, (uint32_t)seen);
+  }
+  decodeIdle((uint32_t)(last + DECODER_MAX_DIT * 10));
+
+  // The hook appends to the same text as the live decoder
+  return simDecoded().substr(start);
+}
+
+/** Sends text from the paddle keyer, returns the character errors in what the decoder made of it */
+static uint32_t paddleText(const std::string &text, const SimLoop_t &loop)
+{
+  simReset();
+
+  for (size_t sent = 0; sent < text.size() || playbackBusy() || playbackPending();)
+  {
+    if (sent < text.size())
+      sent += appendPlaybackText((const uint8_t *)text.data() + sent, text.size() - sent > 60 ? 60 : text.size() - sent);
+    simRunUntil(simTime() + 50000, loop);
+  }
+  simRunUntil(simTime() + (uint64_t)(settings.timings.wordGap >> TIMING_FRACTION_BITS) * 2, loop);
+
+  return editDistance(trimmed(simDecoded()), text);
+}
+
+/** Hand sends text on a straight key with a drifting speed and sloppy timing, returns the character errors at the device and at the host */
+static uint32_t handText(const std::string &text, const HandRun_t &run, const SimLoop_t &loop, uint32_t &hostErrors)
+{
+  simReset();
+  if (inputCapture)
+    setupCapture();
+
+  double time = (double)simTime() + 100000;
+  for (size_t i = 0; i < text.size(); i++)
+  {
+    double wpm = run.startWpm + (run.endWpm - run.startWpm) * i / text.size();
+    double unit = 1200000.0 / wpm;
+
+    if (text[i] == ' ')
+    {
+      time += unit * 4 * jitter(BENCH_HAND_JITTER); // On top of the character space
+      continue;
+    }
+
+    for (uint8_t code = morseEncode(text[i]); code > 1; code >>= 1)
+    {
+      simRunUntil((uint64_t)time, loop);
+      simSetKey(BENCH_STRAIGHT_PIN, true);
+      time += unit * ((code & 1) ? run.dahRatio : 1) * jitter(BENCH_HAND_JITTER);
+      simRunUntil((uint64_t)time, loop);
+      simSetKey(BENCH_STRAIGHT_PIN, false);
+      time += unit * jitter(BENCH_HAND_JITTER);
+    }
+    time += unit * 2 * jitter(BENCH_HAND_JITTER); // Character space
+  }
+  simRunUntil((uint64_t)time + DECODER_MAX_DIT * 10, loop);
+
+  uint32_t errors = editDistance(trimmed(simDecoded()), text);
+  hostErrors = editDistance(trimmed(decodeAtHost()), text);
+  return errors;
+}
+
+/** Decodes paddle and hand sent text at the keyer, and the same timing as it reaches a browser over USB */
+int benchDecoder(int argc, char **argv)
+{
+  SimLoop_t loop = {20, 200, 2000};
+
+  // Optional overrides: decoder [loop period us] [stall every N passes] [max stall us]
+  if (argc > 0)
+    loop.period = atoi(argv[0]);
+  if (argc > 1)
+    loop.stallEvery = atoi(argv[1]);
+  if (argc > 2)
+    loop.stallMax = atoi(argv[2]);
+
+  printf("CW decoder, loop period %u us, stall up to %u us every ~%u passes\n",
+         loop.period, loop.stallMax, loop.stallEvery);
+  printf("%-9s %11s %6s %6s %9s %12s %12s\n", "key", "WPM", "ratio", "weight", "chars", "device err%", "host err%");
+
+  uint32_t failures = 0;
+
+  settings.keyMode = keyMode_t::KEY_PADDLES;
+  for (const PaddleRun_t &run : paddleRuns)
+  {
+    settings.wpm = (uint16_t)(run.wpm * INTTOFLOATSCALAR);
+    settings.farnsworth = (uint16_t)(run.farnsworth * INTTOFLOATSCALAR);
+    settings.weight = run.weight;
+    setupWPM();
+
+    std::string text = randomText();
+    uint32_t errors = paddleText(text, loop);
+    uint32_t hostErrors = editDistance(trimmed(decodeAtHost()), text);
+    if (errors > text.size() * BENCH_MAX_ERROR)
+      failures++;
+
+    char speed[16];
+    snprintf(speed, sizeof(speed), run.farnsworth ? "%.0f/%.0f" : "%.0f", run.wpm, run.farnsworth);
+    printf("%-9s %11s %6.1f %6u %9zu %12.2f %12.2f\n", "paddles", speed, 3.0, run.weight, text.size(),
+           100.0 * errors / text.size(), 100.0 * hostErrors / text.size());
+  }
+
+  settings.keyMode = keyMode_t::KEY_STRAIGHT;
+  settings.gpio.straightKey = BENCH_STRAIGHT_PIN;
+  settings.farnsworth = DEFAULT_FARNSWORTH;
+  settings.weight = DEFAULT_WEIGHT;
+  for (const HandRun_t &run : handRuns)
+  {
+    // The configured speed is only where the estimate starts
+    settings.wpm = DEFAULT_WPM;
+    setupWPM();
+
+    std::string text = randomText();
+    uint32_t hostErrors;
+    uint32_t errors = handText(text, run, loop, hostErrors);
+    if (errors > text.size() * BENCH_MAX_ERROR)
+      failures++;
+
+    char speed[16];
+    snprintf(speed, sizeof(speed), "%.0f->%.0f", run.startWpm, run.endWpm);
+    printf("%-9s %11s %6.1f %6s %9zu %12.2f %12.2f\n", "straight", speed, run.dahRatio, "-", text.size(),
+           100.0 * errors / text.size(), 100.0 * hostErrors / text.size());
+  }
+
+  settings.keyMode = keyMode_t::KEY_PADDLES;
+  settings.wpm = DEFAULT_WPM;
+  setupWPM();
+
+  printf("%s\n", failures ? "FAILED" : "Passed");
+  return failures ? 1 : 0;
+}
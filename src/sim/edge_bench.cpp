@@ -0,0 +1,90 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../main.h"
+#include "../keyer.h"
+#include "../capture.h"
+#include "sim.h"
+
+#define BENCH_DIT_PIN 3
+#define BENCH_DAH_PIN 29
+#define BENCH_ELEMENTS 500
+
+static const float benchWPM[] = {20, 40, 60};
+
+/** Squeezes both paddles and returns the element length jitter, edge error counters are left in keyerStats */
+static double squeeze(float wpm, const SimLoop_t &loop)
+{
+  settings.keyMode = keyMode_t::KEY_PADDLES;
+  settings.gpio.ditPaddle = BENCH_DIT_PIN;
+  settings.gpio.dahPaddle = BENCH_DAH_PIN;
+  settings.wpm = (uint16_t)(wpm * INTTOFLOATSCALAR);
+  setupWPM();
+
+  double ditUs = 1200000.0 / wpm;
+
+  simReset();
+  if (inputCapture)
+    setupCapture();
+
+  simSetKey(BENCH_DIT_PIN, true);
+  simSetKey(BENCH_DAH_PIN, true);
+  simRunUntil(simTime() + (uint64_t)(ditUs * 3 * BENCH_ELEMENTS), loop);
+  simSetKey(BENCH_DIT_PIN, false);
+  simSetKey(BENCH_DAH_PIN, false);
+  simRunUntil(simTime() + (uint64_t)(ditUs * 10), loop);
+
+  SimStat_t jitter;
+  statReset(jitter);
+
+  const std::vector<SimEdge_t> &edges = simEdges();
+  for (size_t i = 1; i < edges.size(); i++)
+  {
+    if (!edges[i - 1].state || edges[i].state)
+      continue;
+
+    double length = (double)(edges[i].time - edges[i - 1].time);
+    statAdd(jitter, length - (length < ditUs * 2 ? ditUs : ditUs * 3));
+  }
+
+  return statStdDev(jitter);
+}
+
+/** Scheduled vs actual output edge error with loop() polled deadlines vs the hardware state alarm */
+int benchEdges(int argc, char **argv)
+{
+  SimLoop_t loop = {20, 200, 2000};
+
+  // Optional overrides: edges [period us] [stall every N passes] [max stall us]
+  if (argc > 0)
+    loop.period = atoi(argv[0]);
+  if (argc > 1)
+    loop.stallEvery = atoi(argv[1]);
+  if (argc > 2)
+    loop.stallMax = atoi(argv[2]);
+
+  printf("Output edge error, loop period %u us, stall up to %u us every ~%u passes\n",
+         loop.period, loop.stallMax, loop.stallEvery);
+  printf("%-12s %6s %8s %9s %9s %9s\n", "mode", "WPM", "edges", "mean err", "max err", "jitter");
+
+  bool savedAlarm = edgeAlarm;
+  const bool modes[] = {false, true};
+
+  for (bool alarm : modes)
+  {
+    edgeAlarm = alarm;
+
+    for (float wpm : benchWPM)
+    {
+      double jitter = squeeze(wpm, loop);
+      double mean = keyerStats.edges ? (double)keyerStats.edgeErrorTotal / keyerStats.edges : 0.0;
+
+      // All errors reported in microseconds
+      printf("%-12s %6.1f %8u %9.1f %9u %9.1f\n", alarm ? "state alarm" : "loop poll", wpm,
+             keyerStats.edges, mean, keyerStats.maxEdgeError, jitter);
+    }
+  }
+
+  edgeAlarm = savedAlarm;
+  return 0;
+}
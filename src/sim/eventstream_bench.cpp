@@ -0,0 +1,270 @@
+#include <Arduino.h>
+#include <BitPacker.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include "../main.h"
+#include "../eventstream.h"
+#include "sim.h"
+
+#define BENCH_EVENTS 20000        // Key transitions streamed
+#define BENCH_DROP_EVERY 37       // Every Nth message is lost on the way to the host
+#define BENCH_PINGS 200           // Clock sync pings, one a second
+#define BENCH_PING_PERIOD 1000000 // Between pings
+#define BENCH_CLOCK_OFFSET 123456789.0 // Device clock behind the host at the first ping, us
+#define BENCH_CLOCK_DRIFT 37.5e-6      // Device crystal fast of the host, 37.5 ppm
+#define BENCH_USB_FRAME 1000      // USB MIDI is polled once per millisecond
+#define BENCH_HOST_JITTER 3000    // Scheduling delay on the host, either way through, up to
+#define BENCH_HOST_SPIKE 30000    // Occasional longer stall of the host
+#define BENCH_MAX_OFFSET_ERROR 200.0 // Clock offset error the sync must stay under, us
+#define BENCH_MAX_DRIFT_ERROR 5.0    // Drift error the sync must stay under, ppm
+
+static uint32_t benchRandom = 0x27D4EB2F;
+
+/** xorshift32, fixed seed so every run streams the same events */
+static uint32_t nextRandom()
+{
+  benchRandom ^= benchRandom << 13;
+  benchRandom ^= benchRandom >> 17;
+  benchRandom ^= benchRandom << 5;
+  return benchRandom;
+}
+
+// What a host makes of the stream, as the browser does it
+struct HostStream_t
+{
+  bool synced;
+  uint8_t expected; // Sequence number of the next message
+  uint32_t lastTime;
+  uint32_t lost;    // Messages missing from the sequence
+  uint32_t skipped; // Transitions thrown away until an absolute time came
+};
+
+/** Decodes one CMD_KEY_EVENTS payload, appending the transitions it could time */
+static void hostDecode(HostStream_t &host, const uint8_t *data, uint8_t size, std::vector<KeyEvent_t> &out)
+{
+  BitPacker<7 + 4 + EVENT_STREAM_BATCH * 35> packer;
+  packer.unpack7Bit(data, size);
+
+  uint8_t sequence = packer.extractField(7);
+  uint8_t count = packer.extractField(4);
+
+  // A gap in the sequence leaves the deltas with nothing to add to
+  if (sequence != host.expected)
+  {
+    host.lost += (sequence - host.expected) & 0x7F;
+    host.synced = false;
+  }
+  host.expected = (sequence + 1) & 0x7F;
+
+  for (uint8_t i = 0; i < count; i++)
+  {
+    KeyEvent_t event = {};
+    event.state = packer.extractField(1);
+    uint8_t width = packer.extractField(2);
+    uint32_t value = packer.extractField(width == 3 ? 32 : (width + 1) * 8);
+
+    if (width == 3)
+    {
+      event.time = value;
+      host.synced = true;
+    }
+    else if (host.synced)
+    {
+      event.time = host.lastTime + value;
+    }
+    else
+    {
+      host.skipped++;
+      continue;
+    }
+
+    host.lastTime = event.time;
+    out.push_back(event);
+  }
+}
+
+/** Streams random key transitions in batches, some messages lost, and checks every timestamp the host keeps is exact */
+static uint32_t streamEvents(uint32_t &sent, uint32_t &received, uint32_t &bytes, uint32_t &lost, uint32_t &skipped)
+{
+  std::vector<KeyEvent_t> events;
+  uint32_t time = 0xFFF00000; // Wraps part way through
+  for (uint32_t i = 0; i < BENCH_EVENTS; i++)
+  {
+    // Mostly Morse from 5 to 60 WPM, now and then a pause long enough to need a wider delta
+    uint32_t r = nextRandom() % 100;
+    time += r < 90 ? 20000 + nextRandom() % 700000 : r < 99 ? 1000000 + nextRandom() % 10000000 : 20000000 + nextRandom() % 40000000;
+    if (nextRandom() % 20 == 0)
+      time += 1 + nextRandom() % 200; // Contact bounce through a straight key
+    events.push_back({time, 0, 0, 0, (bool)(i & 1)});
+  }
+
+  resetEventStream();
+  HostStream_t host = {false, 0, 0, 0, 0};
+  std::vector<KeyEvent_t> decoded;
+  std::vector<uint32_t> expected;
+  uint32_t messages = 0;
+  bytes = 0;
+
+  for (size_t i = 0; i < events.size();)
+  {
+    // However many the host loop found in the queue this pass
+    uint8_t count = 1 + nextRandom() % EVENT_STREAM_BATCH;
+    if (count > events.size() - i)
+      count = events.size() - i;
+
+    uint8_t out[MAX_SYSEX_LENGTH];
+    uint8_t size;
+    encodeKeyEvents(&events[i], count, out, size);
+    bytes += size + 4; // SysEx header, command and footer
+
+    if (++messages % BENCH_DROP_EVERY != 0)
+    {
+      size_t before = decoded.size();
+      hostDecode(host, out, size, decoded);
+      // The transitions kept are the last of the message, the ones after an absolute time
+      for (size_t j = i + count - (decoded.size() - before); j < i + count; j++)
+        expected.push_back(events[j].time);
+    }
+    i += count;
+  }
+
+  sent = events.size();
+  received = decoded.size();
+  lost = host.lost;
+  skipped = host.skipped;
+
+  uint32_t errors = decoded.size() == expected.size() ? 0 : 1;
+  for (size_t i = 0; i < decoded.size() && i < expected.size(); i++)
+    errors += decoded[i].time != expected[i];
+  return errors;
+}
+
+/** Device clock at a host time, before micros() wraps it to 32 bits */
+static double deviceTime(double hostTime)
+{
+  return hostTime * (1 + BENCH_CLOCK_DRIFT) - BENCH_CLOCK_OFFSET;
+}
+
+static uint32_t deviceClock(double hostTime)
+{
+  return (uint32_t)(int64_t)floor(deviceTime(hostTime));
+}
+
+/** One way delay through USB and the host's scheduling */
+static double usbDelay(double at)
+{
+  double frame = (floor(at / BENCH_USB_FRAME) + 1) * BENCH_USB_FRAME - at;
+  double delay = frame + nextRandom() % BENCH_HOST_JITTER;
+  if (nextRandom() % 50 == 0)
+    delay += nextRandom() % BENCH_HOST_SPIKE;
+  return delay;
+}
+
+// A ping as the host saw it: when it left, when the pong came back, and the device time in between
+struct Ping_t
+{
+  double sent;
+  double returned;
+  double device; // Unwrapped
+  double arrived; // For the bench to check against, the host never knows this
+  double wait;    // Half the time the device took to answer, included in device
+};
+
+/** Pings the simulated device, then fits its clock to the host's from the pongs with the shortest round trips */
+static void syncClocks(double &offsetError, double &driftError, double &meanRtt)
+{
+  std::vector<Ping_t> pings;
+  uint32_t lastDevice = 0;
+  double unwrapped = 0;
+
+  for (int i = 0; i < BENCH_PINGS; i++)
+  {
+    double sent = 1000000.0 + (double)i * BENCH_PING_PERIOD + nextRandom() % 100000;
+    double arrived = sent + usbDelay(sent);
+    double answered = arrived + 20 + nextRandom() % 30; // Handling the SysEx on core0
+    double returned = answered + usbDelay(answered);
+
+    uint32_t received = deviceClock(arrived);
+    uint32_t replied = deviceClock(answered);
+
+    // micros() wraps every 71 minutes, the host keeps counting
+    if (pings.empty())
+      unwrapped = received;
+    else
+      unwrapped += (uint32_t)(received - lastDevice);
+    lastDevice = received;
+
+    // The device time halfway between receiving and replying stands for the middle of the round trip
+    double wait = (double)(uint32_t)(replied - received) / 2;
+    pings.push_back({sent, returned, unwrapped + wait, arrived, wait});
+  }
+
+  // Only the quickest quarter of round trips in each stretch of pings is trusted, a slow one was held up somewhere unknown
+  std::vector<Ping_t> fit;
+  const size_t window = 8;
+  for (size_t start = 0; start + window <= pings.size(); start += window)
+  {
+    size_t best = start;
+    for (size_t i = start; i < start + window; i++)
+    {
+      if (pings[i].returned - pings[i].sent < pings[best].returned - pings[best].sent)
+        best = i;
+    }
+    fit.push_back(pings[best]);
+  }
+
+  // Least squares of device time against host time at the middle of each round trip
+  double sx = 0, sy = 0, sxx = 0, sxy = 0, rtt = 0;
+  double x0 = fit[0].sent;
+  double y0 = fit[0].device;
+  for (const Ping_t &ping : fit)
+  {
+    double x = (ping.sent + ping.returned) / 2 - x0;
+    double y = ping.device - y0;
+    sx += x;
+    sy += y;
+    sxx += x * x;
+    sxy += x * y;
+  }
+  for (const Ping_t &ping : pings)
+    rtt += ping.returned - ping.sent;
+
+  double n = fit.size();
+  double slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+  double intercept = (sy - slope * sx) / n;
+
+  // Where the fit puts the device clock at the last ping, against the truth
+  double at = pings.back().sent;
+  double estimate = y0 + intercept + slope * (at - x0);
+  double truth = deviceTime(at) - (deviceTime(pings[0].arrived) - pings[0].device + pings[0].wait);
+
+  offsetError = estimate - truth;
+  driftError = (slope - 1 - BENCH_CLOCK_DRIFT) * 1e6;
+  meanRtt = rtt / pings.size();
+}
+
+/** Round trips the key event stream through a host decoder, then syncs the host to the device clock over ping/pong */
+int benchEventStream(int argc, char **argv)
+{
+  printf("Key event stream, %u transitions, every %uth message lost\n", BENCH_EVENTS, BENCH_DROP_EVERY);
+
+  uint32_t sent, received, bytes, lost, skipped;
+  uint32_t errors = streamEvents(sent, received, bytes, lost, skipped);
+  printf("%10s %10s %10s %10s %12s %10s\n", "sent", "timed", "lost msgs", "skipped", "bytes/event", "wrong");
+  printf("%10u %10u %10u %10u %12.2f %10u\n", sent, received, lost, skipped, (double)bytes / sent, errors);
+
+  double offsetError, driftError, meanRtt;
+  syncClocks(offsetError, driftError, meanRtt);
+  printf("Clock sync, %u pings, %.1f ppm drift, mean round trip %.0f us\n", BENCH_PINGS, BENCH_CLOCK_DRIFT * 1e6, meanRtt);
+  printf("%16s %16s\n", "offset err us", "drift err ppm");
+  printf("%16.1f %16.2f\n", offsetError, driftError);
+
+  uint32_t failures = errors;
+  if (fabs(offsetError) > BENCH_MAX_OFFSET_ERROR || fabs(driftError) > BENCH_MAX_DRIFT_ERROR)
+    failures++;
+
+  printf("%s\n", failures ? "FAILED" : "Passed");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,485 @@
+#include <Arduino.h>
+#include <math.h>
+#include "../main.h"
+#include "../keyer.h"
+#include "../playback.h"
+#include "../decoder.h"
+#include "../stats.h"
+#include "../transmit.h"
+#include "../timers.h"
+#include "../potadc.h"
+#include "../speedpot.h"
+#include "../selftest.h"
+#include "sim.h"
+
+static uint64_t simClock = 0;
+static uint32_t simRandom = 1;
+static bool pinLevel[SIM_NUM_PINS];
+static voidFuncPtrParam pinIrq[SIM_NUM_PINS];
+static void *pinIrqParam[SIM_NUM_PINS];
+static std::vector<SimEdge_t> edges;
+static std::vector<SimEdge_t> pttEdges;
+static std::vector<SimNote_t> notes;
+static uint32_t noteCount = 0;
+static bool alarmArmed = false;
+static uint64_t alarmTime = 0;
+static std::string decoded;
+static std::vector<SimUsbWrite_t> usbWrites;
+static int loopbackFrom = -1; // Self-test drive pin wired to a key pin
+static int loopbackTo = -1;
+
+// Idle sleep, what loop1() would have done between events
+static bool simEvent = false; // Event register, set by signalEvent() and taken by the next pass
+static bool asleep = false;   // The last run ended with the keyer asleep
+static uint64_t sleepTime = 0;
+static uint32_t passes = 0;
+
+// Speed knob ADC, samples made up as the clock passes them
+static int potPin = -1;
+static uint16_t potRing[SPEED_POT_RING_SIZE];
+static uint16_t potHead = 0;
+static uint64_t potNextSample = 0;
+static uint16_t potValue = 0;
+static uint16_t potNoise = 0;
+static uint32_t potSpikeEvery = 0;
+static uint32_t potRandom = 1;
+
+/** xorshift32, deterministic so every run of the benchmark sees the same stalls */
+static uint32_t nextRandom()
+{
+  simRandom ^= simRandom << 13;
+  simRandom ^= simRandom >> 17;
+  simRandom ^= simRandom << 5;
+  return simRandom;
+}
+
+/** Separate xorshift32 for the knob samples, so the loop stalls are the same with or without it */
+static uint32_t nextPotRandom()
+{
+  potRandom ^= potRandom << 13;
+  potRandom ^= potRandom >> 17;
+  potRandom ^= potRandom << 5;
+  return potRandom;
+}
+
+uint32_t millis()
+{
+  return (uint32_t)(simClock / 1000);
+}
+
+uint32_t micros()
+{
+  return (uint32_t)simClock;
+}
+
+void delay(uint32_t ms)
+{
+  simClock += (uint64_t)ms * 1000;
+}
+
+void pinMode(uint8_t pin, PinMode mode)
+{
+  if (pin < SIM_NUM_PINS && mode == PinMode::INPUT_PULLUP)
+    pinLevel[pin] = true;
+}
+
+PinStatus digitalRead(uint8_t pin)
+{
+  if (pin >= SIM_NUM_PINS)
+    return LOW;
+
+  return pinLevel[pin] ? HIGH : LOW;
+}
+
+uint32_t readInputPins()
+{
+  uint32_t levels = 0;
+  for (int i = 0; i < SIM_NUM_PINS; i++)
+    levels |= (uint32_t)pinLevel[i] << i;
+  return levels;
+}
+
+void digitalWrite(uint8_t pin, PinStatus value)
+{
+  if (pin < SIM_NUM_PINS)
+    pinLevel[pin] = (value == HIGH);
+}
+
+void attachInterruptParam(uint8_t pin, voidFuncPtrParam callback, PinStatus mode, void *param)
+{
+  if (pin < SIM_NUM_PINS)
+  {
+    pinIrq[pin] = callback; // Always CHANGE, the only mode the firmware uses
+    pinIrqParam[pin] = param;
+  }
+}
+
+void detachInterrupt(uint8_t pin)
+{
+  if (pin < SIM_NUM_PINS)
+    pinIrq[pin] = nullptr;
+}
+
+/** Notes go out the moment they are queued, there is no USB to wait for */
+static void sendNote(uint8_t k, bool state)
+{
+  notes.push_back({simClock, state, k, keyers.note[k], keyers.channel[k]});
+
+  uint32_t inputTime;
+  if (takeNoteInput(k, inputTime))
+    histogramAdd(HIST_KEY_LATENCY, micros() - inputTime);
+
+  if (k == 0)
+    decodeKeyEdge(state, micros()); // The decoder follows the first keyer, like the device
+
+  selfTestNote(k, state, micros());
+}
+
+void sendNoteOn(uint8_t k)
+{
+  noteCount++;
+  sendNote(k, true);
+}
+
+void sendNoteOff(uint8_t k)
+{
+  sendNote(k, false);
+}
+
+void sendDecodedCharacter(char c)
+{
+  decoded += c;
+}
+
+/** USB MIDI writes from the transmit scheduler are logged for a benchmark to put on the bus */
+void writeNote(const KeyEvent_t &event)
+{
+  usbWrites.push_back({simClock, true, false, false, {}});
+}
+
+void writeSysEx(const uint8_t *data, uint8_t length, bool bulkCable)
+{
+  usbWrites.push_back({simClock, false, bulkCable, false, std::vector<uint8_t>(data, data + length)});
+}
+
+void flushMidi()
+{
+  for (auto it = usbWrites.rbegin(); it != usbWrites.rend() && !it->flushed; ++it)
+    it->flushed = true;
+}
+
+void setOutput(uint8_t k, bool state)
+{
+  edges.push_back({simClock, state, k});
+}
+
+void setPtt(bool state)
+{
+  pttEdges.push_back({simClock, state, 0});
+}
+
+void setLed(ledElement_t element)
+{
+}
+
+void armStateAlarm(uint32_t deadline)
+{
+  alarmArmed = true;
+  alarmTime = simClock + (int32_t)(deadline - (uint32_t)simClock);
+}
+
+void cancelStateAlarm()
+{
+  alarmArmed = false;
+}
+
+void signalEvent()
+{
+  simEvent = true;
+}
+
+/** Drives a self-test pin, the key pin wired to it follows at the same instant */
+void driveTestPin(uint8_t pin, bool pressed)
+{
+  simSetKey(pin, pressed);
+  if (pin == loopbackFrom)
+    simSetKey(loopbackTo, pressed);
+}
+
+/** Resets the virtual clock, pins and captured output */
+void simReset(uint64_t startTime)
+{
+  stopKeyers(); // Nothing sent or armed carries over
+  cleanUpSpeedPot();
+  stopSelfTest();
+
+  simClock = startTime;
+  simRandom = 0x2545F491;
+  for (int i = 0; i < SIM_NUM_PINS; i++)
+  {
+    pinLevel[i] = true; // Pulled up, key open
+    pinIrq[i] = nullptr;
+  }
+  edges.clear();
+  pttEdges.clear();
+  notes.clear();
+  noteCount = 0;
+  alarmArmed = false;
+  simEvent = false;
+  asleep = false;
+  sleepTime = 0;
+  passes = 0;
+  keyerStats = {};
+  resetKeyerStats();
+  resetHostStats();
+
+  setupTimers(micros());
+  keyers = {};
+  loadKeyers();
+  clearIambicMemory();
+  setupKeyDebounce();
+  clearPlayback(false);
+  resetDecoder(settings.wpm);
+  decoded.clear();
+  usbWrites.clear();
+  loopbackFrom = -1;
+  loopbackTo = -1;
+}
+
+bool beginPotAdc(uint8_t pin)
+{
+  endPotAdc();
+  if (pin < SPEED_POT_FIRST_PIN || pin > SPEED_POT_LAST_PIN)
+    return false;
+
+  potPin = pin;
+  potHead = 0;
+  potNextSample = simClock + SPEED_POT_SAMPLE_US;
+  potRandom = 0x1B873593;
+  memset(potRing, 0, sizeof(potRing));
+  return true;
+}
+
+void endPotAdc()
+{
+  potPin = -1;
+}
+
+const volatile uint16_t *potAdcRing()
+{
+  return potRing;
+}
+
+uint16_t potAdcHead()
+{
+  if (potPin < 0)
+    return 0;
+
+  // Every conversion the free running ADC has made by now, older ones overwritten like the DMA does
+  for (; potNextSample <= simClock; potNextSample += SPEED_POT_SAMPLE_US)
+  {
+    int32_t sample = potValue;
+    if (potNoise)
+      sample += (int32_t)(nextPotRandom() % (potNoise * 2 + 1)) - potNoise;
+    if (potSpikeEvery && nextPotRandom() % potSpikeEvery == 0)
+      sample = (nextPotRandom() & 1) ? 4095 : 0; // Wiper lifting off the track
+    potRing[potHead] = constrain(sample, 0, 4095);
+    potHead = (potHead + 1) & (SPEED_POT_RING_SIZE - 1);
+  }
+  return potHead;
+}
+
+void simSetPot(uint16_t value, uint16_t noise, uint32_t spikeEvery)
+{
+  potAdcHead(); // Samples up to now were of the old position
+  potValue = value;
+  potNoise = noise;
+  potSpikeEvery = spikeEvery;
+}
+
+void simLoopback(uint8_t drivePin, uint8_t keyPin)
+{
+  loopbackFrom = drivePin;
+  loopbackTo = keyPin;
+}
+
+uint64_t simTime()
+{
+  return simClock;
+}
+
+void simAdvance(uint32_t us)
+{
+  simClock += us;
+}
+
+/** Closes or opens a key contact, active low like the real pull-up inputs */
+void simSetKey(uint8_t pin, bool pressed)
+{
+  if (pin >= SIM_NUM_PINS || pinLevel[pin] == !pressed)
+    return;
+
+  pinLevel[pin] = !pressed;
+
+  // Edge interrupt fires at the exact virtual time of the edge
+  if (pinIrq[pin] != nullptr)
+    pinIrq[pin](pinIrqParam[pin]);
+}
+
+/** Sleeps until the keyer's next wake or the state alarm when it has nothing to do, like loop1() does. Returns true if
+ * the next pass is woken from sleep, an event arriving while a previous run left it asleep included */
+static bool sleepUntilWake(uint64_t time)
+{
+  uint32_t wake;
+  if (simEvent || !keyerNextWake(micros(), wake))
+    return asleep;
+
+  uint64_t until = simClock + (uint32_t)(wake - micros());
+  if (alarmArmed && alarmTime < until)
+    until = alarmTime;
+  if (until > time)
+    until = time; // Still asleep when the benchmark moves a key or looks
+
+  sleepTime += until - simClock;
+  simClock = until;
+  asleep = true;
+  return true;
+}
+
+/** Fires the state alarm if it is due by the given time, it interrupts the pass at its exact deadline */
+static void fireAlarms(uint64_t until)
+{
+  while (alarmArmed && alarmTime <= until)
+  {
+    alarmArmed = false;
+    if (alarmTime > simClock)
+      simClock = alarmTime;
+    processStateDeadline(micros());
+    simEvent = true; // onStateAlarm() wakes loop1() on the device
+  }
+}
+
+/** Runs loop() passes until the target, the last one cut short to end on it when exact */
+static void runPasses(uint64_t time, const SimLoop_t &loop, bool exact)
+{
+  simEvent = true; // Whatever the benchmark did before this comes with an event on the device
+  uint64_t lastPassEnd = simClock;
+
+  while (simClock < time)
+  {
+    bool woken = loop.sleep && sleepUntilWake(time);
+    if (simClock >= time)
+      break;
+    simEvent = false; // The pass takes the event
+    asleep = false;
+
+    // Woken from sleep the keyer runs at once, the rest of loop1() comes after it
+    if (woken)
+    {
+      fireAlarms(simClock);
+      processKey();
+    }
+
+    uint32_t passTime = loop.period;
+    if (loop.stallEvery && (nextRandom() % loop.stallEvery) == 0)
+      passTime += nextRandom() % (loop.stallMax + 1); // midi.update()/USB servicing stall
+
+    uint64_t passEnd = simClock + passTime;
+    if (exact && passEnd > time)
+    {
+      passEnd = time;
+      passTime = passEnd - simClock;
+    }
+
+    fireAlarms(passEnd);
+
+    histogramAdd(HIST_KEYER_PERIOD, passEnd - lastPassEnd);
+    simClock = passEnd;
+    lastPassEnd = passEnd;
+    passes++;
+    if (!woken)
+      processKey();
+    decodeIdle(micros()); // core0 on the device, once per pass is close enough
+  }
+}
+
+void simRunUntil(uint64_t time, const SimLoop_t &loop)
+{
+  runPasses(time, loop, false);
+}
+
+void simRunTo(uint64_t time, const SimLoop_t &loop)
+{
+  runPasses(time, loop, true);
+}
+
+uint64_t simSleepTime()
+{
+  return sleepTime;
+}
+
+uint32_t simPasses()
+{
+  return passes;
+}
+
+const std::vector<SimEdge_t> &simEdges()
+{
+  return edges;
+}
+
+const std::vector<SimEdge_t> &simPttEdges()
+{
+  return pttEdges;
+}
+
+uint32_t simNoteCount()
+{
+  return noteCount;
+}
+
+const std::vector<SimNote_t> &simNotes()
+{
+  return notes;
+}
+
+const std::string &simDecoded()
+{
+  return decoded;
+}
+
+std::vector<SimUsbWrite_t> &simUsbWrites()
+{
+  return usbWrites;
+}
+
+void statReset(SimStat_t &stat)
+{
+  stat = {0, 0.0, 0.0, 0.0, 0.0};
+}
+
+void statAdd(SimStat_t &stat, double value)
+{
+  if (stat.count == 0 || value < stat.min)
+    stat.min = value;
+  if (stat.count == 0 || value > stat.max)
+    stat.max = value;
+  stat.count++;
+  stat.sum += value;
+  stat.sumSq += value * value;
+}
+
+double statMean(const SimStat_t &stat)
+{
+  return stat.count ? stat.sum / stat.count : 0.0;
+}
+
+double statStdDev(const SimStat_t &stat)
+{
+  if (stat.count < 2)
+    return 0.0;
+
+  double mean = statMean(stat);
+  double variance = stat.sumSq / stat.count - mean * mean;
+  return variance > 0.0 ? sqrt(variance) : 0.0;
+}
@@ -0,0 +1,426 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <new>
+#include <BitPacker.hpp>
+#include "../main.h"
+#include "../keyer.h"
+#include "../capture.h"
+#include "../config.h"
+#include "sim.h"
+
+#define BENCH_ITERATIONS 200000 // Timed calls of each hot path per repeat
+#define BENCH_REPEATS 5         // Best of, the first is a warm up and is not counted
+#define BENCH_MAX_SLOWDOWN 1.25 // Slower than the baseline by more than this fails
+#define BENCH_DIT_PIN 3
+#define BENCH_DAH_PIN 29
+#define BENCH_FIELDS 9 // 32-bit fields in a packed message, a stats reply
+
+// Heap allocations made by anything in the simulation, the firmware hot paths must not make any
+static uint64_t allocations = 0;
+
+void *operator new(size_t size)
+{
+  allocations++;
+  void *p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+  free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+  free(p);
+}
+
+// A hot path timed one call at a time, setup runs before every repeat
+struct HotPath_t
+{
+  const char *name;
+  void (*setup)();
+  void (*run)(uint32_t i);
+  bool allocates; // Expected to use the heap, a reference rather than firmware
+};
+
+// What each hot path works on
+static BitPacker<(MAX_SYSEX_LENGTH - 4) * 7> packer;
+static uint8_t message[MAX_SYSEX_LENGTH];
+static uint8_t messageSize = 0;
+static Settings_t benchSettings;
+static Settings_t decoded;
+static uint32_t checksum = 0;        // What the timed calls return, summed
+static volatile uint32_t sink = 0;   // Takes the checksum so the compiler keeps the calls
+
+/** A full packer, read back from the start */
+static void fillPacker()
+{
+  packer.reset();
+  for (uint32_t field = 0; field < BENCH_FIELDS; field++)
+    packer.addField(field * 2654435761u, 32);
+  packer.pack7Bit(message, messageSize);
+}
+
+static void addField(uint32_t i)
+{
+  if (i % BENCH_FIELDS == 0)
+    packer.reset();
+  checksum += packer.addField(i * 2654435761u, 32);
+}
+
+static void extractField(uint32_t i)
+{
+  if (i % BENCH_FIELDS == 0)
+    packer.unpack7Bit(message, messageSize);
+  checksum += (uint32_t)packer.extractField(32);
+}
+
+static void pack7Bit(uint32_t i)
+{
+  uint8_t out[MAX_SYSEX_LENGTH];
+  uint8_t outSize;
+  packer.pack7Bit(out, outSize);
+  checksum += out[i % outSize];
+}
+
+static void unpack7Bit(uint32_t i)
+{
+  message[0] = i & 0x7F;
+  checksum += packer.unpack7Bit(message, messageSize);
+}
+
+/** A message packed and read back through the heap based packer, the way the SysEx replies used to be built */
+static void referenceMessage(uint32_t i)
+{
+  uint8_t out[MAX_SYSEX_LENGTH];
+  uint8_t outSize;
+  DynamicBitPacker reference((MAX_SYSEX_LENGTH - 4) * 7);
+  for (uint32_t field = 0; field < BENCH_FIELDS; field++)
+    reference.addField(i * 2654435761u + field, 32);
+  reference.pack7Bit(out, outSize);
+  reference.unpack7Bit(out, outSize);
+  for (uint32_t field = 0; field < BENCH_FIELDS; field++)
+    checksum += (uint32_t)reference.extractField(32);
+}
+
+/** Default settings with every field set to something, packed as CMD_SET_CONFIG sends them */
+static void setupConfig()
+{
+  benchSettings = settings;
+  benchSettings.wpm = 25 * WPM_SCALE;
+  benchSettings.pttLead = 5;
+  benchSettings.keyers[0].keyMode = keyMode_t::KEY_STRAIGHT;
+  benchSettings.keyers[0].straightKey = 7;
+
+  // A whole CMD_SET_CONFIG message as handleSysEx() gets it
+  const uint8_t header[] = SYSEX_HEADER;
+  uint8_t size;
+  memcpy(message, header, sizeof(header));
+  message[sizeof(header)] = CMD_SET_CONFIG;
+  encodeConfig(benchSettings, &message[sizeof(header) + 1], size);
+  messageSize = sizeof(header) + 1 + size;
+  message[messageSize++] = SYSEX_FOOTER;
+}
+
+/** A CMD_SET_FIELDS message changing the speed, note and PTT lead */
+static void setupFields()
+{
+  setupConfig();
+
+  const uint8_t header[] = SYSEX_HEADER;
+  BitPacker<(MAX_SYSEX_LENGTH - 4) * 7> fields;
+  fields.addField(3, 7);
+  fields.addField(CONFIG_WPM, 7);
+  fields.addField(30 * WPM_SCALE, configFieldBits[CONFIG_WPM]);
+  fields.addField(CONFIG_NOTE, 7);
+  fields.addField(70, configFieldBits[CONFIG_NOTE]);
+  fields.addField(CONFIG_PTTLEAD, 7);
+  fields.addField(10, configFieldBits[CONFIG_PTTLEAD]);
+
+  uint8_t size;
+  message[sizeof(header)] = CMD_SET_FIELDS;
+  fields.pack7Bit(&message[sizeof(header) + 1], size);
+  messageSize = sizeof(header) + 1 + size;
+  message[messageSize++] = SYSEX_FOOTER;
+}
+
+static void encodeConfigOp(uint32_t i)
+{
+  uint8_t out[CONFIG_PACKED_SIZE];
+  uint8_t outSize;
+  benchSettings.volume = i & 0x7F;
+  encodeConfig(benchSettings, out, outSize);
+  checksum += out[i % outSize];
+}
+
+static void decodeConfigOp(uint32_t i)
+{
+  const uint8_t header[] = SYSEX_HEADER;
+  checksum += decodeConfig(decoded, &message[sizeof(header) + 1], messageSize - sizeof(header) - 2);
+}
+
+/** What handleSysEx() does with a config message on core0 and applySettings() then on core1, short of setting the keyer up */
+static bool receiveConfig(const uint8_t *data, uint8_t length)
+{
+  const uint8_t header[] = SYSEX_HEADER;
+  if (length < sizeof(header) + 2 || memcmp(data, header, sizeof(header)) != 0 || data[length - 1] != SYSEX_FOOTER)
+    return false;
+
+  decoded = benchSettings;
+  const uint8_t *payload = &data[sizeof(header) + 1];
+  uint8_t size = length - sizeof(header) - 2;
+  uint8_t fields = data[sizeof(header)] == CMD_SET_FIELDS ? decodeConfigFields(decoded, payload, size)
+                                                          : decodeConfig(decoded, payload, size);
+  return fields && settingsChanges(benchSettings, decoded) != CHANGE_NONE;
+}
+
+static void setConfigOp(uint32_t i)
+{
+  benchSettings.volume = i & 0x7F; // Always a change to apply
+  checksum += receiveConfig(message, messageSize);
+}
+
+/** A paddle keyer at 25 WPM on edge capture, set up afresh */
+static void setupKeyer()
+{
+  settings.keyMode = keyMode_t::KEY_PADDLES;
+  settings.gpio.ditPaddle = BENCH_DIT_PIN;
+  settings.gpio.dahPaddle = BENCH_DAH_PIN;
+  settings.gpio.speedPot = 0;
+  for (KeyerSettings_t &keyer : settings.keyers)
+    keyer.keyMode = keyMode_t::KEY_NONE;
+  settings.pttMode = gpioOutputMode_t::OUTPUT_DISABLED;
+  settings.wpm = 25 * WPM_SCALE;
+  setupWPM();
+
+  simReset();
+  setupCapture();
+}
+
+/** The same keyer with both paddles held, it sends dits and dahs in turn */
+static void setupSqueeze()
+{
+  setupKeyer();
+  simSetKey(BENCH_DIT_PIN, true);
+  simSetKey(BENCH_DAH_PIN, true);
+}
+
+/** One loop pass, idle or squeezing as the setup left the paddles. Squeezing, the elements end in the pass as the clock reaches them */
+static void keyerPass(uint32_t i)
+{
+  simAdvance(20);
+  processKey();
+}
+
+/** A captured paddle edge through the debounce into the state machine, a press or release every other call */
+static void keyEdge(uint32_t i)
+{
+  simAdvance(DEFAULT_DEBOUNCE_US + 1000); // Past the lockout and any element the last press started
+  simSetKey(BENCH_DIT_PIN, !(i & 1));
+  processKey();
+}
+
+/** The state alarm at the end of each element and gap while squeezing */
+static void stateDeadline(uint32_t i)
+{
+  simAdvance(keyers.stateEndTime[0] - micros());
+  processStateDeadline(micros());
+}
+
+static const HotPath_t hotPaths[] = {
+    {"bitpacker.addField", nullptr, addField, false},
+    {"bitpacker.extractField", fillPacker, extractField, false},
+    {"bitpacker.pack7Bit", fillPacker, pack7Bit, false},
+    {"bitpacker.unpack7Bit", fillPacker, unpack7Bit, false},
+    {"dynamicbitpacker.message", nullptr, referenceMessage, true},
+    {"config.encode", setupConfig, encodeConfigOp, false},
+    {"config.decode", setupConfig, decodeConfigOp, false},
+    {"sysex.setConfig", setupConfig, setConfigOp, false},
+    {"sysex.setFields", setupFields, setConfigOp, false},
+    {"keyer.idlePass", setupKeyer, keyerPass, false},
+    {"keyer.squeezePass", setupSqueeze, keyerPass, false},
+    {"keyer.keyEdge", setupKeyer, keyEdge, false},
+    {"keyer.stateDeadline", setupSqueeze, stateDeadline, false}};
+
+#define HOT_PATH_COUNT (sizeof(hotPaths) / sizeof(hotPaths[0]))
+
+// Result of a hot path, this run's or the baseline's
+struct HotPathResult_t
+{
+  char name[40];
+  uint32_t iterations;
+  double ns;     // Per call, best repeat
+  double allocs; // Per call, over the counted repeats
+};
+
+/** Times a hot path over the repeats, the best one counts */
+static HotPathResult_t measure(const HotPath_t &path, uint32_t iterations)
+{
+  HotPathResult_t result = {};
+  snprintf(result.name, sizeof(result.name), "%s", path.name);
+  result.iterations = iterations;
+
+  uint64_t allocated = 0;
+  for (uint32_t repeat = 0; repeat < BENCH_REPEATS; repeat++)
+  {
+    if (path.setup)
+      path.setup();
+
+    uint64_t before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++)
+      path.run(i);
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+    if (repeat == 0)
+      continue; // Warm up, the simulation's logs grow to size here
+    allocated += allocations - before;
+    if (result.ns == 0 || ns < result.ns)
+      result.ns = ns;
+  }
+
+  result.allocs = (double)allocated / ((double)iterations * (BENCH_REPEATS - 1));
+  return result;
+}
+
+/** Reads results saved by an earlier run, returns the number read */
+static uint32_t readResults(const char *path, HotPathResult_t *results, uint32_t capacity)
+{
+  FILE *file = fopen(path, "r");
+  if (!file)
+    return 0;
+
+  char line[128];
+  uint32_t count = 0;
+  while (count < capacity && fgets(line, sizeof(line), file))
+  {
+    HotPathResult_t &result = results[count];
+    if (sscanf(line, "%39[^,],%u,%lf,%lf", result.name, &result.iterations, &result.ns, &result.allocs) == 4)
+      count++; // The header line does not scan
+  }
+  fclose(file);
+  return count;
+}
+
+/** Times the firmware hot paths and counts their heap allocations, optionally saving the results and comparing them with a baseline */
+int benchHotPaths(int argc, char **argv)
+{
+  uint32_t iterations = BENCH_ITERATIONS;
+  const char *resultsPath = nullptr;
+  const char *baselinePath = nullptr;
+
+  // Optional, in any order: hotpaths [iterations] [--save results file] [--baseline baseline file]
+  for (int a = 0; a < argc; a++)
+  {
+    char *end;
+    long value = strtol(argv[a], &end, 10);
+    if (strcmp(argv[a], "--save") == 0 && a + 1 < argc)
+      resultsPath = argv[++a];
+    else if (strcmp(argv[a], "--baseline") == 0 && a + 1 < argc)
+      baselinePath = argv[++a];
+    else if (end != argv[a] && *end == 0 && value > 0 && value <= INT32_MAX)
+      iterations = value;
+    else
+    {
+      printf("Usage: hotpaths [iterations] [--save results file] [--baseline baseline file]\n");
+      return 1;
+    }
+  }
+
+  HotPathResult_t baseline[HOT_PATH_COUNT * 2];
+  uint32_t baselineCount = 0;
+  if (baselinePath)
+  {
+    baselineCount = readResults(baselinePath, baseline, HOT_PATH_COUNT * 2);
+    if (baselineCount == 0)
+    {
+      printf("No results in %s\n", baselinePath);
+      return 1;
+    }
+  }
+
+  Settings_t saved = settings;
+  bool savedCapture = inputCapture;
+  inputCapture = true;
+
+  printf("Firmware hot paths, best of %u repeats of %u calls\n", BENCH_REPEATS - 1, iterations);
+  printf("%-26s %10s %10s %12s %8s\n", "hot path", "ns/op", "allocs/op", "baseline ns", "change");
+
+  HotPathResult_t results[HOT_PATH_COUNT];
+  int result = 0;
+  for (uint32_t p = 0; p < HOT_PATH_COUNT; p++)
+  {
+    results[p] = measure(hotPaths[p], iterations);
+    const HotPathResult_t &run = results[p];
+    bool fail = !hotPaths[p].allocates && run.allocs > 0;
+
+    printf("%-26s %10.1f %10.3f", run.name, run.ns, run.allocs);
+
+    // Against the baseline, slower by more than the margin or allocating more fails
+    const HotPathResult_t *before = nullptr;
+    for (uint32_t b = 0; b < baselineCount; b++)
+    {
+      if (strcmp(baseline[b].name, run.name) == 0)
+        before = &baseline[b];
+    }
+    if (before)
+    {
+      fail = fail || run.ns > before->ns * BENCH_MAX_SLOWDOWN || run.allocs > before->allocs + 0.001;
+      printf(" %12.1f %+7.1f%%", before->ns, before->ns > 0 ? 100.0 * (run.ns / before->ns - 1.0) : 0.0);
+    }
+    else if (baselineCount)
+    {
+      printf(" %12s %8s", "-", "new");
+    }
+    printf("%s\n", fail ? "  FAIL" : "");
+    if (fail)
+      result = 1;
+  }
+
+  if (resultsPath)
+  {
+    FILE *file = fopen(resultsPath, "w");
+    if (!file)
+    {
+      printf("Cannot write %s\n", resultsPath);
+      result = 1;
+    }
+    else
+    {
+      fprintf(file, "name,iterations,ns_per_op,allocs_per_op\n");
+      for (const HotPathResult_t &run : results)
+        fprintf(file, "%s,%u,%.2f,%.4f\n", run.name, run.iterations, run.ns, run.allocs);
+      fclose(file);
+      printf("Results saved to %s\n", resultsPath);
+    }
+  }
+
+  sink = checksum;
+
+  settings = saved;
+  setupWPM();
+  inputCapture = savedCapture;
+  simReset();
+  return result;
+}
@@ -0,0 +1,279 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "../main.h"
+#include "../config.h"
+#include "../journal.h"
+#include "sim.h"
+
+#define BENCH_SAVES 50000  // Saves made
+#define BENCH_TEAR_EVERY 20 // On average, a save loses power part way through
+#define BENCH_FLIP_EVERY 50 // On average, a bit of the journal goes bad before a boot
+#define BENCH_BOOT_SAVES 20000   // Boot image saves made
+#define BENCH_RESTART_EVERY 2000 // On average, the journal starts over from sequence 1
+
+static uint32_t benchRandom = 0x9E3779B9;
+
+/** xorshift32, fixed seed so every run sees the same faults */
+static uint32_t nextRandom()
+{
+  benchRandom ^= benchRandom << 13;
+  benchRandom ^= benchRandom >> 17;
+  benchRandom ^= benchRandom << 5;
+  return benchRandom;
+}
+
+// Intact record in the simulated journal file
+struct BenchRecord_t
+{
+  size_t offset;
+  size_t size;
+  std::vector<uint8_t> payload;
+};
+
+// Journal file as nvram.cpp keeps it, on a flash that can lose power mid write
+struct BenchJournal_t
+{
+  std::vector<uint8_t> file;
+  std::vector<BenchRecord_t> records;
+  uint16_t sequence;
+  bool dirty;
+  uint32_t compactions;
+  uint64_t bytesWritten;
+};
+
+/** Appends a record, or compacts to it when full or damaged, returns false if power was lost part way */
+static bool saveRecord(BenchJournal_t &journal, const std::vector<uint8_t> &payload, bool tear)
+{
+  uint8_t record[JOURNAL_RECORD_SIZE(CONFIG_PACKED_SIZE)];
+  uint8_t size = encodeJournalRecord(journal.sequence + 1, payload.data(), payload.size(), record);
+  size_t written = tear ? nextRandom() % size : size;
+  journal.bytesWritten += written;
+
+  if (journal.dirty || journal.file.size() + size > JOURNAL_SIZE)
+  {
+    // Written to the side and renamed over, a torn copy is never renamed
+    if (tear)
+      return false;
+    journal.file.assign(record, record + size);
+    journal.records = {{0, size, payload}};
+    journal.dirty = false;
+    journal.compactions++;
+  }
+  else
+  {
+    size_t offset = journal.file.size();
+    journal.file.insert(journal.file.end(), record, record + written);
+    if (tear)
+    {
+      journal.dirty = true;
+      return false;
+    }
+    journal.records.push_back({offset, size, payload});
+  }
+
+  journal.sequence++;
+  return true;
+}
+
+/** Boots from the journal, returns the payload it would load and whether it found one */
+static bool bootJournal(BenchJournal_t &journal, std::vector<uint8_t> &payload)
+{
+  JournalScan_t scan = scanJournal(journal.file.data(), journal.file.size());
+  journal.sequence = scan.sequence;
+  journal.dirty = scan.damaged > 0;
+  if (!scan.found)
+    return false;
+
+  payload.assign(&journal.file[scan.offset], &journal.file[scan.offset] + scan.length);
+  return true;
+}
+
+// Boot image sector as nvram.cpp writes it, NOR flash: programming only clears bits, erasing sets them
+struct BenchBootSector_t
+{
+  uint8_t flash[BOOT_SECTOR_SIZE];
+  uint32_t erases;
+};
+
+/** Loses power part way through an erase or program, bits that were on their way keep a random state */
+static void tearFlash(uint8_t *data, size_t size, const uint8_t *target)
+{
+  size_t done = nextRandom() % size;
+  for (size_t i = done; i < size; i++)
+  {
+    uint8_t moving = (data[i] ^ target[i]) & nextRandom();
+    data[i] ^= moving;
+  }
+  for (size_t i = 0; i < done; i++)
+    data[i] = target[i];
+}
+
+/** Programs a record into the next slot like writeBootSettings(), returns false if power was lost part way */
+static bool saveBootImage(BenchBootSector_t &boot, uint16_t sequence, const std::vector<uint8_t> &payload, bool tearErase,
+                          bool tearProgram)
+{
+  uint8_t page[BOOT_SLOT_SIZE];
+  memset(page, 0xFF, sizeof(page));
+  uint8_t size = encodeJournalRecord(sequence, payload.data(), payload.size(), page);
+
+  BootScan_t scan = scanBootSector(boot.flash, size);
+  uint8_t slot = scan.found && (int16_t)(sequence - scan.sequence) <= 0 ? BOOT_SLOTS : scan.next;
+  if (slot == BOOT_SLOTS)
+  {
+    uint8_t erased[BOOT_SECTOR_SIZE];
+    memset(erased, 0xFF, sizeof(erased));
+    boot.erases++;
+    if (tearErase)
+    {
+      tearFlash(boot.flash, BOOT_SECTOR_SIZE, erased);
+      return false;
+    }
+    memcpy(boot.flash, erased, BOOT_SECTOR_SIZE);
+    slot = 0;
+  }
+
+  uint8_t *flash = &boot.flash[slot * BOOT_SLOT_SIZE];
+  uint8_t target[BOOT_SLOT_SIZE];
+  for (size_t i = 0; i < BOOT_SLOT_SIZE; i++)
+    target[i] = flash[i] & page[i];
+
+  // The padding after the record is left erased, power lost past the record loses nothing
+  if (tearProgram)
+  {
+    tearFlash(flash, size, target);
+    return memcmp(flash, target, size) == 0;
+  }
+  memcpy(flash, target, BOOT_SLOT_SIZE);
+  return true;
+}
+
+/** Saves random configs to the boot image with erases and programs torn, a boot must load what was saved under the sequence it finds */
+static uint32_t benchBootImage()
+{
+  BenchBootSector_t boot;
+  memset(boot.flash, 0xFF, sizeof(boot.flash));
+  boot.erases = 0;
+
+  std::vector<std::vector<uint8_t>> saved(UINT16_MAX + 1); // Payload each sequence number was last saved with
+  uint16_t sequence = 0;
+  bool lastSaved = false;
+  uint32_t tornErases = 0, tornPrograms = 0, restarts = 0, stale = 0, missing = 0, wrong = 0;
+  double scanNs = 0;
+
+  for (uint32_t i = 0; i < BENCH_BOOT_SAVES; i++)
+  {
+    if (nextRandom() % BENCH_RESTART_EVERY == 0)
+    {
+      sequence = 0; // Formatted filesystem, the journal numbers from 1 again
+      restarts++;
+    }
+    sequence++;
+
+    std::vector<uint8_t> payload(CONFIG_PACKED_SIZE);
+    for (uint8_t &b : payload)
+      b = nextRandom() & 0x7F;
+
+    bool tearErase = nextRandom() % BENCH_TEAR_EVERY == 0;
+    bool tearProgram = nextRandom() % BENCH_TEAR_EVERY == 0;
+    uint32_t erases = boot.erases;
+    lastSaved = saveBootImage(boot, sequence, payload, tearErase, tearProgram);
+    if (lastSaved)
+      saved[sequence] = payload;
+    else
+      saved[sequence].clear(); // Whatever the sequence held before is gone with the torn write
+    bool erased = boot.erases != erases;
+    tornErases += erased && tearErase;
+    tornPrograms += !(erased && tearErase) && tearProgram;
+
+    auto start = std::chrono::steady_clock::now();
+    BootScan_t scan = scanBootSector(boot.flash, JOURNAL_RECORD_SIZE(CONFIG_PACKED_SIZE));
+    scanNs += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    // The journal catches an image that is behind, one it does not match must never load
+    if (!scan.found)
+    {
+      missing++;
+      wrong += lastSaved;
+      continue;
+    }
+    std::vector<uint8_t> loaded(&boot.flash[scan.offset], &boot.flash[scan.offset] + scan.length);
+    if (loaded != saved[scan.sequence] || (lastSaved && scan.sequence != sequence))
+      wrong++;
+    stale += scan.sequence != sequence;
+  }
+
+  printf("%8s %8s %8s %8s %8s %8s %8s %8s %10s\n", "saves", "erases", "torn er", "torn pr", "restart", "stale",
+         "none", "wrong", "scan us");
+  printf("%8u %8u %8u %8u %8u %8u %8u %8u %10.2f\n", BENCH_BOOT_SAVES, boot.erases, tornErases, tornPrograms, restarts,
+         stale, missing, wrong, scanNs / BENCH_BOOT_SAVES / 1000);
+  return wrong;
+}
+
+/** Saves random configs with torn writes and bit rot, every boot must load the newest config that survived or nothing */
+int benchJournal(int argc, char **argv)
+{
+  printf("Settings journal, %u saves, %u byte journal, %u byte configs\n", BENCH_SAVES, JOURNAL_SIZE, CONFIG_PACKED_SIZE);
+
+  BenchJournal_t journal = {};
+  uint32_t torn = 0, flips = 0, fallbacks = 0, lost = 0, wrong = 0;
+  double scanNs = 0;
+  uint32_t boots = 0;
+
+  for (uint32_t i = 0; i < BENCH_SAVES; i++)
+  {
+    std::vector<uint8_t> payload(CONFIG_PACKED_SIZE);
+    for (uint8_t &b : payload)
+      b = nextRandom() & 0x7F;
+
+    bool tear = nextRandom() % BENCH_TEAR_EVERY == 0;
+    bool saved = saveRecord(journal, payload, tear);
+    torn += !saved;
+
+    bool flip = nextRandom() % BENCH_FLIP_EVERY == 0 && !journal.file.empty();
+    if (!tear && !flip)
+      continue;
+
+    // Bad bits take out the record they land in
+    if (flip)
+    {
+      size_t bit = nextRandom() % (journal.file.size() * 8);
+      journal.file[bit / 8] ^= 1 << (bit % 8);
+      for (size_t r = 0; r < journal.records.size(); r++)
+      {
+        if (bit / 8 >= journal.records[r].offset && bit / 8 < journal.records[r].offset + journal.records[r].size)
+        {
+          journal.records.erase(journal.records.begin() + r);
+          fallbacks += r == journal.records.size(); // It was the newest
+          break;
+        }
+      }
+      flips++;
+    }
+
+    std::vector<uint8_t> loaded;
+    auto start = std::chrono::steady_clock::now();
+    bool found = bootJournal(journal, loaded);
+    scanNs += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    boots++;
+
+    if (journal.records.empty())
+      lost += !found; // Nothing intact left, the defaults load
+    else if (!found || loaded != journal.records.back().payload)
+      wrong++;
+  }
+
+  printf("%8s %8s %8s %10s %10s %8s %8s %12s %10s\n", "torn", "flips", "boots", "fell back", "defaults", "wrong",
+         "compact", "bytes/save", "scan us");
+  printf("%8u %8u %8u %10u %10u %8u %8u %12.1f %10.2f\n", torn, flips, boots, fallbacks, lost, wrong,
+         journal.compactions, (double)journal.bytesWritten / BENCH_SAVES, scanNs / boots / 1000);
+
+  printf("Boot image, %u saves, %u byte sector in %u slots\n", BENCH_BOOT_SAVES, BOOT_SECTOR_SIZE, BOOT_SLOTS);
+  wrong += benchBootImage();
+
+  printf("%s\n", wrong ? "FAILED" : "Passed");
+  return wrong ? 1 : 0;
+}
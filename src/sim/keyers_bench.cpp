@@ -0,0 +1,129 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include "../main.h"
+#include "../keyer.h"
+#include "../capture.h"
+#include "sim.h"
+
+#define BENCH_DIT_PIN 3
+#define BENCH_DAH_PIN 29
+#define BENCH_ELEMENTS 500
+#define BENCH_WPM 40
+
+// Paddle pins of the keyers after the first, clear of the first keyer's
+static const uint8_t benchKeyerPins[KEYER_COUNT - 1][2] = {{4, 5}, {6, 7}, {8, 9}};
+
+/** Sets up the first count keyers as paddles, the rest without a key */
+static void setupKeyers(uint8_t count)
+{
+  settings.keyMode = keyMode_t::KEY_PADDLES;
+  settings.gpio.ditPaddle = BENCH_DIT_PIN;
+  settings.gpio.dahPaddle = BENCH_DAH_PIN;
+
+  for (uint8_t k = 1; k < KEYER_COUNT; k++)
+  {
+    KeyerSettings_t &keyer = settings.keyers[k - 1];
+    keyer = {};
+    keyer.keyMode = k < count ? keyMode_t::KEY_PADDLES : keyMode_t::KEY_NONE;
+    keyer.ditPaddle = benchKeyerPins[k - 1][0];
+    keyer.dahPaddle = benchKeyerPins[k - 1][1];
+    keyer.note = DEFAULT_MIDI_NOTE + k;
+    keyer.channel = DEFAULT_MIDI_CHANNEL;
+  }
+}
+
+/** Presses or releases both paddles of the first count keyers */
+static void squeezeKeyers(uint8_t count, bool pressed)
+{
+  simSetKey(BENCH_DIT_PIN, pressed);
+  simSetKey(BENCH_DAH_PIN, pressed);
+
+  for (uint8_t k = 1; k < count; k++)
+  {
+    simSetKey(benchKeyerPins[k - 1][0], pressed);
+    simSetKey(benchKeyerPins[k - 1][1], pressed);
+  }
+}
+
+/** Host time of every keyer squeezing at once as the keyer count grows, each keyer's elements checked against the nominal timing */
+int benchKeyers(int argc, char **argv)
+{
+  SimLoop_t loop = {20, 0, 0};
+  uint32_t elements = BENCH_ELEMENTS;
+
+  // Optional overrides: keyers [loop period us] [elements]
+  if (argc > 0)
+    loop.period = atoi(argv[0]);
+  if (argc > 1)
+    elements = atoi(argv[1]);
+
+  settings.wpm = BENCH_WPM * WPM_SCALE;
+  setupWPM();
+
+  double ditUs = 1200000.0 / BENCH_WPM;
+  uint64_t duration = (uint64_t)(ditUs * 3 * elements);
+
+  printf("Keyer instances squeezed at once, %d WPM, loop period %u us, %u elements each\n", BENCH_WPM, loop.period, elements);
+  printf("%7s %9s %9s %10s %9s %9s\n", "keyers", "passes", "ns/pass", "ns/keyer", "elements", "max err");
+
+  int result = 0;
+
+  for (uint8_t count = 1; count <= KEYER_COUNT; count++)
+  {
+    setupKeyers(count);
+    simReset();
+    if (inputCapture)
+      setupCapture();
+
+    squeezeKeyers(count, true);
+
+    auto start = std::chrono::steady_clock::now();
+    simRunUntil(simTime() + duration, loop);
+    auto stop = std::chrono::steady_clock::now();
+
+    squeezeKeyers(count, false);
+    simRunUntil(simTime() + (uint64_t)(ditUs * 10), loop);
+
+    // Element lengths of each keyer from its own output edges
+    uint32_t keyerElements[KEYER_COUNT] = {};
+    uint64_t lastOn[KEYER_COUNT] = {};
+    double maxError = 0.0;
+
+    for (const SimEdge_t &edge : simEdges())
+    {
+      if (edge.state)
+      {
+        lastOn[edge.keyer] = edge.time;
+        continue;
+      }
+
+      double length = (double)(edge.time - lastOn[edge.keyer]);
+      double error = fabs(length - (length < ditUs * 2 ? ditUs : ditUs * 3));
+      if (error > maxError)
+        maxError = error;
+      keyerElements[edge.keyer]++;
+    }
+
+    // Every keyer must send as many elements as the first, on time
+    uint32_t fewest = keyerElements[0];
+    for (uint8_t k = 1; k < count; k++)
+    {
+      if (keyerElements[k] < fewest)
+        fewest = keyerElements[k];
+    }
+
+    uint32_t passes = duration / loop.period;
+    double ns = std::chrono::duration<double, std::nano>(stop - start).count() / passes;
+
+    bool fail = fewest == 0 || fewest + 1 < keyerElements[0] || maxError > loop.period * 2;
+    printf("%7u %9u %9.1f %10.1f %9u %9.1f%s\n", count, passes, ns, ns / count, fewest, maxError, fail ? "  FAIL" : "");
+    if (fail)
+      result = 1;
+  }
+
+  setupKeyers(1);
+  return result;
+}
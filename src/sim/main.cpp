@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <string.h>
+#include "../main.h"
+#include "sim.h"
+
+Settings_t settings;
+
+// Host benchmarks, run with no arguments to run them all
+struct Bench_t
+{
+  const char *name;
+  int (*run)(int argc, char **argv);
+};
+
+static const Bench_t benches[] = {
+    {"timing", benchTiming},
+    {"capture", benchCapture},
+    {"edges", benchEdges},
+    {"bitpacker", benchBitPacker},
+    {"throughput", benchThroughput},
+    {"playback", benchPlayback},
+    {"decoder", benchDecoder},
+    {"telemetry", benchTelemetry},
+    {"eventstream", benchEventStream},
+    {"transmit", benchTransmit},
+    {"journal", benchJournal},
+    {"keyers", benchKeyers},
+    {"ptt", benchPtt},
+    {"trace", benchTrace},
+    {"reconfig", benchReconfig},
+    {"speedpot", benchSpeedPot},
+    {"sleep", benchSleep},
+    {"hotpaths", benchHotPaths},
+    {"selftest", benchSelfTest}};
+
+int main(int argc, char **argv)
+{
+  int result = 0;
+
+  // Benchmarks set the rest of the settings they use
+  settings.debounceMode = DEFAULT_DEBOUNCE_MODE;
+  settings.straightDebounce = DEFAULT_DEBOUNCE_WINDOW;
+  settings.ditDebounce = DEFAULT_DEBOUNCE_WINDOW;
+  settings.dahDebounce = DEFAULT_DEBOUNCE_WINDOW;
+
+  for (const Bench_t &bench : benches)
+  {
+    if (argc > 1 && strcmp(argv[1], bench.name) != 0)
+      continue;
+
+    result |= bench.run(argc > 2 ? argc - 2 : 0, argv + 2);
+    printf("\n");
+  }
+
+  return result;
+}
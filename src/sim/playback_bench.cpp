@@ -0,0 +1,219 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "../main.h"
+#include "../keyer.h"
+#include "../capture.h"
+#include "../playback.h"
+#include "../morse.h"
+#include "sim.h"
+
+#define BENCH_DIT_PIN 3
+#define BENCH_DAH_PIN 29
+#define BENCH_WORDS 200        // Random words streamed per WPM
+#define BENCH_HOST_POLL 50000  // Host checks the free space every 50 ms
+#define BENCH_ABORTS 50        // Paddle aborts per WPM
+
+static const float benchWPM[] = {15, 25, 40, 60};
+
+static const char *benchWordList[] = {"CQ", "TEST", "DE", "PARIS", "5NN", "73", "QTH?", "RST", "TU", "K1ABC/P", "ES", "GL"};
+
+static uint32_t benchRandom = 0x1B873593;
+
+/** xorshift32, fixed seed so every run sends the same text */
+static uint32_t nextRandom()
+{
+  benchRandom ^= benchRandom << 13;
+  benchRandom ^= benchRandom >> 17;
+  benchRandom ^= benchRandom << 5;
+  return benchRandom;
+}
+
+static double ditUs()
+{
+  return settings.timings.dit / (double)(1 << TIMING_FRACTION_BITS);
+}
+
+/** Looks a keyed pattern up in the Morse table, '#' if it is not a character */
+static char decodeCharacter(uint8_t code)
+{
+  for (char c = ' '; c <= '_'; c++)
+  {
+    if (morseEncode(c) == code)
+      return c;
+  }
+  return '#';
+}
+
+/** Decodes the output timeline back into text, with the dit length the keyer was set to */
+static std::string decodeOutput()
+{
+  std::string text;
+  const std::vector<SimEdge_t> &edges = simEdges();
+  double dit = ditUs();
+  uint8_t dahs = 0;
+  uint8_t elements = 0;
+
+  for (size_t i = 1; i < edges.size(); i++)
+  {
+    double length = (double)(edges[i].time - edges[i - 1].time);
+    if (edges[i - 1].state && !edges[i].state)
+    {
+      if (length >= dit * 2)
+        dahs |= 1 << elements;
+      elements++;
+    }
+    else if (!edges[i - 1].state && edges[i].state && length > dit * 2)
+    {
+      text += decodeCharacter(dahs | (1 << elements));
+      if (length > dit * 5)
+        text += ' ';
+      dahs = 0;
+      elements = 0;
+    }
+  }
+  if (elements)
+    text += decodeCharacter(dahs | (1 << elements));
+  return text;
+}
+
+/** Dit units a piece of text takes, from the first element to the end of the last */
+static uint32_t textUnits(const std::string &text)
+{
+  uint32_t units = 0;
+  for (size_t i = 0; i < text.size(); i++)
+  {
+    if (text[i] == ' ')
+    {
+      units += 4; // Word space on top of the character space
+      continue;
+    }
+
+    for (uint8_t code = morseEncode(text[i]); code > 1; code >>= 1)
+      units += (code & 1 ? 3 : 1) + 1;
+    units += 2; // Character space on top of the element gap
+  }
+  return units - 3; // No spacing after the last element
+}
+
+/** Streams random words through the playback buffer like the host would, returns true if the text and its timing came out exactly */
+static bool streamText(double &timingError, const SimLoop_t &loop)
+{
+  std::string message;
+  for (int i = 0; i < BENCH_WORDS; i++)
+    message += std::string(i ? " " : "") + benchWordList[nextRandom() % (sizeof(benchWordList) / sizeof(benchWordList[0]))];
+
+  simReset();
+
+  // Top the buffer up whenever the host polls, never waiting for it to run dry
+  size_t sent = 0;
+  while (sent < message.size() || playbackBusy() || playbackPending())
+  {
+    if (sent < message.size())
+    {
+      size_t chunk = message.size() - sent;
+      if (chunk > playbackFree())
+        chunk = playbackFree();
+      if (chunk > MAX_SYSEX_LENGTH - 4)
+        chunk = MAX_SYSEX_LENGTH - 4; // One SysEx message worth
+      sent += appendPlaybackText((const uint8_t *)message.data() + sent, (uint8_t)chunk);
+    }
+    simRunUntil(simTime() + BENCH_HOST_POLL, loop);
+  }
+
+  const std::vector<SimEdge_t> &edges = simEdges();
+  double keyed = edges.empty() ? 0 : (double)(edges.back().time - edges.front().time);
+  timingError = keyed - textUnits(message) * ditUs();
+
+  return decodeOutput() == message;
+}
+
+/** Presses a paddle in the middle of playback, returns false if any text is keyed after the press */
+static bool abortText(SimStat_t &latency, const SimLoop_t &loop)
+{
+  simReset();
+  if (inputCapture)
+    setupCapture();
+
+  // Dahs only, so anything keyed after the abort that is not a dit came from the text
+  const char *text = "TTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTT";
+  appendPlaybackText((const uint8_t *)text, strlen(text));
+  simRunUntil(simTime() + (uint64_t)(ditUs() * (5 + nextRandom() % 40)), loop);
+
+  uint16_t aborts = playbackAborts();
+  uint64_t pressed = simTime();
+  size_t edgesBefore = simEdges().size();
+  simSetKey(BENCH_DIT_PIN, true);
+
+  while (playbackBusy() && simTime() < pressed + DEFAULT_DEBOUNCE_US * 4)
+    simRunUntil(simTime() + 10, loop);
+  statAdd(latency, (double)(simTime() - pressed));
+
+  simRunUntil(simTime() + (uint64_t)(ditUs() * 1.5), loop);
+  simSetKey(BENCH_DIT_PIN, false);
+  simRunUntil(simTime() + (uint64_t)(ditUs() * 20), loop);
+
+  if (playbackAborts() != (uint16_t)(aborts + 1) || playbackPending())
+    return false;
+
+  // Only the cut dah, if the press landed in one, and the paddle's dits may follow
+  const std::vector<SimEdge_t> &edges = simEdges();
+  for (size_t i = edgesBefore + 1; i < edges.size(); i++)
+  {
+    if (edges[i - 1].state && !edges[i].state && edges[i - 1].time > pressed &&
+        (double)(edges[i].time - edges[i - 1].time) > ditUs() * 2)
+      return false;
+  }
+  return true;
+}
+
+/** Streams text through the playback buffer at several speeds, then aborts it from the paddles */
+int benchPlayback(int argc, char **argv)
+{
+  SimLoop_t loop = {20, 200, 2000};
+
+  // Optional overrides: playback [loop period us] [stall every N passes] [max stall us]
+  if (argc > 0)
+    loop.period = atoi(argv[0]);
+  if (argc > 1)
+    loop.stallEvery = atoi(argv[1]);
+  if (argc > 2)
+    loop.stallMax = atoi(argv[2]);
+
+  printf("Text playback, loop period %u us, stall up to %u us every ~%u passes\n",
+         loop.period, loop.stallMax, loop.stallEvery);
+  printf("%6s %8s %12s %10s %14s %14s\n", "WPM", "text", "timing err", "aborts", "abort mean us", "abort max us");
+
+  settings.keyMode = keyMode_t::KEY_PADDLES;
+  settings.gpio.ditPaddle = BENCH_DIT_PIN;
+  settings.gpio.dahPaddle = BENCH_DAH_PIN;
+  settings.iambicMode = DEFAULT_IAMBIC_MODE;
+  settings.ditMemory = DEFAULT_DIT_MEMORY;
+  settings.dahMemory = DEFAULT_DAH_MEMORY;
+
+  uint32_t failures = 0;
+
+  for (float wpm : benchWPM)
+  {
+    settings.wpm = (uint16_t)(wpm * INTTOFLOATSCALAR);
+    setupWPM();
+
+    double timingError;
+    bool textOk = streamText(timingError, loop);
+
+    SimStat_t latency;
+    statReset(latency);
+    uint32_t abortsOk = 0;
+    for (int i = 0; i < BENCH_ABORTS; i++)
+      abortsOk += abortText(latency, loop);
+
+    failures += !textOk + (BENCH_ABORTS - abortsOk);
+    printf("%6.1f %8s %12.1f %7u/%u %14.1f %14.1f\n", wpm, textOk ? "ok" : "FAIL", timingError,
+           abortsOk, BENCH_ABORTS, statMean(latency), latency.max);
+  }
+
+  printf("%s\n", failures ? "FAILED" : "Passed");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,239 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include "../main.h"
+#include "../keyer.h"
+#include "../capture.h"
+#include "../timers.h"
+#include "sim.h"
+
+#define BENCH_DIT_PIN 3
+#define BENCH_DAH_PIN 29
+#define BENCH_PRESSES 300        // Random paddle presses keyed per PTT setting
+#define BENCH_WHEEL_PASSES 2000000 // Keyer passes per timer wheel load
+#define BENCH_TIMER_SPAN 50000     // Timers are started up to this many microseconds out, a dozen turns of the wheel
+
+// PTT lead and tail pairs, in PTT_LEAD_UNIT_US and PTT_TAIL_UNIT_US steps
+static const uint8_t pttSettings[][2] = {{0, 0}, {0, 20}, {5, 5}, {20, 20}, {50, 2}, {127, 255}};
+
+// Timer wheel loads, timers running at once
+static const uint8_t benchLoads[] = {1, 4, 16, TIMER_POOL_SIZE - 1};
+
+static uint32_t benchRandom = 0x27D4EB2F;
+static uint32_t wheelNow = 0;
+static uint32_t wheelLastPass = 0;
+static uint32_t wheelFires = 0;
+static uint32_t wheelLate = 0; // Fired before their deadline, or not in the first pass after it
+
+/** xorshift32, fixed seed so every PTT setting keys the same presses */
+static uint32_t nextRandom()
+{
+  benchRandom ^= benchRandom << 13;
+  benchRandom ^= benchRandom >> 17;
+  benchRandom ^= benchRandom << 5;
+  return benchRandom;
+}
+
+/** Timer wheel load callback, checks it fired on time and starts another one */
+static void onBenchTimer(uint32_t deadline)
+{
+  if (!timeReached(wheelNow, deadline) || timeReached(wheelLastPass, deadline))
+    wheelLate++;
+  wheelFires++;
+
+  uint32_t next = wheelNow + nextRandom() % BENCH_TIMER_SPAN;
+  timerStart(next, onBenchTimer, next);
+}
+
+/** Host time of keyer passes with a given number of timers running, the cost per timer fired should not grow with the load */
+static bool benchWheel(uint8_t load, uint32_t passes)
+{
+  setupTimers(0);
+  wheelNow = 0;
+  wheelLastPass = 0;
+  wheelFires = 0;
+  wheelLate = 0;
+
+  for (uint8_t i = 0; i < load; i++)
+  {
+    uint32_t deadline = nextRandom() % BENCH_TIMER_SPAN;
+    timerStart(deadline, onBenchTimer, deadline);
+  }
+
+  // Passes every 16 us like a busy keyer loop, now and then a stalled one
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t pass = 0; pass < passes; pass++)
+  {
+    wheelLastPass = wheelNow;
+    wheelNow += (nextRandom() & 255) ? 16 : nextRandom() % 20000;
+    timerAdvance(wheelNow);
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+  bool fail = wheelLate || timersPending() != load;
+  printf("%6u %10u %10u %12.1f %12.1f %8u%s\n", load, passes, wheelFires, ns / passes, ns / wheelFires, wheelLate,
+         fail ? "  FAIL" : "");
+
+  setupTimers(0);
+  return !fail;
+}
+
+/** Level of an edge list at a time, edges at that very time included */
+static bool levelAt(const std::vector<SimEdge_t> &edges, uint64_t time)
+{
+  bool level = false;
+  for (const SimEdge_t &edge : edges)
+  {
+    if (edge.time > time)
+      break;
+    level = edge.state;
+  }
+  return level;
+}
+
+/** Keys random paddle presses, some with gaps longer than the tail, and returns the output edges */
+static std::vector<SimEdge_t> keyPresses(const SimLoop_t &loop)
+{
+  benchRandom = 0x27D4EB2F;
+  simReset();
+  if (inputCapture)
+    setupCapture();
+
+  uint32_t dit = settings.timings.dit >> TIMING_FRACTION_BITS;
+  for (int i = 0; i < BENCH_PRESSES; i++)
+  {
+    uint8_t pin = (nextRandom() & 1) ? BENCH_DIT_PIN : BENCH_DAH_PIN;
+    simSetKey(pin, true);
+    simRunUntil(simTime() + dit / 2 + nextRandom() % (dit * 4), loop);
+    simSetKey(pin, false);
+
+    // Mostly inside a character, now and then long enough for PTT to drop
+    uint32_t gap = (nextRandom() % 8) ? dit + nextRandom() % (dit * 6) : nextRandom() % 3000000;
+    simRunUntil(simTime() + gap, loop);
+  }
+  simRunUntil(simTime() + 3000000, loop); // Every tail runs out
+
+  return simEdges();
+}
+
+/** Keys random presses under each PTT lead and tail, checks RF never goes on without PTT and the output is the key shifted by the lead */
+int benchPtt(int argc, char **argv)
+{
+  SimLoop_t loop = {20, 200, 2000};
+  uint32_t passes = BENCH_WHEEL_PASSES;
+
+  // Optional overrides: ptt [loop period us] [stall every N passes] [max stall us] [timer wheel passes]
+  if (argc > 0)
+    loop.period = atoi(argv[0]);
+  if (argc > 1)
+    loop.stallEvery = atoi(argv[1]);
+  if (argc > 2)
+    loop.stallMax = atoi(argv[2]);
+  if (argc > 3)
+    passes = atoi(argv[3]);
+
+  int result = 0;
+
+  printf("Timer wheel, %u slots of %u us, timers restarted up to %d ms out as they fire\n", TIMER_WHEEL_SLOTS,
+         1u << TIMER_TICK_SHIFT, BENCH_TIMER_SPAN / 1000);
+  printf("%6s %10s %10s %12s %12s %8s\n", "load", "passes", "fired", "ns/pass", "ns/fire", "late");
+  for (uint8_t load : benchLoads)
+  {
+    if (!benchWheel(load, passes))
+      result = 1;
+  }
+
+  printf("\nPTT sequencing, %d random paddle presses, loop period %u us, stall up to %u us every ~%u passes\n",
+         BENCH_PRESSES, loop.period, loop.stallMax, loop.stallEvery);
+  printf("%8s %8s %6s %8s %10s %10s %10s %7s\n", "lead ms", "tail ms", "PTT", "elements", "min lead", "min tail",
+         "shift err", "no PTT");
+
+  settings.keyMode = keyMode_t::KEY_PADDLES;
+  settings.gpio.ditPaddle = BENCH_DIT_PIN;
+  settings.gpio.dahPaddle = BENCH_DAH_PIN;
+  settings.wpm = DEFAULT_WPM * 2;
+  setupWPM();
+
+  // The output as keyed, without sequencing
+  settings.pttMode = gpioOutputMode_t::OUTPUT_DISABLED;
+  std::vector<SimEdge_t> keyed = keyPresses(loop);
+
+  for (const uint8_t *ptt : pttSettings)
+  {
+    settings.pttMode = gpioOutputMode_t::OUTPUT_NORMAL;
+    settings.pttLead = ptt[0];
+    settings.pttTail = ptt[1];
+    uint32_t lead = ptt[0] * PTT_LEAD_UNIT_US;
+    uint32_t tail = ptt[1] * PTT_TAIL_UNIT_US;
+
+    std::vector<SimEdge_t> rf = keyPresses(loop);
+    const std::vector<SimEdge_t> &pttEdges = simPttEdges();
+
+    // Every output edge is the keyed one moved by the lead
+    double shiftError = rf.size() == keyed.size() ? 0.0 : 1e9;
+    for (size_t i = 0; i < rf.size() && i < keyed.size(); i++)
+    {
+      double error = fabs((double)(rf[i].time - keyed[i].time) - lead);
+      if (error > shiftError || rf[i].state != keyed[i].state)
+        shiftError = rf[i].state != keyed[i].state ? 1e9 : error;
+    }
+
+    // RF only with PTT up, after the lead, and PTT held for the tail after RF last went off
+    uint32_t noPtt = 0;
+    double minLead = 1e9;
+    double minTail = 1e9;
+    uint64_t pttUp = 0;
+    uint32_t cycles = 0;
+
+    for (const SimEdge_t &edge : rf)
+    {
+      if (edge.state && !levelAt(pttEdges, edge.time))
+        noPtt++;
+    }
+    for (const SimEdge_t &edge : pttEdges)
+    {
+      if (edge.state)
+      {
+        pttUp = edge.time;
+        cycles++;
+
+        // First RF on of this transmission
+        for (const SimEdge_t &on : rf)
+        {
+          if (on.state && on.time >= pttUp)
+          {
+            minLead = fmin(minLead, (double)(on.time - pttUp));
+            break;
+          }
+        }
+        continue;
+      }
+
+      if (levelAt(rf, edge.time))
+        noPtt++; // PTT dropped under RF
+      for (auto it = rf.rbegin(); it != rf.rend(); ++it)
+      {
+        if (!it->state && it->time <= edge.time)
+        {
+          minTail = fmin(minTail, (double)(edge.time - it->time));
+          break;
+        }
+      }
+    }
+
+    // The state alarm switches delayed edges on time, polling them from loop() adds the stalls
+    double shiftLimit = edgeAlarm ? 0.0 : loop.stallMax + loop.period;
+    bool fail = noPtt || cycles == 0 || minLead + loop.period < lead || minTail + (1u << TIMER_TICK_SHIFT) < tail ||
+                shiftError > shiftLimit;
+    printf("%8u %8u %6u %8zu %10.0f %10.0f %10.1f %7u%s\n", lead / 1000, tail / 1000, cycles, rf.size() / 2,
+           minLead, minTail, shiftError, noPtt, fail ? "  FAIL" : "");
+    if (fail)
+      result = 1;
+  }
+
+  settings.pttMode = gpioOutputMode_t::OUTPUT_DISABLED;
+  simReset();
+  return result;
+}
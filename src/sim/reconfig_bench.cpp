@@ -0,0 +1,413 @@
+#include <Arduino.h>
+#include <BitPacker.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "../main.h"
+#include "../keyer.h"
+#include "../capture.h"
+#include "../config.h"
+#include "sim.h"
+
+#define BENCH_DIT_PIN 3
+#define BENCH_DAH_PIN 29
+#define BENCH_WPM 20
+#define BENCH_TRIALS 16         // Changes made at points spread over a dit and dah
+#define BENCH_SQUEEZE 2000000   // Paddles squeezed this long, the change made part way
+#define BENCH_PTT_LEAD 30       // PTT lead while squeezing, PTT_LEAD_UNIT_US steps
+
+// A settings change made while the paddles are squeezed
+struct BenchChange_t
+{
+  const char *name;
+  void (*apply)(Settings_t &settings);
+};
+
+static void fasterWpm(Settings_t &s) { s.wpm = (BENCH_WPM + 4) * WPM_SCALE; }
+static void slowerWpm(Settings_t &s) { s.wpm = (BENCH_WPM - 4) * WPM_SCALE; }
+static void heavier(Settings_t &s) { s.weight = 65; }
+static void newNote(Settings_t &s) { s.note = DEFAULT_MIDI_NOTE + 12; s.channel = DEFAULT_MIDI_CHANNEL + 1; }
+static void quieter(Settings_t &s) { s.volume = DEFAULT_MIDI_VOLUME / 2; }
+static void shorterLead(Settings_t &s) { s.pttLead = 5; }
+static void longerLead(Settings_t &s) { s.pttLead = 90; }
+
+static const BenchChange_t benchChanges[] = {
+    {"wpm +4", fasterWpm},
+    {"wpm -4", slowerWpm},
+    {"weight 65", heavier},
+    {"note, channel", newNote},
+    {"volume", quieter},
+    {"ptt lead 5 ms", shorterLead},
+    {"ptt lead 90 ms", longerLead}};
+
+// Single field changes and what settingsChanges() must make of them
+struct BenchClass_t
+{
+  void (*apply)(Settings_t &settings);
+  uint8_t expected;
+};
+
+static void movedDah(Settings_t &s) { s.gpio.dahPaddle = 28; }
+static void straightMode(Settings_t &s) { s.keyMode = keyMode_t::KEY_STRAIGHT; }
+static void longerDebounce(Settings_t &s) { s.ditDebounce += 4; }
+static void movedOutput(Settings_t &s) { s.gpio.output = 16; }
+static void movedPtt(Settings_t &s) { s.gpio.ptt = 14; }
+static void rgbLed(Settings_t &s) { s.ledMode = ledMode_t::LED_RGB; }
+static void secondKeyer(Settings_t &s) { s.keyers[0].keyMode = keyMode_t::KEY_STRAIGHT; }
+static void secondOutput(Settings_t &s) { s.keyers[0].output = 17; }
+static void secondNote(Settings_t &s) { s.keyers[0].note = 70; }
+static void speedKnob(Settings_t &s) { s.gpio.speedPot = 27; }
+static void speedRange(Settings_t &s) { s.speedMax = 50; }
+static void nothing(Settings_t &s) {}
+
+static const BenchClass_t benchClasses[] = {
+    {fasterWpm, CHANGE_SOFT}, {heavier, CHANGE_SOFT}, {newNote, CHANGE_SOFT}, {quieter, CHANGE_SOFT},
+    {shorterLead, CHANGE_SOFT}, {secondNote, CHANGE_SOFT}, {movedDah, CHANGE_KEYS}, {straightMode, CHANGE_KEYS},
+    {longerDebounce, CHANGE_KEYS}, {secondKeyer, CHANGE_KEYS}, {movedOutput, CHANGE_OUTPUTS},
+    {movedPtt, CHANGE_OUTPUTS}, {secondOutput, CHANGE_OUTPUTS}, {rgbLed, CHANGE_LED}, {speedKnob, CHANGE_KEYS}, {speedRange, CHANGE_SOFT}, {nothing, CHANGE_NONE}};
+
+// What a change did to the keying around it, summed over the trials
+struct BenchResult_t
+{
+  uint32_t elements;
+  uint32_t cut;   // Elements and gaps matching neither the old nor the new timing
+  uint32_t stale; // Elements started after the change still at the old timing or note
+  uint32_t hung;  // Note offs for a different note or channel than their note on
+  uint32_t rf;    // Output elements not the length of their note, or missing
+};
+
+/** The squeeze every trial starts from, PTT sequenced so a changed lead shows on the output */
+static Settings_t baseSettings()
+{
+  Settings_t base = settings;
+  base.keyMode = keyMode_t::KEY_PADDLES;
+  base.gpio.ditPaddle = BENCH_DIT_PIN;
+  base.gpio.dahPaddle = BENCH_DAH_PIN;
+  base.wpm = BENCH_WPM * WPM_SCALE;
+  base.weight = DEFAULT_WEIGHT;
+  base.farnsworth = 0;
+  base.note = DEFAULT_MIDI_NOTE;
+  base.channel = DEFAULT_MIDI_CHANNEL;
+  base.volume = DEFAULT_MIDI_VOLUME;
+  base.iambicMode = iambicMode_t::IAMBIC_B;
+  base.pttMode = gpioOutputMode_t::OUTPUT_NORMAL;
+  base.pttLead = BENCH_PTT_LEAD;
+  base.pttTail = 20;
+  for (KeyerSettings_t &keyer : base.keyers)
+    keyer = {};
+  return base;
+}
+
+/** Element and gap lengths of a set of settings, in microseconds */
+static void nominalTimings(const Settings_t &from, uint32_t &dit, uint32_t &dah, uint32_t &gap)
+{
+  Settings_t saved = settings;
+  settings = from;
+  setupWPM();
+  dit = settings.timings.dit >> TIMING_FRACTION_BITS;
+  dah = settings.timings.dah >> TIMING_FRACTION_BITS;
+  gap = settings.timings.gap >> TIMING_FRACTION_BITS;
+  settings = saved;
+}
+
+/** True if a length is within the tolerance of a nominal one */
+static inline bool near(uint64_t length, uint32_t nominal, uint32_t tolerance)
+{
+  return (length > nominal ? length - nominal : nominal - length) <= tolerance;
+}
+
+/** Reconfigures the way setConfig() did before, every key and output set up again */
+static void teardown(const Settings_t &newSettings)
+{
+  stopKeyers();
+  cleanUpCapture();
+  settings = newSettings;
+  setupWPM();
+  loadKeyers();
+  setupKeyDebounce();
+  if (inputCapture)
+    setupCapture();
+}
+
+/** Squeezes the paddles, makes the change part way through an element and checks the keying either side of it */
+static void runTrial(const BenchChange_t &change, bool swap, uint32_t trial, const SimLoop_t &loop, BenchResult_t &result)
+{
+  Settings_t before = baseSettings();
+  Settings_t after = before;
+  change.apply(after);
+
+  uint32_t oldDit, oldDah, oldGap, newDit, newDah, newGap;
+  nominalTimings(before, oldDit, oldDah, oldGap);
+  nominalTimings(after, newDit, newDah, newGap);
+
+  settings = before;
+  setupWPM();
+  simReset();
+  if (inputCapture)
+    setupCapture();
+
+  simSetKey(BENCH_DIT_PIN, true);
+  simSetKey(BENCH_DAH_PIN, true);
+
+  uint64_t changeTime = BENCH_SQUEEZE / 2 + (uint64_t)trial * (oldDit + oldDah + oldGap * 2) / BENCH_TRIALS;
+  simRunUntil(changeTime, loop);
+  changeTime = simTime();
+
+  if (swap)
+    swapKeyerSettings(after);
+  else
+    teardown(after);
+
+  simRunUntil(BENCH_SQUEEZE, loop);
+  simSetKey(BENCH_DIT_PIN, false);
+  simSetKey(BENCH_DAH_PIN, false);
+  simRunUntil(simTime() + 3000000, loop); // The PTT tail runs out
+
+  uint32_t tolerance = loop.period * 2;
+
+  // Notes of the first keyer, on then off
+  const std::vector<SimNote_t> &notes = simNotes();
+  std::vector<uint64_t> lengths;
+  for (size_t i = 0; i + 1 < notes.size(); i += 2)
+  {
+    const SimNote_t &on = notes[i];
+    const SimNote_t &off = notes[i + 1];
+    if (!on.state || off.state || on.note != off.note || on.channel != off.channel)
+    {
+      result.hung++;
+      continue;
+    }
+
+    uint64_t length = off.time - on.time;
+    lengths.push_back(length);
+    result.elements++;
+
+    bool old = near(length, oldDit, tolerance) || near(length, oldDah, tolerance);
+    bool fresh = near(length, newDit, tolerance) || near(length, newDah, tolerance);
+    if (!old && !fresh)
+      result.cut++;
+    else if (on.time > changeTime && old && !fresh)
+      result.stale++;
+    else if (on.time > changeTime && (on.note != after.note || on.channel != after.channel))
+      result.stale++;
+
+    // The gap after it, up to the next note within the squeeze
+    if (i + 2 < notes.size() && notes[i + 2].time < BENCH_SQUEEZE)
+    {
+      uint64_t gap = notes[i + 2].time - off.time;
+      if (!near(gap, oldGap, tolerance) && !near(gap, newGap, tolerance))
+        result.cut++;
+    }
+  }
+  if (notes.size() & 1)
+    result.hung++;
+
+  // The output is the notes moved by the PTT lead, element for element
+  const std::vector<SimEdge_t> &edges = simEdges();
+  size_t outputs = 0;
+  for (size_t i = 0; i + 1 < edges.size(); i += 2)
+  {
+    if (!edges[i].state || edges[i + 1].state || outputs >= lengths.size() ||
+        !near(edges[i + 1].time - edges[i].time, lengths[outputs], tolerance))
+      result.rf++;
+    outputs++;
+  }
+  if (outputs != lengths.size())
+    result.rf++;
+}
+
+/** Takes up a key or output change the way applySettings() does, the keyers stopped and set up again on the new pins */
+static void restart(const Settings_t &newSettings, bool keys)
+{
+  stopKeyers();
+  if (keys)
+    cleanUpCapture();
+  swapKeyerSettings(newSettings);
+  loadKeyers();
+  if (keys)
+  {
+    setupKeyDebounce();
+    if (inputCapture)
+      setupCapture();
+  }
+}
+
+/** Taps a dit and changes the keys or outputs part way through it, returns true if the output and PTT end off with the note */
+static bool stopTrial(void (*apply)(Settings_t &settings), bool keys, bool ptt, uint32_t trial, const SimLoop_t &loop)
+{
+  Settings_t before = baseSettings();
+  if (!ptt)
+    before.pttMode = gpioOutputMode_t::OUTPUT_DISABLED;
+  Settings_t after = before;
+  apply(after);
+
+  settings = before;
+  setupWPM();
+  simReset();
+  if (inputCapture)
+    setupCapture();
+
+  uint32_t dit = settings.timings.dit >> TIMING_FRACTION_BITS;
+  simSetKey(BENCH_DIT_PIN, true);
+  simRunUntil(dit / 4, loop);
+  simSetKey(BENCH_DIT_PIN, false);
+  simRunUntil(dit / 4 + (uint64_t)(trial + 1) * dit / (BENCH_TRIALS + 1), loop);
+
+  restart(after, keys);
+  simRunUntil(simTime() + 2000000, loop);
+
+  const std::vector<SimEdge_t> &edges = simEdges();
+  const std::vector<SimEdge_t> &pttEdges = simPttEdges();
+  const std::vector<SimNote_t> &notes = simNotes();
+  return (edges.empty() || !edges.back().state) && (pttEdges.empty() || !pttEdges.back().state) && !notes.empty() &&
+         !notes.back().state;
+}
+
+/** Packs a list of fields by id, as the browser sends CMD_SET_FIELDS */
+static void hostEncodeFields(const Settings_t &from, const uint8_t *ids, uint8_t count, uint8_t *out, uint8_t &outSize)
+{
+  // Values read off a full packed config, the way the browser holds them
+  uint8_t config[CONFIG_PACKED_SIZE];
+  uint8_t configSize;
+  encodeConfig(from, config, configSize);
+
+  BitPacker<CONFIG_PACKED_SIZE * 7> packed;
+  packed.unpack7Bit(config, configSize);
+  uint32_t values[CONFIG_FIELD_COUNT];
+  for (uint8_t id = 0; id < CONFIG_FIELD_COUNT; id++)
+    values[id] = packed.extractField(configFieldBits[id]);
+
+  BitPacker<(MAX_SYSEX_LENGTH - 4) * 7> packer;
+  packer.addField(count, 7);
+  for (uint8_t i = 0; i < count; i++)
+  {
+    packer.addField(ids[i], 7);
+    packer.addField(values[ids[i]], configFieldBits[ids[i]]);
+  }
+  packer.pack7Bit(out, outSize);
+}
+
+/** Round trips changed field lists through decodeConfigFields(), a cut short or unknown list must change nothing */
+static bool checkFieldLists()
+{
+  Settings_t base = baseSettings();
+  Settings_t changed = base;
+  fasterWpm(changed);
+  newNote(changed);
+  shorterLead(changed);
+  changed.keyers[2].output = 21;
+
+  const uint8_t ids[] = {CONFIG_WPM, CONFIG_NOTE, CONFIG_CHANNEL, CONFIG_PTTLEAD, CONFIG_KEYER3_OUTPUT};
+  uint8_t data[MAX_SYSEX_LENGTH];
+  uint8_t size;
+  hostEncodeFields(changed, ids, sizeof(ids), data, size);
+
+  uint8_t expected[CONFIG_PACKED_SIZE], got[CONFIG_PACKED_SIZE], configSize;
+  encodeConfig(changed, expected, configSize);
+
+  Settings_t decoded = base;
+  bool ok = decodeConfigFields(decoded, data, size) == sizeof(ids);
+  encodeConfig(decoded, got, configSize);
+  ok = ok && memcmp(expected, got, configSize) == 0;
+
+  // Cut short: nothing applied
+  encodeConfig(base, expected, configSize);
+  decoded = base;
+  ok = ok && decodeConfigFields(decoded, data, size - 2) == 0;
+  encodeConfig(decoded, got, configSize);
+  ok = ok && memcmp(expected, got, configSize) == 0;
+
+  // A field id past the end of the layout: nothing applied
+  BitPacker<(MAX_SYSEX_LENGTH - 4) * 7> packer;
+  packer.addField(2, 7);
+  packer.addField(CONFIG_WPM, 7);
+  packer.addField(changed.wpm, 16);
+  packer.addField(CONFIG_FIELD_COUNT, 7);
+  packer.addField(0, 7);
+  packer.pack7Bit(data, size);
+  decoded = base;
+  ok = ok && decodeConfigFields(decoded, data, size) == 0;
+  encodeConfig(decoded, got, configSize);
+  ok = ok && memcmp(expected, got, configSize) == 0;
+
+  return ok;
+}
+
+/** Changes settings part way through a squeeze, taken up between passes against the old teardown, and checks the keying is not disturbed */
+int benchReconfig(int argc, char **argv)
+{
+  SimLoop_t loop = {20, 200, 2000};
+
+  // Optional overrides: reconfig [loop period us] [stall every N passes] [max stall us]
+  if (argc > 0)
+    loop.period = atoi(argv[0]);
+  if (argc > 1)
+    loop.stallEvery = atoi(argv[1]);
+  if (argc > 2)
+    loop.stallMax = atoi(argv[2]);
+
+  int result = 0;
+  Settings_t saved = settings;
+
+  // Classification of single field changes
+  uint32_t right = 0;
+  for (const BenchClass_t &check : benchClasses)
+  {
+    Settings_t before = baseSettings();
+    Settings_t after = before;
+    check.apply(after);
+    right += settingsChanges(before, after) == check.expected;
+  }
+  bool classOk = right == sizeof(benchClasses) / sizeof(benchClasses[0]);
+  bool fieldsOk = checkFieldLists();
+  printf("Settings changes classified %u of %zu right, changed field lists %s%s\n", right,
+         sizeof(benchClasses) / sizeof(benchClasses[0]), fieldsOk ? "exact" : "wrong", classOk && fieldsOk ? "" : "  FAIL");
+  if (!classOk || !fieldsOk)
+    result = 1;
+
+  // Keys or outputs changed part way through an element, the keyers stopped with nothing left keyed
+  uint32_t stopped = 0;
+  uint32_t stopTrials = 0;
+  for (int keys = 0; keys < 2; keys++)
+  {
+    for (int ptt = 0; ptt < 2; ptt++)
+    {
+      for (uint32_t trial = 0; trial < BENCH_TRIALS; trial++)
+      {
+        stopped += stopTrial(keys ? movedDah : movedOutput, keys, ptt, trial, loop);
+        stopTrials++;
+      }
+    }
+  }
+  printf("Keys or outputs changed mid element, output and PTT off after %u of %u%s\n", stopped, stopTrials,
+         stopped == stopTrials ? "" : "  FAIL");
+  if (stopped != stopTrials)
+    result = 1;
+
+  printf("\nSettings changed while squeezing at %d WPM, PTT lead %d ms, %d points through an element, loop period %u us, stall up to %u us every ~%u passes\n",
+         BENCH_WPM, BENCH_PTT_LEAD, BENCH_TRIALS, loop.period, loop.stallMax, loop.stallEvery);
+  printf("%-16s %-9s %9s %6s %6s %6s %6s\n", "change", "apply", "elements", "cut", "stale", "hung", "rf");
+
+  for (const BenchChange_t &change : benchChanges)
+  {
+    for (int swap = 0; swap < 2; swap++)
+    {
+      BenchResult_t totals = {};
+      for (uint32_t trial = 0; trial < BENCH_TRIALS; trial++)
+        runTrial(change, swap, trial, loop, totals);
+
+      // Only the swap is held to it, the teardown is there to compare against
+      bool fail = swap && (totals.cut || totals.stale || totals.hung || totals.rf);
+      printf("%-16s %-9s %9u %6u %6u %6u %6u%s\n", change.name, swap ? "swap" : "teardown", totals.elements, totals.cut,
+             totals.stale, totals.hung, totals.rf, fail ? "  FAIL" : "");
+      if (fail)
+        result = 1;
+    }
+  }
+
+  settings = saved;
+  setupWPM();
+  simReset();
+  return result;
+}
@@ -0,0 +1,225 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <BitPacker.hpp>
+#include "../main.h"
+#include "../keyer.h"
+#include "../capture.h"
+#include "../selftest.h"
+#include "sim.h"
+
+#define BENCH_DIT_PIN 3
+#define BENCH_DAH_PIN 29
+#define BENCH_STRAIGHT_PIN 2
+#define BENCH_DRIVE_PIN 6  // Spare GPIO wired back to the key pin
+#define BENCH_OUTPUT_PIN 9 // Keyer output, the test must refuse to drive it
+#define BENCH_WPM 30
+#define BENCH_PRESSES 1000
+
+// CMD_SELF_TEST reply as the browser reads it
+struct HostSelfTest_t
+{
+  bool running;
+  uint8_t pin;
+  uint16_t presses;
+  uint16_t driven;
+  SelfTestStats_t output;
+  SelfTestStats_t note;
+};
+
+// A self-test run: how the key is wired and read
+struct SelfTestRun_t
+{
+  const char *name;
+  keyMode_t keyMode;
+  debounceMode_t debounce;
+  bool capture;
+  bool sleep;
+  bool wired;    // Drive pin wired to the key, else left unconnected
+  int drivePin;  // -1 drives the key pin itself
+  bool accepted; // The keyer takes the pin
+  bool stopped;  // Stopped halfway with a count of none
+};
+
+static const SelfTestRun_t selfTestRuns[] = {
+    {"paddles", keyMode_t::KEY_PADDLES, debounceMode_t::DEBOUNCE_LEADING, true, false, true, BENCH_DRIVE_PIN, true, false},
+    {"paddles, settle", keyMode_t::KEY_PADDLES, debounceMode_t::DEBOUNCE_SETTLE, true, false, true, BENCH_DRIVE_PIN, true, false},
+    {"paddles, polled", keyMode_t::KEY_PADDLES, debounceMode_t::DEBOUNCE_LEADING, false, false, true, BENCH_DRIVE_PIN, true, false},
+    {"paddles, asleep", keyMode_t::KEY_PADDLES, debounceMode_t::DEBOUNCE_LEADING, true, true, true, BENCH_DRIVE_PIN, true, false},
+    {"straight", keyMode_t::KEY_STRAIGHT, debounceMode_t::DEBOUNCE_LEADING, true, false, true, BENCH_DRIVE_PIN, true, false},
+    {"straight, key pin", keyMode_t::KEY_STRAIGHT, debounceMode_t::DEBOUNCE_LEADING, true, false, true, -1, true, false},
+    {"paddles, stopped", keyMode_t::KEY_PADDLES, debounceMode_t::DEBOUNCE_LEADING, true, false, true, BENCH_DRIVE_PIN, true, true},
+    {"paddles, unwired", keyMode_t::KEY_PADDLES, debounceMode_t::DEBOUNCE_LEADING, true, false, false, BENCH_DRIVE_PIN, true, false},
+    {"paddles, output pin", keyMode_t::KEY_PADDLES, debounceMode_t::DEBOUNCE_LEADING, true, false, false, BENCH_OUTPUT_PIN, false, false}};
+
+/** Unpacks one set of latency stats */
+template <uint16_t N>
+static void hostDecodeStats(BitPacker<N> &packer, SelfTestStats_t &stats)
+{
+  stats.count = packer.extractField(14);
+  stats.min = packer.extractField(16);
+  stats.mean = packer.extractField(16);
+  stats.p99 = packer.extractField(16);
+  stats.max = packer.extractField(16);
+}
+
+/** Asks for the results and decodes the CMD_SELF_TEST reply */
+static void readSelfTest(HostSelfTest_t &test)
+{
+  uint8_t data[MAX_SYSEX_LENGTH];
+  uint8_t size;
+  encodeSelfTest(data, size);
+
+  BitPacker<(SELF_TEST_BITS + 6) / 7 * 7> packer;
+  packer.unpack7Bit(data, size);
+  test.running = packer.extractField(1);
+  test.pin = packer.extractField(7);
+  test.presses = packer.extractField(14);
+  test.driven = packer.extractField(14);
+  hostDecodeStats(packer, test.output);
+  hostDecodeStats(packer, test.note);
+}
+
+/** True if the stats hang together: the minimum at or below the mean and 99th percentile, both at or below the maximum */
+static bool statsOrdered(const SelfTestStats_t &stats)
+{
+  return stats.count == 0 || (stats.min <= stats.mean && stats.min <= stats.p99 && stats.mean <= stats.max && stats.p99 <= stats.max);
+}
+
+/** True if two sets of stats are the same */
+static bool statsEqual(const SelfTestStats_t &a, const SelfTestStats_t &b)
+{
+  return a.count == b.count && a.min == b.min && a.mean == b.mean && a.p99 == b.p99 && a.max == b.max;
+}
+
+/** Prints one set of latency stats */
+static void printStats(const SelfTestStats_t &stats)
+{
+  printf(" %6u %6u %6u %6u %6u", stats.count, stats.min, stats.mean, stats.p99, stats.max);
+}
+
+/** Runs a self-test on the simulated HAL the way the browser asks for one, returns true if it passed */
+static bool runSelfTest(const SelfTestRun_t &run, uint16_t presses, const SimLoop_t &baseLoop)
+{
+  SimLoop_t loop = baseLoop;
+  loop.sleep = run.sleep;
+  inputCapture = run.capture;
+  settings.keyMode = run.keyMode;
+  settings.debounceMode = run.debounce;
+
+  simReset();
+  if (inputCapture)
+    setupCapture();
+
+  uint8_t keyPin = run.keyMode == keyMode_t::KEY_STRAIGHT ? BENCH_STRAIGHT_PIN : BENCH_DIT_PIN;
+  uint8_t drivePin = run.drivePin < 0 ? keyPin : run.drivePin;
+  if (run.wired && drivePin != keyPin)
+    simLoopback(drivePin, keyPin);
+
+  // CMD_SELF_TEST with the pin and count, taken by the keyer on its next pass
+  requestSelfTest(drivePin, presses);
+  simRunUntil(simTime() + loop.period, loop);
+  processSelfTestRequest(micros());
+
+  // Random presses come about every few elements, give them ten times that
+  uint64_t timeout = simTime() + (uint64_t)presses * 10 * 20 * (1200000 / BENCH_WPM);
+  HostSelfTest_t test;
+  while (selfTestRunning && simTime() < timeout)
+  {
+    simRunUntil(simTime() + 100000, loop);
+
+    // CMD_SELF_TEST with none stops it, the presses timed so far stay
+    readSelfTest(test);
+    if (run.stopped && test.driven >= presses / 2)
+    {
+      requestSelfTest(0, 0);
+      simRunUntil(simTime() + loop.period, loop);
+      processSelfTestRequest(micros());
+    }
+  }
+
+  readSelfTest(test);
+  SelfTestStats_t output;
+  SelfTestStats_t note;
+  bool finished = selfTestResults(output, note);
+
+  // Latency the keyer can add: a loop pass and its stall before the edge is seen, the settling window on top
+  uint32_t window = settings.ditDebounce * DEBOUNCE_TICK_US;
+  uint32_t bound = loop.period + loop.stallMax + DEBOUNCE_TICK_US + (run.debounce == debounceMode_t::DEBOUNCE_SETTLE ? window : 0);
+
+  bool fail = !finished || test.running || !statsEqual(test.output, output) || !statsEqual(test.note, note) ||
+              !statsOrdered(output) || !statsOrdered(note);
+  if (run.stopped)
+    fail = fail || test.pin != drivePin || test.presses != presses || test.driven < presses / 2 || test.driven >= presses ||
+           output.count + 1 < test.driven || output.count > test.driven || note.count + 1 < test.driven ||
+           note.count > test.driven || output.max > bound || note.max > bound; // The last press may be cut short
+  else if (run.accepted && run.wired)
+    fail = fail || test.driven != presses || output.count != presses || note.count != presses || output.max > bound ||
+           note.max > bound;
+  else if (run.accepted)
+    fail = fail || test.driven != presses || output.count || note.count; // Nothing wired, nothing keyed
+  else
+    fail = fail || test.presses || test.driven; // Refused, never started
+
+  printf("%-20s %4u %7u %7u", run.name, drivePin, test.driven, bound);
+  printStats(output);
+  printStats(note);
+  printf("%s\n", fail ? "  FAIL" : "");
+  return !fail;
+}
+
+/** Runs the loopback latency self-test against the simulated HAL, wired and read every way the device can be */
+int benchSelfTest(int argc, char **argv)
+{
+  uint16_t presses = BENCH_PRESSES;
+  SimLoop_t loop = {20, 200, 2000};
+
+  // Optional overrides: selftest [presses] [loop period us] [stall every N passes] [max stall us]
+  if (argc > 0)
+    presses = atoi(argv[0]);
+  if (argc > 1)
+    loop.period = atoi(argv[1]);
+  if (argc > 2)
+    loop.stallEvery = atoi(argv[2]);
+  if (argc > 3)
+    loop.stallMax = atoi(argv[3]);
+
+  Settings_t saved = settings;
+  bool savedCapture = inputCapture;
+  bool savedSleep = idleSleep;
+  idleSleep = true; // Only taken up by the runs that sleep
+
+  settings.gpio.ditPaddle = BENCH_DIT_PIN;
+  settings.gpio.dahPaddle = BENCH_DAH_PIN;
+  settings.gpio.straightKey = BENCH_STRAIGHT_PIN;
+  settings.gpio.speedPot = 0;
+  settings.gpioOutputMode = gpioOutputMode_t::OUTPUT_NORMAL;
+  settings.gpio.output = BENCH_OUTPUT_PIN;
+  for (KeyerSettings_t &keyer : settings.keyers)
+    keyer.keyMode = keyMode_t::KEY_NONE;
+  settings.pttMode = gpioOutputMode_t::OUTPUT_DISABLED;
+  settings.ledMode = ledMode_t::LED_DISABLED;
+  settings.wpm = BENCH_WPM * WPM_SCALE;
+  settings.farnsworth = 0;
+  settings.weight = DEFAULT_WEIGHT;
+  setupWPM();
+
+  printf("Loopback self-test, %u random presses at %d WPM, press to output on and note on latency in us\n", presses,
+         BENCH_WPM);
+  printf("%-20s %4s %7s %7s %6s %6s %6s %6s %6s %6s %6s %6s %6s %6s\n", "key", "pin", "pressed", "bound", "output",
+         "min", "mean", "p99", "max", "notes", "min", "mean", "p99", "max");
+
+  int result = 0;
+  for (const SelfTestRun_t &run : selfTestRuns)
+  {
+    if (!runSelfTest(run, presses, loop))
+      result = 1;
+  }
+
+  settings = saved;
+  setupWPM();
+  inputCapture = savedCapture;
+  idleSleep = savedSleep;
+  simReset();
+  return result;
+}
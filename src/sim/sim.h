@@ -0,0 +1,118 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <Arduino.h>
+#include <string>
+#include <vector>
+
+#define SIM_NUM_PINS 30
+
+// Output edge captured from setOutput()
+struct SimEdge_t
+{
+    uint64_t time; // Virtual time in microseconds
+    bool state;    // Key down/up
+    uint8_t keyer; // Instance that switched its output
+};
+
+// MIDI note on or off sent by a keyer
+struct SimNote_t
+{
+    uint64_t time; // Virtual time in microseconds
+    bool state;    // Note on/off
+    uint8_t keyer;
+    uint8_t note;
+    uint8_t channel;
+};
+
+// Loop timing model, how long each pass of loop() takes on the device
+struct SimLoop_t
+{
+    uint32_t period;     // Base loop() period in microseconds
+    uint32_t stallEvery; // Average passes between midi.update() stalls, 0 to disable
+    uint32_t stallMax;   // Longest stall in microseconds
+    bool sleep;          // Sleep between events when the keyer allows it, like loop1() with idle sleep
+};
+
+// USB MIDI write from the transmit scheduler, a note or SysEx
+struct SimUsbWrite_t
+{
+    uint64_t time;             // Virtual time in microseconds
+    bool note;
+    bool bulkCable;            // Sent on the second virtual cable
+    bool flushed;              // flushMidi() was called after it
+    std::vector<uint8_t> data; // SysEx bytes, a part of a message when chunked
+};
+
+// Running min/max/mean/stddev accumulator
+struct SimStat_t
+{
+    uint32_t count;
+    double sum;
+    double sumSq;
+    double min;
+    double max;
+};
+
+// Virtual clock and pins
+void simReset(uint64_t startTime = 0);
+uint64_t simTime();
+void simAdvance(uint32_t us);
+void simSetKey(uint8_t pin, bool pressed);
+
+// Wires a self-test drive pin to a key pin until the next reset, like the loopback on the device
+void simLoopback(uint8_t drivePin, uint8_t keyPin);
+
+// Speed knob ADC level from now on (0 to 4095), with random noise of up to +-noise and a full scale spike about every spikeEvery samples, 0 for none
+void simSetPot(uint16_t value, uint16_t noise = 0, uint32_t spikeEvery = 0);
+
+// Runs loop() passes of the keyer until the virtual clock reaches the target
+void simRunUntil(uint64_t time, const SimLoop_t &loop);
+
+// Same, the last pass cut short so the clock ends exactly on the target
+void simRunTo(uint64_t time, const SimLoop_t &loop);
+
+// Time the keyer spent asleep between events and loop() passes it ran, since the last reset
+uint64_t simSleepTime();
+uint32_t simPasses();
+
+// Captured output timeline
+const std::vector<SimEdge_t> &simEdges();
+const std::vector<SimEdge_t> &simPttEdges();
+uint32_t simNoteCount();
+const std::vector<SimNote_t> &simNotes();
+
+// Text from the CW decoder, fed with the note on/off edges
+const std::string &simDecoded();
+
+// USB MIDI writes since the last reset, for a benchmark to consume
+std::vector<SimUsbWrite_t> &simUsbWrites();
+
+// Statistics
+void statReset(SimStat_t &stat);
+void statAdd(SimStat_t &stat, double value);
+double statMean(const SimStat_t &stat);
+double statStdDev(const SimStat_t &stat);
+
+// Benchmarks
+int benchTiming(int argc, char **argv);
+int benchCapture(int argc, char **argv);
+int benchEdges(int argc, char **argv);
+int benchBitPacker(int argc, char **argv);
+int benchThroughput(int argc, char **argv);
+int benchPlayback(int argc, char **argv);
+int benchDecoder(int argc, char **argv);
+int benchTelemetry(int argc, char **argv);
+int benchEventStream(int argc, char **argv);
+int benchTransmit(int argc, char **argv);
+int benchJournal(int argc, char **argv);
+int benchKeyers(int argc, char **argv);
+int benchPtt(int argc, char **argv);
+int benchTrace(int argc, char **argv);
+int benchReconfig(int argc, char **argv);
+int benchSpeedPot(int argc, char **argv);
+int benchSleep(int argc, char **argv);
+int benchHotPaths(int argc, char **argv);
+int benchSelfTest(int argc, char **argv);
+
+#endif
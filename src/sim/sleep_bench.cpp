@@ -0,0 +1,218 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "../main.h"
+#include "../keyer.h"
+#include "../capture.h"
+#include "sim.h"
+
+#define BENCH_DIT_PIN 3
+#define BENCH_DAH_PIN 29
+#define BENCH_STRAIGHT_PIN 2
+#define BENCH_WPM 25
+#define BENCH_PRESSES 200        // A quarter of them taps let go inside the debounce window
+#define BENCH_BOUNCES 3          // Contact bounces on every press and release, 100 us apart
+#define BENCH_IDLE 10000000      // Key left alone this long before and after the presses
+#define BENCH_MAX_IDLE_AWAKE 0.1 // Percent of the idle time the keyer may spend awake
+
+static uint32_t benchRandom = 0x85EBCA6B;
+
+static uint32_t nextBenchRandom()
+{
+  benchRandom ^= benchRandom << 13;
+  benchRandom ^= benchRandom >> 17;
+  benchRandom ^= benchRandom << 5;
+  return benchRandom;
+}
+
+// One run of the presses with the loop polled or sleeping between events
+struct SleepRun_t
+{
+  uint32_t passes;
+  uint64_t time;
+  uint64_t sleep;
+  uint64_t idleSleep; // Asleep during the idle stretches
+  SimStat_t latency;  // Press to output on
+  std::vector<SimEdge_t> edges;
+};
+
+/** Bounces a key contact, the keyer keeps running between bounces */
+static void bounceKey(uint8_t pin, bool pressed, const SimLoop_t &loop)
+{
+  for (int i = 0; i < BENCH_BOUNCES; i++)
+  {
+    simSetKey(pin, pressed);
+    simRunTo(simTime() + 100, loop);
+    simSetKey(pin, !pressed);
+    simRunTo(simTime() + 100, loop);
+  }
+  simSetKey(pin, pressed);
+}
+
+/** Leaves the key alone for BENCH_IDLE, adding the time asleep to the run */
+static void runIdle(SleepRun_t &run, const SimLoop_t &loop)
+{
+  uint64_t slept = simSleepTime();
+  simRunTo(simTime() + BENCH_IDLE, loop);
+  run.idleSleep += simSleepTime() - slept;
+}
+
+/** Idle, random presses from idle with bounce on a straight key or paddles, some squeezed, then idle again */
+static void runPresses(bool straight, const SimLoop_t &loop, SleepRun_t &run)
+{
+  benchRandom = 0x85EBCA6B; // The same presses at the same times either way
+  run.idleSleep = 0;
+  statReset(run.latency);
+
+  simReset();
+  setupCapture();
+  runIdle(run, loop);
+
+  uint32_t dit = 1200000 / BENCH_WPM;
+  std::vector<uint64_t> pressTimes;
+  for (int i = 0; i < BENCH_PRESSES; i++)
+  {
+    uint8_t pin = straight ? BENCH_STRAIGHT_PIN : (nextBenchRandom() & 1) ? BENCH_DIT_PIN : BENCH_DAH_PIN;
+    bool squeeze = !straight && nextBenchRandom() % 4 == 0;
+
+    pressTimes.push_back(simTime());
+    bounceKey(pin, true, loop);
+    if (squeeze)
+      simSetKey(pin == BENCH_DIT_PIN ? BENCH_DAH_PIN : BENCH_DIT_PIN, true);
+
+    // Some taps let go inside the debounce window
+    uint32_t hold = nextBenchRandom() % 4 == 0 ? 2000 + nextBenchRandom() % DEFAULT_DEBOUNCE_US
+                                              : dit / 2 + nextBenchRandom() % (dit * 4);
+    simRunTo(simTime() + hold, loop);
+
+    if (squeeze)
+      simSetKey(pin == BENCH_DIT_PIN ? BENCH_DAH_PIN : BENCH_DIT_PIN, false);
+    bounceKey(pin, false, loop);
+
+    // Long enough for the element being sent and one remembered, every press starts from idle
+    simRunTo(simTime() + dit * 10 + nextBenchRandom() % 300000, loop);
+  }
+
+  runIdle(run, loop);
+
+  run.passes = simPasses();
+  run.time = simTime();
+  run.sleep = simSleepTime();
+  run.edges = simEdges();
+
+  // The first output edge after each press, a tap shorter than the settling window keys nothing
+  size_t next = 0;
+  for (size_t i = 0; i < pressTimes.size(); i++)
+  {
+    while (next < run.edges.size() && (run.edges[next].time < pressTimes[i] || !run.edges[next].state))
+      next++;
+    if (next < run.edges.size() && (i + 1 == pressTimes.size() || run.edges[next].time < pressTimes[i + 1]))
+      statAdd(run.latency, (double)(run.edges[next].time - pressTimes[i]));
+  }
+}
+
+/** Edges of the sleeping run later than the polled run's, or more than a pass earlier. Every edge is one if they differ in number or state */
+static uint32_t movedEdges(const SleepRun_t &polled, const SleepRun_t &sleeping, uint32_t period)
+{
+  if (polled.edges.size() != sleeping.edges.size())
+    return (uint32_t)(polled.edges.size() > sleeping.edges.size() ? polled.edges.size() : sleeping.edges.size());
+
+  uint32_t moved = 0;
+  for (size_t i = 0; i < polled.edges.size(); i++)
+  {
+    const SimEdge_t &a = polled.edges[i];
+    const SimEdge_t &b = sleeping.edges[i];
+    moved += a.state != b.state || b.time > a.time || a.time - b.time > period;
+  }
+  return moved;
+}
+
+/** Prints a run's share of time awake, loop passes and press to output latency */
+static void printRun(const char *key, const char *mode, const SleepRun_t &run)
+{
+  double awake = 100.0 * (run.time - run.sleep) / run.time;
+  double idleAwake = 100.0 * (2.0 * BENCH_IDLE - run.idleSleep) / (2.0 * BENCH_IDLE);
+  printf("%-18s %-7s %9u %9.0f %8.3f %10.4f %9.1f %9.1f", key, mode, run.passes, run.passes / (run.time / 1e6), awake,
+         idleAwake, statMean(run.latency), run.latency.max);
+}
+
+/** Runs the keyer polled every pass and sleeping between events, compares time awake and the output it keys */
+int benchSleep(int argc, char **argv)
+{
+  uint32_t period = 20;
+
+  // Optional override: sleep [loop period us]. No stalls, both runs must see the same pass timing
+  if (argc > 0)
+    period = atoi(argv[0]);
+
+  const SimLoop_t polledLoop = {period, 0, 0, false};
+  const SimLoop_t sleepLoop = {period, 0, 0, true};
+
+  Settings_t saved = settings;
+  bool savedCapture = inputCapture;
+  bool savedSleep = idleSleep;
+  inputCapture = true;
+  idleSleep = true;
+
+  settings.gpio.ditPaddle = BENCH_DIT_PIN;
+  settings.gpio.dahPaddle = BENCH_DAH_PIN;
+  settings.gpio.straightKey = BENCH_STRAIGHT_PIN;
+  settings.gpio.speedPot = 0;
+  for (KeyerSettings_t &keyer : settings.keyers)
+    keyer.keyMode = keyMode_t::KEY_NONE;
+  settings.iambicMode = DEFAULT_IAMBIC_MODE;
+  settings.ditMemory = DEFAULT_DIT_MEMORY;
+  settings.dahMemory = DEFAULT_DAH_MEMORY;
+  settings.pttMode = gpioOutputMode_t::OUTPUT_DISABLED;
+  settings.wpm = BENCH_WPM * WPM_SCALE;
+  settings.farnsworth = 0;
+  settings.weight = DEFAULT_WEIGHT;
+  setupWPM();
+
+  printf("Keyer polled every %u us pass vs asleep between events, %u presses with %u bounces between %.0f s idle stretches\n",
+         period, BENCH_PRESSES, BENCH_BOUNCES, BENCH_IDLE / 1e6);
+  printf("%-18s %-7s %9s %9s %8s %10s %9s %9s %7s\n", "key", "loop", "passes", "passes/s", "awake %", "idle awake",
+         "mean us", "max us", "moved");
+
+  int result = 0;
+  const keyMode_t modes[] = {keyMode_t::KEY_PADDLES, keyMode_t::KEY_STRAIGHT};
+  const debounceMode_t debounceModes[] = {debounceMode_t::DEBOUNCE_LEADING, debounceMode_t::DEBOUNCE_SETTLE};
+  for (keyMode_t mode : modes)
+  {
+    for (debounceMode_t debounce : debounceModes)
+    {
+      settings.keyMode = mode;
+      settings.debounceMode = debounce;
+      bool straight = mode == keyMode_t::KEY_STRAIGHT;
+      char key[24];
+      snprintf(key, sizeof(key), "%s, %s", straight ? "straight" : "paddles",
+               debounce == debounceMode_t::DEBOUNCE_LEADING ? "leading" : "settle");
+
+      SleepRun_t polled;
+      SleepRun_t sleeping;
+      runPresses(straight, polledLoop, polled);
+      runPresses(straight, sleepLoop, sleeping);
+
+      printRun(key, "polled", polled);
+      printf("\n");
+
+      // Waking on the edge must key no later than the next polled pass would have, and the rest of the output the same
+      uint32_t moved = movedEdges(polled, sleeping, period);
+      double idleAwake = 100.0 * (2.0 * BENCH_IDLE - sleeping.idleSleep) / (2.0 * BENCH_IDLE);
+      bool fail = moved || sleeping.latency.count != polled.latency.count || sleeping.latency.max > polled.latency.max ||
+                  idleAwake > BENCH_MAX_IDLE_AWAKE;
+      printRun(key, "sleep", sleeping);
+      printf(" %7u%s\n", moved, fail ? "  FAIL" : "");
+      if (fail)
+        result = 1;
+    }
+  }
+
+  settings = saved;
+  setupWPM();
+  inputCapture = savedCapture;
+  idleSleep = savedSleep;
+  simReset();
+  return result;
+}
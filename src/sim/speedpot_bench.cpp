@@ -0,0 +1,238 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "../main.h"
+#include "../keyer.h"
+#include "../capture.h"
+#include "../speedpot.h"
+#include "sim.h"
+
+#define BENCH_DIT_PIN 3
+#define BENCH_DAH_PIN 29
+#define BENCH_POT_PIN 27
+#define BENCH_SPEED_MIN 10
+#define BENCH_SPEED_MAX 40
+#define BENCH_NOISE 40         // ADC counts either way, about a third of a WPM step
+#define BENCH_SPIKE_EVERY 50   // Samples between full scale spikes
+#define BENCH_HOLD 3000000     // Knob held still this long per position
+#define BENCH_SETTLE 200000    // Time allowed for the speed to get there
+#define BENCH_SWEEP 4000000    // Knob turned end to end this slowly while squeezing
+#define BENCH_MAX_RESPONSE 150000
+
+// Knob positions in WPM steps above BENCH_SPEED_MIN, halves sit right on the boundary between two speeds
+static const double benchPositions[] = {0.0, 3.0, 7.5, 12.25, 15.5, 20.75, 29.5, 30.0};
+
+/** ADC level of a position in WPM above the minimum */
+static uint16_t potValue(double position)
+{
+  return (uint16_t)(position * 4095 / (BENCH_SPEED_MAX - BENCH_SPEED_MIN) + 0.5);
+}
+
+/** Settings with the knob on BENCH_POT_PIN and both paddles */
+static void benchSettings()
+{
+  settings.keyMode = keyMode_t::KEY_PADDLES;
+  settings.gpio.ditPaddle = BENCH_DIT_PIN;
+  settings.gpio.dahPaddle = BENCH_DAH_PIN;
+  settings.gpio.speedPot = BENCH_POT_PIN;
+  settings.speedMin = BENCH_SPEED_MIN;
+  settings.speedMax = BENCH_SPEED_MAX;
+  settings.wpm = DEFAULT_WPM;
+  settings.farnsworth = 0;
+  settings.weight = DEFAULT_WEIGHT;
+  setupWPM();
+}
+
+/** Runs a millisecond at a time, counting speed changes and keeping the time of the last one */
+static void runWatching(uint64_t until, const SimLoop_t &loop, uint32_t &changes, uint64_t &lastChange)
+{
+  uint16_t wpm = settings.wpm;
+  while (simTime() < until)
+  {
+    simRunUntil(simTime() + 1000, loop);
+    if (settings.wpm != wpm)
+    {
+      wpm = settings.wpm;
+      changes++;
+      lastChange = simTime();
+    }
+  }
+}
+
+/** Holds the knob still at a position with noise and spikes, the speed must get there and then stay put */
+static bool benchHold(double position, const SimLoop_t &loop)
+{
+  settings.wpm = DEFAULT_WPM; // Set over SysEx before the knob takes over
+  setupWPM();
+  simReset();
+  simSetPot(potValue(position), BENCH_NOISE, BENCH_SPIKE_EVERY);
+  setupSpeedPot(micros());
+
+  uint32_t changes = 0;
+  uint64_t lastChange = 0;
+  runWatching(BENCH_SETTLE, loop, changes, lastChange);
+  uint16_t settled = settings.wpm;
+
+  uint32_t chatter = 0;
+  runWatching(BENCH_HOLD, loop, chatter, lastChange);
+
+  // Right on a boundary either speed will do
+  double low = BENCH_SPEED_MIN + position;
+  uint16_t nearest = (uint16_t)(low + 0.5) * WPM_SCALE;
+  bool boundary = position - (int)position == 0.5;
+  bool right = settled == nearest || (boundary && settled == nearest - WPM_SCALE);
+
+  bool fail = !right || chatter;
+  printf("%9.2f %9.2f %10.2f %8u%s\n", low, settled / (double)WPM_SCALE, lastChange / 1000.0, chatter,
+         fail ? "  FAIL" : "");
+
+  cleanUpSpeedPot();
+  return !fail;
+}
+
+/** Turns the knob across its travel, the speed must follow without going back on itself */
+static bool benchSweep(bool up, const SimLoop_t &loop, uint32_t &reversals, uint32_t &steps)
+{
+  uint64_t start = simTime();
+  uint16_t wpm = settings.wpm;
+  int direction = up ? 1 : -1;
+
+  while (simTime() < start + BENCH_SWEEP + BENCH_SETTLE)
+  {
+    double travel = (double)(simTime() - start) / BENCH_SWEEP;
+    if (travel > 1.0)
+      travel = 1.0;
+    double position = (up ? travel : 1.0 - travel) * (BENCH_SPEED_MAX - BENCH_SPEED_MIN);
+    simSetPot(potValue(position), BENCH_NOISE, BENCH_SPIKE_EVERY);
+    simRunUntil(simTime() + 1000, loop);
+
+    if (settings.wpm != wpm)
+    {
+      if ((settings.wpm > wpm ? 1 : -1) != direction)
+        reversals++;
+      steps++;
+      wpm = settings.wpm;
+    }
+  }
+  return settings.wpm == (up ? BENCH_SPEED_MAX : BENCH_SPEED_MIN) * WPM_SCALE;
+}
+
+/** Element and gap lengths of a whole WPM speed */
+static void speedTimings(uint16_t wpm, uint32_t &dit, uint32_t &dah, uint32_t &gap)
+{
+  uint16_t saved = settings.wpm;
+  settings.wpm = wpm;
+  setupWPM();
+  dit = settings.timings.dit >> TIMING_FRACTION_BITS;
+  dah = settings.timings.dah >> TIMING_FRACTION_BITS;
+  gap = settings.timings.gap >> TIMING_FRACTION_BITS;
+  settings.wpm = saved;
+  setupWPM();
+}
+
+/** True if a length is within the tolerance of a nominal one */
+static inline bool near(uint64_t length, uint32_t nominal, uint32_t tolerance)
+{
+  return (length > nominal ? length - nominal : nominal - length) <= tolerance;
+}
+
+/** Drives the keyer speed from a simulated knob on an ADC pin: steady positions with noise, a step and sweeps while squeezing */
+int benchSpeedPot(int argc, char **argv)
+{
+  SimLoop_t loop = {20, 200, 2000};
+
+  // Optional overrides: speedpot [loop period us] [stall every N passes] [max stall us]
+  if (argc > 0)
+    loop.period = atoi(argv[0]);
+  if (argc > 1)
+    loop.stallEvery = atoi(argv[1]);
+  if (argc > 2)
+    loop.stallMax = atoi(argv[2]);
+
+  int result = 0;
+  Settings_t saved = settings;
+  benchSettings();
+
+  printf("Speed knob held still, %d to %d WPM, noise +-%d counts, a spike every ~%d samples, %u ms drains\n",
+         BENCH_SPEED_MIN, BENCH_SPEED_MAX, BENCH_NOISE, BENCH_SPIKE_EVERY, SPEED_POT_PERIOD_US / 1000);
+  printf("%9s %9s %10s %8s\n", "knob WPM", "speed", "settled ms", "chatter");
+  for (double position : benchPositions)
+  {
+    if (!benchHold(position, loop))
+      result = 1;
+  }
+
+  // Knob turned quickly from one speed to another
+  simReset();
+  simSetPot(potValue(0), BENCH_NOISE, BENCH_SPIKE_EVERY);
+  setupSpeedPot(micros());
+  simRunUntil(BENCH_SETTLE, loop);
+  uint64_t turned = simTime();
+  simSetPot(potValue(20), BENCH_NOISE, BENCH_SPIKE_EVERY);
+  while (settings.wpm != (BENCH_SPEED_MIN + 20) * WPM_SCALE && simTime() < turned + 1000000)
+    simRunUntil(simTime() + 100, loop);
+  uint64_t response = simTime() - turned;
+  bool responseFail = response > BENCH_MAX_RESPONSE;
+  printf("\nKnob turned from %d to %d WPM: speed there after %.1f ms%s\n", BENCH_SPEED_MIN, BENCH_SPEED_MIN + 20,
+         response / 1000.0, responseFail ? "  FAIL" : "");
+  if (responseFail)
+    result = 1;
+  cleanUpSpeedPot();
+
+  // Swept end to end and back while both paddles are squeezed
+  simReset();
+  if (inputCapture)
+    setupCapture();
+  simSetPot(potValue(0), BENCH_NOISE, BENCH_SPIKE_EVERY);
+  setupSpeedPot(micros());
+  simRunUntil(BENCH_SETTLE, loop);
+  simSetKey(BENCH_DIT_PIN, true);
+  simSetKey(BENCH_DAH_PIN, true);
+
+  uint32_t reversals = 0;
+  uint32_t steps = 0;
+  bool ends = benchSweep(true, loop, reversals, steps);
+  ends = benchSweep(false, loop, reversals, steps) && ends;
+
+  simSetKey(BENCH_DIT_PIN, false);
+  simSetKey(BENCH_DAH_PIN, false);
+  simRunUntil(simTime() + 500000, loop);
+  cleanUpSpeedPot();
+
+  // Every element and gap must be the length of one speed the knob went through, none cut between two
+  uint32_t tolerance = loop.period * 2;
+  uint32_t elements = 0;
+  uint32_t offNominal = 0;
+  const std::vector<SimNote_t> &notes = simNotes();
+  for (size_t i = 0; i + 1 < notes.size(); i += 2)
+  {
+    uint64_t length = notes[i + 1].time - notes[i].time;
+    uint64_t gap = i + 2 < notes.size() ? notes[i + 2].time - notes[i + 1].time : 0;
+    bool element = false;
+    bool spacing = gap == 0;
+    for (uint16_t wpm = BENCH_SPEED_MIN; wpm <= BENCH_SPEED_MAX; wpm++)
+    {
+      uint32_t dit, dah, space;
+      speedTimings(wpm * WPM_SCALE, dit, dah, space);
+      element = element || near(length, dit, tolerance) || near(length, dah, tolerance);
+      spacing = spacing || near(gap, space, tolerance);
+    }
+    elements++;
+    offNominal += !element + !spacing;
+  }
+
+  bool sweepFail = !ends || reversals || offNominal || elements == 0;
+  printf("\nKnob swept %d to %d WPM and back over %.0f s each way while squeezing\n", BENCH_SPEED_MIN,
+         BENCH_SPEED_MAX, BENCH_SWEEP / 1e6);
+  printf("%8s %8s %10s %12s %6s\n", "elements", "steps", "reversals", "off nominal", "ends");
+  printf("%8u %8u %10u %12u %6s%s\n", elements, steps, reversals, offNominal, ends ? "yes" : "no",
+         sweepFail ? "  FAIL" : "");
+  if (sweepFail)
+    result = 1;
+
+  settings = saved;
+  setupWPM();
+  simReset();
+  return result;
+}
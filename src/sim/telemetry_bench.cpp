@@ -0,0 +1,123 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include "../main.h"
+#include "../keyer.h"
+#include "../capture.h"
+#include "../stats.h"
+#include "sim.h"
+
+#define BENCH_DIT_PIN 3
+#define BENCH_DAH_PIN 29
+#define BENCH_PRESSES 400        // Random paddle presses keyed
+#define BENCH_ITERATIONS 10000000 // Timed histogram adds
+
+static const char *histogramNames[HISTOGRAM_COUNT] = {"keyer period", "keyer pass", "element error", "edge error",
+                                                      "keyer sleep", "host period", "midi update", "sysex",
+                                                      "key latency", "journal write", "host sleep"};
+
+static uint32_t benchRandom = 0xC2B2AE35;
+
+/** xorshift32, fixed seed so every run keys the same presses */
+static uint32_t nextRandom()
+{
+  benchRandom ^= benchRandom << 13;
+  benchRandom ^= benchRandom >> 17;
+  benchRandom ^= benchRandom << 5;
+  return benchRandom;
+}
+
+/** Upper bound of the bucket the given share of a histogram's values fall in */
+static uint32_t percentile(const Histogram_t &histogram, double share)
+{
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    total += histogram.buckets[i];
+
+  uint32_t seen = 0;
+  for (uint8_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+  {
+    seen += histogram.buckets[i];
+    if (total && seen >= total * share)
+    {
+      uint32_t upper = (1u << i) - 1;
+      return i + 1 == HISTOGRAM_BUCKETS || upper > histogram.max ? histogram.max : upper;
+    }
+  }
+  return histogram.max;
+}
+
+/** Keys random paddle presses under loop stalls and prints the histograms the keyer filled in, then times a histogram add */
+int benchTelemetry(int argc, char **argv)
+{
+  SimLoop_t loop = {20, 200, 2000};
+  uint32_t iterations = BENCH_ITERATIONS;
+
+  // Optional overrides: telemetry [loop period us] [stall every N passes] [max stall us] [iterations]
+  if (argc > 0)
+    loop.period = atoi(argv[0]);
+  if (argc > 1)
+    loop.stallEvery = atoi(argv[1]);
+  if (argc > 2)
+    loop.stallMax = atoi(argv[2]);
+  if (argc > 3)
+    iterations = atoi(argv[3]);
+
+  printf("Telemetry histograms, loop period %u us, stall up to %u us every ~%u passes\n",
+         loop.period, loop.stallMax, loop.stallEvery);
+
+  settings.keyMode = keyMode_t::KEY_PADDLES;
+  settings.gpio.ditPaddle = BENCH_DIT_PIN;
+  settings.gpio.dahPaddle = BENCH_DAH_PIN;
+  settings.wpm = DEFAULT_WPM * 2;
+  setupWPM();
+
+  simReset();
+  if (inputCapture)
+    setupCapture();
+
+  uint32_t dit = settings.timings.dit >> TIMING_FRACTION_BITS;
+  for (int i = 0; i < BENCH_PRESSES; i++)
+  {
+    uint8_t pin = (nextRandom() & 1) ? BENCH_DIT_PIN : BENCH_DAH_PIN;
+    simSetKey(pin, true);
+    simRunUntil(simTime() + dit / 2 + nextRandom() % (dit * 4), loop);
+    simSetKey(pin, false);
+    simRunUntil(simTime() + dit + nextRandom() % (dit * 6), loop);
+  }
+
+  printf("%-14s %10s %10s %10s %10s\n", "histogram", "count", "p50 us", "p99 us", "max us");
+  for (uint8_t id = 0; id < HISTOGRAM_COUNT; id++)
+  {
+    const Histogram_t &histogram = histograms[id];
+    if (histogram.count == 0)
+      continue; // USB/MIDI only runs on the device
+    printf("%-14s %10u %10u %10u %10u\n", histogramNames[id], histogram.count, percentile(histogram, 0.5),
+           percentile(histogram, 0.99), histogram.max);
+  }
+
+  uint32_t failures = 0;
+  if (histograms[HIST_KEYER_PERIOD].count == 0 || histograms[HIST_EDGE_ERROR].count == 0 ||
+      histograms[HIST_ELEMENT_ERROR].count == 0 || histograms[HIST_KEY_LATENCY].count == 0)
+    failures++;
+
+  // Values spread over every bucket, halving included
+  resetKeyerStats();
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++)
+    histogramAdd(HIST_KEYER_PASS, nextRandom() >> (nextRandom() & 31));
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    total += histograms[HIST_KEYER_PASS].buckets[i];
+  if (histograms[HIST_KEYER_PASS].count != iterations || total == 0)
+    failures++;
+
+  printf("histogramAdd %.1f ns/op on this machine, random number generation included\n", ns);
+  printf("%s\n", failures ? "FAILED" : "Passed");
+
+  simReset();
+  return failures ? 1 : 0;
+}
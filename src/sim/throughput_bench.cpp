@@ -0,0 +1,251 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include "../main.h"
+#include "../keyer.h"
+#include "../capture.h"
+#include "sim.h"
+
+#define BENCH_DIT_PIN 3
+#define BENCH_DAH_PIN 29
+#define BENCH_CHARACTERS 150 // Random characters tapped per WPM and mode
+#define BENCH_MAX_ELEMENTS 6 // Longest random character
+#define BENCH_SQUEEZE 9      // Elements keyed per squeeze
+
+static const float benchWPM[] = {10, 15, 20, 30, 40, 50, 60, 70, 80};
+
+static const char *modeNames[] = {"iambic A", "iambic B", "ultimatic"};
+
+static uint32_t benchRandom = 0x6D2B79F5;
+
+/** xorshift32, fixed seed so every run taps the same text */
+static uint32_t nextRandom()
+{
+  benchRandom ^= benchRandom << 13;
+  benchRandom ^= benchRandom >> 17;
+  benchRandom ^= benchRandom << 5;
+  return benchRandom;
+}
+
+/** Element lengths in microseconds, from the fixed point timings the keyer uses */
+static double ditUs()
+{
+  return settings.timings.dit / (double)(1 << TIMING_FRACTION_BITS);
+}
+
+static double elementUs(char element)
+{
+  return (element == '.' ? settings.timings.dit : settings.timings.dah) / (double)(1 << TIMING_FRACTION_BITS);
+}
+
+static double gapUs()
+{
+  return settings.timings.gap / (double)(1 << TIMING_FRACTION_BITS);
+}
+
+static uint8_t elementPin(char element)
+{
+  return element == '.' ? BENCH_DIT_PIN : BENCH_DAH_PIN;
+}
+
+/** Runs until the output next switches on, returns when, 0 if it never did */
+static uint64_t runUntilKeyed(uint64_t limit, const SimLoop_t &loop)
+{
+  size_t edgeCount = simEdges().size();
+  while (simTime() < limit)
+  {
+    simRunUntil(simTime() + 50, loop);
+    for (size_t i = edgeCount; i < simEdges().size(); i++)
+    {
+      if (simEdges()[i].state)
+        return simEdges()[i].time;
+    }
+  }
+  return 0;
+}
+
+/** Decodes the output timeline back into elements, a space between characters */
+static std::string decodeOutput()
+{
+  std::string text;
+  const std::vector<SimEdge_t> &edges = simEdges();
+  double dit = ditUs();
+
+  for (size_t i = 1; i < edges.size(); i++)
+  {
+    double length = (double)(edges[i].time - edges[i - 1].time);
+    if (edges[i - 1].state && !edges[i].state)
+      text += length < dit * 2 ? '.' : '-';
+    else if (!edges[i - 1].state && edges[i].state && length > dit * 2)
+      text += ' ';
+  }
+  return text;
+}
+
+/** Taps each element of a character once, during the element before it, so the whole character comes from paddle memory */
+static void tapCharacter(const std::string &character, const SimLoop_t &loop)
+{
+  double dit = ditUs();
+  double hold = dit / 4 > DEFAULT_DEBOUNCE_US * 1.1 ? dit / 4 : DEFAULT_DEBOUNCE_US * 1.1; // Long enough to pass the debounce
+
+  // The first press starts the keyer, the rest of the timeline follows from when it did
+  simSetKey(elementPin(character[0]), true);
+  uint64_t start = runUntilKeyed(simTime() + DEFAULT_DEBOUNCE_US * 4, loop);
+  simSetKey(elementPin(character[0]), false);
+  double released = (double)simTime(); // A stall can hold the key a little past the start
+
+  // Each following element is pressed and released early in the one before it, never sooner after the last release than the debounce allows
+  double elementStart = (double)start;
+  for (size_t i = 1; i < character.size(); i++)
+  {
+    double press = elementStart + hold > released + hold ? elementStart + hold : released + hold;
+    simRunUntil((uint64_t)press, loop);
+    simSetKey(elementPin(character[i]), true);
+    simRunUntil(simTime() + (uint64_t)hold, loop); // Timed from the actual press, a stall can run past the planned one
+    simSetKey(elementPin(character[i]), false);
+    released = (double)simTime();
+
+    elementStart += elementUs(character[i - 1]) + gapUs();
+  }
+
+  // Let the character finish and leave a character space
+  simRunUntil((uint64_t)(elementStart + elementUs(character.back()) + dit * 4), loop);
+}
+
+/** Taps random characters at the current speed, returns the elements dropped or inserted */
+static uint32_t tapText(uint32_t &elements, const SimLoop_t &loop)
+{
+  std::string expected;
+
+  simReset();
+  if (inputCapture)
+    setupCapture();
+
+  for (int c = 0; c < BENCH_CHARACTERS; c++)
+  {
+    std::string character;
+    int length = 1 + nextRandom() % BENCH_MAX_ELEMENTS;
+    for (int i = 0; i < length; i++)
+      character += (nextRandom() & 1) ? '-' : '.';
+
+    tapCharacter(character, loop);
+    expected += (c ? " " : "") + character;
+    elements += length;
+  }
+
+  std::string actual = decodeOutput();
+  if (actual == expected)
+    return 0;
+
+  // Count every element that differs, a misplaced character space aside
+  uint32_t errors = 0;
+  size_t length = actual.size() > expected.size() ? actual.size() : expected.size();
+  for (size_t i = 0; i < length; i++)
+  {
+    if (i >= actual.size() || i >= expected.size() || actual[i] != expected[i])
+      errors++;
+  }
+  return errors;
+}
+
+/** Squeezes both paddles and releases them in the middle of an element, returns the elements dropped or inserted */
+static uint32_t squeeze(const SimLoop_t &loop)
+{
+  simReset();
+  if (inputCapture)
+    setupCapture();
+
+  simSetKey(BENCH_DIT_PIN, true);
+  simRunUntil(simTime() + 1000, loop);
+  simSetKey(BENCH_DAH_PIN, true);
+
+  // A leading edge debounce keys the dit before the dah is pressed
+  std::string expected;
+  if (simEdges().empty())
+    runUntilKeyed(simTime() + DEFAULT_DEBOUNCE_US * 4, loop);
+  double elementStart = simEdges().empty() ? 0.0 : (double)simEdges()[0].time;
+
+  // The dit starts before the dah press lands, then the squeeze takes over
+  if (settings.iambicMode == iambicMode_t::ULTIMATIC)
+    expected = "." + std::string(BENCH_SQUEEZE - 1, '-'); // The dah, pressed last, repeats
+  else
+    for (int i = 0; i < BENCH_SQUEEZE; i++)
+      expected += (i & 1) ? '-' : '.'; // Alternates
+
+  for (size_t i = 0; i < expected.size() - 1; i++)
+    elementStart += elementUs(expected[i]) + gapUs();
+
+  // Release halfway through the last element
+  simRunUntil((uint64_t)(elementStart + elementUs(expected.back()) / 2), loop);
+
+  if (settings.iambicMode == iambicMode_t::ULTIMATIC)
+  {
+    // Releasing just the dah hands back to the held dit
+    simSetKey(BENCH_DAH_PIN, false);
+    elementStart += elementUs(expected.back()) + gapUs();
+    expected += "..";
+    simRunUntil((uint64_t)(elementStart + elementUs('.') + gapUs() + elementUs('.') / 2), loop);
+  }
+  else if (settings.iambicMode == iambicMode_t::IAMBIC_B)
+  {
+    expected += expected.back() == '.' ? '-' : '.'; // The opposite element remembered during the last one
+  }
+
+  simSetKey(BENCH_DIT_PIN, false);
+  simSetKey(BENCH_DAH_PIN, false);
+  simRunUntil(simTime() + (uint64_t)(ditUs() * 20), loop);
+
+  std::string actual = decodeOutput();
+  return actual == expected ? 0 : 1 + abs((int)actual.size() - (int)expected.size());
+}
+
+/** Scripted paddle input through each iambic mode, every element must come out exactly once */
+int benchThroughput(int argc, char **argv)
+{
+  SimLoop_t loop = {20, 200, 2000};
+
+  // Optional overrides: throughput [loop period us] [stall every N passes] [max stall us]
+  if (argc > 0)
+    loop.period = atoi(argv[0]);
+  if (argc > 1)
+    loop.stallEvery = atoi(argv[1]);
+  if (argc > 2)
+    loop.stallMax = atoi(argv[2]);
+
+  printf("Paddle memory throughput, loop period %u us, stall up to %u us every ~%u passes\n",
+         loop.period, loop.stallMax, loop.stallEvery);
+  printf("%-10s %6s %9s %9s %9s\n", "mode", "WPM", "tapped", "errors", "squeeze");
+
+  settings.keyMode = keyMode_t::KEY_PADDLES;
+  settings.gpio.ditPaddle = BENCH_DIT_PIN;
+  settings.gpio.dahPaddle = BENCH_DAH_PIN;
+  settings.ditMemory = DEFAULT_DIT_MEMORY;
+  settings.dahMemory = DEFAULT_DAH_MEMORY;
+
+  uint32_t failures = 0;
+  const iambicMode_t modes[] = {iambicMode_t::IAMBIC_A, iambicMode_t::IAMBIC_B, iambicMode_t::ULTIMATIC};
+
+  for (iambicMode_t mode : modes)
+  {
+    settings.iambicMode = mode;
+
+    for (float wpm : benchWPM)
+    {
+      settings.wpm = (uint16_t)(wpm * INTTOFLOATSCALAR);
+      setupWPM();
+
+      uint32_t elements = 0;
+      uint32_t errors = tapText(elements, loop);
+      uint32_t squeezeErrors = squeeze(loop);
+      failures += errors + squeezeErrors;
+
+      printf("%-10s %6.1f %9u %9u %9s\n", modeNames[mode], wpm, elements, errors, squeezeErrors ? "FAIL" : "ok");
+    }
+  }
+
+  settings.iambicMode = DEFAULT_IAMBIC_MODE;
+  printf("%s, %u elements dropped or inserted\n", failures ? "FAILED" : "Passed", failures);
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,153 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include "../main.h"
+#include "../keyer.h"
+#include "../capture.h"
+#include "sim.h"
+
+#define BENCH_DIT_PIN 3
+#define BENCH_DAH_PIN 29
+#define BENCH_ELEMENTS 200 // Elements keyed per paddle pattern and WPM
+#define BENCH_START_TIME (0x100000000ULL - 1000000) // A second before micros() wraps, every run crosses it
+
+static const float benchWPM[] = {5, 10, 12, 15, 20, 25, 30, 35, 40, 50, 60};
+
+// Paddle patterns, each held until BENCH_ELEMENTS elements would have been sent
+struct Pattern_t
+{
+    bool dit;
+    bool dah;
+    uint32_t units; // Dit units per element including its gap
+};
+
+static const Pattern_t patterns[] = {
+    {true, false, 2},  // Dits
+    {false, true, 4},  // Dahs
+    {true, true, 3}};  // Squeeze, alternating dit/dah
+
+// Per WPM results
+struct TimingResult_t
+{
+    SimStat_t ditError;
+    SimStat_t dahError;
+    SimStat_t gapError;
+    uint32_t elements;
+};
+
+/** Splits the captured output timeline into elements and gaps and measures them against ideal timing */
+static void measure(TimingResult_t &result, double ditUs)
+{
+  const std::vector<SimEdge_t> &edges = simEdges();
+
+  for (size_t i = 1; i < edges.size(); i++)
+  {
+    double length = (double)(edges[i].time - edges[i - 1].time);
+
+    if (edges[i - 1].state && !edges[i].state)
+    {
+      result.elements++;
+      if (length < ditUs * 2)
+        statAdd(result.ditError, length - ditUs);
+      else
+        statAdd(result.dahError, length - ditUs * 3);
+    }
+    else if (!edges[i - 1].state && edges[i].state && length < ditUs * 2)
+    {
+      statAdd(result.gapError, length - ditUs); // Inter-element gap within a run
+    }
+  }
+}
+
+/** Runs every paddle pattern at a single WPM setting, returns the simulated time in microseconds */
+static uint64_t runWPM(TimingResult_t &result, float wpm, const SimLoop_t &loop)
+{
+  settings.keyMode = keyMode_t::KEY_PADDLES;
+  settings.gpio.ditPaddle = BENCH_DIT_PIN;
+  settings.gpio.dahPaddle = BENCH_DAH_PIN;
+  settings.wpm = (uint16_t)(wpm * INTTOFLOATSCALAR);
+  setupWPM();
+
+  double ditUs = 1200000.0 / wpm;
+
+  statReset(result.ditError);
+  statReset(result.dahError);
+  statReset(result.gapError);
+  result.elements = 0;
+
+  uint64_t simulated = 0;
+
+  for (const Pattern_t &pattern : patterns)
+  {
+    simReset(BENCH_START_TIME);
+    if (inputCapture)
+      setupCapture();
+
+    uint64_t hold = (uint64_t)(ditUs * pattern.units * BENCH_ELEMENTS);
+
+    simSetKey(BENCH_DIT_PIN, pattern.dit);
+    simSetKey(BENCH_DAH_PIN, pattern.dah);
+    simRunUntil(simTime() + hold, loop);
+
+    simSetKey(BENCH_DIT_PIN, false);
+    simSetKey(BENCH_DAH_PIN, false);
+    simRunUntil(simTime() + (uint64_t)(ditUs * 10), loop); // Let the last element finish
+
+    measure(result, ditUs);
+    simulated += simTime() - BENCH_START_TIME;
+  }
+
+  return simulated;
+}
+
+/** Element length, gap and jitter per WPM setting against the ideal PARIS timing */
+int benchTiming(int argc, char **argv)
+{
+  SimLoop_t loop = {20, 200, 2000};
+
+  // Optional overrides: timing [period us] [stall every N passes] [max stall us]
+  if (argc > 0)
+    loop.period = atoi(argv[0]);
+  if (argc > 1)
+    loop.stallEvery = atoi(argv[1]);
+  if (argc > 2)
+    loop.stallMax = atoi(argv[2]);
+
+  printf("Keyer timing (%s), loop period %u us, stall up to %u us every ~%u passes\n",
+         inputCapture ? "edge capture" : "polling", loop.period, loop.stallMax, loop.stallEvery);
+  printf("%6s %8s %9s %9s %9s %9s %9s %9s %9s\n",
+         "WPM", "elements", "dit err", "dit jit", "dah err", "dah jit", "gap err", "gap jit", "max err");
+
+  uint64_t simulated = 0;
+  auto start = std::chrono::steady_clock::now();
+
+  for (float wpm : benchWPM)
+  {
+    TimingResult_t result;
+    simulated += runWPM(result, wpm, loop);
+
+    double maxError = 0;
+    const SimStat_t *stats[] = {&result.ditError, &result.dahError, &result.gapError};
+    for (const SimStat_t *stat : stats)
+    {
+      if (stat->count && fabs(stat->min) > maxError)
+        maxError = fabs(stat->min);
+      if (stat->count && fabs(stat->max) > maxError)
+        maxError = fabs(stat->max);
+    }
+
+    // All errors reported in microseconds
+    printf("%6.1f %8u %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", wpm, result.elements,
+           statMean(result.ditError), statStdDev(result.ditError),
+           statMean(result.dahError), statStdDev(result.dahError),
+           statMean(result.gapError), statStdDev(result.gapError), maxError);
+  }
+
+  double wall = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  printf("Simulated %.1f s of keying in %.1f ms (%.0fx real time)\n",
+         simulated / 1e6, wall / 1e3, wall > 0 ? simulated / wall : 0.0);
+
+  return 0;
+}
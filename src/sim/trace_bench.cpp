@@ -0,0 +1,460 @@
+#include <Arduino.h>
+#include <BitPacker.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include "../main.h"
+#include "../keyer.h"
+#include "../capture.h"
+#include "../config.h"
+#include "../trace.h"
+#include "sim.h"
+
+#define BENCH_DIT_PIN 3
+#define BENCH_DAH_PIN 29
+#define BENCH_STRAIGHT_PIN 6      // Second keyer, a straight key
+#define BENCH_PRESSES 150         // Random paddle and straight key presses traced
+#define BENCH_START 0x10000000    // Device time the trace starts at
+#define BENCH_SETTLE 500000       // Run on after the last record, for the last element to finish
+#define BENCH_TOLERANCE 2500      // Output edge time difference a replay of a device trace may show, us
+
+static uint32_t benchRandom = 0x27D4EB2F;
+
+/** xorshift32, fixed seed so every run traces the same presses */
+static uint32_t nextRandom()
+{
+  benchRandom ^= benchRandom << 13;
+  benchRandom ^= benchRandom >> 17;
+  benchRandom ^= benchRandom << 5;
+  return benchRandom;
+}
+
+// A trace as the host has it, read back over SysEx or loaded from the file the browser saves
+struct HostTrace_t
+{
+  bool recording;
+  bool full;
+  uint16_t count;
+  uint16_t capacity;
+  uint32_t start;
+  std::vector<uint8_t> config; // Packed like CMD_SET_CONFIG
+  std::vector<TraceRecord_t> records;
+};
+
+// Output edge differences between a trace and its replay
+struct TraceDiff_t
+{
+  uint32_t edges;     // Output edges in the trace
+  uint32_t replayed;  // Output edges in the replay
+  uint32_t differing; // Missing, extra, a different keyer or state, or further apart than the tolerance
+  double maxShift;    // Largest time difference of edges that line up, us
+  double meanShift;
+};
+
+/** Decodes a CMD_TRACE reply, the header then the settings */
+static void hostDecodeHeader(const uint8_t *data, uint8_t size, HostTrace_t &trace)
+{
+  BitPacker<TRACE_HEADER_SIZE * 7> packer; // Rounded up to whole 7-bit bytes
+  packer.unpack7Bit(data, TRACE_HEADER_SIZE);
+
+  trace.recording = packer.extractField(1);
+  trace.full = packer.extractField(1);
+  trace.count = packer.extractField(16);
+  trace.capacity = packer.extractField(16);
+  trace.start = packer.extractField(32);
+  trace.config.assign(data + TRACE_HEADER_SIZE, data + size);
+  trace.records.clear();
+}
+
+/** Decodes a CMD_GET_TRACE reply, returns the records it held */
+static uint8_t hostDecodePage(const uint8_t *data, uint8_t size, HostTrace_t &trace)
+{
+  BitPacker<(TRACE_PAGE_BITS + 6) / 7 * 7> packer;
+  packer.unpack7Bit(data, size);
+
+  uint16_t first = packer.extractField(14);
+  uint8_t count = packer.extractField(3);
+  if (first != trace.records.size())
+    return 0; // Not the page asked for
+
+  for (uint8_t i = 0; i < count; i++)
+  {
+    TraceRecord_t record;
+    record.time = packer.extractField(32);
+    record.kind = packer.extractField(2);
+    record.value = packer.extractField(30);
+    trace.records.push_back(record);
+  }
+  return count;
+}
+
+/** Reads the trace back the way the browser does, the header then a page at a time, returns the messages it took */
+static uint32_t downloadTrace(HostTrace_t &trace)
+{
+  uint8_t data[MAX_SYSEX_LENGTH];
+  uint8_t size;
+
+  encodeTraceHeader(data, size);
+  hostDecodeHeader(data, size, trace);
+
+  uint32_t messages = 1;
+  while (trace.records.size() < trace.count)
+  {
+    encodeTracePage(trace.records.size(), data, size);
+    messages++;
+    if (!hostDecodePage(data, size, trace))
+      break;
+  }
+  return messages;
+}
+
+/** Writes a trace in the format the browser saves it in */
+static void writeTrace(FILE *file, const HostTrace_t &trace)
+{
+  fprintf(file, "# PicoKeyer trace, times in microseconds\nconfig ");
+  for (uint8_t byte : trace.config)
+    fprintf(file, "%02x", byte);
+  fprintf(file, "\nstart %u\n", trace.start);
+
+  for (const TraceRecord_t &record : trace.records)
+  {
+    if (record.kind == TRACE_INPUT)
+      fprintf(file, "in %u %08x\n", record.time, (uint32_t)record.value);
+    else
+      fprintf(file, "out %u %u %u\n", record.time, (uint32_t)record.value >> 1, (uint32_t)record.value & 1);
+  }
+}
+
+/** Reads a trace saved by the browser, returns false if there is no config or start line */
+static bool readTrace(FILE *file, HostTrace_t &trace)
+{
+  char line[256];
+  bool haveConfig = false;
+  bool haveStart = false;
+
+  trace = {};
+  while (fgets(line, sizeof(line), file))
+  {
+    TraceRecord_t record = {};
+    uint32_t time, a, b;
+
+    if (strncmp(line, "config ", 7) == 0)
+    {
+      for (const char *hex = line + 7; hex[0] && hex[1] && hex[0] != '\n'; hex += 2)
+      {
+        unsigned int byte;
+        if (sscanf(hex, "%2x", &byte) != 1)
+          break;
+        trace.config.push_back(byte);
+      }
+      haveConfig = !trace.config.empty();
+    }
+    else if (sscanf(line, "start %u", &time) == 1)
+    {
+      trace.start = time;
+      haveStart = true;
+    }
+    else if (sscanf(line, "in %u %x", &time, &a) == 2)
+    {
+      record = {time, a, TRACE_INPUT};
+      trace.records.push_back(record);
+    }
+    else if (sscanf(line, "out %u %u %u", &time, &a, &b) == 3)
+    {
+      record = {time, a << 1 | (b & 1), TRACE_OUTPUT};
+      trace.records.push_back(record);
+    }
+  }
+
+  trace.count = trace.records.size();
+  return haveConfig && haveStart;
+}
+
+/** Output edges of a trace, in the order they were switched */
+static std::vector<TraceRecord_t> traceOutputs(const std::vector<TraceRecord_t> &records)
+{
+  std::vector<TraceRecord_t> outputs;
+  for (const TraceRecord_t &record : records)
+  {
+    if (record.kind == TRACE_OUTPUT)
+      outputs.push_back(record);
+  }
+  return outputs;
+}
+
+/** Sim time of a trace time, counted from the start so the 32-bit device clock may wrap */
+static uint64_t replayTime(const HostTrace_t &trace, uint32_t time)
+{
+  int32_t offset = time - trace.start;
+  return (uint64_t)trace.start + (offset > 0 ? offset : 0);
+}
+
+/** Keys a trace's raw input into the keyer with its settings, at the times it was captured, and traces the output again */
+static std::vector<TraceRecord_t> replayTrace(const HostTrace_t &trace, const SimLoop_t &loop, bool &configOk)
+{
+  configOk = decodeConfig(settings, trace.config.data(), trace.config.size()) != 0;
+  setupWPM();
+
+  simReset(trace.start);
+  if (inputCapture)
+    setupCapture();
+
+  requestTraceStart(settings);
+  processTraceRequest(micros(), readInputPins() & keyInputPins());
+
+  // Inputs in the order the keyer took them, a captured edge may carry a time before a record made after it
+  uint64_t lastTime = trace.start;
+  uint32_t pins = keyInputPins();
+  for (const TraceRecord_t &record : trace.records)
+  {
+    uint64_t time = replayTime(trace, record.time);
+    lastTime = time > lastTime ? time : lastTime;
+    if (record.kind != TRACE_INPUT)
+      continue;
+
+    simRunTo(lastTime, loop);
+    for (uint32_t moved = pins; moved; moved &= moved - 1)
+    {
+      uint8_t pin = __builtin_ctz(moved);
+      simSetKey(pin, !((record.value >> pin) & 1));
+    }
+  }
+  simRunUntil(lastTime + BENCH_SETTLE, loop);
+  stopTrace();
+
+  std::vector<TraceRecord_t> records;
+  for (uint16_t i = 0; i < traceCount(); i++)
+    records.push_back(traceAt(i));
+  return traceOutputs(records);
+}
+
+/** Lines up the output edges of a trace and its replay, edge for edge */
+static TraceDiff_t diffOutputs(const std::vector<TraceRecord_t> &traced, const std::vector<TraceRecord_t> &replayed,
+                               uint32_t tolerance)
+{
+  TraceDiff_t diff = {(uint32_t)traced.size(), (uint32_t)replayed.size(), 0, 0.0, 0.0};
+  uint32_t matched = 0;
+
+  size_t common = traced.size() < replayed.size() ? traced.size() : replayed.size();
+  diff.differing = traced.size() - common + replayed.size() - common;
+
+  for (size_t i = 0; i < common; i++)
+  {
+    double shift = fabs((double)(int32_t)(replayed[i].time - traced[i].time));
+    if (replayed[i].value != traced[i].value || shift > tolerance)
+    {
+      diff.differing++;
+      continue;
+    }
+
+    matched++;
+    diff.meanShift += shift;
+    diff.maxShift = fmax(diff.maxShift, shift);
+  }
+
+  if (matched)
+    diff.meanShift /= matched;
+  return diff;
+}
+
+/** Prints a replay's differences, returns true if it matched the trace */
+static bool printDiff(const char *name, const TraceDiff_t &diff, bool expectMatch)
+{
+  bool matched = diff.differing == 0;
+  printf("%-18s %8u %8u %9u %10.1f %10.1f %9s%s\n", name, diff.edges, diff.replayed, diff.differing, diff.maxShift,
+         diff.meanShift, matched ? "match" : "differs", matched != expectMatch ? "  FAIL" : "");
+  return matched == expectMatch;
+}
+
+/** Traces random presses on a paddle keyer and a straight key keyer the way the device would */
+static void recordTrace(const SimLoop_t &loop)
+{
+  benchRandom = 0x27D4EB2F;
+
+  settings.keyMode = keyMode_t::KEY_PADDLES;
+  settings.gpio.ditPaddle = BENCH_DIT_PIN;
+  settings.gpio.dahPaddle = BENCH_DAH_PIN;
+  settings.wpm = DEFAULT_WPM;
+  settings.weight = DEFAULT_WEIGHT;
+  settings.keyers[0] = {};
+  settings.keyers[0].keyMode = keyMode_t::KEY_STRAIGHT;
+  settings.keyers[0].straightKey = BENCH_STRAIGHT_PIN;
+  settings.keyers[0].note = DEFAULT_MIDI_NOTE + 1;
+  settings.keyers[0].channel = DEFAULT_MIDI_CHANNEL;
+  setupWPM();
+
+  simReset(BENCH_START);
+  if (inputCapture)
+    setupCapture();
+
+  requestTraceStart(settings);
+  processTraceRequest(micros(), readInputPins() & keyInputPins());
+
+  uint32_t dit = settings.timings.dit >> TIMING_FRACTION_BITS;
+  for (int i = 0; i < BENCH_PRESSES; i++)
+  {
+    uint32_t r = nextRandom() % 8;
+    uint32_t hold = dit / 2 + nextRandom() % (dit * 4);
+
+    if (r == 0)
+    {
+      // Squeeze, the second paddle a little after the first
+      simSetKey(BENCH_DIT_PIN, true);
+      simRunUntil(simTime() + nextRandom() % dit, loop);
+      simSetKey(BENCH_DAH_PIN, true);
+      simRunUntil(simTime() + hold, loop);
+      simSetKey(BENCH_DIT_PIN, false);
+      simSetKey(BENCH_DAH_PIN, false);
+    }
+    else if (r < 3)
+    {
+      // Straight key with a little contact bounce on the way down
+      for (uint32_t bounce = nextRandom() % 3; bounce; bounce--)
+      {
+        simSetKey(BENCH_STRAIGHT_PIN, true);
+        simRunUntil(simTime() + 200 + nextRandom() % 800, loop);
+        simSetKey(BENCH_STRAIGHT_PIN, false);
+        simRunUntil(simTime() + 200 + nextRandom() % 800, loop);
+      }
+      simSetKey(BENCH_STRAIGHT_PIN, true);
+      simRunUntil(simTime() + hold, loop);
+      simSetKey(BENCH_STRAIGHT_PIN, false);
+    }
+    else
+    {
+      uint8_t pin = (nextRandom() & 1) ? BENCH_DIT_PIN : BENCH_DAH_PIN;
+      simSetKey(pin, true);
+      simRunUntil(simTime() + hold, loop);
+      simSetKey(pin, false);
+    }
+
+    simRunUntil(simTime() + dit + nextRandom() % (dit * 6), loop);
+  }
+  simRunUntil(simTime() + BENCH_SETTLE, loop);
+  stopTrace();
+}
+
+/** Replays a trace file saved by the browser against this build of the keyer */
+static int replayFile(const char *path, const SimLoop_t &loop, uint32_t tolerance)
+{
+  FILE *file = fopen(path, "r");
+  if (!file)
+  {
+    printf("Cannot open %s\n", path);
+    return 1;
+  }
+
+  HostTrace_t trace;
+  bool loaded = readTrace(file, trace);
+  fclose(file);
+  if (!loaded)
+  {
+    printf("%s is not a PicoKeyer trace\n", path);
+    return 1;
+  }
+
+  bool configOk;
+  std::vector<TraceRecord_t> replayed = replayTrace(trace, loop, configOk);
+  std::vector<TraceRecord_t> traced = traceOutputs(trace.records);
+
+  printf("Replay of %s, %zu records, loop period %u us, tolerance %u us%s\n", path, trace.records.size(), loop.period,
+         tolerance, configOk ? "" : ", settings not understood");
+  printf("%-18s %8s %8s %9s %10s %10s %9s\n", "", "edges", "replayed", "differing", "max shift", "mean shift", "");
+  bool ok = printDiff("replay", diffOutputs(traced, replayed, tolerance), true);
+
+  // The first few edges that moved, to start looking from
+  uint32_t shown = 0;
+  for (size_t i = 0; i < traced.size() && i < replayed.size() && shown < 10; i++)
+  {
+    int32_t shift = replayed[i].time - traced[i].time;
+    if (replayed[i].value == traced[i].value && (uint32_t)abs(shift) <= tolerance)
+      continue;
+    printf("  edge %zu at +%u us: keyer %u %s, replay keyer %u %s %+d us\n", i, traced[i].time - trace.start,
+           (uint32_t)traced[i].value >> 1, (traced[i].value & 1) ? "on" : "off", (uint32_t)replayed[i].value >> 1,
+           (replayed[i].value & 1) ? "on" : "off", shift);
+    shown++;
+  }
+
+  return ok && configOk ? 0 : 1;
+}
+
+/** Traces random keying, reads it back over SysEx and through the trace file, replays it and diffs the output */
+int benchTrace(int argc, char **argv)
+{
+  SimLoop_t loop = {20, 200, 2000};
+  SimLoop_t steady = {20, 0, 0};
+
+  // Optional: trace [trace file] [loop period us] [tolerance us] replays a trace the browser saved
+  if (argc > 0)
+  {
+    if (argc > 1)
+      steady.period = atoi(argv[1]);
+    return replayFile(argv[0], steady, argc > 2 ? atoi(argv[2]) : BENCH_TOLERANCE);
+  }
+
+  recordTrace(loop);
+
+  HostTrace_t device;
+  uint32_t messages = downloadTrace(device);
+
+  // Through the file format, as a trace saved by the browser would come
+  HostTrace_t trace;
+  FILE *file = tmpfile();
+  writeTrace(file, device);
+  rewind(file);
+  bool loaded = readTrace(file, trace);
+  fclose(file);
+
+  bool sameRecords = loaded && trace.records.size() == device.records.size() && trace.config == device.config;
+  for (size_t i = 0; sameRecords && i < trace.records.size(); i++)
+  {
+    sameRecords = trace.records[i].time == device.records[i].time && trace.records[i].kind == device.records[i].kind &&
+                  trace.records[i].value == device.records[i].value;
+  }
+
+  int result = 0;
+  bool readBack = sameRecords && !device.full && device.count == traceCount() && !device.recording;
+  printf("Trace of %d random paddle and straight key presses, %u records of %u in %u SysEx messages, file round trip %s%s\n",
+         BENCH_PRESSES, device.count, device.capacity, messages, sameRecords ? "exact" : "differs",
+         readBack ? "" : "  FAIL");
+  if (!readBack)
+    result = 1;
+
+  std::vector<TraceRecord_t> traced = traceOutputs(trace.records);
+  Settings_t keyed = settings;
+  bool configOk;
+
+  printf("\nReplays, %s, device loop period %u us with stalls up to %u us every ~%u passes\n",
+         inputCapture ? "edge capture" : "polling", loop.period, loop.stallMax, loop.stallEvery);
+  printf("%-18s %8s %8s %9s %10s %10s %9s\n", "", "edges", "replayed", "differing", "max shift", "mean shift", "");
+
+  // The same loop timing gives the same output to the microsecond when edges are captured with their time
+  TraceDiff_t same = diffOutputs(traced, replayTrace(trace, loop, configOk), inputCapture ? 0 : loop.period);
+  if (!printDiff("same loop", same, true) || !configOk)
+    result = 1;
+
+  // Without the stalls an element can only start sooner, by up to the longest stall
+  TraceDiff_t steadyDiff = diffOutputs(traced, replayTrace(trace, steady, configOk), loop.stallMax + loop.period * 2);
+  if (!printDiff("steady loop", steadyDiff, true))
+    result = 1;
+
+  // A keyer with a timing change must not replay as a match
+  uint8_t config[CONFIG_PACKED_SIZE];
+  uint8_t configSize;
+  Settings_t changed = keyed;
+  changed.weight = 60;
+  encodeConfig(changed, config, configSize);
+  HostTrace_t regressed = trace;
+  regressed.config.assign(config, config + configSize);
+  TraceDiff_t weightDiff = diffOutputs(traced, replayTrace(regressed, steady, configOk), loop.stallMax + loop.period * 2);
+  if (!printDiff("weight 60", weightDiff, false))
+    result = 1;
+
+  settings = keyed;
+  settings.keyers[0] = {};
+  setupWPM();
+  simReset();
+  return result;
+}
@@ -0,0 +1,269 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include "../main.h"
+#include "../keyer.h"
+#include "../eventstream.h"
+#include "../transmit.h"
+#include "sim.h"
+
+#define BENCH_SECONDS 60          // Simulated time per policy
+#define BENCH_PASS_MIN 40         // core0 loop pass, us
+#define BENCH_PASS_MAX 300
+#define BENCH_KEY_MIN 15000       // Between key transitions, 15 to 80 ms is about 80 down to 15 WPM
+#define BENCH_KEY_MAX 80000
+#define BENCH_BURST 8             // Replies per host request, like sendGetHistograms()
+#define BENCH_BULK_SIZE 51        // Bytes in each, a histogram reply
+#define BENCH_HOST_TURNAROUND 2000 // The host asks again this long after the last reply arrives
+
+enum benchPolicy_t : uint8_t
+{
+  POLICY_DIRECT, // Everything written in the order it was made, as before the scheduler
+  POLICY_SHARED, // Scheduled, bulk SysEx whole on the key cable
+  POLICY_CABLE,  // Scheduled, bulk SysEx chunked on cable 2
+};
+
+static const char *policyNames[] = {"direct", "shared cable", "own cable"};
+
+// USB-MIDI event packet waiting in the device's endpoint buffer
+struct BenchPacket_t
+{
+  uint64_t written;
+  uint64_t keyed;   // When the key switched, for notes
+  bool note;
+  bool cable2;
+  uint8_t size;
+  uint8_t bytes[3];
+};
+
+static uint32_t benchRandom = 0x165667B1;
+
+/** xorshift32, fixed seed so every policy sees the same keying */
+static uint32_t nextRandom()
+{
+  benchRandom ^= benchRandom << 13;
+  benchRandom ^= benchRandom >> 17;
+  benchRandom ^= benchRandom << 5;
+  return benchRandom;
+}
+
+// What reaches the host
+struct BenchHost_t
+{
+  std::vector<uint8_t> open[2]; // SysEx being reassembled per cable
+  bool inSysEx[2];
+  uint32_t broken;      // SysEx cut short by a note on the same cable
+  uint32_t nextSeq;     // Bulk reply expected next
+  uint32_t outOfOrder;
+  uint32_t outstanding; // Bulk replies still to arrive
+  uint64_t bulkBytes;
+  uint64_t nextRequest;
+  std::vector<double> noteLatency;
+};
+
+/** A reply the host can check off: command, sequence number in two 7-bit bytes, filler */
+static void bulkMessage(uint32_t seq, uint8_t *out)
+{
+  out[0] = 0xF0;
+  out[1] = 0x7D;
+  out[2] = CMD_GET_HISTOGRAM;
+  out[3] = seq & 0x7F;
+  out[4] = (seq >> 7) & 0x7F;
+  for (uint8_t i = 5; i < BENCH_BULK_SIZE - 1; i++)
+    out[i] = (seq + i) & 0x7F;
+  out[BENCH_BULK_SIZE - 1] = 0xF7;
+}
+
+/** Host side of one packet off the bus */
+static void receivePacket(BenchHost_t &host, const BenchPacket_t &packet, uint64_t frameTime)
+{
+  uint8_t cable = packet.cable2;
+  if (packet.note)
+  {
+    if (host.inSysEx[cable])
+    {
+      host.broken++;
+      host.inSysEx[cable] = false;
+    }
+    host.noteLatency.push_back((double)(frameTime - packet.keyed));
+    return;
+  }
+
+  for (uint8_t i = 0; i < packet.size; i++)
+  {
+    uint8_t b = packet.bytes[i];
+    if (b == 0xF0)
+    {
+      if (host.inSysEx[cable])
+        host.broken++;
+      host.open[cable].clear();
+      host.inSysEx[cable] = true;
+    }
+    if (!host.inSysEx[cable])
+      continue;
+
+    host.open[cable].push_back(b);
+    if (b != 0xF7)
+      continue;
+
+    host.inSysEx[cable] = false;
+    const std::vector<uint8_t> &message = host.open[cable];
+    if (message.size() == BENCH_BULK_SIZE && message[2] == CMD_GET_HISTOGRAM)
+    {
+      uint32_t seq = message[3] | (message[4] << 7);
+      if (seq != (host.nextSeq & 0x3FFF))
+        host.outOfOrder++;
+      host.nextSeq++;
+      host.bulkBytes += message.size();
+      if (host.outstanding && --host.outstanding == 0)
+        host.nextRequest = frameTime + BENCH_HOST_TURNAROUND;
+    }
+  }
+}
+
+/** Splits the scheduler's writes into event packets in the endpoint buffer */
+static void packWrites(std::deque<BenchPacket_t> &bus, uint64_t keyed[], size_t &keyedNext)
+{
+  for (const SimUsbWrite_t &write : simUsbWrites())
+  {
+    if (write.note)
+    {
+      bus.push_back({write.time, keyed[keyedNext++ % 64], true, false, 0, {}});
+      continue;
+    }
+    for (size_t i = 0; i < write.data.size(); i += 3)
+    {
+      BenchPacket_t packet = {write.time, 0, false, write.bulkCable, 0, {}};
+      for (size_t j = i; j < i + 3 && j < write.data.size(); j++)
+        packet.bytes[packet.size++] = write.data[j];
+      bus.push_back(packet);
+    }
+  }
+  simUsbWrites().clear();
+}
+
+/** Keys random transitions with the event stream on while the host keeps asking for bulk replies, returns the failures */
+static uint32_t runPolicy(benchPolicy_t policy, BenchHost_t &host)
+{
+  benchRandom = 0x165667B1;
+  simReset();
+  resetEventStream();
+  resetTransmit(policy == POLICY_CABLE);
+
+  host = {};
+  std::deque<BenchPacket_t> bus;
+  uint64_t keyed[64]; // Key times of notes written but not yet packed, in order
+  size_t keyedWritten = 0;
+  size_t keyedNext = 0;
+  uint64_t nextKey = BENCH_KEY_MIN;
+  uint64_t nextFrame = USB_FRAME_US;
+  uint32_t bulkSeq = 0;
+  bool keyState = false;
+  uint64_t end = (uint64_t)BENCH_SECONDS * 1000000;
+
+  while (simTime() < end)
+  {
+    simAdvance(BENCH_PASS_MIN + nextRandom() % (BENCH_PASS_MAX - BENCH_PASS_MIN));
+
+    // One 64 byte packet leaves each frame, only what was flushed before the frame started
+    for (; nextFrame <= simTime(); nextFrame += USB_FRAME_US)
+    {
+      for (uint8_t i = 0; i < TX_FRAME_EVENTS && !bus.empty() && bus.front().written < nextFrame; i++)
+      {
+        receivePacket(host, bus.front(), nextFrame);
+        bus.pop_front();
+      }
+    }
+
+    // Key transitions the keyer queued since the last pass
+    while (nextKey <= simTime())
+    {
+      keyState = !keyState;
+      KeyEvent_t event = {(uint32_t)nextKey, 0, 60, 1, 100, keyState};
+      uint8_t message[MAX_SYSEX_LENGTH] = {0xF0, 0x7D, CMD_KEY_EVENTS};
+      uint8_t size;
+      encodeKeyEvents(&event, 1, &message[3], size);
+      message[3 + size] = 0xF7;
+
+      keyed[keyedWritten++ % 64] = nextKey;
+      if (policy == POLICY_DIRECT)
+      {
+        writeNote(event);
+        writeSysEx(message, size + 4, false);
+      }
+      else
+      {
+        transmitNote(event);
+        transmitSysEx(message, size + 4, TX_KEY);
+      }
+      nextKey += BENCH_KEY_MIN + nextRandom() % (BENCH_KEY_MAX - BENCH_KEY_MIN);
+    }
+
+    // A burst of requests answered in this pass
+    if (host.outstanding == 0 && host.nextRequest <= simTime())
+    {
+      for (uint8_t i = 0; i < BENCH_BURST; i++)
+      {
+        uint8_t message[BENCH_BULK_SIZE];
+        bulkMessage(bulkSeq++, message);
+        if (policy == POLICY_DIRECT)
+          writeSysEx(message, BENCH_BULK_SIZE, false);
+        else
+          transmitSysEx(message, BENCH_BULK_SIZE, TX_BULK);
+      }
+      host.outstanding = BENCH_BURST;
+    }
+
+    if (policy == POLICY_DIRECT)
+      flushMidi();
+    else
+      serviceTransmit((simTime() / USB_FRAME_US) & USB_FRAME_MASK);
+
+    packWrites(bus, keyed, keyedNext);
+  }
+
+  return host.broken + host.outOfOrder + keyerStats.sysExDrops;
+}
+
+/** Note latency with SysEx replies saturating the USB link, written straight out and through the transmit scheduler */
+int benchTransmit(int argc, char **argv)
+{
+  printf("USB MIDI transmit, %u event packets a frame, %u kept for notes, %u byte replies in bursts of %u\n",
+         TX_FRAME_EVENTS, TX_KEY_RESERVE, BENCH_BULK_SIZE, BENCH_BURST);
+  printf("%-13s %8s %12s %12s %12s %12s %10s\n", "policy", "notes", "mean us", "p99 us", "max us", "bulk B/s", "errors");
+
+  uint32_t failures = 0;
+  const benchPolicy_t policies[] = {POLICY_DIRECT, POLICY_SHARED, POLICY_CABLE};
+
+  for (benchPolicy_t policy : policies)
+  {
+    BenchHost_t host;
+    uint32_t errors = runPolicy(policy, host);
+
+    std::vector<double> &latency = host.noteLatency;
+    std::sort(latency.begin(), latency.end());
+    double sum = 0;
+    for (double value : latency)
+      sum += value;
+    double mean = latency.empty() ? 0 : sum / latency.size();
+    double p99 = latency.empty() ? 0 : latency[latency.size() * 99 / 100];
+    double max = latency.empty() ? 0 : latency.back();
+
+    // A note is keyed during one pass, written at its end and leaves in the frame after, sharing the cable can cost one more frame
+    double limit = BENCH_PASS_MAX + USB_FRAME_US * (policy == POLICY_CABLE ? 1 : 2);
+    if (policy != POLICY_DIRECT && (errors || max > limit || host.bulkBytes == 0))
+      failures++;
+
+    printf("%-13s %8zu %12.0f %12.0f %12.0f %12.0f %10u\n", policyNames[policy], latency.size(), mean, p99, max,
+           host.bulkBytes / (double)BENCH_SECONDS, errors);
+  }
+
+  printf("%s\n", failures ? "FAILED" : "Passed");
+
+  simReset();
+  resetTransmit(TX_SEPARATE_CABLE);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,148 @@
+#include <Arduino.h>
+#include "main.h"
+#include "speedpot.h"
+#include "potadc.h"
+#include "keyer.h"
+#include "timers.h"
+#include "trace.h"
+
+#define POT_ADC_MAX 4095  // 12 bit samples
+#define POT_LEVEL_BITS 8  // Fraction bits of the smoothed level and the knob position in WPM
+#define POT_MEDIAN 5      // Samples in the median, a spike has to last half of them to get through
+
+static bool potActive = false;
+static uint8_t potTimer = TIMER_NONE;
+static uint16_t potTail = 0;   // Next sample to read from the ring
+static uint16_t potWindow[POT_MEDIAN]; // Latest samples, oldest overwritten first
+static uint8_t potNext = 0;            // Window slot of the next sample
+static uint32_t potLevel = 0;  // Smoothed level, ADC counts << POT_LEVEL_BITS
+static uint8_t potSamples = 0; // Samples seen since setup, up to POT_MEDIAN
+static uint16_t potWpm = 0;    // Speed the knob last set, 0 until it has
+
+/** Middle of the window, an insertion sort of a copy */
+static uint16_t windowMedian()
+{
+  uint16_t sorted[POT_MEDIAN];
+  for (uint8_t i = 0; i < POT_MEDIAN; i++)
+  {
+    uint16_t sample = potWindow[i];
+    uint8_t j = i;
+    for (; j > 0 && sorted[j - 1] > sample; j--)
+      sorted[j] = sorted[j - 1];
+    sorted[j] = sample;
+  }
+  return sorted[POT_MEDIAN / 2];
+}
+
+/** Moves the speed to where the knob is, whole WPM at a time and only past the hysteresis */
+static void updateSpeed()
+{
+  uint8_t low = settings.speedMin;
+  uint8_t range = settings.speedMax > low ? settings.speedMax - low : 0;
+
+  // Knob position in WPM above speedMin, POT_LEVEL_BITS fraction bits
+  uint32_t position = (uint32_t)(((uint64_t)potLevel * range) / POT_ADC_MAX);
+  uint32_t step = (position + (1 << (POT_LEVEL_BITS - 1))) >> POT_LEVEL_BITS;
+
+  // Held where it is unless the knob is well past half way to the next step, or the speed came from elsewhere
+  uint16_t current = potWpm / WPM_SCALE;
+  if (potWpm && settings.wpm == potWpm && current >= low && current <= low + range)
+  {
+    uint32_t held = (uint32_t)(current - low) << POT_LEVEL_BITS;
+    uint32_t band = (1 << (POT_LEVEL_BITS - 1)) + SPEED_POT_HYSTERESIS;
+    if (position + band > held && position < held + band)
+      return;
+  }
+
+  uint16_t wpm = (low + step) * WPM_SCALE;
+  if (wpm < MIN_WPM)
+    wpm = MIN_WPM;
+  potWpm = wpm;
+  if (settings.wpm == wpm)
+    return;
+
+  // Elements already started keep their deadlines, the next one is timed from these
+  settings.wpm = wpm;
+  setupWPM();
+  stopTrace(); // A replay keys the whole trace at the speed it started with
+}
+
+/** Drains the samples the DMA wrote since the last pass through the filter, then updates the speed */
+static void onSpeedPot(uint32_t deadline)
+{
+  potTimer = timerStart(deadline + SPEED_POT_PERIOD_US, onSpeedPot, deadline + SPEED_POT_PERIOD_US);
+
+  const volatile uint16_t *ring = potAdcRing();
+  uint16_t head = potAdcHead();
+  if (head == potTail)
+    return;
+
+  for (; potTail != head; potTail = (potTail + 1) & (SPEED_POT_RING_SIZE - 1))
+  {
+    potWindow[potNext] = ring[potTail] & POT_ADC_MAX;
+    potNext = potNext + 1 < POT_MEDIAN ? potNext + 1 : 0;
+
+    // The median of the first window seeds the filter rather than ramping it up from zero
+    if (potSamples < POT_MEDIAN)
+    {
+      if (++potSamples == POT_MEDIAN)
+        potLevel = (uint32_t)windowMedian() << POT_LEVEL_BITS;
+      continue;
+    }
+
+    int32_t target = (int32_t)windowMedian() << POT_LEVEL_BITS;
+    potLevel += (target - (int32_t)potLevel) >> SPEED_POT_SMOOTH_SHIFT;
+  }
+
+  if (potSamples == POT_MEDIAN)
+    updateSpeed();
+}
+
+/** Starts the ADC on settings.gpio.speedPot and the timer draining it, false with the speed left to SysEx */
+bool setupSpeedPot(uint32_t now)
+{
+  cleanUpSpeedPot();
+  if (!beginPotAdc(settings.gpio.speedPot))
+    return false;
+
+  potTail = potAdcHead();
+  potSamples = 0;
+  potLevel = 0;
+  potNext = 0;
+  potWpm = 0;
+
+  noInterrupts(); // The wheel is shared with the state alarm
+  potTimer = timerStart(now + SPEED_POT_PERIOD_US, onSpeedPot, now + SPEED_POT_PERIOD_US);
+  interrupts();
+
+  potActive = potTimer != TIMER_NONE;
+  if (!potActive)
+    endPotAdc();
+  return potActive;
+}
+
+/** Stops the ADC and its timer, the speed stays where the knob left it */
+void cleanUpSpeedPot()
+{
+  if (!potActive)
+    return;
+
+  noInterrupts();
+  timerCancel(potTimer);
+  interrupts();
+
+  endPotAdc();
+  potActive = false;
+}
+
+/** True while the knob sets the speed */
+bool speedPotActive()
+{
+  return potActive;
+}
+
+/** Smoothed knob level, ADC counts << 8 */
+uint32_t speedPotLevel()
+{
+  return potLevel;
+}
@@ -0,0 +1,21 @@
+#ifndef SPEEDPOT_H
+#define SPEEDPOT_H
+
+#include "main.h"
+
+// Speed knob on an ADC pin, settings.speedMin to settings.speedMax whole WPM
+// across its travel. The ADC runs free into a DMA ring (potadc.h) and a
+// timer on the keyer's wheel drains it every SPEED_POT_PERIOD_US: each
+// sample goes through a median of five, against pot wiper spikes, then a
+// fixed point IIR, and the speed only moves a step once the level is
+// SPEED_POT_HYSTERESIS past the half way point. The new timings are worked
+// out there and then, the keyer reads settings.timings as always and an
+// element already started keeps its deadline, so a new speed starts with
+// the next element. Runs on core1 with interrupts off like the rest of the
+// keyer's timers.
+bool setupSpeedPot(uint32_t now);
+void cleanUpSpeedPot();
+bool speedPotActive();
+uint32_t speedPotLevel();
+
+#endif
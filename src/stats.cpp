@@ -0,0 +1,51 @@
+#include <Arduino.h>
+#include "main.h"
+#include "stats.h"
+#include "keyer.h"
+
+Histogram_t histograms[HISTOGRAM_COUNT] = {};
+
+// Set by core0 for the keyer to clear its half on the next pass
+static volatile bool resetRequested = false;
+
+/** Asks the keyer to clear its counters and histograms */
+void requestStatsReset()
+{
+  resetRequested = true;
+}
+
+/** Returns true once after a reset was requested */
+bool takeStatsReset()
+{
+  if (!resetRequested)
+    return false;
+
+  resetRequested = false;
+  return true;
+}
+
+/** Clears the counters and histograms written by the keyer (core1), call with interrupts off */
+void resetKeyerStats()
+{
+  keyerStats.elements = 0;
+  keyerStats.maxElementError = 0;
+  keyerStats.maxKeyerPass = 0;
+  keyerStats.keyEventDrops = 0;
+  keyerStats.edges = 0;
+  keyerStats.edgeErrorTotal = 0;
+  keyerStats.maxEdgeError = 0;
+
+  for (uint8_t id = 0; id < HIST_HOST_PERIOD; id++)
+    histograms[id] = {};
+}
+
+/** Clears the counters and histograms written by USB/MIDI (core0) */
+void resetHostStats()
+{
+  keyerStats.maxHostPass = 0;
+  keyerStats.maxKeyEventDelay = 0;
+  keyerStats.sysExDrops = 0;
+
+  for (uint8_t id = HIST_HOST_PERIOD; id < HISTOGRAM_COUNT; id++)
+    histograms[id] = {};
+}
@@ -0,0 +1,33 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "main.h"
+
+extern Histogram_t histograms[HISTOGRAM_COUNT];
+
+/** Adds a value to a histogram, a few cycles so it can sit in the keyer's hot path */
+inline void histogramAdd(histogram_t id, uint32_t value)
+{
+    Histogram_t &histogram = histograms[id];
+    uint8_t bucket = value ? 32 - __builtin_clz(value) : 0;
+    if (bucket >= HISTOGRAM_BUCKETS)
+        bucket = HISTOGRAM_BUCKETS - 1;
+
+    if (histogram.buckets[bucket] == (1 << HISTOGRAM_COUNT_BITS) - 1)
+    {
+        for (uint8_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+            histogram.buckets[i] >>= 1;
+    }
+    histogram.buckets[bucket]++;
+    histogram.count++;
+    if (value > histogram.max)
+        histogram.max = value;
+}
+
+// Each core clears what it owns, see histogram_t
+void requestStatsReset();
+bool takeStatsReset();
+void resetKeyerStats();
+void resetHostStats();
+
+#endif
@@ -0,0 +1,180 @@
+#include <Arduino.h>
+#include "main.h"
+#include "timers.h"
+#include "keyer.h"
+
+#define TIMER_TICK_US (1u << TIMER_TICK_SHIFT)
+#define TIMER_SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+static_assert((TIMER_WHEEL_SLOTS & TIMER_SLOT_MASK) == 0 && TIMER_WHEEL_SLOTS <= 256, "TIMER_WHEEL_SLOTS must be a power of two up to 256");
+static_assert(TIMER_POOL_SIZE < TIMER_NONE, "Timer handles must fit below TIMER_NONE");
+
+// Timer pool, linked into a slot's list while running and into the free list otherwise
+static uint32_t deadlines[TIMER_POOL_SIZE];
+static timerCallback_t callbacks[TIMER_POOL_SIZE];
+static uint32_t params[TIMER_POOL_SIZE];
+static uint8_t nextTimer[TIMER_POOL_SIZE];
+static uint8_t prevTimer[TIMER_POOL_SIZE];
+static uint8_t timerSlot[TIMER_POOL_SIZE];
+
+static uint8_t slots[TIMER_WHEEL_SLOTS]; // First timer in each slot
+static uint8_t freeTimers = TIMER_NONE;
+static uint8_t pending = 0;
+static uint32_t cursorTime = 0; // Start of the tick the wheel has got to
+
+/** Slot of the tick a time falls in */
+static inline uint8_t slotFor(uint32_t time)
+{
+  return (time >> TIMER_TICK_SHIFT) & TIMER_SLOT_MASK;
+}
+
+/** Takes a running timer out of its slot */
+static void unlink(uint8_t timer)
+{
+  if (prevTimer[timer] != TIMER_NONE)
+    nextTimer[prevTimer[timer]] = nextTimer[timer];
+  else
+    slots[timerSlot[timer]] = nextTimer[timer];
+
+  if (nextTimer[timer] != TIMER_NONE)
+    prevTimer[nextTimer[timer]] = prevTimer[timer];
+}
+
+/** Returns a timer to the free list */
+static void release(uint8_t timer)
+{
+  nextTimer[timer] = freeTimers;
+  freeTimers = timer;
+  pending--;
+}
+
+/** Empties the wheel, the tick now falls in is the first one looked at */
+void setupTimers(uint32_t now)
+{
+  for (uint16_t slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+    slots[slot] = TIMER_NONE;
+
+  freeTimers = TIMER_NONE;
+  for (uint8_t timer = TIMER_POOL_SIZE; timer > 0; timer--)
+  {
+    nextTimer[timer - 1] = freeTimers;
+    freeTimers = timer - 1;
+  }
+
+  pending = 0;
+  cursorTime = now & ~(TIMER_TICK_US - 1);
+}
+
+/** Starts a timer that calls back with param once the deadline has passed, returns its handle or TIMER_NONE if every timer is running */
+uint8_t timerStart(uint32_t deadline, timerCallback_t callback, uint32_t param)
+{
+  uint8_t timer = freeTimers;
+  if (timer == TIMER_NONE)
+    return TIMER_NONE;
+  freeTimers = nextTimer[timer];
+  pending++;
+
+  deadlines[timer] = deadline;
+  callbacks[timer] = callback;
+  params[timer] = param;
+
+  // A deadline the wheel has already passed goes in the current slot, looked at every pass
+  uint8_t slot = (int32_t)(deadline - cursorTime) < 0 ? slotFor(cursorTime) : slotFor(deadline);
+  timerSlot[timer] = slot;
+  prevTimer[timer] = TIMER_NONE;
+  nextTimer[timer] = slots[slot];
+  if (slots[slot] != TIMER_NONE)
+    prevTimer[slots[slot]] = timer;
+  slots[slot] = timer;
+
+  return timer;
+}
+
+/** Stops a timer that has not fired yet and clears the handle, a no-op for TIMER_NONE */
+void timerCancel(uint8_t &handle)
+{
+  if (handle == TIMER_NONE)
+    return;
+
+  unlink(handle);
+  release(handle);
+  handle = TIMER_NONE;
+}
+
+/** Fires the timers in a slot that are due by now, in deadline order. Later turns of the wheel stay put */
+static void runSlot(uint8_t slot, uint32_t now)
+{
+  uint8_t due[TIMER_POOL_SIZE];
+  uint8_t count = 0;
+
+  for (uint8_t timer = slots[slot]; timer != TIMER_NONE; timer = nextTimer[timer])
+  {
+    if (!timeReached(now, deadlines[timer]))
+      continue;
+
+    // Sorted as they are gathered, a slot rarely holds more than one or two
+    uint8_t i = count++;
+    for (; i > 0 && (int32_t)(deadlines[due[i - 1]] - deadlines[timer]) > 0; i--)
+      due[i] = due[i - 1];
+    due[i] = timer;
+  }
+
+  // Out of the wheel before any callback runs, they may start or cancel timers
+  timerCallback_t dueCallbacks[TIMER_POOL_SIZE];
+  uint32_t dueParams[TIMER_POOL_SIZE];
+  for (uint8_t i = 0; i < count; i++)
+  {
+    dueCallbacks[i] = callbacks[due[i]];
+    dueParams[i] = params[due[i]];
+    unlink(due[i]);
+    release(due[i]);
+  }
+
+  for (uint8_t i = 0; i < count; i++)
+    dueCallbacks[i](dueParams[i]);
+}
+
+/** Fires every timer due by now, called each keyer pass */
+void timerAdvance(uint32_t now)
+{
+  if (pending == 0)
+  {
+    cursorTime = now & ~(TIMER_TICK_US - 1); // Nothing to look at on the way
+    return;
+  }
+
+  // Every tick behind the one now falls in, at most one turn of the wheel after a stall
+  for (uint16_t visited = 0; (int32_t)(now - cursorTime) >= (int32_t)TIMER_TICK_US && visited < TIMER_WHEEL_SLOTS; visited++)
+  {
+    runSlot(slotFor(cursorTime), now);
+    cursorTime += TIMER_TICK_US;
+  }
+  cursorTime = now & ~(TIMER_TICK_US - 1);
+
+  runSlot(slotFor(cursorTime), now); // The current tick, only what is due already
+}
+
+/** Timers running */
+uint8_t timersPending()
+{
+  return pending;
+}
+
+/** Earliest deadline of the running timers, false if none is running. Walks the whole wheel, for a keyer about to sleep */
+bool timerNextDeadline(uint32_t &deadline)
+{
+  if (pending == 0)
+    return false;
+
+  bool found = false;
+  for (uint16_t slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+  {
+    for (uint8_t timer = slots[slot]; timer != TIMER_NONE; timer = nextTimer[timer])
+    {
+      if (!found || (int32_t)(deadlines[timer] - deadline) < 0)
+        deadline = deadlines[timer];
+      found = true;
+    }
+  }
+  return found;
+}
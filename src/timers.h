@@ -0,0 +1,23 @@
+#ifndef TIMERS_H
+#define TIMERS_H
+
+#include "main.h"
+
+// Hashed timer wheel shared by the keyer's timed actions. Timers hang off the
+// slot of the TIMER_TICK_US tick their deadline falls in, so starting or
+// cancelling one is O(1) and each pass only looks at the slots it moves past.
+// Timers further out than one turn of the wheel wait in their slot for later
+// turns. Runs on core1, the state alarm IRQ starts timers too so callers keep
+// interrupts off around it like the rest of the keyer.
+typedef void (*timerCallback_t)(uint32_t param);
+
+#define TIMER_NONE 0xFF // Handle of no timer
+
+void setupTimers(uint32_t now);
+uint8_t timerStart(uint32_t deadline, timerCallback_t callback, uint32_t param);
+void timerCancel(uint8_t &handle);
+void timerAdvance(uint32_t now);
+uint8_t timersPending();
+bool timerNextDeadline(uint32_t &deadline);
+
+#endif
@@ -0,0 +1,136 @@
+#include <Arduino.h>
+#include <BitPacker.hpp>
+#include "main.h"
+#include "trace.h"
+#include "config.h"
+
+static_assert(INPUT_GPIO_COUNT <= 30, "Key pin levels are traced in 30 bits");
+static_assert(TRACE_BUFFER_SIZE < (1 << 14), "Trace records are addressed in 14 bits");
+static_assert(TRACE_PAGE_RECORDS < 8, "Trace page record count is sent in 3 bits");
+static_assert(TRACE_HEADER_SIZE + CONFIG_PACKED_SIZE + 4 <= MAX_SYSEX_LENGTH, "Trace header does not fit in a SysEx message");
+static_assert((TRACE_PAGE_BITS + 6) / 7 + 4 <= MAX_SYSEX_LENGTH, "Trace page does not fit in a SysEx message");
+
+enum traceRequest_t : uint8_t
+{
+  TRACE_REQUEST_NONE,
+  TRACE_REQUEST_START,
+  TRACE_REQUEST_STOP
+};
+
+volatile bool traceRecording = false;
+
+static TraceRecord_t records[TRACE_BUFFER_SIZE];
+static uint32_t recordCount = 0; // Published to core0 with release, records below it are complete
+static bool traceFull = false;
+static uint32_t traceStart = 0;
+
+// Set by core0 for the keyer to act on next pass
+static volatile traceRequest_t request = TRACE_REQUEST_NONE;
+static Settings_t traceSettings; // Settings the trace was started with, core0 only
+
+/** Asks the keyer to start a new trace, keyed with the given settings */
+void requestTraceStart(const Settings_t &settings)
+{
+  traceSettings = settings;
+  request = TRACE_REQUEST_START;
+}
+
+/** Asks the keyer to stop recording, what it has is kept */
+void requestTraceStop()
+{
+  request = TRACE_REQUEST_STOP;
+}
+
+/** Starts or stops the trace core0 asked for, with the key pin levels as they are now. Call with interrupts off */
+void processTraceRequest(uint32_t now, uint32_t levels)
+{
+  traceRequest_t taken = request;
+  if (taken == TRACE_REQUEST_NONE)
+    return;
+  request = TRACE_REQUEST_NONE;
+
+  if (taken == TRACE_REQUEST_STOP)
+  {
+    stopTrace();
+    return;
+  }
+
+  __atomic_store_n(&recordCount, 0, __ATOMIC_RELEASE);
+  traceFull = false;
+  traceStart = now;
+  traceRecording = true;
+  traceRecord(TRACE_INPUT, now, levels); // Where the replay starts from
+}
+
+/** Stops recording, the keyer's settings are about to change or core0 asked to */
+void stopTrace()
+{
+  traceRecording = false;
+}
+
+/** Appends a record, the trace stops once the buffer is full. Call with interrupts off */
+void traceRecord(traceKind_t kind, uint32_t time, uint32_t value)
+{
+  uint32_t count = __atomic_load_n(&recordCount, __ATOMIC_RELAXED);
+  if (count >= TRACE_BUFFER_SIZE)
+  {
+    traceFull = true;
+    traceRecording = false;
+    return;
+  }
+
+  TraceRecord_t &record = records[count];
+  record.time = time;
+  record.kind = kind;
+  record.value = value;
+  __atomic_store_n(&recordCount, count + 1, __ATOMIC_RELEASE);
+}
+
+/** Records made so far, either core */
+uint16_t traceCount()
+{
+  return __atomic_load_n(&recordCount, __ATOMIC_ACQUIRE);
+}
+
+/** A record below traceCount() */
+const TraceRecord_t &traceAt(uint16_t index)
+{
+  return records[index];
+}
+
+/** Packs the trace state followed by the settings it was recorded with, packed like CMD_SET_CONFIG */
+void encodeTraceHeader(uint8_t *out, uint8_t &outSize)
+{
+  BitPacker<TRACE_HEADER_BITS> packer;
+
+  packer.addField(traceRecording || request == TRACE_REQUEST_START, 1);
+  packer.addField(traceFull, 1);
+  packer.addField(traceCount(), 16);
+  packer.addField(TRACE_BUFFER_SIZE, 16);
+  packer.addField(traceStart, 32);
+  packer.pack7Bit(out, outSize);
+
+  uint8_t configSize;
+  encodeConfig(traceSettings, &out[outSize], configSize);
+  outSize += configSize;
+}
+
+/** Packs up to TRACE_PAGE_RECORDS records from first on, fewer at the end of the trace */
+void encodeTracePage(uint16_t first, uint8_t *out, uint8_t &outSize)
+{
+  BitPacker<TRACE_PAGE_BITS> packer;
+
+  uint16_t count = traceCount();
+  uint8_t page = first < count ? (count - first < TRACE_PAGE_RECORDS ? count - first : TRACE_PAGE_RECORDS) : 0;
+
+  packer.addField(first, 14);
+  packer.addField(page, 3);
+  for (uint8_t i = 0; i < page; i++)
+  {
+    const TraceRecord_t &record = records[first + i];
+    packer.addField(record.time, 32);
+    packer.addField(record.kind, 2);
+    packer.addField(record.value, 30);
+  }
+  packer.pack7Bit(out, outSize);
+}
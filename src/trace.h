@@ -0,0 +1,56 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "main.h"
+
+// Raw key input and keyer output trace for replaying a session on the host.
+// core0 asks for a trace with CMD_TRACE, the keyer (core1) records every
+// change of the raw key pin levels with its capture time and every output
+// edge it switches, until the buffer fills, the trace is stopped or the
+// settings change. core0 reads it back a page at a time with CMD_GET_TRACE,
+// records below traceCount() are never written again until the next start.
+// The state alarm records output edges too, so records are made with
+// interrupts off.
+enum traceKind_t : uint8_t
+{
+    TRACE_INPUT,  // value is the key pin levels, active low
+    TRACE_OUTPUT, // value is the keyer << 1 | output state
+};
+
+struct TraceRecord_t
+{
+    uint32_t time;       // micros() of the key edge or output switch
+    uint32_t value : 30; // See traceKind_t
+    uint32_t kind : 2;
+};
+
+#define TRACE_HEADER_BITS (1 + 1 + 16 + 16 + 32) // Recording, full, count, capacity, start time
+#define TRACE_HEADER_SIZE ((TRACE_HEADER_BITS + 6) / 7)
+#define TRACE_RECORD_BITS (32 + 2 + 30)
+#define TRACE_PAGE_BITS (14 + 3 + TRACE_PAGE_RECORDS * TRACE_RECORD_BITS)
+
+extern volatile bool traceRecording;
+
+// core0
+void requestTraceStart(const Settings_t &settings);
+void requestTraceStop();
+void encodeTraceHeader(uint8_t *out, uint8_t &outSize);
+void encodeTracePage(uint16_t first, uint8_t *out, uint8_t &outSize);
+
+// core1
+void processTraceRequest(uint32_t now, uint32_t levels);
+void stopTrace();
+void traceRecord(traceKind_t kind, uint32_t time, uint32_t value);
+
+// Either core
+uint16_t traceCount();
+const TraceRecord_t &traceAt(uint16_t index);
+
+/** Records an output edge as the keyer switched it, a single test when no trace is running. Call with interrupts off */
+inline void traceOutput(uint8_t k, bool state, uint32_t time)
+{
+    if (traceRecording)
+        traceRecord(TRACE_OUTPUT, time, (uint32_t)k << 1 | state);
+}
+
+#endif
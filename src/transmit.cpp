@@ -0,0 +1,109 @@
+#include <Arduino.h>
+#include "main.h"
+#include "keyer.h"
+#include "queue.h"
+#include "transmit.h"
+
+// SysEx bytes paced out per frame, 3 to an event packet
+#define TX_BULK_FRAME_BYTES ((TX_FRAME_EVENTS - TX_KEY_RESERVE) * 3)
+
+static_assert(TX_KEY_RESERVE < TX_FRAME_EVENTS, "Nothing left for SysEx in a USB frame");
+
+static SpscQueue<uint8_t, TX_BULK_BUFFER_SIZE> bulkQueue; // Each message is a length byte and the SysEx, core0 only
+static uint8_t bulkRemaining = 0; // Bytes of the message at the head still to send, 0 before its length is read
+static uint8_t bulkTokens = 0;    // SysEx bytes that may go out this frame
+static uint8_t bulkBurst = 0;     // Most tokens saved up, a whole message on the key cable
+static uint16_t lastFrame = 0;    // USB frame the tokens were topped up in
+static bool separateCable = false;
+static bool unflushed = false;    // Written since the last flush
+
+/** Drops anything queued and starts pacing over, bulk SysEx on a cable of its own or on the key cable */
+void resetTransmit(bool bulkCable)
+{
+  bulkQueue.clear();
+  bulkRemaining = 0;
+  separateCable = bulkCable;
+  bulkBurst = bulkCable ? TX_BULK_FRAME_BYTES : MAX_SYSEX_LENGTH;
+  bulkTokens = bulkBurst;
+}
+
+/** Writes a key note, it is flushed on this pass */
+void transmitNote(const KeyEvent_t &event)
+{
+  writeNote(event);
+  unflushed = true;
+}
+
+/** Writes key SysEx straight out, or queues bulk SysEx behind it, returns false if there is no room */
+bool transmitSysEx(const uint8_t *data, uint8_t length, txPriority_t priority)
+{
+  if (priority == TX_KEY)
+  {
+    writeSysEx(data, length, false);
+    unflushed = true;
+    return true;
+  }
+
+  if (length == 0 || TX_BULK_BUFFER_SIZE - bulkQueue.size() < (uint32_t)length + 1)
+  {
+    keyerStats.sysExDrops++;
+    return false;
+  }
+
+  bulkQueue.push(length);
+  for (uint8_t i = 0; i < length; i++)
+    bulkQueue.push(data[i]);
+  return true;
+}
+
+/** Sends what bulk SysEx this USB frame has room for and flushes, called every pass after the key notes */
+void serviceTransmit(uint16_t frame)
+{
+  uint16_t frames = (frame - lastFrame) & USB_FRAME_MASK;
+  if (frames)
+  {
+    uint32_t tokens = bulkTokens + (uint32_t)frames * TX_BULK_FRAME_BYTES;
+    bulkTokens = tokens > bulkBurst ? bulkBurst : tokens;
+    lastFrame = frame;
+  }
+
+  uint8_t chunk[MAX_SYSEX_LENGTH];
+  while (bulkRemaining || bulkQueue.size())
+  {
+    if (bulkRemaining == 0)
+      bulkQueue.pop(bulkRemaining);
+
+    uint8_t size = bulkRemaining;
+    if (!separateCable)
+    {
+      // A note between the parts of a SysEx would end it, so it all goes or none of it does
+      if (bulkTokens < size)
+        break;
+    }
+    else if (bulkTokens < size)
+    {
+      size = bulkTokens - bulkTokens % 3; // Whole event packets, the rest follows next frame
+      if (size == 0)
+        break;
+    }
+
+    for (uint8_t i = 0; i < size; i++)
+      bulkQueue.pop(chunk[i]);
+    writeSysEx(chunk, size, separateCable);
+    bulkRemaining -= size;
+    bulkTokens -= size;
+    unflushed = true;
+  }
+
+  if (unflushed)
+  {
+    flushMidi();
+    unflushed = false;
+  }
+}
+
+/** Bytes of bulk SysEx waiting to go out */
+uint16_t transmitPending()
+{
+  return bulkQueue.size();
+}
@@ -0,0 +1,28 @@
+#ifndef TRANSMIT_H
+#define TRANSMIT_H
+
+#include "main.h"
+
+// USB MIDI transmit scheduler, runs on core0. Key notes and the SysEx timed
+// against them go out as soon as they are made and are flushed the same
+// pass. Any other SysEx waits in a queue and is paced to leave room for the
+// notes in every USB frame: whole messages when it shares the key cable, as
+// a note must not land inside a SysEx, or in chunks on a cable of its own.
+enum txPriority_t : uint8_t
+{
+    TX_KEY,  // Key notes, their timestamps and clock sync replies
+    TX_BULK, // Replies to requests, telemetry, decoded text
+};
+
+void resetTransmit(bool bulkCable);
+void transmitNote(const KeyEvent_t &event);
+bool transmitSysEx(const uint8_t *data, uint8_t length, txPriority_t priority);
+void serviceTransmit(uint16_t frame);
+uint16_t transmitPending();
+
+// Provided by the platform
+void writeNote(const KeyEvent_t &event);
+void writeSysEx(const uint8_t *data, uint8_t length, bool bulkCable);
+void flushMidi();
+
+#endif
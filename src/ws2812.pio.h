@@ -0,0 +1,63 @@
+// -------------------------------------------------- //
+// This file is autogenerated by pioasm; do not edit! //
+// -------------------------------------------------- //
+
+// Source, from the pico-examples WS2812 program:
+//
+// .program ws2812
+// .side_set 1
+//
+// .define public T1 2
+// .define public T2 5
+// .define public T3 3
+//
+// .wrap_target
+// bitloop:
+//     out x, 1       side 0 [T3 - 1] ; Side-set still takes place when instruction stalls
+//     jmp !x do_zero side 1 [T1 - 1] ; Branch on the bit we shifted out. Positive pulse
+// do_one:
+//     jmp  bitloop   side 1 [T2 - 1] ; Continue driving high, for a long pulse
+// do_zero:
+//     nop            side 0 [T2 - 1] ; Or drive low, for a short pulse
+// .wrap
+
+#pragma once
+
+#if !PICO_NO_HARDWARE
+#include "hardware/pio.h"
+#endif
+
+// ------ //
+// ws2812 //
+// ------ //
+
+#define ws2812_wrap_target 0
+#define ws2812_wrap 3
+
+#define ws2812_T1 2
+#define ws2812_T2 5
+#define ws2812_T3 3
+
+static const uint16_t ws2812_program_instructions[] = {
+            //     .wrap_target
+    0x6221, //  0: out    x, 1            side 0 [2]
+    0x1123, //  1: jmp    !x, 3           side 1 [1]
+    0x1400, //  2: jmp    0               side 1 [4]
+    0xa442, //  3: nop                    side 0 [4]
+            //     .wrap
+};
+
+#if !PICO_NO_HARDWARE
+static const struct pio_program ws2812_program = {
+    .instructions = ws2812_program_instructions,
+    .length = 4,
+    .origin = -1,
+};
+
+static inline pio_sm_config ws2812_program_get_default_config(uint offset) {
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_wrap(&c, offset + ws2812_wrap_target, offset + ws2812_wrap);
+    sm_config_set_sideset(&c, 1, false, false);
+    return c;
+}
+#endif